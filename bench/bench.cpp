@@ -0,0 +1,304 @@
+#include "regrr.h"
+#include "regrr_codec.h"
+#include "regrr_format.h"
+#include "regrr_reader.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * Benchmarks of the library itself, to track its regressions across versions.
+ * The results are written as JSON by default, `--benchmark_format=console` to read them.
+ *
+ * The backend of the saves is configured as any captured program, with `REGRR_EXT`, `REGRR_ARCHIVE`, `REGRR_COMPRESS`...
+ * and is part of the names of the benchmarks, like `save/rgb-lz4/256x256/8UC3`. `bin/bench.py` runs every backend.
+ * The output directory is a temporary directory removed at exit, unless `REGRR_DIR` is set.
+ */
+
+namespace
+{
+    /**
+     * Count of bytes saved by a benchmark of the archive, which grows at every save.
+     * The other backends overwrite the same file at every iteration.
+     */
+    constexpr std::uint64_t ARCHIVE_BYTES = 256 << 20;
+
+    /**
+     * Temporary directory of the benchmarks, removed at exit.
+     */
+    std::string temporaryDirectory;
+
+    /**
+     * Registered with `std::atexit()` before the library is initialized, so it runs after the library flushed its files.
+     */
+    void removeTemporaryDirectory()
+    {
+        std::error_code error;
+        fs::remove_all(temporaryDirectory, error);
+    }
+
+    /**
+     * Name of the backend of the saves, from the configuration of the library.
+     *
+     * @throw std::runtime_error If the codec is unknown or not compiled.
+     */
+    std::string backendName()
+    {
+        const char *ext = std::getenv("REGRR_EXT");
+        std::string name = ext ? ext : ".xml";
+
+        const char *archive = std::getenv("REGRR_ARCHIVE");
+        const char *compress = std::getenv("REGRR_COMPRESS");
+        const bool encoded = compress && regrr::codec_from_name(compress) != regrr::REGRR_CODEC_NONE;
+        if((archive && std::atoi(archive)) || encoded)
+        {
+            name = REGRR_BINARY_EXT;
+        }
+
+        name.erase(0, name.find_first_not_of('.'));
+
+        if(archive && std::atoi(archive))
+        {
+            name += "-archive";
+        }
+
+        if(encoded)
+        {
+            name += '-';
+            name += compress;
+        }
+
+        return name;
+    }
+
+    /**
+     * Name of the type of a matrix, like `8UC3`.
+     */
+    std::string typeName(int type)
+    {
+        static const char *depths[] = {"8U", "8S", "16U", "16S", "32S", "32F", "64F", "16F"};
+        return std::string(depths[CV_MAT_DEPTH(type)]) + "C" + std::to_string(CV_MAT_CN(type));
+    }
+
+    /**
+     * Matrix with deterministic pixels, not constant so the codecs do not compress it to nothing.
+     */
+    cv::Mat pattern(int rows, int cols, int type)
+    {
+        cv::Mat mat(rows, cols, type);
+        unsigned char *data = mat.data;
+        const size_t size = mat.total() * mat.elemSize();
+        for(size_t i = 0; i < size; i++)
+        {
+            data[i] = static_cast<unsigned char>((i * 7 + i / 251) & 0x3F);
+        }
+
+        return mat;
+    }
+
+    void enterExitScope(benchmark::State& state)
+    {
+        for(auto _ : state)
+        {
+            regrr::enter_scope("scope");
+            regrr::exit_scope();
+        }
+    }
+
+    void scopedFormatted(benchmark::State& state)
+    {
+        int i = 0;
+        for(auto _ : state)
+        {
+            REGRR_SCOPED("scope-%d", i++ & 15);
+        }
+    }
+
+    /**
+     * Save the same matrix at every iteration.
+     * The call count is fixed so the same file is overwritten instead of filling the disk, only the archive grows.
+     * A backend not available, like a codec not compiled, is reported as an error of the benchmark.
+     */
+    void save(benchmark::State& state, const std::string& name, int rows, int cols, int type)
+    {
+        const cv::Mat mat = pattern(rows, cols, type);
+        const int call = 1;
+
+        for(auto _ : state)
+        {
+            try
+            {
+                regrr::save(mat, true, &call, nullptr, "%s", name.c_str());
+            }
+            catch(const std::exception& error)
+            {
+                state.SkipWithError(error.what());
+                break;
+            }
+        }
+
+        state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * mat.total() * mat.elemSize()));
+    }
+
+    /**
+     * Set a pixel of a managed matrix looked up by its name, `REGRR_SET_PX()`.
+     */
+    void setPixelByName(benchmark::State& state)
+    {
+        REGRR_CREATE_MAT(float, 64, 64, "set_px");
+
+        int i = 0;
+        for(auto _ : state)
+        {
+            REGRR_SET_PX(i / 64 & 63, i & 63, static_cast<float>(i), "set_px");
+            i++;
+        }
+    }
+
+    /**
+     * Set a pixel of a managed matrix through its handle, `REGRR_SET_PX_H()`.
+     */
+    void setPixelByHandle(benchmark::State& state)
+    {
+        REGRR_CREATE_MAT_HANDLE(handle, float, 64, 64, "set_px_h");
+
+        int i = 0;
+        for(auto _ : state)
+        {
+            REGRR_SET_PX_H(handle, i / 64 & 63, i & 63, static_cast<float>(i));
+            benchmark::DoNotOptimize(handle.mat().data);
+            i++;
+        }
+    }
+
+    /**
+     * Write an output directory of matrices without hash, so the diff tool compares all of them.
+     */
+    void writeOutput(const std::string& directory, const std::string& ext, int count, const cv::Mat& mat)
+    {
+        fs::create_directories(directory);
+
+        std::ofstream lists(directory + "/lists.txt", std::ios::trunc);
+        lists << ext << '\n';
+
+        for(int call = 1; call <= count; call++)
+        {
+            regrr::write_mat(directory + "/diff." + std::to_string(call) + ext, mat);
+            lists << "diff." << call << '\n';
+        }
+    }
+
+    /**
+     * Compare two outputs end to end with `regrr-diff`, from the lists files to the statistics.
+     * The bytes processed are the pixels of both outputs.
+     */
+    void diff(benchmark::State& state, const std::string& root, const std::string& ext, int count, int size)
+    {
+        const cv::Mat mat = pattern(size, size, CV_32FC1);
+        const std::string directory1 = root + "/diff" + ext + "-1";
+        const std::string directory2 = root + "/diff" + ext + "-2";
+        writeOutput(directory1, ext, count, mat);
+        writeOutput(directory2, ext, count, mat);
+
+        const std::string command = std::string(REGRR_DIFF_PATH) + " --no-cache " + directory1 + " " + directory2 + " > /dev/null";
+
+        for(auto _ : state)
+        {
+            if(std::system(command.c_str()) != 0)
+            {
+                state.SkipWithError("regrr-diff failed");
+                break;
+            }
+        }
+
+        state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * 2 * count * mat.total() * mat.elemSize()));
+
+        fs::remove_all(directory1);
+        fs::remove_all(directory2);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    // The captures of the benchmarks go to a temporary directory, unless configured
+    temporaryDirectory = (fs::temp_directory_path() / ("regrr-bench-" + std::to_string(::getpid()))).string();
+    const std::string& root = temporaryDirectory;
+    std::atexit(removeTemporaryDirectory);
+    if(!std::getenv("REGRR_DIR"))
+    {
+        setenv("REGRR_DIR", (root + "/capture").c_str(), 1);
+    }
+
+    // The banner and the statistics of the library would be mixed with the JSON on the console
+    setenv("REGRR_LOG", "error", 0);
+
+    std::string backend;
+    try
+    {
+        backend = backendName();
+    }
+    catch(const std::exception& error)
+    {
+        std::cerr << "regrr-bench: " << error.what() << std::endl;
+        return 2;
+    }
+    const bool archive = std::getenv("REGRR_ARCHIVE") && std::atoi(std::getenv("REGRR_ARCHIVE"));
+
+    benchmark::RegisterBenchmark("scope/enter_exit", enterExitScope);
+    benchmark::RegisterBenchmark("scope/scoped_formatted", scopedFormatted);
+
+    for(const int size : {64, 256, 1024})
+    {
+        for(const int type : {CV_8UC1, CV_8UC3, CV_32FC1})
+        {
+            const std::string name = "save/" + backend + "/" + std::to_string(size) + "x" + std::to_string(size) + "/" + typeName(type);
+            // The matrix is named after the benchmark, without the directories
+            std::string matName = name;
+            std::replace(matName.begin(), matName.end(), '/', '-');
+            auto *registered = benchmark::RegisterBenchmark(name.c_str(), save, matName, size, size, type);
+
+            if(archive)
+            {
+                const std::uint64_t bytes = static_cast<std::uint64_t>(size) * size * CV_ELEM_SIZE(type);
+                registered->Iterations(static_cast<benchmark::IterationCount>(std::clamp<std::uint64_t>(ARCHIVE_BYTES / bytes, 16, 65536)));
+            }
+        }
+    }
+
+    benchmark::RegisterBenchmark("set_px/name", setPixelByName);
+    benchmark::RegisterBenchmark("set_px/handle", setPixelByHandle);
+
+    // The diff tool runs in another process, so its time is the wall-clock time
+    for(const char *ext : {".xml", REGRR_BINARY_EXT})
+    {
+        const std::string name = std::string("diff/") + (ext + 1) + "/64x256x256/32FC1";
+        benchmark::RegisterBenchmark(name.c_str(), diff, root, std::string(ext), 64, 256)->UseRealTime()->Unit(benchmark::kMillisecond);
+    }
+
+    // JSON by default, can be overridden by the arguments
+    std::vector<char*> arguments(argv, argv + argc);
+    std::string format = "--benchmark_format=json";
+    arguments.insert(arguments.begin() + 1, format.data());
+    int count = static_cast<int>(arguments.size());
+
+    benchmark::Initialize(&count, arguments.data());
+    if(benchmark::ReportUnrecognizedArguments(count, arguments.data()))
+    {
+        return 1;
+    }
+
+    benchmark::AddCustomContext("regrr_backend", backend);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    return 0;
+}
\ No newline at end of file
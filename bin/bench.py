@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+
+# Configurations of the backends of the saves, see bench/bench.cpp
+BACKENDS = {
+    'xml': {'REGRR_EXT': '.xml'},
+    'yml': {'REGRR_EXT': '.yml'},
+    'rgb': {'REGRR_EXT': '.rgb'},
+    'rgb-archive': {'REGRR_ARCHIVE': '1'},
+    'rgb-lz4': {'REGRR_COMPRESS': 'lz4'},
+    'rgb-zstd': {'REGRR_COMPRESS': 'zstd'},
+}
+
+# Variables of the environment which would change the backend of a run
+BACKEND_VARIABLES = ('REGRR_EXT', 'REGRR_ARCHIVE', 'REGRR_COMPRESS')
+
+
+def run(bench, backend, only_saves, arguments):
+    """
+    Run the benchmarks with a backend, and return their JSON.
+    The benchmarks which do not depend on the backend are only run once, with the first backend.
+    Return None if the backend is not available, like a codec not compiled.
+    """
+    env = {name: value for name, value in os.environ.items() if name not in BACKEND_VARIABLES}
+    env.update(BACKENDS[backend])
+
+    command = [bench, '--benchmark_format=json', *arguments]
+    if only_saves and not any(argument.startswith('--benchmark_filter') for argument in arguments):
+        command.append('--benchmark_filter=^save/')
+
+    result = subprocess.run(command, env=env, stdout=subprocess.PIPE)
+    if result.returncode == 2:
+        return None
+
+    result.check_returncode()
+    return json.loads(result.stdout)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        prog='bench',
+        description='Run the benchmarks of the library with every backend, and merge their results in a single JSON.')
+
+    parser.add_argument('bench', help='Path of the regrr-bench executable')
+    parser.add_argument('-o', '--output', help='JSON file of the results, the standard output by default')
+    parser.add_argument('--backends', default=','.join(BACKENDS), help='Backends of the saves, separated by commas')
+
+    # The other arguments are given to Google Benchmark, like --benchmark_repetitions=5
+    args, arguments = parser.parse_known_args()
+
+    merged = None
+    available = []
+    for backend in args.backends.split(','):
+        results = run(args.bench, backend, merged is not None, arguments)
+        if results is None:
+            print(f'{backend}: not available, skipped', file=sys.stderr)
+            continue
+
+        available.append(backend)
+        if merged is None:
+            merged = results
+        else:
+            merged['benchmarks'].extend(results['benchmarks'])
+
+        for benchmark in results['benchmarks']:
+            if benchmark.get('error_occurred'):
+                print(f'{benchmark["name"]}: {benchmark.get("error_message")}', file=sys.stderr)
+
+    if merged is None:
+        sys.exit('No backend available')
+
+    merged['context']['regrr_backend'] = ','.join(available)
+
+    if args.output:
+        with open(args.output, 'w') as file:
+            json.dump(merged, file, indent=2)
+    else:
+        json.dump(merged, sys.stdout, indent=2)
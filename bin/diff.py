@@ -7,142 +7,842 @@ import numpy as np
 import colors
 
 
+# Extension of the native binary format, see include/regrr_format.h
+BINARY_EXT = '.rgb'
+
+# Layout of regrr::BinaryHeader, see include/regrr_format.h
+BINARY_HEADER = np.dtype([
+    ('magic', 'S4'),
+    ('version', '<u4'),
+    ('type', '<i4'),
+    ('rows', '<i4'),
+    ('cols', '<i4'),
+    ('channels', '<i4'),
+    ('step', '<u8'),
+])
+
+# Layout of regrr::EncodedHeader, see include/regrr_format.h
+ENCODED_HEADER = np.dtype([
+    ('magic', 'S4'),
+    ('version', '<u4'),
+    ('codec', '<u4'),
+    ('reference', '<i4'),
+    ('size', '<u8'),
+])
+
+# Codecs of the encoded format, see include/regrr_format.h
+CODEC_NONE = 0
+CODEC_LZ4 = 1
+CODEC_ZSTD = 2
+
+# Name of the archive file in an output directory, see include/regrr_format.h
+ARCHIVE_FILE = 'archive.rgp'
+
+# Layouts of the archive structures, see include/regrr_format.h
+ARCHIVE_HEADER = np.dtype([
+    ('magic', 'S4'),
+    ('version', '<u4'),
+])
+ARCHIVE_RECORD = np.dtype([
+    ('magic', 'S4'),
+    ('path_size', '<u4'),
+    ('payload_size', '<u8'),
+])
+ARCHIVE_INDEX_ENTRY = np.dtype([
+    ('offset', '<u8'),
+    ('path_size', '<u4'),
+    ('reserved', '<u4'),
+])
+ARCHIVE_FOOTER = np.dtype([
+    ('index_offset', '<u8'),
+    ('count', '<u8'),
+    ('magic', 'S4'),
+    ('version', '<u4'),
+])
+ARCHIVE_ALIGNMENT = 8
+
+# Numpy element type of each OpenCV depth (the type modulo 8)
+DEPTH_DTYPES = [np.uint8, np.int8, np.uint16, np.int16, np.int32, np.float32, np.float64, np.float16]
+
+
+def load_binary_mat(path):
+    """
+    Load a matrix in the native binary format.
+    The data is memory-mapped, so no copy is done until the values are read.
+    The matrix has the same shape as with cv2.FileStorage: the channels are flattened into the columns.
+    An encoded matrix is decoded instead, with its references loaded from the same directory.
+    """
+    with open(path, 'rb') as file:
+        magic = file.read(4)
+    if magic == b'RGRZ':
+        with open(path, 'rb') as file:
+            data = file.read()
+        return decode_binary_mat(data, path, lambda call: load_binary_mat(call_path(path, call)))
+    header = np.fromfile(path, dtype=BINARY_HEADER, count=1)[0]
+    if header['magic'] != b'RGRR':
+        raise Exception(f'Not a binary matrix file: "{path}"')
+    dtype = DEPTH_DTYPES[header['type'] & 7]
+    shape = (int(header['rows']), int(header['cols']) * int(header['channels']))
+    if shape[0] * shape[1] == 0:
+        return np.empty(shape, dtype=dtype)
+    return np.memmap(path, dtype=dtype, mode='r', offset=BINARY_HEADER.itemsize, shape=shape)
+
+
+def parse_binary_mat(data, path):
+    """
+    Get a matrix in the native binary format from a buffer, without copy.
+    Same as load_binary_mat(), but the content of the file is given.
+    """
+    header = np.frombuffer(data, dtype=BINARY_HEADER, count=1)[0]
+    if header['magic'] != b'RGRR':
+        raise Exception(f'Not a binary matrix: "{path}"')
+    dtype = DEPTH_DTYPES[header['type'] & 7]
+    shape = (int(header['rows']), int(header['cols']) * int(header['channels']))
+    count = shape[0] * shape[1]
+    if count == 0:
+        return np.empty(shape, dtype=dtype)
+    return np.frombuffer(data, dtype=dtype, count=count, offset=BINARY_HEADER.itemsize).reshape(shape)
+
+
+def is_encoded_mat(data):
+    """
+    Check if a buffer is in the encoded variant of the native binary format.
+    """
+    return len(data) >= ENCODED_HEADER.itemsize and bytes(data[:4]) == b'RGRZ'
+
+
+def decompress(codec, data, size):
+    """
+    Decompress the pixels of an encoded matrix, the modules of the codecs are only needed if used.
+    """
+    if codec == CODEC_NONE:
+        return bytes(data)
+    if codec == CODEC_LZ4:
+        import lz4.block
+        return lz4.block.decompress(bytes(data), uncompressed_size=size)
+    if codec == CODEC_ZSTD:
+        import zstandard
+        return zstandard.ZstdDecompressor().decompress(bytes(data), max_output_size=size)
+    raise Exception(f'Unknown codec {codec}')
+
+
+def decode_binary_mat(data, path, reference):
+    """
+    Decode a matrix in the encoded variant of the native binary format, see include/regrr_format.h.
+    reference(call) loads another call of the same matrix, to undo a delta.
+    The matrix has the same shape as with load_binary_mat().
+    """
+    encoded = np.frombuffer(data, dtype=ENCODED_HEADER, count=1)[0]
+    if encoded['magic'] != b'RGRZ':
+        raise Exception(f'Not an encoded matrix: "{path}"')
+    offset = ENCODED_HEADER.itemsize
+    header = np.frombuffer(data, dtype=BINARY_HEADER, count=1, offset=offset)[0]
+    offset += BINARY_HEADER.itemsize
+    dtype = DEPTH_DTYPES[header['type'] & 7]
+    shape = (int(header['rows']), int(header['cols']) * int(header['channels']))
+    size = int(header['step']) * shape[0]
+    pixels = decompress(int(encoded['codec']), data[offset:offset + int(encoded['size'])], size)
+    if len(pixels) != size:
+        raise Exception(f'Corrupted encoded matrix: "{path}"')
+    mat = np.frombuffer(pixels, dtype=dtype).reshape(shape)
+    if encoded['reference'] > 0:
+        previous = reference(int(encoded['reference']))
+        if previous.shape != shape or previous.dtype != mat.dtype:
+            raise Exception(f'The reference of the delta has another shape: "{path}"')
+        mat = np.bitwise_xor(mat.view(np.uint8), np.ascontiguousarray(previous).view(np.uint8)).view(dtype)
+    return mat
+
+
+def call_path(path, call):
+    """
+    Get the path of another call of a matrix, for example dir/name.3.rgb for dir/name.5.rgb and the call 3.
+    """
+    stem, extension = os.path.splitext(path)
+    return os.path.splitext(stem)[0] + f'.{call}' + extension
+
+
+def align(size):
+    """
+    Round a size of the archive up to the alignment.
+    """
+    return (size + ARCHIVE_ALIGNMENT - 1) // ARCHIVE_ALIGNMENT * ARCHIVE_ALIGNMENT
+
+
+class Archive:
+    """
+    Read an archive file, where all the matrices of an output directory are appended.
+    The file is memory-mapped, and the matrices are found through the index at the end of the file.
+    If the index is missing (the process crashed), all the records are read sequentially instead.
+    """
+
+    def __init__(self, path):
+        """
+        Constructor.
+        """
+        self.path = path
+        self.data = np.memmap(path, dtype=np.uint8, mode='r')
+        header = np.frombuffer(self.data, dtype=ARCHIVE_HEADER, count=1)[0]
+        if header['magic'] != b'RGRP':
+            raise Exception(f'Not an archive file: "{path}"')
+        # Offset of the payload and its size, for each path relative to the output directory
+        # Ordered as the records were written, the last record wins if a path was written twice
+        self.records = {}
+        if not self.read_index():
+            self.scan_records()
+
+    def read_index(self):
+        """
+        Read the records from the index.
+        Return False if the archive has no valid footer.
+        """
+        if len(self.data) < ARCHIVE_HEADER.itemsize + ARCHIVE_FOOTER.itemsize:
+            return False
+        footer = np.frombuffer(self.data, dtype=ARCHIVE_FOOTER, count=1, offset=len(self.data) - ARCHIVE_FOOTER.itemsize)[0]
+        if footer['magic'] != b'RGRI':
+            return False
+        offset = int(footer['index_offset'])
+        for _ in range(int(footer['count'])):
+            entry = np.frombuffer(self.data, dtype=ARCHIVE_INDEX_ENTRY, count=1, offset=offset)[0]
+            offset += ARCHIVE_INDEX_ENTRY.itemsize
+            self.add_record(int(entry['offset']))
+            offset += align(int(entry['path_size']))
+        return True
+
+    def scan_records(self):
+        """
+        Read the records sequentially, until the end of the file or the first incomplete record.
+        """
+        offset = ARCHIVE_HEADER.itemsize
+        while offset + ARCHIVE_RECORD.itemsize <= len(self.data):
+            end = self.add_record(offset)
+            if end is None:
+                break
+            offset = end
+
+    def add_record(self, offset):
+        """
+        Add the record at the given offset.
+        Return the offset after the record, or None if the record is invalid or incomplete.
+        """
+        record = np.frombuffer(self.data, dtype=ARCHIVE_RECORD, count=1, offset=offset)[0]
+        if record['magic'] != b'RGRE':
+            return None
+        path_size = int(record['path_size'])
+        payload_size = int(record['payload_size'])
+        path_offset = offset + ARCHIVE_RECORD.itemsize
+        payload_offset = path_offset + align(path_size)
+        if payload_offset + payload_size > len(self.data):
+            return None
+        path = bytes(self.data[path_offset:path_offset + path_size]).decode()
+        self.records[path] = (payload_offset, payload_size)
+        return payload_offset + align(payload_size)
+
+    def __contains__(self, path):
+        return path in self.records
+
+    def __iter__(self):
+        """
+        Iterate the paths and matrices of the archive, in the order they were written.
+        """
+        for path in self.records:
+            yield path, self.load(path)
+
+    def load(self, path):
+        """
+        Get the matrix at the given path relative to the output directory, without copy.
+        """
+        offset, size = self.records[path]
+        data = self.data[offset:offset + size]
+        if is_encoded_mat(data):
+            return decode_binary_mat(data, path, lambda call: self.load(call_path(path, call)))
+        return parse_binary_mat(data, path)
+
+
+class Output:
+    """
+    Access the matrices of an output directory, either saved as files or appended to an archive.
+    """
+
+    def __init__(self, directory):
+        """
+        Constructor.
+        """
+        self.directory = directory
+        archive_path = os.path.join(directory, ARCHIVE_FILE)
+        self.archive = Archive(archive_path) if os.path.isfile(archive_path) else None
+
+    def path(self, relative_path):
+        """
+        Full path of a matrix, for the messages.
+        """
+        if self.archive is not None:
+            return os.path.join(self.directory, ARCHIVE_FILE) + ':' + relative_path
+        return os.path.join(self.directory, relative_path)
+
+    def exists(self, relative_path):
+        """
+        Check if the matrix at the given path relative to the output directory exists.
+        """
+        if self.archive is not None:
+            return relative_path in self.archive
+        return os.path.isfile(os.path.join(self.directory, relative_path))
+
+    def stamp(self, relative_path):
+        """
+        Identify the content of the matrix at the given path relative to the output directory, without reading it.
+        Made of the size and the modification time of its file, or of the archive.
+        """
+        status = os.stat(self.archive.path if self.archive is not None else os.path.join(self.directory, relative_path))
+        return f'{status.st_size}:{status.st_mtime_ns}'
+
+    def load(self, relative_path):
+        """
+        Load the matrix at the given path relative to the output directory.
+        """
+        if self.archive is not None:
+            return self.archive.load(relative_path)
+        return load_mat(os.path.join(self.directory, relative_path))
+
+
+def save_binary_mat(path, mat):
+    """
+    Save a 2D numpy array in the native binary format, as a single channel matrix.
+    """
+    mat = np.ascontiguousarray(mat)
+    if mat.ndim == 1:
+        mat = mat.reshape(1, -1)
+    depth = [np.dtype(d) for d in DEPTH_DTYPES].index(mat.dtype)
+    header = np.zeros(1, dtype=BINARY_HEADER)
+    header['magic'] = b'RGRR'
+    header['version'] = 1
+    header['type'] = depth
+    header['rows'], header['cols'] = mat.shape
+    header['channels'] = 1
+    header['step'] = mat.shape[1] * mat.itemsize
+    with open(path, 'wb') as file:
+        file.write(header.tobytes() + mat.tobytes())
+
+
+def save_mat(path, mat):
+    """
+    Save a matrix to the given path, in the format given by the extension.
+    """
+    if path.endswith(BINARY_EXT):
+        save_binary_mat(path, mat)
+    else:
+        storage = cv2.FileStorage(path, cv2.FILE_STORAGE_WRITE)
+        # Write the file, we don't care about the node name
+        storage.write("root", mat)
+
+
 def load_mat(path):
     """
     Load an OpenCV matrix from the given path.
     """
+    if path.endswith(BINARY_EXT):
+        return load_binary_mat(path)
     storage = cv2.FileStorage(path, cv2.FILE_STORAGE_READ)
     mat = storage.getFirstTopLevelNode().mat()
     return mat
 
 
+class DiffCache:
+    """
+    Results of the previous comparisons, so an unchanged pair of matrices is not compared again.
+    Each line is the key of a pair then the color and the text of its result, separated by tabulations.
+    The key is the path of both matrices and the content of each: its hash in the lists if recorded, otherwise the size and time of its file.
+    Only the last result of each pair of paths is kept.
+    """
+    VERSION = 'regrr-diff-cache 2'
+
+    def __init__(self, path, settings=''):
+        """
+        Constructor, load the cache file if it exists and was written with the same settings.
+        """
+        self.path = path
+        self.header = self.VERSION + '\t' + settings
+        # Content of both matrices, color and text of the result, by pair of paths
+        self.entries = {}
+        self.changed = False
+        if os.path.isfile(path):
+            with open(path, 'r') as file:
+                if file.readline().rstrip('\n') == self.header:
+                    for line in file:
+                        fields = line.rstrip('\n').split('\t', 5)
+                        if len(fields) == 6:
+                            self.entries[(fields[0], fields[1])] = ((fields[2], fields[3]), fields[4], fields[5])
+
+    @staticmethod
+    def key(output1, output2, path1, path2, hash1, hash2):
+        """
+        Get the key of a pair of matrices, the pair of paths and the pair of contents, from their hashes in the lists if recorded.
+        """
+        content1 = 'h' + hash1 if hash1 is not None else output1.stamp(path1)
+        content2 = 'h' + hash2 if hash2 is not None else output2.stamp(path2)
+        return (os.path.abspath(output1.path(path1)), os.path.abspath(output2.path(path2))), (content1, content2)
+
+    def get(self, key):
+        """
+        Get the color and the text of the result of a pair, or None if not cached or any matrix changed.
+        """
+        paths, contents = key
+        entry = self.entries.get(paths)
+        return entry[1:] if entry is not None and entry[0] == contents else None
+
+    def put(self, key, color, text):
+        """
+        Cache the result of a pair.
+        """
+        paths, contents = key
+        if self.entries.get(paths) != (contents, color, text):
+            self.entries[paths] = (contents, color, text)
+            self.changed = True
+
+    def save(self):
+        """
+        Write the cache file if it changed, replacing it atomically so an interrupted run does not corrupt it.
+        """
+        if not self.changed:
+            return
+        os.makedirs(os.path.dirname(self.path) or '.', exist_ok=True)
+        temporary = self.path + '.tmp'
+        with open(temporary, 'w') as file:
+            file.write(self.header + '\n')
+            for (path1, path2), ((content1, content2), color, text) in self.entries.items():
+                file.write(f'{path1}\t{path2}\t{content1}\t{content2}\t{color}\t{text}\n')
+        os.replace(temporary, self.path)
+
+
+def match_sequences(a, b):
+    """
+    Align two sequences on a longest common subsequence, with the linear-space variant of the Myers diff algorithm.
+    Takes O((N + M) D) time and O(N + M) memory, where D is the count of differences,
+    so long flows with few differences are aligned in about linear time.
+    Return, for each element of a, the index of the element of b it is matched with, or None.
+    """
+    matches = [None] * len(a)
+    # Ranges of a and b left to align, a stack instead of a recursion
+    ranges = [(0, len(a), 0, len(b))]
+    while ranges:
+        a0, a1, b0, b1 = ranges.pop()
+        # The common prefix and suffix are matched directly, which is most of similar flows
+        while a0 < a1 and b0 < b1 and a[a0] == b[b0]:
+            matches[a0] = b0
+            a0, b0 = a0 + 1, b0 + 1
+        while a0 < a1 and b0 < b1 and a[a1 - 1] == b[b1 - 1]:
+            a1, b1 = a1 - 1, b1 - 1
+            matches[a1] = b1
+        if a0 == a1 or b0 == b1:
+            continue
+        # Split where the shortest paths from both ends meet, and align each half
+        split = bisect_sequences(a, b, a0, a1, b0, b1)
+        if split is not None:
+            x, y = split
+            ranges.append((a0, x, b0, y))
+            ranges.append((x, a1, y, b1))
+    return matches
+
+
+def bisect_sequences(a, b, a0, a1, b0, b1):
+    """
+    Find the middle of a shortest edit path of the ranges [a0, a1) of a and [b0, b1) of b,
+    walking the furthest reaching paths from both ends.
+    Return the split in a and b, or None if the ranges have nothing in common.
+    """
+    n, m = a1 - a0, b1 - b0
+    max_d = (n + m + 1) // 2
+    offset = max_d
+    length = 2 * max_d + 1
+    delta = n - m
+    # If the difference of the lengths is odd, the forward path meets the reverse one, otherwise the reverse path meets the forward one
+    front = delta % 2 != 0
+    # Furthest x reached on each diagonal k = x - y, from the start and from the end, -1 if not reached
+    forward = [-1] * length
+    reverse = [-1] * length
+    forward[offset + 1] = 0
+    reverse[offset + 1] = 0
+    # Diagonals trimmed once their paths run out of the ranges
+    k1start = k1end = k2start = k2end = 0
+    for d in range(max_d):
+        for k1 in range(-d + k1start, d + 1 - k1end, 2):
+            k1_offset = offset + k1
+            if k1 == -d or (k1 != d and forward[k1_offset - 1] < forward[k1_offset + 1]):
+                x1 = forward[k1_offset + 1]
+            else:
+                x1 = forward[k1_offset - 1] + 1
+            y1 = x1 - k1
+            while x1 < n and y1 < m and a[a0 + x1] == b[b0 + y1]:
+                x1, y1 = x1 + 1, y1 + 1
+            forward[k1_offset] = x1
+            if x1 > n:
+                k1end += 2
+            elif y1 > m:
+                k1start += 2
+            elif front:
+                k2_offset = offset + delta - k1
+                if 0 <= k2_offset < length and reverse[k2_offset] != -1 and x1 >= n - reverse[k2_offset]:
+                    return a0 + x1, b0 + y1
+        for k2 in range(-d + k2start, d + 1 - k2end, 2):
+            k2_offset = offset + k2
+            if k2 == -d or (k2 != d and reverse[k2_offset - 1] < reverse[k2_offset + 1]):
+                x2 = reverse[k2_offset + 1]
+            else:
+                x2 = reverse[k2_offset - 1] + 1
+            y2 = x2 - k2
+            while x2 < n and y2 < m and a[a1 - 1 - x2] == b[b1 - 1 - y2]:
+                x2, y2 = x2 + 1, y2 + 1
+            reverse[k2_offset] = x2
+            if x2 > n:
+                k2end += 2
+            elif y2 > m:
+                k2start += 2
+            elif not front:
+                k1_offset = offset + delta - k2
+                if 0 <= k1_offset < length and forward[k1_offset] != -1 and forward[k1_offset] >= n - x2:
+                    x1 = forward[k1_offset]
+                    return a0 + x1, b0 + x1 - (k1_offset - offset)
+    return None
+
+
 class MatList:
     """
-    Read from the lists.txt the list of the matrices written to a file
+    Read from the lists.txt the list of the matrices written to a file.
+    The file is streamed, each pass parses the lines as they are iterated.
+    Only the flow of the thread compared is kept in memory, to align it with the flow of the other directory.
     """
     # The possible actions for each line of the file
     ENTER_SCOPE = 0
     EXIT_SCOPE = 1
     SAVE_MAT = 2
 
-    def __init__(self, lists_path):
+    def __init__(self, lists_path, from_scope=None):
         """
         Constructor.
+        from_scope restricts the flow to a subtree, the path of a scope relative to the output directory like "scope1/scope2",
+        prefixed by the name of the thread for the threads other than the main thread.
         """
-        # Every action of the flow
-        self.flow = []
-        # Iterate the line as the flow order
+        self.lists_path = lists_path
+        self.from_scope = [name for name in from_scope.split('/') if name] if from_scope else []
         with open(lists_path, 'r') as file:
             # The first line is the file extension
             self.ext = file.readline().strip()
-            # The following lines are each action in order (the execution flow)
-            # Build the execution flow (self.flow)
+
+    @classmethod
+    def parse_line(cls, line):
+        """
+        Parse a line of the lists file into the thread and the action, or None for an empty line.
+        """
+        # Lines of threads are prefixed with "@name\t" in thread-aware mode
+        thread = ''
+        if line.startswith('@') and '\t' in line:
+            thread, line = line[1:].split('\t', 1)
+        # Remove begin/trailing whitespaces
+        line = line.strip()
+        if len(line) == 0:
+            return None
+        if line[0] == '-':
+            # Exit a scope
+            return thread, {'type': cls.EXIT_SCOPE}
+        if line[0] == '+':
+            # Enter a scope, with a given name after the '+'
+            return thread, {'type': cls.ENTER_SCOPE, 'name': line[1:].strip()}
+        # Otherwise, this is a matrix save
+        # The line contains the name of the matrix, then the annotations separated by tabulations
+        # For example "name.call\t#hash", "name.call\t!reason" when skipped by the budget,
+        # or "name.call\t~roi=x,y,width,height stride=2,2" when only a region is saved
+        mat_name, mat_hash, mat_skipped, mat_region = line, None, None, None
+        while '\t' in mat_name:
+            rest, annotation = mat_name.rsplit('\t', 1)
+            if annotation.startswith('#'):
+                mat_hash = annotation[1:]
+            elif annotation.startswith('!'):
+                mat_skipped = annotation[1:]
+            elif annotation.startswith('~'):
+                mat_region = annotation[1:]
+            else:
+                break
+            mat_name = rest.strip()
+        return thread, {'type': cls.SAVE_MAT, 'name': mat_name, 'hash': mat_hash, 'skipped': mat_skipped, 'region': mat_region}
+
+    def in_scope(self, thread, scopes):
+        """
+        Check if the scopes of a thread are in the subtree of from_scope.
+        """
+        path = [*([thread] if thread else []), *scopes]
+        return path[:len(self.from_scope)] == self.from_scope
+
+    def events(self, only_thread=None):
+        """
+        Iterate the actions of the flow in the file order, with their thread and the stack of scopes they are in.
+        The stack is the one after entering a scope and before exiting it, it is reused so it must not be kept.
+        Only the actions of only_thread if not None, and only the ones in from_scope.
+        """
+        # Stack of scopes of each thread
+        stacks = {}
+        with open(self.lists_path, 'r') as file:
+            # Skip the file extension
+            file.readline()
             for line in file:
-                # Remove begin/trailing whitespaces
-                line = line.strip()
-                if len(line) > 0:
-                    if line[0] == '-':
-                        # Exit a scope
-                        self.flow.append({'type': self.EXIT_SCOPE})
-                    elif line[0] == '+':
-                        # Enter a scope, with a given name after the '+'
-                        scope_name = line[1:].strip()
-                        self.flow.append({'type': self.ENTER_SCOPE, 'name': scope_name})
-                    else:
-                        # Otherwise, this is a matrix save
-                        # The line contains the name of the matrix
-                        mat_name = line.strip()
-                        self.flow.append({'type': self.SAVE_MAT, 'name': mat_name})
-
-    def compare(self, tmp_dir1, tmp_dir2):
+                parsed = self.parse_line(line)
+                if parsed is None:
+                    continue
+                thread, action = parsed
+                if only_thread is not None and thread != only_thread:
+                    continue
+                scopes = stacks.setdefault(thread, [])
+                if action['type'] == self.ENTER_SCOPE:
+                    scopes.append(action['name'])
+                    if self.in_scope(thread, scopes):
+                        yield thread, scopes, action
+                elif action['type'] == self.EXIT_SCOPE:
+                    # Ignore the unbalanced exits, like a truncated file
+                    if scopes:
+                        if self.in_scope(thread, scopes):
+                            yield thread, scopes, action
+                        scopes.pop()
+                elif self.in_scope(thread, scopes):
+                    yield thread, scopes, action
+
+    def threads(self):
+        """
+        Get the names of the threads in a deterministic order, whatever the scheduling was.
+        The main thread (empty name) is always first, then the other threads sorted by name.
+        """
+        names = set()
+        with open(self.lists_path, 'r') as file:
+            # Skip the file extension
+            file.readline()
+            for line in file:
+                names.add(line[1:].split('\t', 1)[0] if line.startswith('@') and '\t' in line else '')
+        return sorted(names, key=lambda name: (name != '', name))
+
+    def flow(self, thread):
+        """
+        Get the actions of the flow of a thread as a list, each with the tuple of the scopes it is in.
+        A scope entered is not in itself. The tuples are shared by the consecutive actions of the same scope.
+        """
+        flow = []
+        scopes = ()
+        for _, stack, action in self.events(thread):
+            if action['type'] == self.ENTER_SCOPE:
+                flow.append((tuple(stack[:-1]), action))
+                scopes = tuple(stack)
+            elif action['type'] == self.EXIT_SCOPE:
+                scopes = tuple(stack[:-1])
+                flow.append((scopes, action))
+            else:
+                if len(scopes) != len(stack):
+                    # Entered from a scope out of from_scope
+                    scopes = tuple(stack)
+                flow.append((scopes, action))
+        return flow
+
+    def exhausted(self):
+        """
+        Check if the bytes of the budget were exhausted, the following matrices of the run are not in the lists.
+        """
+        return any(action['type'] == self.SAVE_MAT and action['skipped'] == 'bytes' for _, _, action in self.events())
+
+    @classmethod
+    def align_flows(cls, flow1, flow2):
+        """
+        Align the flows of a thread of both directories, on their scopes entered and exited and on the names of their matrices.
+        The call counts are ignored, they are shifted after the flows diverge.
+        Return, for each action of flow1, the index of the action of flow2 it is matched with, or None.
+        """
+        # Compare integers instead of strings, each distinct action is interned
+        ids = {}
+
+        def tokens(flow):
+            result = []
+            for _, action in flow:
+                if action['type'] == cls.ENTER_SCOPE:
+                    key = '+' + action['name']
+                elif action['type'] == cls.EXIT_SCOPE:
+                    key = '-'
+                else:
+                    key = '=' + action['name'].rsplit('.', 1)[0]
+                result.append(ids.setdefault(key, len(ids)))
+            return result
+
+        return match_sequences(tokens(flow1), tokens(flow2))
+
+    def path(self, thread, scopes, mat_name):
+        """
+        Path of a matrix relative to the output directories, it is also the key in an archive.
+        Attention to not path-join the extension, its part of the file name.
+        """
+        return '/'.join([*([thread] if thread else []), *scopes, mat_name + self.ext])
+
+    def compare(self, tmp_dir1, tmp_dir2, other=None, cache=None):
         """
         Compare two output directories.
-        Base the files to compare on the lists file given in the constructor.
-        Base the rendering order on the lists file given in the constructor.
+        Compare the flow of each thread separately, each in the sub-directory of the thread.
+        Each directory can contain either files or an archive.
+        other is the MatList of the second directory, if any:
+        the flows are aligned so the matrices are paired even when the flows diverge,
+        the ones with the same hash in both directories are not read,
+        and the ones not saved by the budget of either directory are not reported missing.
+        Without it, the matrices are paired by path.
+        The results of the comparisons are reused from the cache and stored in it, if any.
+        """
+        output1 = Output(tmp_dir1)
+        output2 = Output(tmp_dir2)
+        # Once the bytes of its budget are exhausted, the matrices of a run are not in its lists, they are not only in the other run
+        exhausted1 = other is not None and self.exhausted()
+        exhausted2 = other is not None and other.exhausted()
+        threads = set(self.threads())
+        if other is not None:
+            threads.update(other.threads())
+        for thread in sorted(threads, key=lambda name: (name != '', name)):
+            if thread and self.from_scope[:1] in ([], [thread]):
+                # Each thread is printed like a top-level scope
+                print(colors.white(thread + "/"))
+            flow1 = self.flow(thread)
+            flow2 = other.flow(thread) if other is not None else []
+            matches = self.align_flows(flow1, flow2) if other is not None else [None] * len(flow1)
+            self.compare_flow(flow1, flow2, matches, output1, output2, thread, other, exhausted1, exhausted2, cache)
+
+    def compare_flow(self, flow1, flow2, matches, output1, output2, thread, other, exhausted1, exhausted2, cache):
         """
-        # Stack of scopes for printing a tree
-        scopes = []
+        Compare the matrices of one thread of two output directories, in the order of the first flow.
+        The matrices of the main thread (empty name) are at the root, the others in the sub-directory of the thread.
+        The scopes and the matrices only in the second flow are printed before the next action matched.
+        """
+        # The threads other than the main thread are printed under the name of the thread
+        indent = 1 if thread else 0
+        next2 = 0
+
+        def print_unmatched(end):
+            # Print the scopes and the matrices only in the second flow up to end
+            nonlocal next2
+            for scopes, action in flow2[next2:end]:
+                padding = "    " * (indent + len(scopes))
+                if action['type'] == self.ENTER_SCOPE:
+                    print(colors.white(padding + action['name'] + "/"))
+                elif action['type'] == self.SAVE_MAT and exhausted1:
+                    print(colors.yellow(padding + f'{action["name"]}: not saved by the budget (bytes) of "{output1.directory}"'))
+                elif action['type'] == self.SAVE_MAT:
+                    print(colors.yellow(padding + f'{action["name"]}: only in "{output2.directory}"'))
+            next2 = max(next2, end)
+
         # Iterate all actions, in order
-        for action in self.flow:
-            # Get the type of the action
+        for (scopes, action), match in zip(flow1, matches):
+            scopes2, action2 = None, {}
+            if match is not None:
+                print_unmatched(match)
+                scopes2, action2 = flow2[match]
+                next2 = match + 1
             # Do a different thing depending of the action type
             t = action['type']
             if t == self.ENTER_SCOPE:
-                # Enter a scope
-                scope_name = action['name']
                 # Pretty print it
-                print(colors.white("    " * len(scopes) + scope_name + "/"))
-                # Push the scope
-                scopes.append(scope_name)
+                print(colors.white("    " * (indent + len(scopes)) + action['name'] + "/"))
             elif t == self.EXIT_SCOPE:
-                # Exit a scope
-                scopes.pop()
+                pass
             elif t == self.SAVE_MAT:
-                # Here the real work, we save a matrix.
-                # Pretty print it
-                # Get the name of the matrix
-                mat_name = str(action['name'])
-
-                # Get the path from the matrix name, scopes, and file extension
-                # Both folder should have the same file extension than the one given in constructor
-                # Attention to not path-join the extension, its part of the file name
-                path1 = os.path.join(tmp_dir1, *scopes, mat_name + self.ext)
-                path2 = os.path.join(tmp_dir2, *scopes, mat_name + self.ext)
-
-                # Check if both files exists
-                if os.path.isfile(path1) and os.path.isfile(path2):
-                    # If so, load the matrices and compare them
-                    try:
-                        # Flatten both matrices into vectors
-                        m1 = load_mat(path1).flatten()
-                        m2 = load_mat(path2).flatten()
-                        # Get the absolute difference
-                        diff = np.abs(m2 - m1)
-                        # Compute the L1 distance
-                        d = np.linalg.norm(diff, ord=1)
-                        # Compute more math. info.
-                        min = np.min(diff)
-                        max = np.max(diff)
-                        avg = np.average(diff)
-                        median = np.median(diff)
-                        std = np.std(diff)
-                        # Get the padding depending on the count of scopes
-                        padding = "    " * len(scopes)
-                        # Initial message when matrices are the same
-                        # Data is appened to it if the matrices are different
-                        text = padding + f'{mat_name}: d={d}'
-                        # Are the matrices almost the same?
-                        if d < 0.001:
-                            # The matrices are almost the same, we can print it in green
-                            print(colors.green(text))
-                        else:
-                            # The matrices are different, we print more information
-                            # We also save the difference in files
-                            text += f', min={min}, max={max}, avg={avg}, median={median}, std={std}'
-                            # Different color if the different is big or relatively smaller
-                            if d < 10.0:
-                                print(colors.yellow(text))
-                            else:
-                                print(colors.red(text))
-                            # In this case we save the difference
-                            # In the same file format as the one given in the constructor from the lists file
-                            # Create intermediates directories automatically
-                            diff_dir = os.path.join(tmp_dir1, "diff", *scopes)
-                            os.makedirs(diff_dir, exist_ok=True)
-                            diff_file = os.path.join(diff_dir, mat_name + self.ext),
-                            storage = cv2.FileStorage(diff_file, cv2.FILE_STORAGE_WRITE)
-                            # Write the file, we don't care about the node name
-                            storage.write("root", diff)
-                    except Exception as e:
-                        # If there is an error,
-                        # I am almost sure this is because the dimension mismatch,
-                        # Which can happen frequently if the executable versions or input parameters are different.
-                        print(f'Error when comparing "{os.path.join(*scopes, mat_name + self.ext)}": "{e}".')
-                else:
-                    # Log on we can't find the files, maybe its a mistake and the user want to know...
-                    print(f'Cannot find file matrices: "{path1}" or "{path2}"')
+                self.compare_mat(output1, output2, thread, scopes, action, scopes2, action2, other, indent,
+                                 other is not None and match is None, exhausted2, cache)
             else:
                 raise Exception("Unknown action type: " + str(type))
+        print_unmatched(len(flow2))
+
+    def compare_mat(self, output1, output2, thread, scopes, action, scopes2, action2, other, indent, unmatched, exhausted2, cache):
+        """
+        Compare a matrix of the first flow with the action it is matched with in the second flow, if any, and print the result.
+        """
+        # Get the name of the matrix, and its name in the second directory where the flows diverged
+        mat_name = str(action['name'])
+        label = mat_name if not action2 or action2['name'] == mat_name else f'{mat_name} ({action2["name"]})'
+        padding = "    " * (indent + len(scopes))
+
+        # Get the path from the matrix name, scopes, and file extension, in each directory
+        # Attention the extension can differ between the directories
+        path = self.path(thread, scopes, mat_name)
+        path2 = other.path(thread, scopes2, action2['name']) if action2 else path
+
+        # Once the bytes of its budget are exhausted, the matrices of the second run are not in its lists
+        skipped = action['skipped'] or action2.get('skipped') or ('bytes' if exhausted2 and unmatched else None)
+
+        # Check if both files exists
+        if skipped is not None:
+            # A matrix not saved by the budget of a run is not missing
+            directory = output1.directory if action['skipped'] else output2.directory
+            print(colors.yellow(padding + f'{label}: not saved by the budget ({skipped}) of "{directory}"'))
+        elif unmatched:
+            # The flows diverged, the matrix is not in the second flow
+            print(colors.yellow(padding + f'{label}: only in "{output1.directory}"'))
+        elif action2 and action['region'] != action2['region']:
+            # Two different regions of a matrix are not comparable
+            region1 = action['region'] or 'whole matrix'
+            region2 = action2['region'] or 'whole matrix'
+            print(colors.red(padding + f'{label}: different regions "{region1}" and "{region2}"'))
+        elif output1.exists(path) and output2.exists(path2) and action['hash'] is not None and action['hash'] == action2.get('hash'):
+            # Identical hashes, the matrices are the same without reading them
+            print(colors.green(padding + f'{label}: d=0.0'))
+        elif output1.exists(path) and output2.exists(path2):
+            # Reuse the result of a previous run if both matrices did not change
+            key = DiffCache.key(output1, output2, path, path2, action['hash'], action2.get('hash')) if cache is not None else None
+            result = cache.get(key) if key is not None else None
+            if result is None:
+                result = self.compare_mats(output1, output2, thread, scopes, mat_name, label, path, path2)
+                if key is not None and result[0]:
+                    cache.put(key, *result)
+            color, text = result
+            print(getattr(colors, color)(padding + text) if color else text)
+        else:
+            # Log on we can't find the files, maybe its a mistake and the user want to know...
+            print(f'Cannot find file matrices: "{output1.path(path)}" or "{output2.path(path2)}"')
+
+    def compare_mats(self, output1, output2, thread, scopes, mat_name, label, path, path2):
+        """
+        Load and compare two matrices, and save the difference if any.
+        label is the name of the matrix printed, with its name in the second directory if different.
+        Return the color and the text of the result, without the padding, the color is empty for an error.
+        """
+        try:
+            # Flatten both matrices into vectors
+            m1 = output1.load(path).flatten()
+            m2 = output2.load(path2).flatten()
+            # Get the absolute difference, in double precision like regrr-diff so the integer types do not wrap around
+            # and both tools give the same results, they share the cache file
+            diff = np.abs(m2.astype(np.float64) - m1.astype(np.float64))
+            # Compute the L1 distance
+            d = np.linalg.norm(diff, ord=1)
+            # Compute more math. info.
+            min = np.min(diff)
+            max = np.max(diff)
+            avg = np.average(diff)
+            median = np.median(diff)
+            std = np.std(diff)
+            # Initial message when matrices are the same
+            # Data is appened to it if the matrices are different
+            text = f'{label}: d={d}'
+            # Are the matrices almost the same?
+            if d < 0.001:
+                # The matrices are almost the same, we can print it in green
+                return 'green', text
+            # The matrices are different, we print more information
+            # We also save the difference in files
+            text += f', min={min}, max={max}, avg={avg}, median={median}, std={std}'
+            # In this case we save the difference
+            # In the same file format as the one given in the constructor from the lists file
+            # Create intermediates directories automatically
+            diff_dir = os.path.join(output1.directory, "diff", thread, *scopes)
+            os.makedirs(diff_dir, exist_ok=True)
+            diff_file = os.path.join(diff_dir, mat_name + self.ext)
+            # In the type of the matrices, saturated for the integer types, like regrr-diff
+            if np.issubdtype(m1.dtype, np.integer):
+                info = np.iinfo(m1.dtype)
+                diff = np.minimum(diff, info.max)
+            save_mat(diff_file, diff.astype(m1.dtype))
+            # Different color if the different is big or relatively smaller
+            return ('yellow' if d < 10.0 else 'red'), text
+        except Exception as e:
+            # If there is an error,
+            # I am almost sure this is because the dimension mismatch,
+            # Which can happen frequently if the executable versions or input parameters are different.
+            return '', f'Error when comparing "{os.path.join(thread, *scopes, mat_name + self.ext)}": "{e}".'
 
 
 if __name__ == '__main__':
@@ -152,11 +852,27 @@ if __name__ == '__main__':
 
     parser.add_argument('tmp_dir1', help='Temporary directory of the first version')
     parser.add_argument('tmp_dir2', help='Temporary directory of the second version')
+    parser.add_argument('--from-scope', help='Compare only the subtree of this scope, like "scope1/scope2" or "thread/scope1"')
+    parser.add_argument('--cache', help='Cache file of the results, "diff/cache.txt" in the first directory by default')
+    parser.add_argument('--no-cache', action='store_true', help='Compare all the matrices again, without cache')
 
     args = parser.parse_args()
 
-    # Use the lists of the first temporary directory
-    # It doesn't matter as the matrix should appears in both sides
-    # But it can change the visual output order if the algorithms flows differ
-    info = MatList(os.path.join(args.tmp_dir1, "lists.txt"))
-    info.compare(args.tmp_dir1, args.tmp_dir2)
+    # The binary lists file written with REGRR_LISTS_BINARY is only read by regrr-diff, regrr-lists converts it
+    for tmp_dir in (args.tmp_dir1, args.tmp_dir2):
+        if not os.path.isfile(os.path.join(tmp_dir, "lists.txt")) and os.path.isfile(os.path.join(tmp_dir, "lists.rgl")):
+            parser.error(f'binary lists file in "{tmp_dir}", convert it first with: regrr-lists {tmp_dir}')
+
+    # Print in the order of the lists of the first temporary directory
+    info = MatList(os.path.join(args.tmp_dir1, "lists.txt"), args.from_scope)
+    # The lists of the second directory are aligned with it, so the matrices are paired even if the algorithms flows differ
+    # It may not exist, then the matrices are paired by path
+    lists2 = os.path.join(args.tmp_dir2, "lists.txt")
+    other = MatList(lists2, args.from_scope) if os.path.isfile(lists2) else None
+    cache = None if args.no_cache else DiffCache(args.cache or os.path.join(args.tmp_dir1, "diff", "cache.txt"))
+    try:
+        info.compare(args.tmp_dir1, args.tmp_dir2, other, cache)
+    finally:
+        # Keep the results compared so far if interrupted, so the next run resumes from there
+        if cache is not None:
+            cache.save()
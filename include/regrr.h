@@ -2,8 +2,23 @@
 
 
 #include <opencv2/core.hpp>
+#if REGRR_HAVE_CUDA
+#include <opencv2/core/cuda.hpp>
+#endif
 #include <string>
 #include <type_traits>
+#include <cstdint>
+#include <map>
+#include <utility>
+
+/**
+ * Categories compiled in the program.
+ * The macros with a category not in this mask compile to nothing.
+ * Default is all categories, can be set with the CMake cache variable of the same name.
+ */
+#ifndef REGRR_COMPILE_MASK
+    #define REGRR_COMPILE_MASK 0xFFFFFFFFu
+#endif
 
 #if ENABLE_REGRR
 
@@ -33,6 +48,8 @@
 
     /**
      * Save a matrix.
+     * The argument can be anything convertible to `cv::Mat`, a `cv::Matx` or `cv::Vec` is not copied, see `regrr::view()`.
+     * A `cv::UMat` or a `cv::cuda::GpuMat` is downloaded from its device, see `save()`.
      *
      * Example:
      * ```
@@ -40,7 +57,43 @@
      * REGRR_SAVE(m, "MySuperName-%d", 10);
      * ```
      */
-    #define REGRR_SAVE(mat, ...) do { regrr::save(cv::Mat(mat), true, nullptr, nullptr, __VA_ARGS__); } while(false)
+    #define REGRR_SAVE(mat, ...) do { regrr::save(regrr::view(mat), true, nullptr, nullptr, __VA_ARGS__); } while(false)
+
+    /**
+     * Save a copy of a matrix.
+     * Same as `REGRR_SAVE()`, but in asynchronous mode the data is copied before returning,
+     * so the matrix can be modified immediately after.
+     *
+     * Example:
+     * ```
+     * cv::Mat m;
+     * REGRR_SAVE_COPY(m, "MySuperName-%d", 10);
+     * m.setTo(0);
+     * ```
+     */
+    #define REGRR_SAVE_COPY(mat, ...) do { regrr::save_copy(regrr::view(mat), __VA_ARGS__); } while(false)
+
+    /**
+     * Save only a region of interest of a matrix, a `cv::Rect`.
+     * The region is not copied, and is recorded in the lists file, see `regrr::save_region()`.
+     *
+     * Example:
+     * ```
+     * REGRR_SAVE_ROI(frame, cv::Rect(100, 50, 64, 64), "face-%d", id);
+     * ```
+     */
+    #define REGRR_SAVE_ROI(mat, roi, ...) do { regrr::save_region(regrr::view(mat), (roi), 1, 1, __VA_ARGS__); } while(false)
+
+    /**
+     * Save a downsampled view of a matrix, one row every `rowStride` rows and one column every `colStride` columns.
+     * The rows are not copied, only the columns kept are gathered if `colStride` is not 1, see `regrr::save_region()`.
+     *
+     * Example:
+     * ```
+     * REGRR_SAVE_STRIDED(frame4k, 4, 4, "preview");
+     * ```
+     */
+    #define REGRR_SAVE_STRIDED(mat, rowStride, colStride, ...) do { regrr::save_region(regrr::view(mat), cv::Rect(), (rowStride), (colStride), __VA_ARGS__); } while(false)
 
     /**
      * Create a managed matrix.
@@ -51,10 +104,23 @@
      * REGRR_CREATE_MAT(cv::Vec3f, 10, 10, "MyMatrix");
      * ```
      */
-    #define REGRR_CREATE_MAT(type, rows, cols, ...) regrr::ManagedMatrix REGRR_UNIQUE(cv::Mat_<type>(rows, cols), __VA_ARGS__)
+    #define REGRR_CREATE_MAT(type, rows, cols, ...) regrr::ManagedMat<type> REGRR_UNIQUE(rows, cols, __VA_ARGS__)
+
+    /**
+     * Create a managed matrix, with a handle to access it without looking up its name.
+     * Same as `REGRR_CREATE_MAT()`, but the first argument is the name of the handle variable, a `regrr::ManagedMat<type>`.
+     *
+     * Example:
+     * ```
+     * REGRR_CREATE_MAT_HANDLE(depth, float, 480, 640, "depth-%d", frame);
+     * REGRR_SET_PX_H(depth, 1, 2, 0.5f);
+     * ```
+     */
+    #define REGRR_CREATE_MAT_HANDLE(handle, type, rows, cols, ...) regrr::ManagedMat<type> handle(rows, cols, __VA_ARGS__)
 
     /**
      * Set a pixel of a managed matrix.
+     * The matrix is looked up by its name at every call, prefer `REGRR_SET_PX_H()` in loops.
      *
      * Example:
      * ```
@@ -62,29 +128,298 @@
      * ```
      */
     #define REGRR_SET_PX(row, col, value, ...) regrr::get_mat(__VA_ARGS__).template at<std::decay_t<decltype(value)>>(row, col) = (value)
+
+    /**
+     * Set a pixel of a managed matrix through its handle, see `REGRR_CREATE_MAT_HANDLE()`.
+     * The value is converted to the type of the matrix.
+     *
+     * Example:
+     * ```
+     * REGRR_SET_PX_H(depth, 1, 2, 0.5f);
+     * ```
+     */
+    #define REGRR_SET_PX_H(handle, row, col, value) (handle).mat()(row, col) = (value)
+
+    /**
+     * @{
+     * Same as the macros without `_CAT`, but only if the category is enabled.
+     * The first argument is the category, a bit mask of type `regrr::Category`.
+     *
+     * If the category is not in `REGRR_COMPILE_MASK`, the macro compiles to nothing, its arguments are not evaluated.
+     * Otherwise, it is still checked at runtime with `regrr::category_enabled()`.
+     *
+     * Example:
+     * ```
+     * constexpr regrr::Category CAT_TRACKING = 1u << 1;
+     * REGRR_SCOPED_CAT(CAT_TRACKING, "track-%d", id);
+     * REGRR_SAVE_CAT(CAT_TRACKING, m, "flow");
+     * ```
+     */
+    #define REGRR_SCOPED_CAT(category, ...) [[maybe_unused]] auto REGRR_UNIQUE = regrr::make_if_compiled<regrr::compiled(category)>([&] { return regrr::Scope(regrr::Category(category), __VA_ARGS__); })
+    #define REGRR_SAVE_CAT(category, mat, ...) do { if constexpr(regrr::compiled(category)) { if(regrr::category_enabled(category)) { REGRR_SAVE(mat, __VA_ARGS__); } } } while(false)
+    #define REGRR_CREATE_MAT_CAT(category, type, rows, cols, ...) [[maybe_unused]] auto REGRR_UNIQUE = regrr::make_if_compiled<regrr::compiled(category)>([&] { return regrr::ManagedMat<type>(regrr::Category(category), rows, cols, __VA_ARGS__); })
+    #define REGRR_SET_PX_CAT(category, row, col, value, ...) do { if constexpr(regrr::compiled(category)) { if(regrr::category_enabled(category)) { REGRR_SET_PX(row, col, value, __VA_ARGS__); } } } while(false)
+    /**
+     * @}
+     */
+
+    /**
+     * Name the calling thread in thread-aware mode.
+     * Should be called before entering any scope in this thread.
+     *
+     * Example:
+     * ```
+     * REGRR_THREAD_NAME("worker-%d", workerIndex);
+     * ```
+     */
+    #define REGRR_THREAD_NAME(...) regrr::set_thread_name(__VA_ARGS__)
 #else
 
     // Disable all macros
     #define REGRR_SCOPED(...) do {} while(0)
     #define REGRR_SAVE(...) do {} while(0)
+    #define REGRR_SAVE_COPY(...) do {} while(0)
+    #define REGRR_SAVE_ROI(...) do {} while(0)
+    #define REGRR_SAVE_STRIDED(...) do {} while(0)
     #define REGRR_CREATE_MAT(...) do {} while(0)
+    #define REGRR_CREATE_MAT_HANDLE(...) do {} while(0)
     #define REGRR_SET_PX(...) do {} while(0)
+    #define REGRR_SET_PX_H(...) do {} while(0)
+    #define REGRR_THREAD_NAME(...) do {} while(0)
+    #define REGRR_SCOPED_CAT(...) do {} while(0)
+    #define REGRR_SAVE_CAT(...) do {} while(0)
+    #define REGRR_CREATE_MAT_CAT(...) do {} while(0)
+    #define REGRR_SET_PX_CAT(...) do {} while(0)
 
 #endif
 
 
 namespace regrr
 {
+    /**
+     * A category of macros, as a bit mask.
+     * The categories are defined by the user, for example one bit per subsystem or per verbosity level.
+     */
+    using Category = std::uint32_t;
+
+    /**
+     * Check at compile time if a category is compiled, see `REGRR_COMPILE_MASK`.
+     */
+    constexpr bool compiled(Category category)
+    {
+        return (category & REGRR_COMPILE_MASK) != 0;
+    }
+
+    /**
+     * Replace the RAII objects of the categories not compiled, does nothing.
+     */
+    struct Disabled
+    {
+    };
+
+    /**
+     * Create the RAII object of a category if it is compiled, otherwise `Disabled`.
+     * The object is created by `make`, which is never called if the category is not compiled, so the arguments are not evaluated.
+     * Returned without copy nor move, as the RAII objects are not movable.
+     */
+    template<bool Compiled, typename Make>
+    auto make_if_compiled(Make&& make)
+    {
+        if constexpr(Compiled)
+        {
+            return make();
+        }
+        else
+        {
+            return Disabled();
+        }
+    }
+
+    /**
+     * Check at runtime if a category is enabled.
+     * The categories enabled at runtime are set by the environment variable `REGRR_CATEGORIES`,
+     * a bit mask in decimal or hexadecimal (`0x` prefix). All categories are enabled by default.
+     *
+     * @return true If the library is enabled and any bit of the category is enabled.
+     */
+    bool category_enabled(Category category);
+
     /**
      * Check if the library is enabled.
      *
+     * The library is initialized at the first call of any of its functions, from any thread, the others wait for the end of it.
+     * A process forked by a process using the library writes to its own sub-directory `fork-N` of the output directory,
+     * N being the count of processes forked by its parent until it, with its own lists file and archive. It is only initialized
+     * at its first call, so a forked process which calls `exec()` creates nothing. Only the thread calling `fork()` exists in the child:
+     * it keeps its name, its scopes are entered again in the lists file of the child, and its managed matrices are left to the parent.
+     * The capture of the CUDA matrices is not supported in a forked process.
+     *
+     * The library is configured with environment variables, read once at initialization.
+     * The numbers are integers in decimal, or in hexadecimal with the prefix `0x`.
+     * An invalid value disables the library, the error is logged.
+     *
+     * Output:
+     * - `REGRR_DIR`: the output directory, created if needed. The library is only enabled if set.
+     * - `REGRR_EXT`: the format of the matrix files, `.xml` by default, or `.yml`, `.xml.gz`... for `cv::FileStorage`,
+     *   or `.rgb` for the native binary format of `regrr_format.h`.
+     * - `REGRR_ARCHIVE=1`: append the matrices in the native binary format to a single file `archive.rgp`,
+     *   instead of one file per matrix.
+     * - `REGRR_COMPRESS`: compress the pixels of the native binary format, `lz4` or `zstd` if found at build time,
+     *   with the level `REGRR_COMPRESS_LEVEL`.
+     * - `REGRR_DELTA=N`: save a matrix in full once every N calls with the same name in the same scope,
+     *   and the other calls as a XOR against the previous call, which compresses well for similar frames.
+     *   The previous calls are kept in memory, up to `REGRR_DELTA_MEMORY` bytes per thread (256 MiB by default).
+     *   Both the compression and the deltas imply the native binary format.
+     * - `REGRR_HASH=0`: do not append the hash of the matrices to the lists file, the diff tools then compare them all.
+     * - `REGRR_LISTS_BINARY=1`: write the lists file in a compact binary format `lists.rgl` instead of `lists.txt`, where the names
+     *   are stored once and then referred to by ID, see `ListsHeader` in `regrr_format.h`. `regrr-diff` and the baseline read it
+     *   directly, `regrr-lists` converts it to `lists.txt` for `bin/diff.py`.
+     *
+     * Writing:
+     * - `REGRR_ASYNC=N`: write the matrices in N background threads, through a queue of `REGRR_ASYNC_QUEUE` matrices (64 by default).
+     *   The write errors are then only logged.
+     * - `REGRR_URING=N`: on Linux, write the files of the native binary format and the archive through io_uring,
+     *   up to N writes of 1 MiB in flight, so the caller does not wait for the disk. Falls back to `write()` if io_uring
+     *   is not available. With `REGRR_DIRECT=1`, bypass the page cache with `O_DIRECT` where the file system supports it,
+     *   so the captures do not evict the working set of the process. The errors of the writes in flight are only logged,
+     *   and the end of the archive is only written when it is closed. Its records staged in memory are submitted at every write
+     *   of the lists file, so they are recovered after a crash.
+     * - `REGRR_LISTS_FLUSH=N`: write the lists file every N lines, otherwise when its buffer is full, when leaving the outer scope
+     *   and at exit.
+     * - `REGRR_FSYNC_ON_SIGNAL=1`: synchronize the files to the disk on the fatal signals. The archive is then written
+     *   with `write()`, so none of its records is staged in memory.
+     * - `REGRR_POOL`: the capacity of the pool of matrices, see `allocator()`.
+     * - `REGRR_BATCH_RELEASES=1`: save the managed matrices released in a scope when exiting it, see `release_mat()`.
+     *
+     * Selection:
+     * - `REGRR_THREADS=1`: the thread-aware mode, see `set_thread_name()`.
+     * - `REGRR_CATEGORIES`: the categories enabled, see `category_enabled()`.
+     * - `REGRR_FILTER`: a list of globs separated by `;` matched against `scope1/scope2/.../name`, where `*` matches any characters
+     *   including `/`. A glob prefixed with `!` excludes the matching matrices, for example `main*;!*debug_*`.
+     *   The matrices excluded are not saved nor added to the lists file, and do not increment the call counter.
+     * - `REGRR_BUDGET`: limits of the captures, settings separated by `,`, for example `bytes=2G,rate=50,every=4`.
+     *   `bytes` is the maximum size of the pixels saved during the run (with a `K`, `M` or `G` suffix), `rate` the maximum count
+     *   of saves per second, and `every=N` saves only the calls 1, N+1, 2N+1... of each matrix. A matrix not saved still increments
+     *   the call counter, and its line in the lists file is annotated with the reason (`every`, `rate` or `bytes`), so the diff tools
+     *   do not report it missing. Once the bytes are exhausted, the following saves return immediately and are not added
+     *   to the lists file. Only the saves appended to the lists file and the managed matrices are budgeted.
+     *
+     * Baseline:
+     * - `REGRR_BASELINE`: the output directory of a previous run. The matrices are compared in-process to the same ones
+     *   of the baseline instead of saved, and the results are written to `baseline.txt` in the output directory, one line per matrix.
+     *   The lists file is still written, and the deltas are disabled.
+     * - `REGRR_BASELINE_TOLERANCE`: a file of tolerance rules, see `ToleranceRules` in `regrr_reader.h`.
+     * - `REGRR_BASELINE_SAVE=1`: save the divergent matrices.
+     * - `REGRR_BASELINE_FAIL=1`: throw at the first divergence.
+     *
+     * Messages:
+     * - `REGRR_LOG`: the level of the messages, `quiet`, `error`, `info` (the default, the banner at initialization
+     *   and the statistics at exit) or `debug` (also a message for each save). They are buffered.
+     * - `REGRR_LOG_FILE`: write the messages to this file instead of the console.
+     * - `REGRR_PROFILE=1`: collect the statistics of the overhead of the library, see `stats()`.
+     *
      * @return true If the library is enabled.
      */
     bool enabled();
 
     /**
-     * Save a matrix to a file.
-     * Save it immediately.
+     * Latencies of a step of the library, see `stats()`.
+     * The durations are in seconds, the percentiles are approximated within 12.5%.
+     */
+    struct StepStats
+    {
+        std::uint64_t count = 0;
+        double total = 0;
+        double p50 = 0;
+        double p99 = 0;
+        double max = 0;
+    };
+
+    /**
+     * What was saved in a scope, see `stats()`.
+     */
+    struct ScopeStats
+    {
+        std::uint64_t saves = 0;
+
+        /**
+         * Count of bytes written, after the compression if any.
+         */
+        std::uint64_t bytes = 0;
+    };
+
+    /**
+     * Statistics of the overhead of the library, see `stats()`.
+     */
+    struct Stats
+    {
+        /**
+         * If the statistics are collected. Otherwise, all of them are zero.
+         */
+        bool enabled = false;
+
+        /**
+         * Whole saves in the calling thread, including the steps done by the caller.
+         */
+        StepStats save;
+
+        /**
+         * Formatting of the names of the scopes and matrices.
+         */
+        StepStats format;
+
+        /**
+         * Creation of the directories of the scopes.
+         */
+        StepStats directories;
+
+        /**
+         * Hashes of the matrices for the lists file.
+         */
+        StepStats hash;
+
+        /**
+         * Deltas against the previous calls, see `REGRR_DELTA`.
+         */
+        StepStats delta;
+
+        /**
+         * Writing of the matrices, in the writer threads in asynchronous mode.
+         */
+        StepStats serialize;
+
+        /**
+         * Writing of the lists file.
+         */
+        StepStats lists;
+
+        std::uint64_t saves = 0;
+        std::uint64_t bytes = 0;
+
+        /**
+         * By sub-directory of the output directory, `thread/scope1/scope2` (empty for the root).
+         */
+        std::map<std::string, ScopeStats> scopes;
+    };
+
+    /**
+     * Get the statistics of the overhead of the library, for example to export them to a metrics system.
+     * Only collected if the environment variable `REGRR_PROFILE` is set to 1, they are also printed at exit in this case.
+     * Thread-safe, the saves in progress may be partially counted.
+     */
+    Stats stats();
+
+    /**
+     * Save a matrix to a file, under the directory of the current scope, named `name.call` with the call count of the name.
+     * Save it immediately, unless the asynchronous mode is enabled, see the configuration in `enabled()`.
+     *
+     * In asynchronous mode, the matrix is pushed to a bounded queue and written by background threads.
+     * Only a reference to the data is kept, so the matrix should not be modified until it is written.
+     * Use `save_copy()` if the matrix is modified right after.
+     *
+     * The matrix is appended to the lists file with its hash if `append`, unless excluded by the filter.
+     * A call skipped by the budget is still appended, annotated with the reason, and still increments the call counter.
+     * In baseline mode, the matrix is compared to the same one of the baseline instead of saved.
      *
      * @param append If the matrix should be added to the lists file.
      * For example, it should be disabled for managed matrices as this is added beforehand.
@@ -92,22 +427,141 @@ namespace regrr
      * @param[in] call The call count when the function was called. If nullptr, increment the internal call counter.
      * @param[in] scopes The scopes when the function was called. If nullptr, use the current scopes.
      *
-     * @throw std::runtime_error If the file could not be written.
+     * @throw std::runtime_error If the file could not be written, or the formatted name is longer than 999 characters,
+     * or the matrix diverges from the baseline with `REGRR_BASELINE_FAIL=1`. In asynchronous mode, write errors are only logged.
      */
     void save(const cv::Mat& mat, bool append, const int *call, const std::vector<std::string>* scopes, const char *fmt, ...);
 
+    /**
+     * Save a matrix of an OpenCL device to a file.
+     * Same as `save()`, but the matrix is downloaded first to a matrix of the pool (see `allocator()`).
+     * OpenCV has no asynchronous download of a `cv::UMat`, so this waits for the device, without copy if the matrix is on the host.
+     */
+    void save(const cv::UMat& mat, bool append, const int *call, const std::vector<std::string>* scopes, const char *fmt, ...);
+
+#if REGRR_HAVE_CUDA
+    /**
+     * Save a matrix of the CUDA device to a file, without waiting for the device.
+     * Same as `save()`, but the matrix is snapshotted on the device after the work queued on the null stream,
+     * so the caller can modify it right after, and downloaded on a dedicated stream to a page-locked buffer of a pool.
+     * The file is written in the background once the download is complete.
+     * The line of the lists file has no hash, as the pixels are not on the host yet.
+     * In baseline mode and with the deltas, the matrix is downloaded synchronously and saved as a matrix of the host.
+     *
+     * Only available if OpenCV is built with CUDA, see the CMake option `REGRR_WITH_CUDA`.
+     */
+    void save(const cv::cuda::GpuMat& mat, bool append, const int *call, const std::vector<std::string>* scopes, const char *fmt, ...);
+#endif
+
+    /**
+     * Save a matrix to a file, and append it to the lists file.
+     * Same as `save()`, but in asynchronous mode the data of the matrix is copied before returning.
+     *
+     * @throw std::runtime_error If the file could not be written.
+     */
+    void save_copy(const cv::Mat& mat, const char *fmt, ...);
+
+    /**
+     * @{
+     * Same as `save_copy()` for the matrices of a device, which are always downloaded or snapshotted before returning.
+     */
+    void save_copy(const cv::UMat& mat, const char *fmt, ...);
+#if REGRR_HAVE_CUDA
+    void save_copy(const cv::cuda::GpuMat& mat, const char *fmt, ...);
+#endif
+    /**
+     * @}
+     */
+
+    /**
+     * Save a region of a matrix to a file, and append it to the lists file.
+     * Same as `save()`, but only the region of interest is saved, strided by `rowStride` rows and `colStride` columns.
+     * The region is a view of the matrix, the pixels are only gathered in a new matrix if the columns are strided.
+     * The region is recorded in the lists file as an annotation of the matrix like `~roi=x,y,width,height stride=2,2`,
+     * so the diff tools do not compare two different regions.
+     *
+     * @param roi The region of interest, the whole matrix if the default `cv::Rect()`.
+     * @throw std::runtime_error If the region is not inside the matrix, a stride is not positive,
+     * the matrix has more than 2 dimensions, or same as `save()`.
+     */
+    void save_region(const cv::Mat& mat, const cv::Rect& roi, int rowStride, int colStride, const char *fmt, ...);
+
+    /**
+     * @{
+     * Get a matrix header for the argument of the saving macros, without copying the data when possible.
+     * A `cv::Mat` or `cv::Mat_` shares its data. A `cv::Matx` or `cv::Vec` is wrapped without copy (`cv::Mat(matx)` copies it),
+     * the header has no reference counter so the asynchronous mode copies it before returning.
+     * A `cv::UMat` or a `cv::cuda::GpuMat` is kept on its device, and downloaded by `save()`.
+     * Anything else is converted with `cv::Mat()`.
+     */
+    inline const cv::Mat& view(const cv::Mat& mat)
+    {
+        return mat;
+    }
+
+    inline const cv::UMat& view(const cv::UMat& mat)
+    {
+        return mat;
+    }
+
+#if REGRR_HAVE_CUDA
+    inline const cv::cuda::GpuMat& view(const cv::cuda::GpuMat& mat)
+    {
+        return mat;
+    }
+#endif
+
+    template<typename T, int m, int n>
+    cv::Mat view(const cv::Matx<T, m, n>& matx)
+    {
+        return cv::Mat(m, n, cv::traits::Type<T>::value, const_cast<T*>(matx.val));
+    }
+
+    template<typename T, int cn>
+    cv::Mat view(const cv::Vec<T, cn>& vec)
+    {
+        return cv::Mat(cn, 1, cv::traits::Type<T>::value, const_cast<T*>(vec.val));
+    }
+
+    template<typename T>
+    cv::Mat view(const T& mat)
+    {
+        return cv::Mat(mat);
+    }
+    /**
+     * @}
+     */
+
     /**
      * Enter a scope.
+     *
+     * @throws std::runtime_error If the formatted name is longer than 999 characters.
      */
     void enter_scope(const char *fmt, ...);
 
     /**
      * Exit a scope.
+     * Save the managed matrices released in the scope, if batched, see `release_mat()`.
      *
-     * @throws std::runtime_error If not inside a scope.
+     * @throws std::runtime_error If not inside a scope, or same as `save()` for the managed matrices released.
      */
     void exit_scope();
 
+    /**
+     * Get the allocator of the pool of matrices of the library.
+     * The buffers of the matrices released are kept for the next matrices of the same size class,
+     * up to `REGRR_POOL` bytes (512 MiB by default, 0 disables the pool).
+     *
+     * @return The allocator, or nullptr (the default allocator of OpenCV) if the pool or the library is not enabled.
+     */
+    cv::MatAllocator* allocator();
+
+    /**
+     * Create a matrix with the allocator of the pool, see `allocator()`.
+     * Used by `REGRR_CREATE_MAT`, so the managed matrices created every frame reuse the same buffers.
+     */
+    [[nodiscard]] cv::Mat create_mat(int rows, int cols, int type);
+
     /**
      * Store in-memory a managed matrix.
      * Saving is deferred: it is written to a file when the corresponding `release_mat()` is called with the same name.
@@ -121,20 +575,61 @@ namespace regrr
      */
     void store_mat(cv::Mat mat, const char *fmt, ...);
 
+    /**
+     * @{
+     * Store in-memory a managed matrix of a device.
+     * Same as `store_mat()`, but the matrix stays on its device until released, then it is saved as with `save()`.
+     * It cannot be accessed with `get_mat()`.
+     */
+    void store_mat(cv::UMat mat, const char *fmt, ...);
+#if REGRR_HAVE_CUDA
+    void store_mat(cv::cuda::GpuMat mat, const char *fmt, ...);
+#endif
+    /**
+     * @}
+     */
+
     /**
      * Get a managed matrix.
      *
-     * @throw std::runtime_error If no managed matrix with this name exist.
+     * @throw std::runtime_error If no managed matrix with this name exist, or it is on a device.
      */
     [[nodiscard]] cv::Mat& get_mat(const char *fmt, ...);
 
     /**
      * Release a managed matrix.
      *
-     * @throw std::runtime_error If no managed matrix with this name exist.
+     * With the environment variable `REGRR_BATCH_RELEASES=1`, the matrices released inside a scope are saved together
+     * when the scope is exited, instead of here. In archive mode they are appended with a single write,
+     * in asynchronous mode they are handed to the writers. A matrix wrapping the memory of the user is copied first.
+     * The errors of their saves are then thrown by `exit_scope()`.
+     * The ones of the scopes never exited are saved when their thread exits, at the exit of the process for the main thread,
+     * and their errors are only logged.
+     *
+     * @throw std::runtime_error If no managed matrix with this name exist, or same as `save()`.
      */
     void release_mat(const char *fmt, ...);
 
+    /**
+     * Name the calling thread.
+     *
+     * Only used in thread-aware mode, enabled with the environment variable `REGRR_THREADS=1`.
+     * In this mode, each thread has its own scopes, call counters and managed matrices.
+     * The main thread of the process is saved as usual.
+     * The other threads are saved in a sub-directory with their name,
+     * and their lines in the lists file are prefixed with `@name\t`.
+     * In a forked process, the thread which forked is saved as it was in its parent: as usual if it was the main thread,
+     * otherwise in the sub-directory of its name, and not at all if it was not named.
+     *
+     * The other threads have no default name, as it would depend on the order in which the threads are scheduled:
+     * a thread is not captured until named, its saves and scopes are ignored and an error is logged on its first call.
+     * For the comparison of two runs to be deterministic, the name of each thread should be deterministic,
+     * and each name should be given to a single thread.
+     *
+     * @throw std::runtime_error If the calling thread is inside a scope, in thread-aware mode.
+     */
+    void set_thread_name(const char *fmt, ...);
+
     /**
      * RAII for scope.
      */
@@ -148,12 +643,22 @@ namespace regrr
         explicit Scope(const char *fmt, ...);
 
         /**
-         * Will call `exit_scope()`.
+         * Will call `enter_scope()` only if the category is enabled at runtime.
+         * @param category The category of the scope, see `category_enabled()`.
+         * @param fmt The same argument as `enter_scope()`.
+         */
+        explicit Scope(Category category, const char *fmt, ...);
+
+        /**
+         * Will call `exit_scope()` if the scope was entered.
          */
         ~Scope();
 
         Scope(const Scope&) = delete;
         Scope& operator=(const Scope&) = delete;
+
+    private:
+        bool m_active = true;
     };
 
     /**
@@ -170,14 +675,69 @@ namespace regrr
         explicit ManagedMatrix(cv::Mat mat, const char *fmt, ...);
 
         /**
-         * Will call `release_mat()`.
+         * Will call `store_mat()` only if the category is enabled at runtime.
+         * @param category The category of the matrix, see `category_enabled()`.
+         * @param mat The same argument as `store_mat()`.
+         * @param fmt The same argument as `store_mat()`.
+         */
+        explicit ManagedMatrix(Category category, cv::Mat mat, const char *fmt, ...);
+
+        /**
+         * Will call `release_mat()` if the matrix was stored.
          */
         ~ManagedMatrix();
 
         ManagedMatrix(const ManagedMatrix&) = delete;
         ManagedMatrix& operator=(const ManagedMatrix&) = delete;
 
+        /**
+         * Get the managed matrix, without looking up its name.
+         * This is a header sharing the data of the stored matrix, its pixels can be modified but it should not be reassigned.
+         * If the matrix was not stored (library or category disabled), the pixels are modified but never saved.
+         */
+        cv::Mat& mat() { return m_mat; }
+
     private:
         std::string m_name;
+        cv::Mat m_mat;
+        bool m_active = true;
+    };
+
+    /**
+     * RAII for managed matrices, with typed access to the matrix.
+     * Created by `REGRR_CREATE_MAT()` and `REGRR_CREATE_MAT_HANDLE()`.
+     */
+    template<typename T>
+    class ManagedMat : public ManagedMatrix
+    {
+    public:
+        /**
+         * Create a matrix with `create_mat()` and store it, see `ManagedMatrix`.
+         * @param fmt The same argument as `store_mat()`, followed by its arguments.
+         */
+        template<typename... Args>
+        explicit ManagedMat(int rows, int cols, const char *fmt, Args&&... args)
+            : ManagedMatrix(create_mat(rows, cols, cv::traits::Type<T>::value), fmt, std::forward<Args>(args)...),
+              m_typed(ManagedMatrix::mat())
+        {
+        }
+
+        /**
+         * Same as above, only if the category is enabled at runtime, see `ManagedMatrix`.
+         */
+        template<typename... Args>
+        explicit ManagedMat(Category category, int rows, int cols, const char *fmt, Args&&... args)
+            : ManagedMatrix(category, create_mat(rows, cols, cv::traits::Type<T>::value), fmt, std::forward<Args>(args)...),
+              m_typed(ManagedMatrix::mat())
+        {
+        }
+
+        /**
+         * Get the managed matrix, see `ManagedMatrix::mat()`.
+         */
+        cv::Mat_<T>& mat() { return m_typed; }
+
+    private:
+        cv::Mat_<T> m_typed;
     };
 }
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace regrr
+{
+    /**
+     * Get a codec of the encoded format from its name: `none`, `lz4` or `zstd`.
+     * See `EncodedHeader` for the format.
+     *
+     * @throw std::runtime_error If the name is unknown, or the library was compiled without this codec.
+     */
+    std::uint32_t codec_from_name(std::string_view name);
+
+    /**
+     * Get the name of a codec, for the messages.
+     */
+    const char* codec_name(std::uint32_t codec);
+
+    /**
+     * Compress bytes with a codec.
+     *
+     * @param level Level of compression: 0 is the default of the codec.
+     * For LZ4, a level above 1 uses the slower LZ4 HC. For Zstd, the level is given as is.
+     * @param output Replaced by the compressed bytes, its capacity is reused from a call to the next.
+     * @throw std::runtime_error If the codec is not available or failed.
+     */
+    void compress(std::uint32_t codec, int level, const void *data, size_t size, std::vector<unsigned char>& output);
+
+    /**
+     * Decompress bytes compressed by `compress()`.
+     *
+     * @param outputSize Exact count of bytes once decompressed.
+     * @throw std::runtime_error If the codec is not available, or the data is corrupted or not of the expected size.
+     */
+    void decompress(std::uint32_t codec, const void *data, size_t size, void *output, size_t outputSize);
+
+    /**
+     * XOR two buffers byte by byte, to encode or decode a delta.
+     * The output can be the same buffer as an input.
+     */
+    void xor_bytes(const void *a, const void *b, void *output, size_t size);
+}
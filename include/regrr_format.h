@@ -0,0 +1,312 @@
+#pragma once
+
+
+#include <cstdint>
+
+/**
+ * Extension of the native binary format.
+ * Set `REGRR_EXT` to this value to use it instead of `cv::FileStorage`.
+ */
+#define REGRR_BINARY_EXT ".rgb"
+
+/**
+ * Name of the archive file in the output directory, when `REGRR_ARCHIVE` is set.
+ */
+#define REGRR_ARCHIVE_FILE "archive.rgp"
+
+/**
+ * Name of the lists file in the output directory, in the text format.
+ */
+#define REGRR_LISTS_FILE "lists.txt"
+
+/**
+ * Name of the lists file in the output directory, in the binary format written when `REGRR_LISTS_BINARY` is set.
+ * `regrr-lists` converts it to the text format.
+ */
+#define REGRR_LISTS_BINARY_FILE "lists.rgl"
+
+namespace regrr
+{
+    /**
+     * Header of the native binary format.
+     *
+     * A binary file is this fixed-size header followed by the raw pixels, row by row, without padding.
+     * All fields are in the native byte order of the machine that wrote the file (little-endian on all supported platforms).
+     * The layout is also described in `bin/diff.py`, keep both in sync.
+     */
+    struct BinaryHeader
+    {
+        /**
+         * Always `REGRR_BINARY_MAGIC`.
+         */
+        char magic[4];
+
+        /**
+         * Version of the format, `REGRR_BINARY_VERSION` when written.
+         */
+        std::uint32_t version;
+
+        /**
+         * OpenCV type of the matrix, for example `CV_32FC3`.
+         */
+        std::int32_t type;
+
+        std::int32_t rows;
+        std::int32_t cols;
+        std::int32_t channels;
+
+        /**
+         * Count of bytes of each row in the file.
+         * Always `cols * elemSize()`, as the rows are written without padding.
+         */
+        std::uint64_t step;
+    };
+
+    static_assert(sizeof(BinaryHeader) == 32, "The binary header should not have padding");
+
+    /**
+     * Magic bytes at the start of each binary file.
+     */
+    inline constexpr char REGRR_BINARY_MAGIC[4] = {'R', 'G', 'R', 'R'};
+
+    /**
+     * Current version of the binary format.
+     */
+    inline constexpr std::uint32_t REGRR_BINARY_VERSION = 1;
+
+    /**
+     * Header of an encoded matrix, a variant of the native binary format written when `REGRR_COMPRESS` or `REGRR_DELTA` is set.
+     *
+     * An encoded file (or payload of an archive record) is this header, then the `BinaryHeader` of the matrix as is,
+     * then the pixels encoded: compressed by the codec, after the XOR with the pixels of the reference if any.
+     * The reference is another call of the same matrix in the same directory, for example `name.3.rgb` for `name.5.rgb`,
+     * which may be itself encoded against a previous call.
+     * Both files have the same extension `REGRR_BINARY_EXT`, and are told apart by the magic bytes.
+     */
+    struct EncodedHeader
+    {
+        /**
+         * Always `REGRR_ENCODED_MAGIC`.
+         */
+        char magic[4];
+
+        /**
+         * Version of the format, `REGRR_ENCODED_VERSION` when written.
+         */
+        std::uint32_t version;
+
+        /**
+         * Codec of the pixels, one of the `REGRR_CODEC_*` values.
+         */
+        std::uint32_t codec;
+
+        /**
+         * Call count of the reference of the delta, or 0 if the pixels are not a delta.
+         */
+        std::int32_t reference;
+
+        /**
+         * Count of bytes of the encoded pixels, after the binary header.
+         */
+        std::uint64_t size;
+    };
+
+    static_assert(sizeof(EncodedHeader) == 24, "The encoded header should not have padding");
+
+    inline constexpr char REGRR_ENCODED_MAGIC[4] = {'R', 'G', 'R', 'Z'};
+
+    /**
+     * Current version of the encoded format.
+     */
+    inline constexpr std::uint32_t REGRR_ENCODED_VERSION = 1;
+
+    /**
+     * @{
+     * Codecs of the encoded format.
+     * The pixels are stored as is, or compressed in a single LZ4 block or Zstd frame.
+     */
+    inline constexpr std::uint32_t REGRR_CODEC_NONE = 0;
+    inline constexpr std::uint32_t REGRR_CODEC_LZ4 = 1;
+    inline constexpr std::uint32_t REGRR_CODEC_ZSTD = 2;
+    /**
+     * @}
+     */
+
+    /**
+     * Header at the start of an archive file.
+     *
+     * An archive is this header followed by records, then by the index and the footer.
+     * Each record is an `ArchiveRecord`, the path of the matrix relative to the output directory
+     * (for example `scope1/scope2/name.call.rgb`), then the payload: the content of the binary file of the matrix.
+     * The path and the payload are both padded with zeros to a multiple of `REGRR_ARCHIVE_ALIGNMENT` bytes,
+     * so the pixels of each record are aligned and can be memory-mapped.
+     *
+     * The index is written at exit: an `ArchiveIndexEntry` then the padded path, for each record in the order they were written.
+     * If the process crashed before, there is no footer and the records have to be read sequentially.
+     */
+    struct ArchiveHeader
+    {
+        /**
+         * Always `REGRR_ARCHIVE_MAGIC`.
+         */
+        char magic[4];
+
+        /**
+         * Version of the format, `REGRR_ARCHIVE_VERSION` when written.
+         */
+        std::uint32_t version;
+    };
+
+    static_assert(sizeof(ArchiveHeader) == 8, "The archive header should not have padding");
+
+    /**
+     * Header of each record of an archive.
+     */
+    struct ArchiveRecord
+    {
+        /**
+         * Always `REGRR_ARCHIVE_RECORD_MAGIC`.
+         */
+        char magic[4];
+
+        /**
+         * Count of bytes of the path, without the padding.
+         */
+        std::uint32_t pathSize;
+
+        /**
+         * Count of bytes of the payload, without the padding.
+         */
+        std::uint64_t payloadSize;
+    };
+
+    static_assert(sizeof(ArchiveRecord) == 16, "The archive record should not have padding");
+
+    /**
+     * Entry of the index of an archive, for each record.
+     */
+    struct ArchiveIndexEntry
+    {
+        /**
+         * Offset of the `ArchiveRecord` from the start of the file.
+         */
+        std::uint64_t offset;
+
+        /**
+         * Count of bytes of the path, same as in the record.
+         */
+        std::uint32_t pathSize;
+
+        std::uint32_t reserved;
+    };
+
+    static_assert(sizeof(ArchiveIndexEntry) == 16, "The archive index entry should not have padding");
+
+    /**
+     * Footer at the end of a complete archive file.
+     */
+    struct ArchiveFooter
+    {
+        /**
+         * Offset of the first `ArchiveIndexEntry` from the start of the file.
+         */
+        std::uint64_t indexOffset;
+
+        /**
+         * Count of entries in the index.
+         */
+        std::uint64_t count;
+
+        /**
+         * Always `REGRR_ARCHIVE_INDEX_MAGIC`.
+         */
+        char magic[4];
+
+        /**
+         * Version of the format, same as in the header.
+         */
+        std::uint32_t version;
+    };
+
+    static_assert(sizeof(ArchiveFooter) == 24, "The archive footer should not have padding");
+
+    inline constexpr char REGRR_ARCHIVE_MAGIC[4] = {'R', 'G', 'R', 'P'};
+    inline constexpr char REGRR_ARCHIVE_RECORD_MAGIC[4] = {'R', 'G', 'R', 'E'};
+    inline constexpr char REGRR_ARCHIVE_INDEX_MAGIC[4] = {'R', 'G', 'R', 'I'};
+
+    /**
+     * Current version of the archive format.
+     */
+    inline constexpr std::uint32_t REGRR_ARCHIVE_VERSION = 1;
+
+    /**
+     * Alignment of the paths and payloads in an archive.
+     */
+    inline constexpr std::uint64_t REGRR_ARCHIVE_ALIGNMENT = 8;
+
+    /**
+     * Header of the binary lists file, the compact variant of `lists.txt` written when `REGRR_LISTS_BINARY` is set.
+     *
+     * The header is followed by records until the end of the file, so a file truncated by a crash can still be read up to its last
+     * complete record. Each record starts with its type, one of the `REGRR_LISTS_*` values, as a varint:
+     * an unsigned LEB128 integer, 7 bits per byte starting with the lowest, the high bit set on all the bytes but the last.
+     * The names (scopes, matrices, threads, regions and reasons of the budget) are interned: a `REGRR_LISTS_NAME` record
+     * defines an ID before the first record referring to it, and the records only store the IDs as varints.
+     *
+     * - `REGRR_LISTS_NAME`: the ID, the count of bytes of the name, then the name.
+     * - `REGRR_LISTS_EXTENSION`: the count of bytes of the extension of the matrix files, then the extension, the first record.
+     * - `REGRR_LISTS_THREAD`: the ID of the name of the thread of the following records, until the next one.
+     *   The records before the first one are of the main thread, whose name is empty.
+     * - `REGRR_LISTS_ENTER`: the ID of the name of the scope entered, `+ name` in the text format.
+     * - `REGRR_LISTS_EXIT`: nothing else, `-` in the text format.
+     * - `REGRR_LISTS_SAVE`: the ID of the name of the matrix, the call count zigzag-encoded (`(call << 1) ^ (call >> 31)`),
+     *   the `REGRR_LISTS_HAS_*` flags, then in this order if flagged: the ID of the region, the ID of the reason of the budget,
+     *   and the hash as 8 little-endian bytes. Same as `name.call\t~region\t!reason\t#hash` in the text format.
+     */
+    struct ListsHeader
+    {
+        /**
+         * Always `REGRR_LISTS_MAGIC`.
+         */
+        char magic[4];
+
+        /**
+         * Version of the format, `REGRR_LISTS_VERSION` when written.
+         */
+        std::uint32_t version;
+    };
+
+    static_assert(sizeof(ListsHeader) == 8, "The lists header should not have padding");
+
+    inline constexpr char REGRR_LISTS_MAGIC[4] = {'R', 'G', 'R', 'L'};
+
+    /**
+     * Current version of the binary lists format.
+     */
+    inline constexpr std::uint32_t REGRR_LISTS_VERSION = 1;
+
+    /**
+     * @{
+     * Types of the records of the binary lists file.
+     */
+    inline constexpr std::uint32_t REGRR_LISTS_NAME = 0;
+    inline constexpr std::uint32_t REGRR_LISTS_EXTENSION = 1;
+    inline constexpr std::uint32_t REGRR_LISTS_THREAD = 2;
+    inline constexpr std::uint32_t REGRR_LISTS_ENTER = 3;
+    inline constexpr std::uint32_t REGRR_LISTS_EXIT = 4;
+    inline constexpr std::uint32_t REGRR_LISTS_SAVE = 5;
+    /**
+     * @}
+     */
+
+    /**
+     * @{
+     * Flags of a `REGRR_LISTS_SAVE` record, the annotations of the matrix.
+     */
+    inline constexpr std::uint32_t REGRR_LISTS_HAS_REGION = 1;
+    inline constexpr std::uint32_t REGRR_LISTS_HAS_SKIPPED = 2;
+    inline constexpr std::uint32_t REGRR_LISTS_HAS_HASH = 4;
+    /**
+     * @}
+     */
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+
+#include <opencv2/core.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace regrr
+{
+    /**
+     * Incremental 64 bits hash of bytes, with the XXH64 algorithm.
+     * Feeding the same bytes in several parts gives the same hash as in a single part.
+     */
+    class Hasher
+    {
+    public:
+        explicit Hasher(std::uint64_t seed = 0);
+
+        /**
+         * Add bytes to the hash.
+         */
+        void update(const void *data, size_t size);
+
+        /**
+         * Get the hash of all the bytes added, the hasher can still be updated after.
+         */
+        std::uint64_t digest() const;
+
+    private:
+        std::uint64_t m_seed;
+        std::uint64_t m_accumulators[4];
+        unsigned char m_buffer[32];
+        size_t m_bufferSize = 0;
+        std::uint64_t m_totalSize = 0;
+    };
+
+    /**
+     * Hash the content of a matrix, recorded in the lists file to detect identical matrices without reading them.
+     * This is the hash of the matrix in the native binary format (`BinaryHeader` then the rows without padding),
+     * so two matrices have the same hash only if they also have the same type and size.
+     *
+     * @throw std::runtime_error If the matrix has more than 2 dimensions.
+     */
+    std::uint64_t hash_mat(const cv::Mat& mat);
+}
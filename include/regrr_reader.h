@@ -0,0 +1,410 @@
+#pragma once
+
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace regrr
+{
+    /**
+     * A file mapped read-only in memory.
+     */
+    class MappedFile
+    {
+    public:
+        /**
+         * Map the whole file.
+         *
+         * @throw std::runtime_error If the file could not be opened or mapped.
+         */
+        explicit MappedFile(const std::string& path);
+
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const unsigned char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+        const std::string& path() const { return m_path; }
+
+    private:
+        std::string m_path;
+        unsigned char *m_data = nullptr;
+        size_t m_size = 0;
+    };
+
+    /**
+     * A matrix loaded from an output directory.
+     * The matrix can point directly to a mapped file, which is kept alive with it.
+     */
+    struct LoadedMat
+    {
+        cv::Mat mat;
+        std::shared_ptr<const MappedFile> file;
+    };
+
+    /**
+     * Get a matrix in the native binary format from memory, without copy.
+     *
+     * @param path The path of the matrix, only used in the error messages.
+     * @throw std::runtime_error If the data is not a valid binary matrix, or is encoded (see `decode_binary_mat()`).
+     */
+    cv::Mat parse_binary_mat(const unsigned char *data, size_t size, const std::string& path);
+
+    /**
+     * Check if a matrix in memory is in the encoded variant of the native binary format, see `EncodedHeader`.
+     */
+    bool is_encoded_mat(const unsigned char *data, size_t size);
+
+    /**
+     * Decode a matrix in the encoded variant of the native binary format, see `EncodedHeader`.
+     *
+     * @param path The path of the matrix, only used in the error messages.
+     * @param reference Load the matrix of another call of the same name in the same directory, from its call count.
+     * Only called if the matrix is a delta.
+     * @return A new matrix, which does not point to the data.
+     * @throw std::runtime_error If the data is not a valid encoded matrix, or the reference is not of the same shape.
+     */
+    cv::Mat decode_binary_mat(const unsigned char *data, size_t size, const std::string& path, const std::function<LoadedMat(int)>& reference);
+
+    /**
+     * Get the path of another call of a matrix, for example `dir/name.3.rgb` for `dir/name.5.rgb` and the call 3.
+     *
+     * @throw std::runtime_error If the path does not end with a call count and an extension.
+     */
+    std::string call_path(std::string_view path, int call);
+
+    /**
+     * Load a matrix from a file, in the format given by the extension.
+     * A file in the native binary format is mapped in memory instead of read, unless it is encoded.
+     * The references of an encoded delta are loaded from the same directory.
+     *
+     * @throw std::runtime_error If the file could not be read.
+     */
+    LoadedMat load_mat(const std::string& path);
+
+    /**
+     * Write a matrix to a file, in the format given by the extension.
+     *
+     * @throw std::runtime_error If the file could not be written.
+     */
+    void write_mat(const std::string& path, const cv::Mat& mat);
+
+    /**
+     * Read an archive file, see `ArchiveHeader` for the layout.
+     * The matrices are found through the index at the end of the file.
+     * If the index is missing (the process crashed), all the records are read sequentially instead.
+     */
+    class ArchiveReader
+    {
+    public:
+        /**
+         * Map the archive and read its index.
+         *
+         * @throw std::runtime_error If the file could not be mapped or is not an archive.
+         */
+        explicit ArchiveReader(const std::string& path);
+
+        /**
+         * Check if the archive contains a matrix, from its path relative to the output directory.
+         */
+        bool contains(std::string_view path) const;
+
+        /**
+         * Get a matrix from its path relative to the output directory, without copy unless it is encoded.
+         *
+         * @throw std::runtime_error If the archive does not contain the matrix.
+         */
+        LoadedMat load(std::string_view path) const;
+
+        /**
+         * Paths of the matrices, in the order they were written.
+         */
+        const std::vector<std::string>& paths() const { return m_paths; }
+
+    private:
+        struct Record
+        {
+            std::uint64_t offset;
+            std::uint64_t size;
+        };
+
+        bool readIndex();
+        void scanRecords();
+        std::uint64_t addRecord(std::uint64_t offset);
+
+        std::shared_ptr<const MappedFile> m_file;
+        std::map<std::string, Record, std::less<>> m_records;
+        std::vector<std::string> m_paths;
+    };
+
+    /**
+     * Access the matrices of an output directory, either saved as files or appended to an archive.
+     */
+    class OutputReader
+    {
+    public:
+        /**
+         * Open an output directory, and its archive if any.
+         *
+         * @throw std::runtime_error If the directory has an invalid archive.
+         */
+        explicit OutputReader(const std::string& directory);
+
+        const std::string& directory() const { return m_directory; }
+
+        /**
+         * Full path of a matrix, for the messages.
+         */
+        std::string path(std::string_view path) const;
+
+        /**
+         * Check if a matrix exists, from its path relative to the output directory.
+         */
+        bool exists(std::string_view path) const;
+
+        /**
+         * Load a matrix from its path relative to the output directory.
+         *
+         * @throw std::runtime_error If the matrix could not be loaded.
+         */
+        LoadedMat load(std::string_view path) const;
+
+    private:
+        std::string m_directory;
+        std::unique_ptr<ArchiveReader> m_archive;
+    };
+
+    /**
+     * An event of the lists file.
+     */
+    struct ListsEvent
+    {
+        enum Type
+        {
+            EnterScope,
+            ExitScope,
+            SaveMat
+        };
+
+        Type type;
+
+        /**
+         * Name of the scope entered, or `name.call` of the matrix saved (without extension).
+         * Empty when exiting a scope.
+         */
+        std::string name;
+
+        /**
+         * Hash of the matrix saved (`hash_mat()` in hexadecimal), empty if not recorded.
+         */
+        std::string hash;
+
+        /**
+         * Reason why the matrix was not saved by the budget (`every`, `rate` or `bytes`), empty if it was saved.
+         * After a matrix skipped for `bytes`, the following matrices of the run are not in the lists file.
+         */
+        std::string skipped;
+
+        /**
+         * Region of the matrix saved, like `roi=x,y,width,height stride=2,2` (see `regrr::save_region()`), empty for the whole matrix.
+         */
+        std::string region;
+    };
+
+    /**
+     * Content of a lists file.
+     */
+    struct Lists
+    {
+        /**
+         * Extension of the matrix files, the first line of the file.
+         */
+        std::string extension;
+
+        /**
+         * Every event of the flow of each thread.
+         * The main thread has an empty name, the other threads are saved in a sub-directory with their name.
+         */
+        std::map<std::string, std::vector<ListsEvent>, std::less<>> flows;
+
+        /**
+         * Get the names of the threads in a deterministic order, whatever the scheduling was.
+         * The main thread (empty name) is always first, then the other threads sorted by name.
+         */
+        std::vector<std::string> threads() const;
+    };
+
+    /**
+     * Get the path of the lists file of an output directory, `lists.txt` or the binary `lists.rgl` if only this one exists.
+     */
+    std::string lists_path(const std::string& directory);
+
+    /**
+     * Read a lists file event by event, without keeping the flow in memory.
+     * The file is either in the text format or in the binary format (see `ListsHeader`), told apart by its first bytes.
+     *
+     * @param callback Called for each event in the order of the file, with the name of its thread (empty for the main thread).
+     * @return The extension of the matrix files, the first line of the file.
+     * @throw std::runtime_error If the file could not be read, or is an invalid binary file.
+     */
+    std::string stream_lists(const std::string& path, const std::function<void(std::string_view thread, ListsEvent&& event)>& callback);
+
+    /**
+     * Read a lists file.
+     *
+     * @throw std::runtime_error If the file could not be read.
+     */
+    Lists read_lists(const std::string& path);
+
+    /**
+     * Align two sequences on a longest common subsequence, with the linear-space variant of the Myers diff algorithm.
+     * Takes O((N + M) D) time and O(N + M) memory, where D is the count of differences,
+     * so long flows with few differences are aligned in about linear time. Same as `match_sequences()` of `bin/diff.py`.
+     *
+     * @param matches Output, for each element of `a`, the index of the element of `b` it is matched with, or SIZE_MAX.
+     */
+    void align_sequences(const std::vector<std::uint32_t>& a, const std::vector<std::uint32_t>& b, std::vector<size_t>& matches);
+
+    /**
+     * Statistics of the absolute difference of two matrices, element by element.
+     * Same values as `bin/diff.py`.
+     */
+    struct DiffStats
+    {
+        /**
+         * Count of elements compared, the channels are counted separately.
+         */
+        size_t count = 0;
+
+        /**
+         * Sum of the absolute differences, the L1 distance.
+         */
+        double l1 = 0;
+
+        double min = 0;
+        double max = 0;
+        double avg = 0;
+        double median = 0;
+
+        /**
+         * Population standard deviation of the absolute differences.
+         */
+        double std = 0;
+    };
+
+    /**
+     * Compare two matrices element by element, the shapes are ignored as long as they have the same count of elements.
+     * All the statistics are computed together in a single vectorized pass when possible, without temporary matrix.
+     * The median is exact, selected with a histogram instead of sorting.
+     *
+     * @throw std::runtime_error If the matrices have different depths or count of elements, or are empty.
+     */
+    DiffStats diff_stats(const cv::Mat& a, const cv::Mat& b);
+
+    /**
+     * Get the absolute differences of two matrices, element by element.
+     *
+     * @return A single row of the same depth as the matrices, saturated for the integer types.
+     * @throw std::runtime_error If the matrices have different depths or count of elements, or are empty.
+     */
+    cv::Mat abs_diff(const cv::Mat& a, const cv::Mat& b);
+
+    /**
+     * Tolerance of the comparison of two matrices, element by element.
+     * An element is within the tolerance if it satisfies any of the criteria set, the negative criteria are not set.
+     */
+    struct Tolerance
+    {
+        /**
+         * Maximum absolute difference.
+         */
+        double absolute = -1;
+
+        /**
+         * Maximum difference relative to the largest absolute value of both elements.
+         */
+        double relative = -1;
+
+        /**
+         * Maximum count of representable values between both elements, for the floating types.
+         * For the integer types, same as the absolute difference.
+         */
+        long long ulp = -1;
+    };
+
+    /**
+     * Result of the comparison of two matrices with a tolerance.
+     */
+    struct ToleranceResult
+    {
+        /**
+         * If all the elements are within the tolerance.
+         */
+        bool within = true;
+
+        /**
+         * Index of the first element out of the tolerance, and the values of both elements, if not within.
+         */
+        size_t index = 0;
+        double a = 0;
+        double b = 0;
+    };
+
+    /**
+     * Compare two matrices with a tolerance, element by element.
+     * Stops at the first element out of the tolerance, so a mapped matrix is not read further.
+     * Two NaN are equal.
+     *
+     * @throw std::runtime_error If the matrices have different depths or count of elements, or are empty.
+     */
+    ToleranceResult check_tolerance(const cv::Mat& a, const cv::Mat& b, const Tolerance& tolerance);
+
+    /**
+     * Tolerances of the matrices, loaded from a file.
+     *
+     * Each line is a glob matched against `thread/scope1/scope2/.../name` (without the call count),
+     * where `*` matches any characters including `/` and `?` matches any character,
+     * followed by the criteria of `Tolerance` separated by spaces: `abs=`, `rel=` and `ulp=`.
+     * The last rule matching a matrix is used. Empty lines and lines starting with `#` are ignored.
+     * For example:
+     *
+     *     *            abs=0.001
+     *     main*depth   rel=1e-4 ulp=4
+     */
+    class ToleranceRules
+    {
+    public:
+        /**
+         * Load the rules from a file.
+         *
+         * @throw std::runtime_error If the file could not be read or has an invalid line.
+         */
+        explicit ToleranceRules(const std::string& path);
+
+        /**
+         * Find the tolerance of a matrix.
+         *
+         * @param name The path of the matrix relative to the output directory, without the call count nor the extension.
+         * @return The tolerance of the last rule matching, or nullptr if none.
+         */
+        const Tolerance* find(std::string_view name) const;
+
+    private:
+        struct Rule
+        {
+            std::string glob;
+            Tolerance tolerance;
+        };
+
+        std::vector<Rule> m_rules;
+    };
+}
@@ -20,6 +20,12 @@ int main()
     REGRR_CREATE_MAT(float, 4, 4, "%s", "hello");
     REGRR_SET_PX(0, 0, 10.0f, "%s", "hello");
 
+    REGRR_CREATE_MAT_HANDLE(ramp, float, 4, 4, "ramp");
+    for(int i = 0; i < 16; i++)
+    {
+        REGRR_SET_PX_H(ramp, i / 4, i % 4, i * 0.5f);
+    }
+
     for(int i = 0; i < 10; i++)
     {
         test();
@@ -27,6 +33,8 @@ int main()
 
     REGRR_SAVE(a, "%s", "a%%%");
     REGRR_SAVE(b, "%s", "b%%%\\");
+    REGRR_SAVE_ROI(b, cv::Rect(5, 5, 10, 10), "b-roi");
+    REGRR_SAVE_STRIDED(b, 2, 2, "b-half");
 
     return 0;
 }
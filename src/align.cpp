@@ -0,0 +1,172 @@
+#include "regrr_reader.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace regrr
+{
+    namespace
+    {
+        /**
+         * Myers alignment of two sequences, see `align_sequences()`.
+         */
+        class Aligner
+        {
+        public:
+            /**
+             * @param matches Output, for each element of `a`, the index of the element of `b` it is matched with, or SIZE_MAX.
+             */
+            Aligner(const std::vector<std::uint32_t>& a, const std::vector<std::uint32_t>& b, std::vector<size_t>& matches)
+                : m_a(a),
+                  m_b(b),
+                  m_matches(matches)
+            {
+                m_matches.assign(a.size(), SIZE_MAX);
+                align(0, a.size(), 0, b.size());
+            }
+
+        private:
+            /**
+             * Align the ranges `[a0, a1)` of `a` and `[b0, b1)` of `b`.
+             */
+            void align(size_t a0, size_t a1, size_t b0, size_t b1)
+            {
+                // The common prefix and suffix are matched directly, which is most of similar flows
+                while(a0 < a1 && b0 < b1 && m_a[a0] == m_b[b0])
+                {
+                    m_matches[a0++] = b0++;
+                }
+
+                while(a0 < a1 && b0 < b1 && m_a[a1 - 1] == m_b[b1 - 1])
+                {
+                    m_matches[--a1] = --b1;
+                }
+
+                if(a0 == a1 || b0 == b1)
+                {
+                    return;
+                }
+
+                // Split where the shortest paths from both ends meet, and align each half
+                if(size_t x, y; bisect(a0, a1, b0, b1, x, y))
+                {
+                    align(a0, x, b0, y);
+                    align(x, a1, y, b1);
+                }
+            }
+
+            /**
+             * Find the middle of a shortest edit path of the ranges, walking the furthest reaching paths from both ends.
+             *
+             * @return false if the ranges have nothing in common.
+             */
+            bool bisect(size_t a0, size_t a1, size_t b0, size_t b1, size_t& splitA, size_t& splitB)
+            {
+                const std::ptrdiff_t n = static_cast<std::ptrdiff_t>(a1 - a0);
+                const std::ptrdiff_t m = static_cast<std::ptrdiff_t>(b1 - b0);
+                const std::ptrdiff_t maxD = (n + m + 1) / 2;
+                const std::ptrdiff_t offset = maxD;
+                const std::ptrdiff_t delta = n - m;
+
+                // If the difference of the lengths is odd, the forward path meets the reverse one, otherwise the reverse path meets the forward one
+                const bool front = delta % 2 != 0;
+
+                // Furthest x reached on each diagonal k = x - y, from the start and from the end, -1 if not reached
+                m_forward.assign(2 * maxD + 1, -1);
+                m_reverse.assign(2 * maxD + 1, -1);
+                m_forward[offset + 1] = 0;
+                m_reverse[offset + 1] = 0;
+
+                // Diagonals trimmed once their paths run out of the ranges
+                std::ptrdiff_t k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+
+                for(std::ptrdiff_t d = 0; d < maxD; d++)
+                {
+                    for(std::ptrdiff_t k1 = -d + k1start; k1 <= d - k1end; k1 += 2)
+                    {
+                        const std::ptrdiff_t k1Offset = offset + k1;
+                        std::ptrdiff_t x1 = (k1 == -d || (k1 != d && m_forward[k1Offset - 1] < m_forward[k1Offset + 1]))
+                                          ? m_forward[k1Offset + 1] : m_forward[k1Offset - 1] + 1;
+                        std::ptrdiff_t y1 = x1 - k1;
+                        while(x1 < n && y1 < m && m_a[a0 + x1] == m_b[b0 + y1])
+                        {
+                            x1++;
+                            y1++;
+                        }
+
+                        m_forward[k1Offset] = x1;
+                        if(x1 > n)
+                        {
+                            k1end += 2;
+                        }
+                        else if(y1 > m)
+                        {
+                            k1start += 2;
+                        }
+                        else if(front)
+                        {
+                            const std::ptrdiff_t k2Offset = offset + delta - k1;
+                            if(k2Offset >= 0 && k2Offset < 2 * maxD + 1 && m_reverse[k2Offset] != -1 && x1 >= n - m_reverse[k2Offset])
+                            {
+                                splitA = a0 + static_cast<size_t>(x1);
+                                splitB = b0 + static_cast<size_t>(y1);
+                                return true;
+                            }
+                        }
+                    }
+
+                    for(std::ptrdiff_t k2 = -d + k2start; k2 <= d - k2end; k2 += 2)
+                    {
+                        const std::ptrdiff_t k2Offset = offset + k2;
+                        std::ptrdiff_t x2 = (k2 == -d || (k2 != d && m_reverse[k2Offset - 1] < m_reverse[k2Offset + 1]))
+                                          ? m_reverse[k2Offset + 1] : m_reverse[k2Offset - 1] + 1;
+                        std::ptrdiff_t y2 = x2 - k2;
+                        while(x2 < n && y2 < m && m_a[a1 - 1 - x2] == m_b[b1 - 1 - y2])
+                        {
+                            x2++;
+                            y2++;
+                        }
+
+                        m_reverse[k2Offset] = x2;
+                        if(x2 > n)
+                        {
+                            k2end += 2;
+                        }
+                        else if(y2 > m)
+                        {
+                            k2start += 2;
+                        }
+                        else if(!front)
+                        {
+                            const std::ptrdiff_t k1Offset = offset + delta - k2;
+                            if(k1Offset >= 0 && k1Offset < 2 * maxD + 1 && m_forward[k1Offset] != -1 && m_forward[k1Offset] >= n - x2)
+                            {
+                                const std::ptrdiff_t x1 = m_forward[k1Offset];
+                                splitA = a0 + static_cast<size_t>(x1);
+                                splitB = b0 + static_cast<size_t>(x1 - (k1Offset - offset));
+                                return true;
+                            }
+                        }
+                    }
+                }
+
+                return false;
+            }
+
+            const std::vector<std::uint32_t>& m_a;
+            const std::vector<std::uint32_t>& m_b;
+            std::vector<size_t>& m_matches;
+
+            /**
+             * Reused by all the bisections, each one is done before recursing.
+             */
+            std::vector<std::ptrdiff_t> m_forward;
+            std::vector<std::ptrdiff_t> m_reverse;
+        };
+    }
+
+    void align_sequences(const std::vector<std::uint32_t>& a, const std::vector<std::uint32_t>& b, std::vector<size_t>& matches)
+    {
+        Aligner(a, b, matches);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,243 @@
+#include "regrr_codec.h"
+#include "regrr_format.h"
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#if REGRR_HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+#if REGRR_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace regrr
+{
+    namespace
+    {
+#if REGRR_HAVE_LZ4
+        /**
+         * Check that a size fits in the `int` of the LZ4 API.
+         */
+        int lz4Size(size_t size)
+        {
+            if(size > static_cast<size_t>(LZ4_MAX_INPUT_SIZE))
+            {
+                throw std::runtime_error("Too large for LZ4: " + std::to_string(size) + " bytes");
+            }
+
+            return static_cast<int>(size);
+        }
+#endif
+
+#if REGRR_HAVE_ZSTD
+        /**
+         * Contexts of Zstd, one per thread and reused from a call to the next.
+         */
+        struct ZstdContexts
+        {
+            std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> compression{ZSTD_createCCtx(), &ZSTD_freeCCtx};
+            std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> decompression{ZSTD_createDCtx(), &ZSTD_freeDCtx};
+        };
+
+        ZstdContexts& zstdContexts()
+        {
+            thread_local ZstdContexts contexts;
+            return contexts;
+        }
+#endif
+
+        [[maybe_unused]] [[noreturn]] void unavailable(std::uint32_t codec)
+        {
+            throw std::runtime_error(std::string("The library was compiled without the codec: ") + codec_name(codec));
+        }
+    }
+
+    std::uint32_t codec_from_name(std::string_view name)
+    {
+        std::uint32_t codec;
+        if(name == "none")
+        {
+            codec = REGRR_CODEC_NONE;
+        }
+        else if(name == "lz4")
+        {
+            codec = REGRR_CODEC_LZ4;
+        }
+        else if(name == "zstd")
+        {
+            codec = REGRR_CODEC_ZSTD;
+        }
+        else
+        {
+            throw std::runtime_error("Unknown codec: " + std::string(name));
+        }
+
+#if !REGRR_HAVE_LZ4
+        if(codec == REGRR_CODEC_LZ4)
+        {
+            unavailable(codec);
+        }
+#endif
+
+#if !REGRR_HAVE_ZSTD
+        if(codec == REGRR_CODEC_ZSTD)
+        {
+            unavailable(codec);
+        }
+#endif
+
+        return codec;
+    }
+
+    const char* codec_name(std::uint32_t codec)
+    {
+        switch(codec)
+        {
+        case REGRR_CODEC_NONE:
+            return "none";
+        case REGRR_CODEC_LZ4:
+            return "lz4";
+        case REGRR_CODEC_ZSTD:
+            return "zstd";
+        default:
+            return "unknown";
+        }
+    }
+
+    void compress(std::uint32_t codec, [[maybe_unused]] int level, const void *data, size_t size, std::vector<unsigned char>& output)
+    {
+        switch(codec)
+        {
+        case REGRR_CODEC_NONE:
+            output.assign(static_cast<const unsigned char*>(data), static_cast<const unsigned char*>(data) + size);
+            return;
+
+        case REGRR_CODEC_LZ4:
+        {
+#if REGRR_HAVE_LZ4
+            const int inputSize = lz4Size(size);
+            output.resize(static_cast<size_t>(LZ4_compressBound(inputSize)));
+
+            char *destination = reinterpret_cast<char*>(output.data());
+            const int capacity = static_cast<int>(output.size());
+            const int written = level > 1
+                ? LZ4_compress_HC(static_cast<const char*>(data), destination, inputSize, capacity, level)
+                : LZ4_compress_default(static_cast<const char*>(data), destination, inputSize, capacity);
+
+            if(written <= 0 && size > 0)
+            {
+                throw std::runtime_error("Cannot compress with LZ4");
+            }
+
+            output.resize(static_cast<size_t>(written));
+            return;
+#else
+            unavailable(codec);
+#endif
+        }
+
+        case REGRR_CODEC_ZSTD:
+        {
+#if REGRR_HAVE_ZSTD
+            output.resize(ZSTD_compressBound(size));
+
+            const size_t written = ZSTD_compressCCtx(zstdContexts().compression.get(), output.data(), output.size(), data, size,
+                                                     level != 0 ? level : ZSTD_CLEVEL_DEFAULT);
+            if(ZSTD_isError(written))
+            {
+                throw std::runtime_error(std::string("Cannot compress with Zstd: ") + ZSTD_getErrorName(written));
+            }
+
+            output.resize(written);
+            return;
+#else
+            unavailable(codec);
+#endif
+        }
+
+        default:
+            throw std::runtime_error("Unknown codec: " + std::to_string(codec));
+        }
+    }
+
+    void decompress(std::uint32_t codec, const void *data, size_t size, void *output, size_t outputSize)
+    {
+        switch(codec)
+        {
+        case REGRR_CODEC_NONE:
+            if(size != outputSize)
+            {
+                throw std::runtime_error("Invalid size of the uncompressed data");
+            }
+
+            std::memcpy(output, data, size);
+            return;
+
+        case REGRR_CODEC_LZ4:
+        {
+#if REGRR_HAVE_LZ4
+            const int read = LZ4_decompress_safe(static_cast<const char*>(data), static_cast<char*>(output), lz4Size(size), lz4Size(outputSize));
+            if(read < 0 || static_cast<size_t>(read) != outputSize)
+            {
+                throw std::runtime_error("Corrupted LZ4 data");
+            }
+
+            return;
+#else
+            unavailable(codec);
+#endif
+        }
+
+        case REGRR_CODEC_ZSTD:
+        {
+#if REGRR_HAVE_ZSTD
+            const size_t read = ZSTD_decompressDCtx(zstdContexts().decompression.get(), output, outputSize, data, size);
+            if(ZSTD_isError(read))
+            {
+                throw std::runtime_error(std::string("Corrupted Zstd data: ") + ZSTD_getErrorName(read));
+            }
+
+            if(read != outputSize)
+            {
+                throw std::runtime_error("Corrupted Zstd data: invalid size");
+            }
+
+            return;
+#else
+            unavailable(codec);
+#endif
+        }
+
+        default:
+            throw std::runtime_error("Unknown codec: " + std::to_string(codec));
+        }
+    }
+
+    void xor_bytes(const void *a, const void *b, void *output, size_t size)
+    {
+        const unsigned char *left = static_cast<const unsigned char*>(a);
+        const unsigned char *right = static_cast<const unsigned char*>(b);
+        unsigned char *result = static_cast<unsigned char*>(output);
+
+        // By words, vectorized by the compiler, then the remaining bytes
+        size_t i = 0;
+        for(; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t))
+        {
+            std::uint64_t x;
+            std::uint64_t y;
+            std::memcpy(&x, left + i, sizeof(x));
+            std::memcpy(&y, right + i, sizeof(y));
+            x ^= y;
+            std::memcpy(result + i, &x, sizeof(x));
+        }
+
+        for(; i < size; i++)
+        {
+            result[i] = left[i] ^ right[i];
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "downloader.h"
+#if REGRR_HAVE_CUDA
+#include "logger.h"
+#include "pool.h"
+#include <utility>
+
+namespace regrr
+{
+    DeviceDownloader& deviceDownloader = *new DeviceDownloader;
+
+    void DeviceDownloader::configure(size_t capacity, Write write)
+    {
+        std::lock_guard lock(m_mutex);
+        m_capacity = capacity;
+        m_write = std::move(write);
+    }
+
+    void DeviceDownloader::push(const cv::cuda::GpuMat& mat, const std::string& path)
+    {
+        std::unique_lock lock(m_mutex);
+        if(!m_thread.joinable())
+        {
+            // Created at the first download, so the device is not initialized if never used
+            m_stream = std::make_unique<cv::cuda::Stream>();
+            m_stopping = false;
+            m_thread = std::thread([this] { run(); });
+        }
+
+        m_notFull.wait(lock, [this] { return m_jobs.size() < m_capacity; });
+
+        const Shape shape{mat.rows, mat.cols, mat.type()};
+        Job job{
+            .shape = shape,
+            .snapshot = take(m_snapshots, shape),
+            .host = take(m_hosts, shape),
+            .done = cv::cuda::Event(cv::cuda::Event::DISABLE_TIMING),
+            .path = path,
+        };
+
+        lock.unlock();
+
+        if(job.snapshot.empty())
+        {
+            job.snapshot.create(mat.rows, mat.cols, mat.type());
+        }
+
+        if(job.host.empty())
+        {
+            job.host = cv::cuda::HostMem(mat.rows, mat.cols, mat.type(), cv::cuda::HostMem::PAGE_LOCKED);
+        }
+
+        // The snapshot is ordered after the work of the caller, so the caller can modify the matrix right after
+        // The copy to the host is on the stream of the downloads, ordered after the snapshot
+        cv::cuda::Stream& caller = cv::cuda::Stream::Null();
+        mat.copyTo(job.snapshot, caller);
+
+        cv::cuda::Event snapshotted(cv::cuda::Event::DISABLE_TIMING);
+        snapshotted.record(caller);
+        m_stream->waitEvent(snapshotted);
+
+        job.snapshot.download(job.host, *m_stream);
+        job.done.record(*m_stream);
+
+        lock.lock();
+        m_jobs.push_back(std::move(job));
+        lock.unlock();
+
+        m_notEmpty.notify_one();
+    }
+
+    void DeviceDownloader::stop()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopping = true;
+        }
+
+        m_notEmpty.notify_all();
+
+        if(m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    template<typename T>
+    T DeviceDownloader::take(std::map<Shape, std::vector<T>>& buffers, const Shape& shape)
+    {
+        T buffer;
+        if(auto it = buffers.find(shape); it != buffers.end() && !it->second.empty())
+        {
+            buffer = std::move(it->second.back());
+            it->second.pop_back();
+        }
+
+        return buffer;
+    }
+
+    void DeviceDownloader::run()
+    {
+        while(true)
+        {
+            std::unique_lock lock(m_mutex);
+            m_notEmpty.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+
+            if(m_jobs.empty())
+            {
+                return;
+            }
+
+            Job job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            lock.unlock();
+
+            // There is nobody to catch the exception in the background, so just log it
+            try
+            {
+                job.done.waitForCompletion();
+
+                // The page-locked buffer is kept for the next downloads, the writer gets a matrix of the pool
+                cv::Mat mat;
+                mat.allocator = poolCapacity > 0 ? &bufferPool : nullptr;
+                job.host.createMatHeader().copyTo(mat);
+
+                m_write(std::move(mat), std::move(job.path));
+            }
+            catch(const std::exception& error)
+            {
+                logError("SAVE MATRIX", error);
+            }
+
+            lock.lock();
+            m_snapshots[job.shape].push_back(std::move(job.snapshot));
+            m_hosts[job.shape].push_back(std::move(job.host));
+            lock.unlock();
+
+            m_notFull.notify_one();
+        }
+    }
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,113 @@
+#pragma once
+
+
+#if REGRR_HAVE_CUDA
+#include <opencv2/core.hpp>
+#include <opencv2/core/cuda.hpp>
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Capture of the matrices of the CUDA device, see `save()`.
+ * Internal to the library.
+ */
+
+namespace regrr
+{
+    /**
+     * Download the matrices of the CUDA device in the background, so the device pipeline of the caller never stalls.
+     *
+     * The caller snapshots the matrix on the device after the work queued on the null stream, and queues its copy
+     * to a page-locked buffer on a dedicated stream, without waiting for any of them. A background thread waits for the copies
+     * in order, moves the pixels to a matrix of the pool and hands it to the function writing it.
+     * The snapshots and the page-locked buffers are kept by shape for the next downloads,
+     * as allocating them synchronizes the device. The count of downloads in flight is bounded.
+     */
+    class DeviceDownloader
+    {
+    public:
+        /**
+         * Write a matrix downloaded to its path, called by the background thread.
+         *
+         * @throw std::runtime_error If the file could not be written, only logged.
+         */
+        using Write = std::function<void(cv::Mat mat, std::string path)>;
+
+        /**
+         * Set how the matrices are written, before the first download.
+         *
+         * @param capacity Maximum count of downloads in flight.
+         */
+        void configure(size_t capacity, Write write);
+
+        /**
+         * Queue the download of a device matrix, and its writing to a file.
+         * Start the background thread at the first call. Blocks while too many downloads are in flight.
+         */
+        void push(const cv::cuda::GpuMat& mat, const std::string& path);
+
+        /**
+         * Write all the pending downloads then stop the thread.
+         * Noop if the thread is not started.
+         */
+        void stop();
+
+    private:
+        /**
+         * The type and the size of a matrix, the key of the buffers kept.
+         */
+        using Shape = std::array<int, 3>;
+
+        struct Job
+        {
+            Shape shape;
+            cv::cuda::GpuMat snapshot;
+            cv::cuda::HostMem host;
+
+            /**
+             * Recorded once the copy to the host is queued.
+             */
+            cv::cuda::Event done;
+            std::string path;
+        };
+
+        /**
+         * Take a buffer of a shape kept, or an empty one if none.
+         */
+        template<typename T>
+        static T take(std::map<Shape, std::vector<T>>& buffers, const Shape& shape);
+
+        /**
+         * Main loop of the thread.
+         * Exit only when stopping and there is no more pending download.
+         */
+        void run();
+
+        std::mutex m_mutex;
+        std::condition_variable m_notEmpty;
+        std::condition_variable m_notFull;
+        std::deque<Job> m_jobs;
+        std::map<Shape, std::vector<cv::cuda::GpuMat>> m_snapshots;
+        std::map<Shape, std::vector<cv::cuda::HostMem>> m_hosts;
+        std::unique_ptr<cv::cuda::Stream> m_stream;
+        std::thread m_thread;
+        Write m_write;
+        size_t m_capacity = 1;
+        bool m_stopping = false;
+    };
+
+    /**
+     * The downloader of the device matrices, started at the first download.
+     * Never destroyed, as the CUDA runtime may be unloaded before the static destructors.
+     */
+    extern DeviceDownloader& deviceDownloader;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,196 @@
+#include "regrr_hash.h"
+#include "regrr_format.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace regrr
+{
+    namespace
+    {
+        constexpr std::uint64_t prime1 = 0x9E3779B185EBCA87ull;
+        constexpr std::uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+        constexpr std::uint64_t prime3 = 0x165667B19E3779F9ull;
+        constexpr std::uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+        constexpr std::uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+        std::uint64_t rotateLeft(std::uint64_t value, int count)
+        {
+            return (value << count) | (value >> (64 - count));
+        }
+
+        std::uint64_t read64(const unsigned char *data)
+        {
+            std::uint64_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        std::uint32_t read32(const unsigned char *data)
+        {
+            std::uint32_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        std::uint64_t hashRound(std::uint64_t accumulator, std::uint64_t input)
+        {
+            accumulator += input * prime2;
+            accumulator = rotateLeft(accumulator, 31);
+            return accumulator * prime1;
+        }
+
+        std::uint64_t mergeRound(std::uint64_t hash, std::uint64_t accumulator)
+        {
+            hash ^= hashRound(0, accumulator);
+            return hash * prime1 + prime4;
+        }
+    }
+
+    Hasher::Hasher(std::uint64_t seed)
+        : m_seed(seed),
+          m_accumulators{seed + prime1 + prime2, seed + prime2, seed, seed - prime1}
+    {
+    }
+
+    void Hasher::update(const void *data, size_t size)
+    {
+        const unsigned char *input = static_cast<const unsigned char*>(data);
+        m_totalSize += size;
+
+        // Complete the stripe of 32 bytes started by the previous update
+        if(m_bufferSize > 0)
+        {
+            const size_t count = std::min(size, sizeof(m_buffer) - m_bufferSize);
+            std::memcpy(m_buffer + m_bufferSize, input, count);
+            m_bufferSize += count;
+            input += count;
+            size -= count;
+
+            if(m_bufferSize < sizeof(m_buffer))
+            {
+                return;
+            }
+
+            for(int i = 0; i < 4; i++)
+            {
+                m_accumulators[i] = hashRound(m_accumulators[i], read64(m_buffer + 8 * i));
+            }
+
+            m_bufferSize = 0;
+        }
+
+        // Full stripes directly from the input
+        std::uint64_t v1 = m_accumulators[0];
+        std::uint64_t v2 = m_accumulators[1];
+        std::uint64_t v3 = m_accumulators[2];
+        std::uint64_t v4 = m_accumulators[3];
+        while(size >= 32)
+        {
+            v1 = hashRound(v1, read64(input));
+            v2 = hashRound(v2, read64(input + 8));
+            v3 = hashRound(v3, read64(input + 16));
+            v4 = hashRound(v4, read64(input + 24));
+            input += 32;
+            size -= 32;
+        }
+
+        m_accumulators[0] = v1;
+        m_accumulators[1] = v2;
+        m_accumulators[2] = v3;
+        m_accumulators[3] = v4;
+
+        // Keep the rest for the next update or the digest
+        std::memcpy(m_buffer, input, size);
+        m_bufferSize = size;
+    }
+
+    std::uint64_t Hasher::digest() const
+    {
+        std::uint64_t hash;
+        if(m_totalSize >= 32)
+        {
+            hash = rotateLeft(m_accumulators[0], 1) + rotateLeft(m_accumulators[1], 7)
+                 + rotateLeft(m_accumulators[2], 12) + rotateLeft(m_accumulators[3], 18);
+
+            for(const std::uint64_t accumulator: m_accumulators)
+            {
+                hash = mergeRound(hash, accumulator);
+            }
+        }
+        else
+        {
+            hash = m_seed + prime5;
+        }
+
+        hash += m_totalSize;
+
+        const unsigned char *input = m_buffer;
+        size_t size = m_bufferSize;
+        while(size >= 8)
+        {
+            hash ^= hashRound(0, read64(input));
+            hash = rotateLeft(hash, 27) * prime1 + prime4;
+            input += 8;
+            size -= 8;
+        }
+
+        if(size >= 4)
+        {
+            hash ^= read32(input) * prime1;
+            hash = rotateLeft(hash, 23) * prime2 + prime3;
+            input += 4;
+            size -= 4;
+        }
+
+        while(size > 0)
+        {
+            hash ^= *input * prime5;
+            hash = rotateLeft(hash, 11) * prime1;
+            input++;
+            size--;
+        }
+
+        // Avalanche
+        hash ^= hash >> 33;
+        hash *= prime2;
+        hash ^= hash >> 29;
+        hash *= prime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    std::uint64_t hash_mat(const cv::Mat& mat)
+    {
+        if(mat.dims > 2)
+        {
+            throw std::runtime_error("The binary format does not support more than 2 dimensions");
+        }
+
+        BinaryHeader header{};
+        std::memcpy(header.magic, REGRR_BINARY_MAGIC, sizeof(header.magic));
+        header.version = REGRR_BINARY_VERSION;
+        header.type = mat.type();
+        header.rows = mat.rows;
+        header.cols = mat.cols;
+        header.channels = mat.channels();
+        header.step = mat.cols * mat.elemSize();
+
+        Hasher hasher;
+        hasher.update(&header, sizeof(header));
+
+        if(mat.isContinuous())
+        {
+            hasher.update(mat.data, mat.total() * mat.elemSize());
+        }
+        else
+        {
+            for(int row = 0; row < mat.rows; row++)
+            {
+                hasher.update(mat.ptr(row), header.step);
+            }
+        }
+
+        return hasher.digest();
+    }
+}
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "logger.h"
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <fcntl.h>
+
+namespace regrr
+{
+    Logger logger;
+
+    void Logger::open(const std::string& path)
+    {
+        const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd < 0)
+        {
+            throw std::runtime_error("Cannot open file for write: " + path);
+        }
+
+        std::lock_guard lock(m_mutex);
+        flushLocked();
+        m_fd = fd;
+    }
+
+    void Logger::write(LogLevel level, std::string_view message)
+    {
+        if(!enabled(level))
+        {
+            return;
+        }
+
+        if(!message.empty() && message.back() == '\n')
+        {
+            message.remove_suffix(1);
+        }
+
+        std::lock_guard lock(m_mutex);
+
+        // Keep the order of the messages when the errors go to another stream
+        if(level == LogLevel::Error && m_fd == STDOUT_FILENO)
+        {
+            flushLocked();
+            writeRaw(STDERR_FILENO, message.data(), message.size());
+            writeRaw(STDERR_FILENO, "\n", 1);
+            return;
+        }
+
+        // Keep room for the newline
+        if(m_size + message.size() + 1 > sizeof(m_buffer))
+        {
+            flushLocked();
+
+            // Too long to ever fit in the buffer, write it directly
+            if(message.size() + 1 > sizeof(m_buffer))
+            {
+                writeRaw(m_fd, message.data(), message.size());
+                writeRaw(m_fd, "\n", 1);
+                return;
+            }
+        }
+
+        std::memcpy(m_buffer + m_size, message.data(), message.size());
+        m_buffer[m_size + message.size()] = '\n';
+        m_size += message.size() + 1;
+
+        if(level == LogLevel::Error)
+        {
+            flushLocked();
+        }
+    }
+
+    void Logger::flush()
+    {
+        std::lock_guard lock(m_mutex);
+        flushLocked();
+    }
+
+    void Logger::flushLocked()
+    {
+        const size_t size = m_size;
+        m_size = 0;
+        writeRaw(m_fd, m_buffer, size);
+    }
+
+    void Logger::writeRaw(int fd, const char *data, size_t size)
+    {
+        while(size > 0)
+        {
+            const ssize_t count = ::write(fd, data, size);
+            if(count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if(count <= 0)
+            {
+                break;
+            }
+
+            data += count;
+            size -= static_cast<size_t>(count);
+        }
+    }
+
+    void logError(std::string_view what, const std::exception& error)
+    {
+        std::string message = "CANNOT ";
+        message += what;
+        message += ". ERROR IS:\n";
+        message += error.what();
+        logger.write(LogLevel::Error, message);
+    }
+
+    LogLevel parseLogLevel(std::string_view level)
+    {
+        constexpr std::string_view names[] = {"quiet", "error", "info", "debug"};
+        for(size_t i = 0; i < std::size(names); i++)
+        {
+            if(level == names[i] || level == std::string_view(&"0123"[i], 1))
+            {
+                return static_cast<LogLevel>(i);
+            }
+        }
+
+        throw std::runtime_error("Invalid log level: " + std::string(level));
+    }
+}
\ No newline at end of file
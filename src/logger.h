@@ -0,0 +1,136 @@
+#pragma once
+
+
+#include <exception>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+/**
+ * Messages of the library.
+ * Internal to the library.
+ */
+
+namespace regrr
+{
+    /**
+     * Levels of the messages, set with `REGRR_LOG`.
+     * A message is written if its level is at most the level set.
+     */
+    enum class LogLevel
+    {
+        Quiet,
+        Error,
+        Info,
+        Debug
+    };
+
+    /**
+     * Buffered sink of the messages of the library.
+     * The messages are accumulated in a fixed buffer, written when it is full, at exit, or right away for the errors.
+     * By default the errors go to the standard error and the others to the standard output, all to the file if one is opened.
+     * Failures to write the messages are ignored, there is nowhere else to report them.
+     *
+     * The buffer has a fixed address and size so `flushFromSignal()` can write it from a signal handler.
+     */
+    class Logger
+    {
+    public:
+        /**
+         * Check if the messages of a level are written, to not format them otherwise.
+         */
+        bool enabled(LogLevel level) const
+        {
+            return level <= m_level;
+        }
+
+        void setLevel(LogLevel level)
+        {
+            m_level = level;
+        }
+
+        /**
+         * Write all the messages to a file instead of the console, from now.
+         *
+         * @throw std::runtime_error If the file could not be opened.
+         */
+        void open(const std::string& path);
+
+        /**
+         * Write a message, noop if its level is not enabled.
+         * A newline character '\n' is automatically added at the end of the message if missing.
+         */
+        void write(LogLevel level, std::string_view message);
+
+        /**
+         * Write the buffered messages.
+         */
+        void flush();
+
+        /**
+         * Write the buffered messages without locking.
+         * Only uses async-signal-safe functions.
+         */
+        void flushFromSignal()
+        {
+            flushLocked();
+        }
+
+        /**
+         * @{
+         * Lock around `fork()`, so a child does not inherit the logger in the middle of a message, see `beforeFork()`.
+         */
+        void lock()
+        {
+            m_mutex.lock();
+        }
+
+        void unlock()
+        {
+            m_mutex.unlock();
+        }
+        /**
+         * @}
+         */
+
+        /**
+         * Forget the messages buffered by the parent in a child process after `fork()`, the parent writes them.
+         */
+        void forget()
+        {
+            m_size = 0;
+        }
+
+    private:
+        /**
+         * Same as `flush()`, but the mutex should be already locked.
+         */
+        void flushLocked();
+
+        /**
+         * Write a buffer to a file descriptor, retrying on partial writes.
+         */
+        static void writeRaw(int fd, const char *data, size_t size);
+
+        std::mutex m_mutex;
+        int m_fd = STDOUT_FILENO;
+        LogLevel m_level = LogLevel::Info;
+        char m_buffer[64 * 1024];
+        size_t m_size = 0;
+    };
+
+    extern Logger logger;
+
+    /**
+     * Log an error caught where nobody can handle it, for example in the background.
+     */
+    void logError(std::string_view what, const std::exception& error);
+
+    /**
+     * Parse the level of the messages, either a name or its number.
+     *
+     * @throw std::runtime_error If the level is unknown.
+     */
+    LogLevel parseLogLevel(std::string_view level);
+}
\ No newline at end of file
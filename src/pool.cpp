@@ -0,0 +1,108 @@
+#include "pool.h"
+#include <algorithm>
+#include <bit>
+#include <new>
+
+namespace regrr
+{
+    size_t poolCapacity = 512 * 1024 * 1024;
+
+    PoolAllocator& bufferPool = *new PoolAllocator;
+
+    cv::UMatData* PoolAllocator::allocate(int dims, const int* sizes, int type, void* data0, size_t* step, cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const
+    {
+        // The memory of the user is not pooled
+        if(data0)
+        {
+            return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data0, step, flags, usageFlags);
+        }
+
+        size_t total = CV_ELEM_SIZE(type);
+        for(int i = dims - 1; i >= 0; i--)
+        {
+            if(step)
+            {
+                step[i] = total;
+            }
+
+            total *= sizes[i];
+        }
+
+        size_t classSize;
+        const size_t index = sizeClass(total, classSize);
+
+        void *buffer = nullptr;
+        void *storage = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            std::vector<void*>& buffers = m_buffers[index];
+            if(!buffers.empty())
+            {
+                buffer = buffers.back();
+                buffers.pop_back();
+                m_cached -= classSize;
+            }
+
+            if(!m_datas.empty())
+            {
+                storage = m_datas.back();
+                m_datas.pop_back();
+            }
+        }
+
+        if(!buffer)
+        {
+            buffer = cv::fastMalloc(classSize);
+        }
+
+        if(!storage)
+        {
+            storage = ::operator new(sizeof(cv::UMatData));
+        }
+
+        cv::UMatData *u = new(storage) cv::UMatData(this);
+        u->data = u->origdata = static_cast<uchar*>(buffer);
+        u->size = total;
+        return u;
+    }
+
+    void PoolAllocator::deallocate(cv::UMatData* u) const
+    {
+        if(!u)
+        {
+            return;
+        }
+
+        size_t classSize;
+        const size_t index = sizeClass(u->size, classSize);
+        void *buffer = u->origdata;
+        u->~UMatData();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if(m_cached + classSize <= poolCapacity)
+        {
+            m_buffers[index].push_back(buffer);
+            m_cached += classSize;
+        }
+        else
+        {
+            cv::fastFree(buffer);
+        }
+
+        m_datas.push_back(u);
+    }
+
+    size_t PoolAllocator::sizeClass(size_t size, size_t& classSize)
+    {
+        size = std::max<size_t>(size, 64);
+
+        // The size is in (2^(bits-1), 2^bits], rounded up to a multiple of 2^(bits-3): 5, 6, 7 or 8 times it
+        const int bits = std::bit_width(size - 1);
+        const size_t granularity = size_t(1) << (bits - 3);
+        const size_t steps = (size + granularity - 1) / granularity;
+        classSize = steps * granularity;
+        return static_cast<size_t>(bits) * 4 + (steps - 5);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,80 @@
+#pragma once
+
+
+#include <opencv2/core.hpp>
+#include <array>
+#include <mutex>
+#include <vector>
+
+/**
+ * Pool of the buffers of the matrices, see `allocator()`.
+ * Internal to the library.
+ */
+
+namespace regrr
+{
+    /**
+     * Maximum size in bytes of the buffers kept by the pool of matrices for reuse, see `PoolAllocator`.
+     * If zero, the matrices are allocated by OpenCV as usual.
+     */
+    extern size_t poolCapacity;
+
+    /**
+     * Allocator of matrices recycling their buffers, for the managed matrices and the snapshots of the asynchronous writer.
+     * The same sizes are allocated again and again when capturing every frame, so the released buffers are kept
+     * in free lists by size class and given back to the next allocation of the same class, without going to the heap.
+     * The size classes are the powers of two divided in 4 steps, so at most 25% of a buffer is wasted.
+     * The `UMatData` of the matrices are recycled too.
+     * At most `poolCapacity` bytes are kept in the free lists, the buffers released beyond are freed.
+     * Thread-safe, the snapshots are released by the writer threads.
+     */
+    class PoolAllocator : public cv::MatAllocator
+    {
+    public:
+        cv::UMatData* allocate(int dims, const int* sizes, int type, void* data0, size_t* step, cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+
+        bool allocate(cv::UMatData* u, cv::AccessFlag, cv::UMatUsageFlags) const override
+        {
+            return u != nullptr;
+        }
+
+        void deallocate(cv::UMatData* u) const override;
+
+        /**
+         * @{
+         * Lock around `fork()`, so a child does not inherit the pool in the middle of an allocation, see `beforeFork()`.
+         */
+        void lock()
+        {
+            m_mutex.lock();
+        }
+
+        void unlock()
+        {
+            m_mutex.unlock();
+        }
+        /**
+         * @}
+         */
+
+    private:
+        /**
+         * Get the size class of a buffer.
+         *
+         * @param classSize Output of the size of the buffers of this class, at least `size`.
+         * @return The index of the class.
+         */
+        static size_t sizeClass(size_t size, size_t& classSize);
+
+        mutable std::mutex m_mutex;
+        mutable std::array<std::vector<void*>, 65 * 4> m_buffers;
+        mutable std::vector<void*> m_datas;
+        mutable size_t m_cached = 0;
+    };
+
+    /**
+     * The pool of matrices, only used if `poolCapacity > 0`.
+     * Never destroyed, as matrices can be released by the user or the static destructors after the exit.
+     */
+    extern PoolAllocator& bufferPool;
+}
\ No newline at end of file
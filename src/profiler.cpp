@@ -0,0 +1,161 @@
+#include "profiler.h"
+#include "logger.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+namespace regrr
+{
+    bool profiling = false;
+
+    std::array<LatencyHistogram, static_cast<size_t>(Step::Count)> stepLatencies;
+
+    std::map<std::string, ScopeStats, std::less<>> scopeStats;
+    std::mutex scopeStatsMutex;
+
+    StepStats LatencyHistogram::stats() const
+    {
+        StepStats stats;
+        stats.count = m_count.load(std::memory_order_relaxed);
+        stats.total = m_total.load(std::memory_order_relaxed) * 1e-9;
+        stats.max = m_max.load(std::memory_order_relaxed) * 1e-9;
+        stats.p50 = std::min(percentile(stats.count, 0.50), stats.max);
+        stats.p99 = std::min(percentile(stats.count, 0.99), stats.max);
+        return stats;
+    }
+
+    size_t LatencyHistogram::bucket(std::uint64_t duration)
+    {
+        if(duration < subBuckets)
+        {
+            return static_cast<size_t>(duration);
+        }
+
+        const int bit = std::bit_width(duration) - 1;
+        const size_t sub = static_cast<size_t>(duration >> (bit - 3)) & (subBuckets - 1);
+        return static_cast<size_t>(bit - 2) * subBuckets + sub;
+    }
+
+    std::uint64_t LatencyHistogram::upperBound(size_t index)
+    {
+        if(index < subBuckets)
+        {
+            return index;
+        }
+
+        const int bit = static_cast<int>(index / subBuckets) + 2;
+        const std::uint64_t sub = index % subBuckets;
+        return ((subBuckets + sub + 1) << (bit - 3)) - 1;
+    }
+
+    double LatencyHistogram::percentile(std::uint64_t count, double ratio) const
+    {
+        if(count == 0)
+        {
+            return 0;
+        }
+
+        const std::uint64_t rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(ratio * count)));
+        std::uint64_t seen = 0;
+        for(size_t i = 0; i < bucketCount; i++)
+        {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+            if(seen >= rank)
+            {
+                return upperBound(i) * 1e-9;
+            }
+        }
+
+        return m_max.load(std::memory_order_relaxed) * 1e-9;
+    }
+
+    void recordWrite(std::string_view path, std::uint64_t bytes)
+    {
+        const size_t slash = path.rfind('/');
+        const std::string_view scope = slash == std::string_view::npos ? std::string_view() : path.substr(0, slash);
+
+        std::lock_guard lock(scopeStatsMutex);
+
+        auto it = scopeStats.find(scope);
+        if(it == scopeStats.end())
+        {
+            it = scopeStats.emplace(std::string(scope), ScopeStats{}).first;
+        }
+
+        it->second.saves++;
+        it->second.bytes += bytes;
+    }
+
+    void printStats(const Stats& stats)
+    {
+        std::ostringstream out;
+        const auto printStep = [&out] (const char *name, const StepStats& step) {
+            out << "    " << std::left << std::setw(12) << name << std::right
+                << std::setw(10) << step.count
+                << std::setw(12) << std::fixed << std::setprecision(3) << step.total * 1e3
+                << std::setw(12) << step.p50 * 1e6
+                << std::setw(12) << step.p99 * 1e6
+                << std::setw(12) << step.max * 1e6 << std::defaultfloat << '\n';
+        };
+
+        out << "***** REGRR library statistics:" << '\n';
+        out << "    saves: " << stats.saves << '\n';
+        out << "    bytes written: " << stats.bytes << '\n';
+        out << "    step             count    total ms     p50 us      p99 us      max us" << '\n';
+        printStep("save", stats.save);
+        printStep("format", stats.format);
+        printStep("directories", stats.directories);
+        printStep("hash", stats.hash);
+        printStep("delta", stats.delta);
+        printStep("serialize", stats.serialize);
+        printStep("lists", stats.lists);
+
+        // The scopes which wrote the most first, only the first ones
+        std::vector<std::pair<std::string, ScopeStats>> scopes(stats.scopes.begin(), stats.scopes.end());
+        std::sort(scopes.begin(), scopes.end(), [] (const auto& a, const auto& b) {
+            return a.second.bytes > b.second.bytes;
+        });
+
+        constexpr size_t maxScopes = 20;
+        out << "    scopes: " << scopes.size() << '\n';
+        for(size_t i = 0; i < std::min(scopes.size(), maxScopes); i++)
+        {
+            out << "        \"" << scopes[i].first << "\": " << scopes[i].second.saves << " saves, "
+                << scopes[i].second.bytes << " bytes" << '\n';
+        }
+
+        if(scopes.size() > maxScopes)
+        {
+            out << "        ... " << scopes.size() - maxScopes << " more" << '\n';
+        }
+
+        logger.write(LogLevel::Info, std::move(out).str());
+    }
+
+    Stats stats()
+    {
+        Stats stats;
+        stats.enabled = profiling;
+        stats.save = stepLatencies[static_cast<size_t>(Step::Save)].stats();
+        stats.format = stepLatencies[static_cast<size_t>(Step::Format)].stats();
+        stats.directories = stepLatencies[static_cast<size_t>(Step::Directories)].stats();
+        stats.hash = stepLatencies[static_cast<size_t>(Step::Hash)].stats();
+        stats.delta = stepLatencies[static_cast<size_t>(Step::Delta)].stats();
+        stats.serialize = stepLatencies[static_cast<size_t>(Step::Serialize)].stats();
+        stats.lists = stepLatencies[static_cast<size_t>(Step::Lists)].stats();
+
+        std::lock_guard lock(scopeStatsMutex);
+        for(const auto& [scope, scopeStat]: scopeStats)
+        {
+            stats.scopes.emplace(scope, scopeStat);
+            stats.saves += scopeStat.saves;
+            stats.bytes += scopeStat.bytes;
+        }
+
+        return stats;
+    }
+}
\ No newline at end of file
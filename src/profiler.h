@@ -0,0 +1,146 @@
+#pragma once
+
+
+#include "regrr.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+/**
+ * Self-profiling of the library, only if `REGRR_PROFILE=1`, see `stats()`.
+ * Internal to the library.
+ */
+
+namespace regrr
+{
+    /**
+     * If the statistics are collected.
+     */
+    extern bool profiling;
+
+    /**
+     * The steps measured, see `Stats`.
+     */
+    enum class Step
+    {
+        Save,
+        Format,
+        Directories,
+        Hash,
+        Delta,
+        Serialize,
+        Lists,
+        Count
+    };
+
+    /**
+     * Histogram of durations in nanoseconds, lock-free so it can be updated by any thread.
+     * The buckets are the powers of two divided in 8 linear sub-buckets, so each bucket is within 12.5% of its values.
+     */
+    class LatencyHistogram
+    {
+    public:
+        void record(std::uint64_t duration)
+        {
+            m_buckets[bucket(duration)].fetch_add(1, std::memory_order_relaxed);
+            m_count.fetch_add(1, std::memory_order_relaxed);
+            m_total.fetch_add(duration, std::memory_order_relaxed);
+
+            std::uint64_t max = m_max.load(std::memory_order_relaxed);
+            while(duration > max && !m_max.compare_exchange_weak(max, duration, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        StepStats stats() const;
+
+    private:
+        static constexpr size_t subBuckets = 8;
+        static constexpr size_t bucketCount = (64 - 2) * subBuckets;
+
+        /**
+         * Index of the bucket of a duration: the durations below 8 have their own bucket,
+         * then the position of the highest bit and the 3 bits after it.
+         */
+        static size_t bucket(std::uint64_t duration);
+
+        /**
+         * Largest duration of a bucket, in nanoseconds.
+         */
+        static std::uint64_t upperBound(size_t index);
+
+        /**
+         * Get a percentile in seconds, as the upper bound of its bucket.
+         */
+        double percentile(std::uint64_t count, double ratio) const;
+
+        std::array<std::atomic<std::uint64_t>, bucketCount> m_buckets{};
+        std::atomic<std::uint64_t> m_count{0};
+        std::atomic<std::uint64_t> m_total{0};
+        std::atomic<std::uint64_t> m_max{0};
+    };
+
+    /**
+     * The latencies of each step.
+     */
+    extern std::array<LatencyHistogram, static_cast<size_t>(Step::Count)> stepLatencies;
+
+    /**
+     * What was written in each sub-directory of the output directory, see `recordWrite()`.
+     */
+    extern std::map<std::string, ScopeStats, std::less<>> scopeStats;
+    extern std::mutex scopeStatsMutex;
+
+    /**
+     * RAII to measure the duration of a step, noop if not profiling.
+     */
+    class StepTimer
+    {
+    public:
+        explicit StepTimer(Step step)
+            : m_step(step),
+              m_active(profiling)
+        {
+            if(m_active)
+            {
+                m_start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~StepTimer()
+        {
+            if(m_active)
+            {
+                const auto duration = std::chrono::steady_clock::now() - m_start;
+                stepLatencies[static_cast<size_t>(m_step)].record(
+                    static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()));
+            }
+        }
+
+        StepTimer(const StepTimer&) = delete;
+        StepTimer& operator=(const StepTimer&) = delete;
+
+    private:
+        Step m_step;
+        bool m_active;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    /**
+     * Count a matrix written, in the sub-directory of its path.
+     *
+     * @param path Path of the matrix, relative to the output directory.
+     */
+    void recordWrite(std::string_view path, std::uint64_t bytes);
+
+    /**
+     * Print the statistics, at exit.
+     */
+    void printStats(const Stats& stats);
+}
\ No newline at end of file
@@ -0,0 +1,931 @@
+#include "regrr_reader.h"
+#include "regrr_format.h"
+#include "regrr_codec.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace regrr
+{
+    namespace
+    {
+        /**
+         * Round a size of the archive up to the alignment.
+         */
+        std::uint64_t align(std::uint64_t size)
+        {
+            return (size + REGRR_ARCHIVE_ALIGNMENT - 1) / REGRR_ARCHIVE_ALIGNMENT * REGRR_ARCHIVE_ALIGNMENT;
+        }
+
+        /**
+         * Remove the whitespaces at the beginning and at the end of a string.
+         */
+        std::string_view strip(std::string_view text)
+        {
+            constexpr std::string_view whitespaces = " \t\r\n\v\f";
+
+            const size_t begin = text.find_first_not_of(whitespaces);
+            if(begin == std::string_view::npos)
+            {
+                return {};
+            }
+
+            const size_t end = text.find_last_not_of(whitespaces);
+            return text.substr(begin, end - begin + 1);
+        }
+
+        /**
+         * Check if a text matches a glob, where `*` matches any characters and `?` any character.
+         * Backtracks only to the last `*`, so it is linear in practice.
+         */
+        bool matchGlob(std::string_view glob, std::string_view text)
+        {
+            size_t g = 0;
+            size_t t = 0;
+            size_t star = std::string_view::npos;
+            size_t starText = 0;
+
+            while(t < text.size())
+            {
+                if(g < glob.size() && (glob[g] == '?' || glob[g] == text[t]))
+                {
+                    g++;
+                    t++;
+                }
+                else if(g < glob.size() && glob[g] == '*')
+                {
+                    star = g++;
+                    starText = t;
+                }
+                else if(star != std::string_view::npos)
+                {
+                    g = star + 1;
+                    t = ++starText;
+                }
+                else
+                {
+                    return false;
+                }
+            }
+
+            while(g < glob.size() && glob[g] == '*')
+            {
+                g++;
+            }
+
+            return g == glob.size();
+        }
+
+        /**
+         * Check if a path has the given extension.
+         */
+        bool hasExtension(std::string_view path, std::string_view extension)
+        {
+            return path.size() >= extension.size() && path.substr(path.size() - extension.size()) == extension;
+        }
+
+        /**
+         * Read and check the header of a matrix in the native binary format.
+         *
+         * @throw std::runtime_error If the data is not a binary matrix of the supported version.
+         */
+        BinaryHeader parseBinaryHeader(const unsigned char *data, size_t size, const std::string& path)
+        {
+            BinaryHeader header;
+            if(size < sizeof(header))
+            {
+                throw std::runtime_error("Not a binary matrix: " + path);
+            }
+
+            std::memcpy(&header, data, sizeof(header));
+            if(std::memcmp(header.magic, REGRR_BINARY_MAGIC, sizeof(header.magic)) != 0)
+            {
+                throw std::runtime_error("Not a binary matrix: " + path);
+            }
+
+            if(header.version != REGRR_BINARY_VERSION)
+            {
+                throw std::runtime_error("Unsupported version of binary matrix: " + path);
+            }
+
+            return header;
+        }
+
+        /**
+         * Decoder of the records of a binary lists file, see `ListsHeader`.
+         * Each read fails at the end of the data, so a record truncated by a crash is only detected, not read.
+         */
+        class ListsDecoder
+        {
+        public:
+            ListsDecoder(const unsigned char *data, size_t size)
+                : m_data(data), m_end(data + size)
+            {
+            }
+
+            /**
+             * Read an unsigned LEB128 varint.
+             *
+             * @return False if the data ended before.
+             */
+            bool varint(std::uint64_t& value)
+            {
+                value = 0;
+                for(int shift = 0; m_data < m_end && shift < 64; shift += 7)
+                {
+                    const unsigned char byte = *m_data++;
+                    value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+                    if(!(byte & 0x80))
+                    {
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            /**
+             * Read a count of bytes then the bytes.
+             *
+             * @return False if the data ended before.
+             */
+            bool string(std::string_view& value)
+            {
+                std::uint64_t size;
+                if(!varint(size) || size > static_cast<std::uint64_t>(m_end - m_data))
+                {
+                    return false;
+                }
+
+                value = std::string_view(reinterpret_cast<const char*>(m_data), size);
+                m_data += size;
+                return true;
+            }
+
+            /**
+             * Read 8 little-endian bytes.
+             *
+             * @return False if the data ended before.
+             */
+            bool uint64(std::uint64_t& value)
+            {
+                if(m_end - m_data < static_cast<std::ptrdiff_t>(sizeof(value)))
+                {
+                    return false;
+                }
+
+                std::memcpy(&value, m_data, sizeof(value));
+                m_data += sizeof(value);
+                return true;
+            }
+
+        private:
+            const unsigned char *m_data;
+            const unsigned char *m_end;
+        };
+
+        /**
+         * Same as `stream_lists()` for a file in the binary format, see `ListsHeader`.
+         * The file is read up to its last complete record.
+         *
+         * @throw std::runtime_error If the file has an unsupported version, an unknown record, or refers to a name not defined.
+         */
+        std::string streamBinaryLists(const MappedFile& file, const std::function<void(std::string_view thread, ListsEvent&& event)>& callback)
+        {
+            ListsHeader header;
+            if(file.size() < sizeof(header))
+            {
+                throw std::runtime_error("Not a lists file: " + file.path());
+            }
+
+            std::memcpy(&header, file.data(), sizeof(header));
+            if(header.version != REGRR_LISTS_VERSION)
+            {
+                throw std::runtime_error("Unsupported version of lists file: " + file.path());
+            }
+
+            // The names are views of the mapped file, by ID
+            std::vector<std::string_view> names;
+            std::vector<bool> defined;
+            const auto name = [&] (std::uint64_t id) {
+                if(id >= names.size() || !defined[id])
+                {
+                    throw std::runtime_error("Name " + std::to_string(id) + " not defined in lists file: " + file.path());
+                }
+
+                return names[id];
+            };
+
+            std::string extension;
+            std::string_view thread;
+
+            ListsDecoder decoder(file.data() + sizeof(header), file.size() - sizeof(header));
+            for(std::uint64_t type; decoder.varint(type);)
+            {
+                if(type == REGRR_LISTS_NAME)
+                {
+                    std::uint64_t id;
+                    std::string_view value;
+                    if(!decoder.varint(id) || !decoder.string(value))
+                    {
+                        break;
+                    }
+
+                    if(id >= names.size())
+                    {
+                        names.resize(id + 1);
+                        defined.resize(id + 1, false);
+                    }
+
+                    names[id] = value;
+                    defined[id] = true;
+                }
+                else if(type == REGRR_LISTS_EXTENSION)
+                {
+                    std::string_view value;
+                    if(!decoder.string(value))
+                    {
+                        break;
+                    }
+
+                    extension = value;
+                }
+                else if(type == REGRR_LISTS_THREAD)
+                {
+                    std::uint64_t id;
+                    if(!decoder.varint(id))
+                    {
+                        break;
+                    }
+
+                    thread = name(id);
+                }
+                else if(type == REGRR_LISTS_ENTER)
+                {
+                    std::uint64_t id;
+                    if(!decoder.varint(id))
+                    {
+                        break;
+                    }
+
+                    callback(thread, ListsEvent{ListsEvent::EnterScope, std::string(name(id)), {}, {}, {}});
+                }
+                else if(type == REGRR_LISTS_EXIT)
+                {
+                    callback(thread, ListsEvent{ListsEvent::ExitScope, {}, {}, {}, {}});
+                }
+                else if(type == REGRR_LISTS_SAVE)
+                {
+                    std::uint64_t id;
+                    std::uint64_t zigzag;
+                    std::uint64_t flags;
+                    std::uint64_t region = 0;
+                    std::uint64_t skipped = 0;
+                    std::uint64_t hash = 0;
+                    if(!decoder.varint(id) || !decoder.varint(zigzag) || !decoder.varint(flags)
+                       || ((flags & REGRR_LISTS_HAS_REGION) && !decoder.varint(region))
+                       || ((flags & REGRR_LISTS_HAS_SKIPPED) && !decoder.varint(skipped))
+                       || ((flags & REGRR_LISTS_HAS_HASH) && !decoder.uint64(hash)))
+                    {
+                        break;
+                    }
+
+                    // Same event as the line `name.call\t~region\t!reason\t#hash` of the text format
+                    const auto call = static_cast<std::int32_t>(static_cast<std::uint32_t>(zigzag >> 1) ^ -static_cast<std::uint32_t>(zigzag & 1));
+                    ListsEvent event{ListsEvent::SaveMat, std::string(name(id)), {}, {}, {}};
+                    event.name += '.';
+                    event.name += std::to_string(call);
+
+                    if(flags & REGRR_LISTS_HAS_REGION)
+                    {
+                        event.region = name(region);
+                    }
+
+                    if(flags & REGRR_LISTS_HAS_SKIPPED)
+                    {
+                        event.skipped = name(skipped);
+                    }
+
+                    if(flags & REGRR_LISTS_HAS_HASH)
+                    {
+                        char hex[17];
+                        std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+                        event.hash = hex;
+                    }
+
+                    callback(thread, std::move(event));
+                }
+                else
+                {
+                    throw std::runtime_error("Unknown record " + std::to_string(type) + " in lists file: " + file.path());
+                }
+            }
+
+            return extension;
+        }
+    }
+
+    // MappedFile
+
+    MappedFile::MappedFile(const std::string& path)
+        : m_path(path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+        {
+            throw std::runtime_error("Cannot open file for read: " + path);
+        }
+
+        struct stat status{};
+        if(::fstat(fd, &status) < 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("Cannot get the size of file: " + path);
+        }
+
+        m_size = static_cast<size_t>(status.st_size);
+
+        // An empty file cannot be mapped, it has no data
+        if(m_size > 0)
+        {
+            void *data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(data == MAP_FAILED)
+            {
+                ::close(fd);
+                throw std::runtime_error("Cannot map file: " + path + ": " + std::strerror(errno));
+            }
+
+            m_data = static_cast<unsigned char*>(data);
+        }
+
+        // The mapping stays valid after closing the file
+        ::close(fd);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if(m_data)
+        {
+            ::munmap(m_data, m_size);
+        }
+    }
+
+    // Matrix files
+
+    cv::Mat parse_binary_mat(const unsigned char *data, size_t size, const std::string& path)
+    {
+        if(is_encoded_mat(data, size))
+        {
+            throw std::runtime_error("Encoded binary matrix, should be decoded: " + path);
+        }
+
+        const BinaryHeader header = parseBinaryHeader(data, size, path);
+
+        if(header.rows == 0 || header.cols == 0)
+        {
+            return cv::Mat(header.rows, header.cols, header.type);
+        }
+
+        if(size < sizeof(header) + header.step * static_cast<std::uint64_t>(header.rows))
+        {
+            throw std::runtime_error("Truncated binary matrix: " + path);
+        }
+
+        // The data is only read, OpenCV just needs a non-const pointer
+        return cv::Mat(header.rows, header.cols, header.type, const_cast<unsigned char*>(data + sizeof(header)), header.step);
+    }
+
+    bool is_encoded_mat(const unsigned char *data, size_t size)
+    {
+        return size >= sizeof(EncodedHeader) && std::memcmp(data, REGRR_ENCODED_MAGIC, sizeof(REGRR_ENCODED_MAGIC)) == 0;
+    }
+
+    cv::Mat decode_binary_mat(const unsigned char *data, size_t size, const std::string& path, const std::function<LoadedMat(int)>& reference)
+    {
+        EncodedHeader encoded;
+        if(size < sizeof(encoded))
+        {
+            throw std::runtime_error("Not an encoded matrix: " + path);
+        }
+
+        std::memcpy(&encoded, data, sizeof(encoded));
+        if(std::memcmp(encoded.magic, REGRR_ENCODED_MAGIC, sizeof(encoded.magic)) != 0)
+        {
+            throw std::runtime_error("Not an encoded matrix: " + path);
+        }
+
+        if(encoded.version != REGRR_ENCODED_VERSION)
+        {
+            throw std::runtime_error("Unsupported version of encoded matrix: " + path);
+        }
+
+        const BinaryHeader header = parseBinaryHeader(data + sizeof(encoded), size - sizeof(encoded), path);
+        const size_t offset = sizeof(encoded) + sizeof(header);
+        if(size - offset < encoded.size)
+        {
+            throw std::runtime_error("Truncated encoded matrix: " + path);
+        }
+
+        // The matrix is continuous, so the rows are decoded at once
+        cv::Mat mat(header.rows, header.cols, header.type);
+        const size_t pixels = header.step * static_cast<std::uint64_t>(header.rows);
+        if(mat.total() * mat.elemSize() != pixels)
+        {
+            throw std::runtime_error("Invalid encoded matrix: " + path);
+        }
+
+        try
+        {
+            decompress(encoded.codec, data + offset, encoded.size, mat.data, pixels);
+        }
+        catch(const std::runtime_error& error)
+        {
+            throw std::runtime_error("Cannot decode matrix: " + path + ": " + error.what());
+        }
+
+        // Undo the XOR with the reference, which may be itself a delta
+        if(encoded.reference > 0)
+        {
+            const LoadedMat loaded = reference(encoded.reference);
+            const cv::Mat& previous = loaded.mat;
+            if(previous.rows != mat.rows || previous.cols != mat.cols || previous.type() != mat.type())
+            {
+                throw std::runtime_error("The reference of the delta has another shape: " + path);
+            }
+
+            const size_t rowSize = header.step;
+            for(int row = 0; row < mat.rows; row++)
+            {
+                xor_bytes(mat.ptr(row), previous.ptr(row), mat.ptr(row), rowSize);
+            }
+        }
+
+        return mat;
+    }
+
+    std::string call_path(std::string_view path, int call)
+    {
+        // `name.call.ext`: the extension then the call count are after the last dots
+        const size_t extension = path.rfind('.');
+        const size_t count = extension == std::string_view::npos || extension == 0 ? std::string_view::npos : path.rfind('.', extension - 1);
+        const size_t slash = path.rfind('/');
+        if(count == std::string_view::npos || (slash != std::string_view::npos && count < slash))
+        {
+            throw std::runtime_error("No call count in the path: " + std::string(path));
+        }
+
+        return std::string(path.substr(0, count + 1)) + std::to_string(call) + std::string(path.substr(extension));
+    }
+
+    LoadedMat load_mat(const std::string& path)
+    {
+        LoadedMat loaded;
+
+        if(hasExtension(path, REGRR_BINARY_EXT))
+        {
+            auto file = std::make_shared<MappedFile>(path);
+            if(is_encoded_mat(file->data(), file->size()))
+            {
+                loaded.mat = decode_binary_mat(file->data(), file->size(), path, [&path] (int call) {
+                    return load_mat(call_path(path, call));
+                });
+            }
+            else
+            {
+                loaded.file = std::move(file);
+                loaded.mat = parse_binary_mat(loaded.file->data(), loaded.file->size(), path);
+            }
+        }
+        else
+        {
+            cv::FileStorage storage(path, cv::FileStorage::READ);
+            if(!storage.isOpened())
+            {
+                throw std::runtime_error("Cannot open file for read: " + path);
+            }
+
+            loaded.mat = storage.getFirstTopLevelNode().mat();
+        }
+
+        return loaded;
+    }
+
+    void write_mat(const std::string& path, const cv::Mat& mat)
+    {
+        if(!hasExtension(path, REGRR_BINARY_EXT))
+        {
+            cv::FileStorage writer(path, cv::FileStorage::WRITE);
+            writer << "root" << mat.reshape(1);
+            writer.release();
+            return;
+        }
+
+        if(mat.dims > 2)
+        {
+            throw std::runtime_error("The binary format does not support more than 2 dimensions: " + path);
+        }
+
+        BinaryHeader header{};
+        std::memcpy(header.magic, REGRR_BINARY_MAGIC, sizeof(header.magic));
+        header.version = REGRR_BINARY_VERSION;
+        header.type = mat.type();
+        header.rows = mat.rows;
+        header.cols = mat.cols;
+        header.channels = mat.channels();
+        header.step = mat.cols * mat.elemSize();
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        for(int row = 0; row < mat.rows; row++)
+        {
+            file.write(reinterpret_cast<const char*>(mat.ptr(row)), static_cast<std::streamsize>(header.step));
+        }
+
+        if(!file)
+        {
+            throw std::runtime_error("Can't write file: " + path);
+        }
+    }
+
+    // ArchiveReader
+
+    ArchiveReader::ArchiveReader(const std::string& path)
+        : m_file(std::make_shared<MappedFile>(path))
+    {
+        ArchiveHeader header;
+        if(m_file->size() < sizeof(header))
+        {
+            throw std::runtime_error("Not an archive file: " + path);
+        }
+
+        std::memcpy(&header, m_file->data(), sizeof(header));
+        if(std::memcmp(header.magic, REGRR_ARCHIVE_MAGIC, sizeof(header.magic)) != 0)
+        {
+            throw std::runtime_error("Not an archive file: " + path);
+        }
+
+        if(!readIndex())
+        {
+            scanRecords();
+        }
+    }
+
+    bool ArchiveReader::contains(std::string_view path) const
+    {
+        return m_records.find(path) != m_records.end();
+    }
+
+    LoadedMat ArchiveReader::load(std::string_view path) const
+    {
+        const auto it = m_records.find(path);
+        if(it == m_records.end())
+        {
+            throw std::runtime_error("The archive does not contain: " + std::string(path));
+        }
+
+        const unsigned char *data = m_file->data() + it->second.offset;
+        const std::string name(path);
+
+        LoadedMat loaded;
+        if(is_encoded_mat(data, it->second.size))
+        {
+            loaded.mat = decode_binary_mat(data, it->second.size, name, [this, &name] (int call) {
+                return load(call_path(name, call));
+            });
+        }
+        else
+        {
+            loaded.file = m_file;
+            loaded.mat = parse_binary_mat(data, it->second.size, name);
+        }
+
+        return loaded;
+    }
+
+    bool ArchiveReader::readIndex()
+    {
+        const unsigned char *data = m_file->data();
+        const std::uint64_t size = m_file->size();
+
+        ArchiveFooter footer;
+        if(size < sizeof(ArchiveHeader) + sizeof(footer))
+        {
+            return false;
+        }
+
+        std::memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+        if(std::memcmp(footer.magic, REGRR_ARCHIVE_INDEX_MAGIC, sizeof(footer.magic)) != 0)
+        {
+            return false;
+        }
+
+        std::uint64_t offset = footer.indexOffset;
+        for(std::uint64_t i = 0; i < footer.count; i++)
+        {
+            ArchiveIndexEntry entry;
+            if(offset + sizeof(entry) > size)
+            {
+                throw std::runtime_error("Invalid index of archive: " + m_file->path());
+            }
+
+            std::memcpy(&entry, data + offset, sizeof(entry));
+            if(addRecord(entry.offset) == 0)
+            {
+                throw std::runtime_error("Invalid index of archive: " + m_file->path());
+            }
+
+            offset += sizeof(entry) + align(entry.pathSize);
+        }
+
+        return true;
+    }
+
+    void ArchiveReader::scanRecords()
+    {
+        std::uint64_t offset = sizeof(ArchiveHeader);
+        while(offset + sizeof(ArchiveRecord) <= m_file->size())
+        {
+            offset = addRecord(offset);
+            if(offset == 0)
+            {
+                break;
+            }
+        }
+    }
+
+    std::uint64_t ArchiveReader::addRecord(std::uint64_t offset)
+    {
+        const unsigned char *data = m_file->data();
+        const std::uint64_t size = m_file->size();
+
+        ArchiveRecord record;
+        if(offset + sizeof(record) > size)
+        {
+            return 0;
+        }
+
+        std::memcpy(&record, data + offset, sizeof(record));
+        if(std::memcmp(record.magic, REGRR_ARCHIVE_RECORD_MAGIC, sizeof(record.magic)) != 0)
+        {
+            return 0;
+        }
+
+        const std::uint64_t pathOffset = offset + sizeof(record);
+        const std::uint64_t payloadOffset = pathOffset + align(record.pathSize);
+        if(payloadOffset + record.payloadSize > size)
+        {
+            return 0;
+        }
+
+        std::string path(reinterpret_cast<const char*>(data + pathOffset), record.pathSize);
+
+        // The last record wins if a path was written twice, as when overwriting a file
+        const auto [it, inserted] = m_records.insert_or_assign(path, Record{payloadOffset, record.payloadSize});
+        if(inserted)
+        {
+            m_paths.push_back(std::move(path));
+        }
+
+        return payloadOffset + align(record.payloadSize);
+    }
+
+    // OutputReader
+
+    OutputReader::OutputReader(const std::string& directory)
+        : m_directory(directory)
+    {
+        const std::string archivePath = m_directory + "/" + REGRR_ARCHIVE_FILE;
+        if(::access(archivePath.c_str(), F_OK) == 0)
+        {
+            m_archive = std::make_unique<ArchiveReader>(archivePath);
+        }
+    }
+
+    std::string OutputReader::path(std::string_view path) const
+    {
+        if(m_archive)
+        {
+            return m_directory + "/" + REGRR_ARCHIVE_FILE + ":" + std::string(path);
+        }
+
+        return m_directory + "/" + std::string(path);
+    }
+
+    bool OutputReader::exists(std::string_view path) const
+    {
+        if(m_archive)
+        {
+            return m_archive->contains(path);
+        }
+
+        struct stat status{};
+        return ::stat(this->path(path).c_str(), &status) == 0 && S_ISREG(status.st_mode);
+    }
+
+    LoadedMat OutputReader::load(std::string_view path) const
+    {
+        if(m_archive)
+        {
+            return m_archive->load(path);
+        }
+
+        return load_mat(this->path(path));
+    }
+
+    // Lists
+
+    std::vector<std::string> Lists::threads() const
+    {
+        // The map is already sorted, and the empty name of the main thread is first
+        std::vector<std::string> names;
+        for(const auto& [name, flow]: flows)
+        {
+            names.push_back(name);
+        }
+
+        return names;
+    }
+
+    std::string lists_path(const std::string& directory)
+    {
+        const std::string text = directory + "/" REGRR_LISTS_FILE;
+        const std::string binary = directory + "/" REGRR_LISTS_BINARY_FILE;
+
+        struct stat status{};
+        return ::stat(text.c_str(), &status) == 0 || ::stat(binary.c_str(), &status) != 0 ? text : binary;
+    }
+
+    std::string stream_lists(const std::string& path, const std::function<void(std::string_view thread, ListsEvent&& event)>& callback)
+    {
+        std::ifstream file(path);
+        if(!file)
+        {
+            throw std::runtime_error("Cannot open file for read: " + path);
+        }
+
+        // The binary format is told apart by its magic bytes, the text format starts with the extension
+        char magic[sizeof(REGRR_LISTS_MAGIC)] = {};
+        if(file.read(magic, sizeof(magic)) && std::memcmp(magic, REGRR_LISTS_MAGIC, sizeof(magic)) == 0)
+        {
+            file.close();
+            return streamBinaryLists(MappedFile(path), callback);
+        }
+
+        file.clear();
+        file.seekg(0);
+
+        // The first line is the file extension
+        std::string line;
+        std::getline(file, line);
+        const std::string extension(strip(line));
+
+        // The following lines are each event in order (the execution flow)
+        while(std::getline(file, line))
+        {
+            std::string_view text = line;
+
+            // Lines of threads are prefixed with "@name\t" in thread-aware mode
+            std::string_view thread;
+            if(const size_t tab = text.find('\t'); !text.empty() && text[0] == '@' && tab != std::string_view::npos)
+            {
+                thread = text.substr(1, tab - 1);
+                text = text.substr(tab + 1);
+            }
+
+            text = strip(text);
+            if(text.empty())
+            {
+                continue;
+            }
+
+            if(text[0] == '-')
+            {
+                callback(thread, ListsEvent{ListsEvent::ExitScope, {}, {}, {}, {}});
+            }
+            else if(text[0] == '+')
+            {
+                callback(thread, ListsEvent{ListsEvent::EnterScope, std::string(strip(text.substr(1))), {}, {}, {}});
+            }
+            else
+            {
+                // The annotations of a matrix are appended after tabulations, each one starting by a symbol
+                // For example "name.call\t#hash", "name.call\t!reason" when skipped by the budget, or "name.call\t~region" for a region
+                ListsEvent event{ListsEvent::SaveMat, {}, {}, {}, {}};
+                for(size_t tab = text.rfind('\t'); tab != std::string_view::npos; tab = text.rfind('\t'))
+                {
+                    const std::string_view annotation = text.substr(tab + 1);
+                    if(annotation.empty() || (annotation[0] != '#' && annotation[0] != '!' && annotation[0] != '~'))
+                    {
+                        break;
+                    }
+
+                    (annotation[0] == '#' ? event.hash : annotation[0] == '!' ? event.skipped : event.region) = annotation.substr(1);
+                    text = strip(text.substr(0, tab));
+                }
+
+                event.name = text;
+                callback(thread, std::move(event));
+            }
+        }
+
+        return extension;
+    }
+
+    Lists read_lists(const std::string& path)
+    {
+        Lists lists;
+        lists.extension = stream_lists(path, [&lists] (std::string_view thread, ListsEvent&& event) {
+            auto it = lists.flows.find(thread);
+            if(it == lists.flows.end())
+            {
+                it = lists.flows.emplace(std::string(thread), std::vector<ListsEvent>()).first;
+            }
+
+            it->second.push_back(std::move(event));
+        });
+
+        return lists;
+    }
+
+    // ToleranceRules
+
+    ToleranceRules::ToleranceRules(const std::string& path)
+    {
+        std::ifstream file(path);
+        if(!file)
+        {
+            throw std::runtime_error("Cannot open file for read: " + path);
+        }
+
+        std::string line;
+        for(int number = 1; std::getline(file, line); number++)
+        {
+            const std::string_view text = strip(line);
+            if(text.empty() || text[0] == '#')
+            {
+                continue;
+            }
+
+            std::istringstream tokens{std::string(text)};
+            Rule rule;
+            tokens >> rule.glob;
+
+            std::string criterion;
+            while(tokens >> criterion)
+            {
+                const size_t equal = criterion.find('=');
+                const std::string key = criterion.substr(0, equal);
+                const std::string value = equal == std::string::npos ? std::string() : criterion.substr(equal + 1);
+
+                try
+                {
+                    size_t parsed = 0;
+                    if(key == "abs")
+                    {
+                        rule.tolerance.absolute = std::stod(value, &parsed);
+                    }
+                    else if(key == "rel")
+                    {
+                        rule.tolerance.relative = std::stod(value, &parsed);
+                    }
+                    else if(key == "ulp")
+                    {
+                        rule.tolerance.ulp = std::stoll(value, &parsed);
+                    }
+
+                    if(parsed == 0 || parsed != value.size())
+                    {
+                        throw std::invalid_argument(criterion);
+                    }
+                }
+                catch(const std::logic_error&)
+                {
+                    throw std::runtime_error("Invalid tolerance at line " + std::to_string(number) + " of " + path + ": " + criterion);
+                }
+            }
+
+            m_rules.push_back(std::move(rule));
+        }
+    }
+
+    const Tolerance* ToleranceRules::find(std::string_view name) const
+    {
+        for(auto it = m_rules.rbegin(); it != m_rules.rend(); it++)
+        {
+            if(matchGlob(it->glob, name))
+            {
+                return &it->tolerance;
+            }
+        }
+
+        return nullptr;
+    }
+}
\ No newline at end of file
@@ -1,33 +1,109 @@
 #include "regrr.h"
+#include "regrr_format.h"
+#include "regrr_hash.h"
+#include "regrr_codec.h"
+#include "regrr_reader.h"
+#include "downloader.h"
+#include "logger.h"
+#include "pool.h"
+#include "profiler.h"
+#include "uring.h"
 #include <cstdio>
 #include <filesystem>
-#include <sstream>
-#include <fstream>
+#include <iterator>
 #include <string>
-#include <iostream>
+#include <sstream>
 #include <cstdarg>
 #include <utility>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <csignal>
+#include <string_view>
+#include <charconv>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <array>
+#include <bit>
+#include <new>
+#include <memory>
+#include <exception>
 
 #define REGRR_DIR "REGRR_DIR"
 #define REGRR_EXT "REGRR_EXT"
-#define REGRR_LISTS "lists.txt"
+#define REGRR_ASYNC "REGRR_ASYNC"
+#define REGRR_ASYNC_QUEUE "REGRR_ASYNC_QUEUE"
+#define REGRR_LISTS_FLUSH "REGRR_LISTS_FLUSH"
+#define REGRR_FSYNC_ON_SIGNAL "REGRR_FSYNC_ON_SIGNAL"
+#define REGRR_THREADS "REGRR_THREADS"
+#define REGRR_CATEGORIES "REGRR_CATEGORIES"
+#define REGRR_FILTER "REGRR_FILTER"
+#define REGRR_ARCHIVE "REGRR_ARCHIVE"
+#define REGRR_HASH "REGRR_HASH"
+#define REGRR_POOL "REGRR_POOL"
+#define REGRR_COMPRESS "REGRR_COMPRESS"
+#define REGRR_COMPRESS_LEVEL "REGRR_COMPRESS_LEVEL"
+#define REGRR_DELTA "REGRR_DELTA"
+#define REGRR_DELTA_MEMORY "REGRR_DELTA_MEMORY"
+#define REGRR_PROFILE "REGRR_PROFILE"
+#define REGRR_BUDGET "REGRR_BUDGET"
+#define REGRR_LOG "REGRR_LOG"
+#define REGRR_LOG_FILE "REGRR_LOG_FILE"
+#define REGRR_BASELINE "REGRR_BASELINE"
+#define REGRR_BASELINE_SAVE "REGRR_BASELINE_SAVE"
+#define REGRR_BASELINE_FAIL "REGRR_BASELINE_FAIL"
+#define REGRR_BASELINE_TOLERANCE "REGRR_BASELINE_TOLERANCE"
+#define REGRR_BATCH_RELEASES "REGRR_BATCH_RELEASES"
+#define REGRR_URING "REGRR_URING"
+#define REGRR_DIRECT "REGRR_DIRECT"
+#define REGRR_LISTS_BINARY "REGRR_LISTS_BINARY"
+#define REGRR_BASELINE_RESULTS "baseline.txt"
 
 namespace fs = std::filesystem;
 
 /**
- * Utility macro to transform a printf-like varargs to a string.
- * Limited to 1000 characters.
+ * Utility macro to format a printf-like varargs into the thread-local name buffer, see `formatName()`.
  *
- * @param output The string variable output where to store the result.
+ * @param output The string view variable output where to store the result.
+ * It is valid until the next call of this macro in the same thread.
  * @param fmt The argument of the function which contain the format string, before the varargs parameters.
+ *
+ * @throw std::runtime_error If the formatted name is too long.
  */
 #define REGRR_VARARGS_TO_STRING(output, fmt) \
-        {char buf[1000]; \
-        va_list args; \
+        {va_list args; \
+        va_start(args, fmt); \
+        try { output = formatName(fmt, args); } catch(...) { va_end(args); throw; } \
+        va_end(args);} do{}while(false)
+
+/**
+ * Utility macro to save a matrix with the printf-like varargs of its name, see `vsave()`.
+ *
+ * @param fmt The argument of the function which contain the format string, before the varargs parameters.
+ * @param ... The arguments of `vsave()` before the format string.
+ */
+#define REGRR_VARARGS_SAVE(fmt, ...) \
+        {va_list args; \
         va_start(args, fmt); \
-        vsnprintf(buf, sizeof(buf), fmt, args); \
-        va_end(args); \
-        output = std::string(buf);} do{}while(false)
+        try { vsave(__VA_ARGS__, fmt, args); } catch(...) { va_end(args); throw; } \
+        va_end(args);} do{}while(false)
 
 namespace regrr
 {
@@ -38,35 +114,332 @@ namespace regrr
          * Global variables for the internal state of the library.
          */
 
+        /**
+         * Hash for string maps, to look up with a `std::string_view` without building a `std::string`.
+         */
+        struct StringHash
+        {
+            using is_transparent = void;
+
+            size_t operator()(std::string_view value) const
+            {
+                return std::hash<std::string_view>{}(value);
+            }
+        };
+
+        /**
+         * Map from string, which can be looked up with a `std::string_view`.
+         */
+        template<typename T>
+        using StringMap = std::unordered_map<std::string, T, StringHash, std::equal_to<>>;
+
+        /**
+         * Set of strings, which can be looked up with a `std::string_view`.
+         */
+        using StringSet = std::unordered_set<std::string, StringHash, std::equal_to<>>;
+
+        /**
+         * ID of no name, see `NameTable`.
+         */
+        constexpr std::uint32_t NO_NAME = UINT32_MAX;
+
+        /**
+         * Names of the scopes, matrices and threads interned into IDs, shared by all the threads.
+         * An ID is given to each distinct name the first time it is seen and never changes,
+         * so the states are indexed by ID, and the binary lists file refers to the names by ID.
+         * The names are formatted at each call, so each call still hashes its name once to get its ID, see `nameId()`.
+         * Thread-safe, but each thread looks up its own cache first.
+         */
+        class NameTable
+        {
+        public:
+            /**
+             * Get the ID of a name, given the first time it is interned.
+             */
+            std::uint32_t intern(std::string_view name)
+            {
+                std::lock_guard lock(m_mutex);
+
+                auto it = m_ids.find(name);
+                if(it == m_ids.end())
+                {
+                    it = m_ids.emplace(std::string(name), static_cast<std::uint32_t>(m_names.size())).first;
+                    m_names.push_back(&it->first);
+                }
+
+                return it->second;
+            }
+
+            /**
+             * Get the name of an ID, valid forever.
+             */
+            std::string_view name(std::uint32_t id)
+            {
+                std::lock_guard lock(m_mutex);
+                return *m_names[id];
+            }
+
+            /**
+             * @{
+             * Lock around `fork()`, so a child does not inherit the table in the middle of an update, see `beforeFork()`.
+             */
+            void lock()
+            {
+                m_mutex.lock();
+            }
+
+            void unlock()
+            {
+                m_mutex.unlock();
+            }
+            /**
+             * @}
+             */
+
+        private:
+            std::mutex m_mutex;
+            StringMap<std::uint32_t> m_ids;
+
+            /**
+             * The keys of `m_ids` by ID, the nodes of the map never move.
+             */
+            std::vector<const std::string*> m_names;
+        };
+
+        /**
+         * The interned names, never destroyed as the lists file refers to them until the exit.
+         */
+        NameTable& nameTable = *new NameTable;
+
         /**
          * Structure to store managed matrices.
          * Store the call count when the matrice was created,
-         * as well with the scope, to know which filename to give when saved,
+         * as well with the directory of the scope, to know which filename to give when saved,
          * because they could have changed between the creation and the release.
          */
         struct Managed
         {
             cv::Mat mat;
-            std::vector<std::string> scopes;
+            std::string directory;
             int call;
+
+            /**
+             * If the matrix is excluded by the capture filter.
+             * It is still stored so the user can access it, but it is never saved.
+             */
+            bool filtered;
+
+            /**
+             * If the matrix is on a device, in `umat` or `gpuMat` instead of `mat`.
+             * It is downloaded when released.
+             */
+            bool device = false;
+            cv::UMat umat;
+#if REGRR_HAVE_CUDA
+            cv::cuda::GpuMat gpuMat;
+#endif
+        };
+
+        /**
+         * A managed matrix released inside a scope, saved when the scope is exited, see `batchReleases`.
+         */
+        struct BatchedRelease
+        {
+            std::string name;
+            Managed managed;
+
+            /**
+             * Count of scopes when it was released.
+             */
+            size_t depth;
+        };
+
+        /**
+         * A pattern of the capture filter `REGRR_FILTER`.
+         * The pattern is matched against the path `scope1/scope2/.../matName`.
+         * `*` matches any sequence of characters (including `/`) and `?` matches any character.
+         */
+        struct FilterPattern
+        {
+            std::string glob;
+
+            /**
+             * If the pattern is prefixed with `!`: matching matrices are excluded.
+             */
+            bool exclude;
+
+            /**
+             * Index from which the glob only contains `*`.
+             * Equal to the size of the glob if it does not end with `*`.
+             */
+            size_t starTail;
+        };
+
+        /**
+         * The patterns of the capture filter.
+         * If empty, all matrices are captured.
+         */
+        std::vector<FilterPattern> filterPatterns;
+
+        /**
+         * What the capture filter decided for all the matrices of a scope.
+         */
+        enum class FilterVerdict
+        {
+            Included,
+            Excluded,
+
+            /**
+             * Depends on the name of the matrix, should be checked with `filterName()`.
+             */
+            ByName,
+        };
+
+        /**
+         * Partial match of the capture filter against a scope path, cached for each scope.
+         * Incremental, the state of a scope is computed from the state of its parent.
+         */
+        struct FilterState
+        {
+            /**
+             * For each pattern, the positions in the glob reachable after matching the scope path.
+             */
+            std::vector<std::vector<size_t>> positions;
+
+            FilterVerdict verdict = FilterVerdict::Included;
+        };
+
+        /**
+         * The previous call of a matrix, kept to save the next call as a delta against it, see `REGRR_DELTA`.
+         */
+        struct DeltaReference
+        {
+            /**
+             * Copy of the matrix, as the user may modify it after.
+             */
+            cv::Mat mat;
+
+            int call = 0;
+
+            /**
+             * Count of deltas since the last call saved in full.
+             */
+            int chain = 0;
+
+            /**
+             * When the reference was last used, to evict the least recently used.
+             */
+            long long lastUse = 0;
         };
 
         /**
-         * Current scopes pushed.
-         * scopes[0] stores the most outer scope.
+         * State of the library specific to each thread in thread-aware mode.
+         * Otherwise, there is a single state shared by all the threads.
          */
-        std::vector<std::string> scopes;
+        struct ThreadState
+        {
+            /**
+             * Current scopes pushed.
+             * scopes[0] stores the most outer scope.
+             */
+            std::vector<std::string> scopes;
+
+            /**
+             * IDs of the names already interned by this thread, see `nameId()`.
+             */
+            StringMap<std::uint32_t> nameIds;
+
+            /**
+             * Store for each matrix how many time it has been serialized, by ID of its name, 0 if never.
+             * Useful when some part of the algorithm is run multiple time but we want to check each separately.
+             */
+            std::vector<int> callCounts;
+
+            /**
+             * Managed matrices, by ID of their name.
+             */
+            std::unordered_map<std::uint32_t, Managed> managedMats;
+
+            /**
+             * Managed matrices released but not saved yet, in the order of the releases, see `batchReleases`.
+             * The depths are increasing, as the releases of a scope are saved when exiting it.
+             */
+            std::vector<BatchedRelease> batchedReleases;
+
+            /**
+             * State of the capture filter of each scope, only when the filter is enabled.
+             * filters[0] is the state outside any scope, filters[i + 1] the state of scopes[i].
+             */
+            std::vector<FilterState> filters;
+
+            /**
+             * Directory of the current scope, `outputDir/threadName/scope1/scope2/.../` with a trailing `/`.
+             * Built incrementally when entering and exiting scopes, empty until first used.
+             */
+            std::string directory;
+
+            /**
+             * Size of `directory` before each scope was entered, to remove it when exiting the scope.
+             */
+            std::vector<size_t> directorySizes;
+
+            /**
+             * The directories already created by this thread.
+             * Permits to not check again the whole hierarchy on each save.
+             */
+            StringSet createdDirectories;
+
+            /**
+             * Previous call of each matrix, by directory and name, only when the deltas are enabled.
+             */
+            StringMap<DeltaReference> deltas;
+
+            /**
+             * Count of bytes of the matrices in `deltas`, at most `deltaMemory`.
+             */
+            size_t deltaBytes = 0;
+
+            /**
+             * Count of uses of `deltas`, as a clock for `DeltaReference::lastUse`.
+             */
+            long long deltaUses = 0;
+
+            /**
+             * Name of the thread, empty for the main thread, and for the other threads not named yet in thread-aware mode.
+             * The lines of the lists file are tagged with this name,
+             * and the matrices are saved under a sub-directory with this name.
+             */
+            std::string name;
+
+            /**
+             * ID of `name`, only interned for the binary lists file.
+             */
+            std::uint32_t nameId = NO_NAME;
+
+            /**
+             * If the thread was reported as not captured because not named, see `capturedThread()`.
+             */
+            bool unnamedReported = false;
+
+            ThreadState() = default;
+
+            /**
+             * Save the managed matrices released in the scopes a thread never exited, when it exits.
+             * Noop for `mainState`, whose releases are saved by `shutdown()`.
+             */
+            ~ThreadState();
+        };
 
         /**
-         * Store for each matrix how many time it has been serialized.
-         * Useful when some part of the algorithm is run multiple time but we want to check each separately.
+         * The state of the main thread, or of all the threads if not in thread-aware mode.
          */
-        std::unordered_map<std::string, int> callCounts;
+        ThreadState mainState;
 
         /**
-         * Managed matrices.
+         * If each thread has its own state.
+         * Enabled with `REGRR_THREADS`.
          */
-        std::unordered_map<std::string, Managed> managedMats;
+        bool threadAware = false;
 
         /**
          * If the library is enabled at runtime.
@@ -74,6 +447,12 @@ namespace regrr
          */
         bool runtimeEnabled = false;
 
+        /**
+         * Categories enabled at runtime.
+         * Default is all categories.
+         */
+        Category runtimeCategories = ~Category(0);
+
         /**
          * Output extension.
          * Default is XML file.
@@ -81,180 +460,3669 @@ namespace regrr
         std::string outputExtension = ".xml";
 
         /**
-         * Output directory.
+         * Output directory.
+         */
+        std::string outputDir;
+
+        /**
+         * The path to the lists file.
+         */
+        std::string listsPath;
+
+        /**
+         * If the lists file is written in the binary format, `lists.rgl` instead of `lists.txt`.
+         * Enabled with `REGRR_LISTS_BINARY`.
+         */
+        bool binaryLists = false;
+
+        /**
+         * Count of background threads writing the matrices.
+         * If zero, the matrices are written synchronously in `save()`.
+         */
+        int asyncThreads = 0;
+
+        /**
+         * Maximum count of matrices waiting to be written in asynchronous mode.
+         * When the queue is full, `save()` blocks until a writer thread is available.
+         */
+        size_t asyncQueueSize = 64;
+
+        /**
+         * If the managed matrices released inside a scope are saved together when exiting the scope, instead of in `release_mat()`.
+         * In archive mode, they are appended with a single write.
+         */
+        bool batchReleases = false;
+
+        /**
+         * Write the lists file every this count of lines.
+         * If zero, only written when the buffer is full, when leaving the outer scope and at exit.
+         */
+        int listsFlush = 0;
+
+        /**
+         * If the files are synchronized to the disk on the fatal signals, with `REGRR_FSYNC_ON_SIGNAL`.
+         * The archive is then written without io_uring, so no record is staged in memory when the process dies.
+         */
+        bool fsyncOnSignal = false;
+
+        /**
+         * If the hash of each matrix saved is recorded in the lists file, next to its name.
+         * Permits to the diff tools to skip the identical matrices without reading them.
+         */
+        bool hashMats = true;
+
+        /**
+         * Codec of the pixels in the native binary format, see `EncodedHeader`.
+         */
+        std::uint32_t outputCodec = REGRR_CODEC_NONE;
+
+        /**
+         * Level of compression given to the codec, 0 for its default.
+         */
+        int codecLevel = 0;
+
+        /**
+         * Save a matrix in full once every this count of calls with the same name in the same scope,
+         * and the other calls as a delta against the previous call.
+         * If zero, the matrices are never saved as a delta.
+         */
+        int deltaInterval = 0;
+
+        /**
+         * Maximum count of bytes of the previous calls kept for the deltas by each thread state.
+         */
+        size_t deltaMemory = 256 * 1024 * 1024;
+
+        /**
+         * @{
+         * Budget of the captures, only if `REGRR_BUDGET` is set, see `save()`.
+         */
+
+        /**
+         * Maximum count of bytes of the matrices saved during the run, 0 if unlimited.
+         */
+        std::uint64_t budgetBytes = 0;
+
+        /**
+         * Maximum count of matrices saved per second, 0 if unlimited.
+         */
+        double budgetRate = 0;
+
+        /**
+         * Save only the first call out of this count of calls of each matrix, 1 to save all the calls.
+         */
+        int budgetEvery = 1;
+
+        /**
+         * Bytes of the matrices accounted so far in the budget.
+         */
+        std::atomic<std::uint64_t> budgetUsed = 0;
+
+        /**
+         * Set once the bytes of the budget are exhausted.
+         * From then, the saves return before even formatting the name of the matrix.
+         */
+        std::atomic<bool> budgetExhausted = false;
+
+        /**
+         * Token bucket of the rate, refilled continuously up to one second of saves.
+         */
+        std::mutex budgetMutex;
+        double budgetTokens = 0;
+        std::chrono::steady_clock::time_point budgetRefill;
+
+        /**
+         * @}
+         */
+
+        /**
+         * @{
+         * State of the initialization, see `ensure_initialized()`.
+         * A process forked once the library is initialized is `Forked` until its first call, see `initializeChild()`.
+         */
+        enum InitState : int
+        {
+            NotInitialized,
+            Initialized,
+            Forked
+        };
+
+        std::atomic<int> initState{NotInitialized};
+
+        /**
+         * Held while initializing, so the other threads calling the library wait for the end of the initialization.
+         */
+        std::mutex initMutex;
+
+        /**
+         * Count of processes forked by this process, and the index of this process among the ones forked by its parent (0 if not forked).
+         * A forked process writes to the sub-directory `fork-N` of the output directory of its parent, N being its index.
+         */
+        int forkCount = 0;
+        int forkIndex = 0;
+        /**
+         * @}
+         */
+
+        /**
+         * Ensure all the variables of the library are initialized.
+         * Must be called in every function of the library.
+         *
+         * @return The value of runtimeEnabled.
+         */
+        bool ensure_initialized();
+
+        /**
+         * Called by `ensure_initialized()` on first call.
+         */
+        void initialize();
+
+        /**
+         * Called by `ensure_initialized()` on first call in a process forked once the library was initialized.
+         */
+        void initializeChild();
+
+        /**
+         * Get the state of the calling thread.
+         * The first time a thread other than the main thread calls it in thread-aware mode, it is registered without name.
+         */
+        ThreadState& state();
+
+        /**
+         * Check if a thread is captured. In thread-aware mode, the threads other than the main thread are only captured once named
+         * with `set_thread_name()`, as a default name would depend on the scheduling. Logs an error the first time it returns false.
+         */
+        bool capturedThread(ThreadState& thread);
+
+        /**
+         * Get the directory of the current scope of a thread, see `ThreadState::directory`.
+         */
+        const std::string& currentDirectory(ThreadState& thread);
+
+        /**
+         * Save the managed matrices released in the scopes of this depth or deeper, see `batchReleases`.
+         * Called at exit for the scopes never exited.
+         */
+        void saveReleases(ThreadState& thread, size_t depth);
+
+        /**
+         * @}
+         */
+
+        /**
+         * @{
+         * Utility functions.
+         */
+
+        /**
+         * Maximum size of a formatted name, including the null terminator.
+         */
+        constexpr size_t maxNameSize = 1000;
+
+        /**
+         * Format a printf-like varargs into a thread-local buffer.
+         * No allocation is done.
+         *
+         * @return A view on the buffer, valid until the next call in the same thread.
+         * @throw std::runtime_error If the formatted name does not fit in `maxNameSize` characters.
+         */
+        std::string_view formatName(const char *fmt, va_list args)
+        {
+            StepTimer timer(Step::Format);
+
+            thread_local char buffer[maxNameSize];
+
+            const int size = std::vsnprintf(buffer, sizeof(buffer), fmt, args);
+            if(size < 0)
+            {
+                throw std::runtime_error(std::string("Invalid name format: ") + fmt);
+            }
+
+            if(static_cast<size_t>(size) >= sizeof(buffer))
+            {
+                throw std::runtime_error("Name too long (" + std::to_string(size) + " characters, the limit is "
+                                         + std::to_string(maxNameSize - 1) + "): " + std::string(buffer, 100) + "...");
+            }
+
+            return std::string_view(buffer, static_cast<size_t>(size));
+        }
+
+        /**
+         * @{
+         * Append a value to a string, without temporary allocation.
+         */
+        void appendTo(std::string& output, std::string_view value)
+        {
+            output.append(value);
+        }
+
+        void appendTo(std::string& output, char value)
+        {
+            output.push_back(value);
+        }
+
+        template<typename T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, char>, int> = 0>
+        void appendTo(std::string& output, T value)
+        {
+            char buffer[24];
+            const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+            output.append(buffer, result.ptr);
+        }
+
+        void appendTo(std::string& output, double value)
+        {
+            char buffer[32];
+            const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+            output.append(buffer, result.ptr);
+        }
+        /**
+         * @}
+         */
+
+        /**
+         * Concat arguments at the end of a string.
+         * Utility function. Reusing the same output string avoids any allocation once its capacity is large enough.
+         */
+        template<typename... Args>
+        void concatTo(std::string& output, const Args& ... args)
+        {
+            (appendTo(output, args), ...);
+        }
+
+        /**
+         * Concat arguments into a string.
+         * Utility function.
+         */
+        template<typename... Args>
+        std::string concat(const Args& ... args)
+        {
+            std::string output;
+            concatTo(output, args...);
+            return output;
+        }
+
+        /**
+         * Concat arguments into a file path exactly like `os.path.join()` in Python.
+         * Utility function.
+         */
+        template<typename First, typename... Args>
+        std::string joinPaths(const First& first, const Args& ... args)
+        {
+            std::string output;
+            appendTo(output, first);
+            ((appendTo(output, '/'), appendTo(output, args)), ...);
+
+            return output;
+        }
+
+        /**
+         * Parse the integer value of an environment variable, in decimal or in hexadecimal with the prefix `0x`.
+         *
+         * @param name The name of the environment variable, for the error.
+         * @throw std::runtime_error If the value is not an integer, or out of the range of the type.
+         */
+        template<typename T>
+        T parseInteger(const char *name, std::string_view value)
+        {
+            const bool hexadecimal = value.size() > 2 && value[0] == '0' && (value[1] == 'x' || value[1] == 'X');
+            const char *begin = value.data() + (hexadecimal ? 2 : 0);
+            const char *end = value.data() + value.size();
+
+            T result{};
+            auto [ptr, error] = std::from_chars(begin, end, result, hexadecimal ? 16 : 10);
+            if(value.empty() || error != std::errc() || ptr != end)
+            {
+                throw std::runtime_error(concat("Invalid integer for ", name, ": ", value));
+            }
+
+            return result;
+        }
+
+        /**
+         * Write a matrix to a file with `cv::FileStorage`.
+         * The format depends on the extension of the path.
+         *
+         * @throw std::runtime_error If the file could not be written.
+         */
+        void writeFileStorageMat(const std::string& path, const cv::Mat& mat)
+        {
+            cv::FileStorage writer;
+
+            // Open the file to write
+            if(!writer.open(path, cv::FileStorage::WRITE))
+            {
+                throw std::runtime_error("Can't open file to write: " + path);
+            }
+
+            // Note:
+            // cv::FileStorage doesn't support matrices with more than 4 elements
+            // So we just flatten the channels in this case with reshape(1)
+            // See https://stackoverflow.com/a/53676859/5110937
+
+            // Write the file to disk
+            // We don't care of the name of the node, but OpenCV requires one
+            // We use a default name, and not the matrix name, in case of special characters that may not be handled by OpenCV
+            writer << "root" << mat.reshape(1);
+            writer.release();
+        }
+
+        /**
+         * Write all the buffers to a file descriptor, in order.
+         * Use as few system calls as possible: a single `writev()` unless there are more buffers than `IOV_MAX`
+         * or the kernel does a partial write.
+         *
+         * @throw std::runtime_error If the file could not be written.
+         */
+        void writeAll(int fd, std::vector<iovec>& buffers, const std::string& path)
+        {
+            size_t first = 0;
+            while(first < buffers.size())
+            {
+                const int count = static_cast<int>(std::min<size_t>(buffers.size() - first, IOV_MAX));
+                const ssize_t written = ::writev(fd, &buffers[first], count);
+                if(written < 0)
+                {
+                    if(errno == EINTR)
+                    {
+                        continue;
+                    }
+
+                    throw std::runtime_error("Can't write file: " + path + ": " + std::strerror(errno));
+                }
+
+                // Skip the buffers fully written, and advance in the buffer partially written
+                size_t remaining = static_cast<size_t>(written);
+                while(first < buffers.size() && remaining >= buffers[first].iov_len)
+                {
+                    remaining -= buffers[first].iov_len;
+                    first++;
+                }
+
+                if(remaining > 0)
+                {
+                    buffers[first].iov_base = static_cast<char*>(buffers[first].iov_base) + remaining;
+                    buffers[first].iov_len -= remaining;
+                }
+            }
+        }
+
+        /**
+         * Prepare the buffers to write a matrix in the native binary format.
+         * See `BinaryHeader` for the layout.
+         * The buffers point to the header and to the matrix, which should both live until written.
+         *
+         * @return The count of bytes of the buffers appended.
+         * @throw std::runtime_error If the matrix has more than 2 dimensions.
+         */
+        size_t binaryBuffers(const std::string& path, const cv::Mat& mat, BinaryHeader& header, std::vector<iovec>& buffers)
+        {
+            if(mat.dims > 2)
+            {
+                throw std::runtime_error("The binary format does not support more than 2 dimensions: " + path);
+            }
+
+            header = BinaryHeader{};
+            std::memcpy(header.magic, REGRR_BINARY_MAGIC, sizeof(header.magic));
+            header.version = REGRR_BINARY_VERSION;
+            header.type = mat.type();
+            header.rows = mat.rows;
+            header.cols = mat.cols;
+            header.channels = mat.channels();
+            header.step = mat.cols * mat.elemSize();
+
+            // Header, then each row without the padding
+            // A continuous matrix is written as a single buffer
+            buffers.push_back(iovec{&header, sizeof(header)});
+
+            if(mat.isContinuous())
+            {
+                buffers.push_back(iovec{const_cast<uchar*>(mat.data), mat.total() * mat.elemSize()});
+            }
+            else
+            {
+                for(int row = 0; row < mat.rows; row++)
+                {
+                    buffers.push_back(iovec{const_cast<uchar*>(mat.ptr(row)), header.step});
+                }
+            }
+
+            return sizeof(header) + header.step * mat.rows;
+        }
+
+        /**
+         * Headers of a matrix in the native binary format, which should live until the matrix is written.
+         */
+        struct BinaryHeaders
+        {
+            EncodedHeader encoded;
+            BinaryHeader header;
+        };
+
+        /**
+         * Prepare the buffers to write a matrix in the native binary format, encoded if needed.
+         * See `EncodedHeader` for the encoded layout.
+         * The compressed pixels are in a buffer of the calling thread, valid until its next call, unless another buffer is given.
+         *
+         * @param reference The call count of the reference of the delta, or 0. The matrix is already the delta.
+         * @param compressed The buffer of the compressed pixels, to keep several matrices until written. Nullptr for the buffer of the thread.
+         * @return The count of bytes of the buffers appended.
+         * @throw std::runtime_error If the matrix has more than 2 dimensions or could not be compressed.
+         */
+        size_t payloadBuffers(const std::string& path, const cv::Mat& mat, int reference, BinaryHeaders& headers, std::vector<iovec>& buffers,
+                              std::vector<unsigned char> *compressed = nullptr)
+        {
+            if(outputCodec == REGRR_CODEC_NONE && reference == 0)
+            {
+                return binaryBuffers(path, mat, headers.header, buffers);
+            }
+
+            // Only the pixels are encoded, after the binary header as is
+            std::vector<iovec> pixels;
+            const size_t size = binaryBuffers(path, mat, headers.header, pixels) - sizeof(BinaryHeader);
+
+            headers.encoded = EncodedHeader{};
+            std::memcpy(headers.encoded.magic, REGRR_ENCODED_MAGIC, sizeof(headers.encoded.magic));
+            headers.encoded.version = REGRR_ENCODED_VERSION;
+            headers.encoded.codec = outputCodec;
+            headers.encoded.reference = reference;
+            headers.encoded.size = size;
+
+            buffers.push_back(iovec{&headers.encoded, sizeof(headers.encoded)});
+            buffers.push_back(iovec{&headers.header, sizeof(headers.header)});
+
+            if(outputCodec == REGRR_CODEC_NONE)
+            {
+                buffers.insert(buffers.end(), pixels.begin() + 1, pixels.end());
+                return sizeof(EncodedHeader) + sizeof(BinaryHeader) + size;
+            }
+
+            // The codecs need the pixels in a single buffer
+            thread_local std::vector<unsigned char> input;
+            thread_local std::vector<unsigned char> threadOutput;
+            std::vector<unsigned char>& output = compressed ? *compressed : threadOutput;
+
+            const void *data = pixels.size() == 2 ? pixels[1].iov_base : nullptr;
+            if(pixels.size() > 2)
+            {
+                input.clear();
+                for(size_t i = 1; i < pixels.size(); i++)
+                {
+                    const unsigned char *row = static_cast<const unsigned char*>(pixels[i].iov_base);
+                    input.insert(input.end(), row, row + pixels[i].iov_len);
+                }
+
+                data = input.data();
+            }
+
+            compress(outputCodec, codecLevel, data, size, output);
+
+            headers.encoded.size = output.size();
+            buffers.push_back(iovec{output.data(), output.size()});
+            return sizeof(EncodedHeader) + sizeof(BinaryHeader) + output.size();
+        }
+
+        /**
+         * Write a matrix to a file in the native binary format, encoded if needed.
+         *
+         * @param reference The call count of the reference of the delta, see `payloadBuffers()`.
+         * @return The count of bytes written.
+         * @throw std::runtime_error If the file could not be written or the matrix has more than 2 dimensions.
+         */
+        size_t writeBinaryMat(const std::string& path, const cv::Mat& mat, int reference)
+        {
+            BinaryHeaders headers;
+            std::vector<iovec> buffers;
+            const size_t size = payloadBuffers(path, mat, reference, headers, buffers);
+
+#if REGRR_HAVE_URING
+            // Copied to the staging buffers, the file is closed in the background
+            if(uringWriter.started())
+            {
+                UringWriter::File *file = uringWriter.open(path);
+                uringWriter.append(*file, buffers);
+                uringWriter.close(file, false);
+                return size;
+            }
+#endif
+
+            const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if(fd < 0)
+            {
+                throw std::runtime_error("Can't open file to write: " + path);
+            }
+
+            try
+            {
+                writeAll(fd, buffers, path);
+            }
+            catch(...)
+            {
+                ::close(fd);
+                throw;
+            }
+
+            ::close(fd);
+            return size;
+        }
+
+        /**
+         * A matrix waiting to be written, by the asynchronous writer or in a batch of the archive.
+         */
+        struct WriteJob
+        {
+            cv::Mat mat;
+            std::string path;
+
+            /**
+             * The call count of the reference if the matrix is a delta, see `payloadBuffers()`.
+             */
+            int reference = 0;
+        };
+
+        /**
+         * Writer of the archive file, see `ArchiveHeader` for the layout.
+         * The records are written directly with a single `writev()` each, so they are in the file even after a crash,
+         * only the index is kept in memory until the archive is closed.
+         */
+        class ArchiveWriter
+        {
+        public:
+            /**
+             * Create or clear the archive file, open it and write the header.
+             *
+             * @throw std::runtime_error If the file could not be opened or written.
+             */
+            void open(const std::string& path)
+            {
+#if REGRR_HAVE_URING
+                if(uringWriter.started() && !fsyncOnSignal)
+                {
+                    m_file = uringWriter.open(path);
+                    m_fd = m_file->fd;
+                }
+                else
+#endif
+                {
+                    m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                }
+
+                if(m_fd < 0)
+                {
+                    throw std::runtime_error("Cannot open file for write: " + path);
+                }
+
+                m_path = path;
+
+                ArchiveHeader header{};
+                std::memcpy(header.magic, REGRR_ARCHIVE_MAGIC, sizeof(header.magic));
+                header.version = REGRR_ARCHIVE_VERSION;
+
+                std::vector<iovec> buffers{iovec{&header, sizeof(header)}};
+                writeBuffers(buffers);
+                m_offset = sizeof(header);
+            }
+
+            /**
+             * If the archive is opened.
+             */
+            bool opened() const
+            {
+                return m_fd >= 0;
+            }
+
+            /**
+             * Append a matrix to the archive, in the native binary format, encoded if needed.
+             * Thread safe, the records are written in the order of the calls.
+             *
+             * @param key Path of the matrix relative to the output directory.
+             * @param reference The call count of the reference of the delta, see `payloadBuffers()`.
+             * @return The count of bytes of the record.
+             * @throw std::runtime_error If the record could not be written or the matrix has more than 2 dimensions.
+             */
+            std::uint64_t write(std::string_view key, const cv::Mat& mat, int reference)
+            {
+                Prepared prepared;
+                std::vector<iovec> buffers;
+                const std::uint64_t size = prepare(key, mat, reference, prepared, buffers, false);
+
+                std::lock_guard lock(m_mutex);
+
+                if(m_fd < 0)
+                {
+                    throw std::runtime_error("The archive is closed: " + m_path);
+                }
+
+                writeBuffers(buffers);
+                m_index.push_back(Entry{m_offset, std::string(key)});
+                m_offset += size;
+                return size;
+            }
+
+            /**
+             * Append several matrices to the archive with a single write, in the order given.
+             * Thread safe, the records are contiguous in the archive.
+             *
+             * @param jobs The matrices, with their full paths.
+             * @param directory The output directory, removed from the paths of the matrices for their keys.
+             * @return The count of bytes of the record of each matrix.
+             * @throw std::runtime_error If the records could not be written or a matrix has more than 2 dimensions.
+             */
+            std::vector<std::uint64_t> write(const std::vector<WriteJob>& jobs, std::string_view directory)
+            {
+                // The headers and the compressed pixels of every record live until the write
+                std::deque<Prepared> prepared;
+                std::vector<iovec> buffers;
+                std::vector<std::uint64_t> sizes;
+                sizes.reserve(jobs.size());
+
+                for(const WriteJob& job: jobs)
+                {
+                    const std::string_view key = std::string_view(job.path).substr(directory.size() + 1);
+                    sizes.push_back(prepare(key, job.mat, job.reference, prepared.emplace_back(), buffers, true));
+                }
+
+                std::lock_guard lock(m_mutex);
+
+                if(m_fd < 0)
+                {
+                    throw std::runtime_error("The archive is closed: " + m_path);
+                }
+
+                writeBuffers(buffers);
+                for(size_t i = 0; i < jobs.size(); i++)
+                {
+                    m_index.push_back(Entry{m_offset, jobs[i].path.substr(directory.size() + 1)});
+                    m_offset += sizes[i];
+                }
+
+                return sizes;
+            }
+
+            /**
+             * Write the index and the footer, then close the file.
+             * Noop if not opened.
+             *
+             * @throw std::runtime_error If the index could not be written.
+             */
+            void close()
+            {
+                static constexpr char zeros[REGRR_ARCHIVE_ALIGNMENT] = {};
+
+                std::lock_guard lock(m_mutex);
+
+                if(m_fd < 0)
+                {
+                    return;
+                }
+
+                std::vector<ArchiveIndexEntry> entries(m_index.size());
+                std::vector<iovec> buffers;
+                buffers.reserve(m_index.size() * 3 + 1);
+
+                for(size_t i = 0; i < m_index.size(); i++)
+                {
+                    entries[i] = ArchiveIndexEntry{m_index[i].offset, static_cast<std::uint32_t>(m_index[i].key.size()), 0};
+                    buffers.push_back(iovec{&entries[i], sizeof(ArchiveIndexEntry)});
+                    buffers.push_back(iovec{m_index[i].key.data(), m_index[i].key.size()});
+                    buffers.push_back(iovec{const_cast<char*>(zeros), padding(m_index[i].key.size())});
+                }
+
+                ArchiveFooter footer{};
+                footer.indexOffset = m_offset;
+                footer.count = m_index.size();
+                std::memcpy(footer.magic, REGRR_ARCHIVE_INDEX_MAGIC, sizeof(footer.magic));
+                footer.version = REGRR_ARCHIVE_VERSION;
+                buffers.push_back(iovec{&footer, sizeof(footer)});
+
+#if REGRR_HAVE_URING
+                // Waits for all the records in flight, so the archive is complete
+                if(m_file)
+                {
+                    writeBuffers(buffers);
+                    UringWriter::File *file = m_file;
+                    m_file = nullptr;
+                    m_fd = -1;
+                    uringWriter.close(file, true);
+                    return;
+                }
+#endif
+
+                const int fd = m_fd;
+                m_fd = -1;
+
+                try
+                {
+                    writeAll(fd, buffers, m_path);
+                }
+                catch(...)
+                {
+                    ::close(fd);
+                    throw;
+                }
+
+                ::close(fd);
+            }
+
+            /**
+             * Submit the records staged in the writer through io_uring, so they are in the archive recovered after a crash.
+             * Noop if the archive is not written through io_uring.
+             */
+            void flush()
+            {
+#if REGRR_HAVE_URING
+                std::lock_guard lock(m_mutex);
+                if(m_file)
+                {
+                    uringWriter.flush(*m_file);
+                }
+#endif
+            }
+
+            /**
+             * Synchronize the records already written to the disk.
+             * Only uses async-signal-safe functions, and never throws.
+             * Not opened through io_uring when synchronized from a signal, as the records staged would be lost.
+             */
+            void syncFromSignal()
+            {
+                if(m_fd >= 0)
+                {
+                    ::fsync(m_fd);
+                }
+            }
+
+            /**
+             * @{
+             * Lock around `fork()`, so a child does not inherit the archive in the middle of a write, see `beforeFork()`.
+             */
+            void lock()
+            {
+                m_mutex.lock();
+            }
+
+            void unlock()
+            {
+                m_mutex.unlock();
+            }
+            /**
+             * @}
+             */
+
+            /**
+             * Forget the archive of the parent in a child process after `fork()`, without writing its index, left to the parent.
+             */
+            void forget()
+            {
+                // Only the descriptor of the child is closed, the file of the writer through io_uring is of the parent
+                if(m_fd >= 0)
+                {
+                    ::close(m_fd);
+                }
+
+                m_fd = -1;
+#if REGRR_HAVE_URING
+                m_file = nullptr;
+#endif
+                m_offset = 0;
+                m_index.clear();
+            }
+
+        private:
+            /**
+             * A record written, kept for the index.
+             */
+            struct Entry
+            {
+                std::uint64_t offset;
+                std::string key;
+            };
+
+            /**
+             * The headers of a record, which should live until written.
+             */
+            struct Prepared
+            {
+                ArchiveRecord record;
+                BinaryHeaders headers;
+
+                /**
+                 * The compressed pixels, only if kept by the record instead of the thread.
+                 */
+                std::vector<unsigned char> compressed;
+            };
+
+            /**
+             * Prepare the buffers to write the record of a matrix.
+             *
+             * @param own If the compressed pixels are kept in `prepared`, to prepare several records before writing them.
+             * @return The count of bytes of the record.
+             */
+            std::uint64_t prepare(std::string_view key, const cv::Mat& mat, int reference, Prepared& prepared, std::vector<iovec>& buffers, bool own)
+            {
+                static constexpr char zeros[REGRR_ARCHIVE_ALIGNMENT] = {};
+
+                ArchiveRecord& record = prepared.record;
+                record = ArchiveRecord{};
+                std::memcpy(record.magic, REGRR_ARCHIVE_RECORD_MAGIC, sizeof(record.magic));
+                record.pathSize = static_cast<std::uint32_t>(key.size());
+
+                buffers.push_back(iovec{&record, sizeof(record)});
+                buffers.push_back(iovec{const_cast<char*>(key.data()), key.size()});
+                buffers.push_back(iovec{const_cast<char*>(zeros), padding(key.size())});
+
+                record.payloadSize = payloadBuffers(m_path, mat, reference, prepared.headers, buffers, own ? &prepared.compressed : nullptr);
+                buffers.push_back(iovec{const_cast<char*>(zeros), padding(record.payloadSize)});
+
+                return sizeof(record) + key.size() + padding(key.size()) + record.payloadSize + padding(record.payloadSize);
+            }
+
+            /**
+             * Write buffers at the end of the archive, through io_uring if started.
+             * Called with the mutex locked, except when opening.
+             */
+            void writeBuffers(std::vector<iovec>& buffers)
+            {
+#if REGRR_HAVE_URING
+                if(m_file)
+                {
+                    uringWriter.append(*m_file, buffers);
+                    return;
+                }
+#endif
+
+                writeAll(m_fd, buffers, m_path);
+            }
+
+            /**
+             * Count of zeros to add after a buffer of this size to align the next one.
+             */
+            static size_t padding(std::uint64_t size)
+            {
+                return static_cast<size_t>((REGRR_ARCHIVE_ALIGNMENT - size % REGRR_ARCHIVE_ALIGNMENT) % REGRR_ARCHIVE_ALIGNMENT);
+            }
+
+            std::mutex m_mutex;
+            int m_fd = -1;
+#if REGRR_HAVE_URING
+            UringWriter::File *m_file = nullptr;
+#endif
+            std::string m_path;
+            std::uint64_t m_offset = 0;
+            std::vector<Entry> m_index;
+        };
+
+        /**
+         * The archive writer, only opened if `REGRR_ARCHIVE` is set.
+         */
+        ArchiveWriter archiveWriter;
+
+        /**
+         * The matrices of the archive written by the calling thread while saving a batch of releases, see `saveReleases()`.
+         * Nullptr when not in a batch, the matrices are then appended to the archive one by one.
+         */
+        thread_local std::vector<WriteJob> *archiveBatch = nullptr;
+
+        /**
+         * Write a matrix to a file, with the backend corresponding to the output extension.
+         * In archive mode, the matrix is appended to the archive instead, or to the batch of the thread if any.
+         *
+         * @param reference The call count of the reference of the delta, see `payloadBuffers()`.
+         * Only in the native binary format.
+         * @throw std::runtime_error If the file could not be written.
+         */
+        void writeMatFile(const std::string& path, const cv::Mat& mat, int reference)
+        {
+            if(archiveBatch && archiveWriter.opened())
+            {
+                // The batch shares the matrix (reference counted), written by `saveReleases()`
+                archiveBatch->push_back(WriteJob{
+                    .mat = mat,
+                    .path = path,
+                    .reference = reference,
+                });
+
+                return;
+            }
+
+            StepTimer timer(Step::Serialize);
+
+            std::uint64_t bytes;
+            if(archiveWriter.opened())
+            {
+                // The key is the path relative to the output directory, as if the file was written
+                bytes = archiveWriter.write(std::string_view(path).substr(outputDir.size() + 1), mat, reference);
+            }
+            else if(outputExtension == REGRR_BINARY_EXT)
+            {
+                bytes = writeBinaryMat(path, mat, reference);
+            }
+            else
+            {
+                writeFileStorageMat(path, mat);
+
+                // The size is only known from the file system, so only asked when profiling
+                bytes = profiling ? fs::file_size(path) : 0;
+            }
+
+            if(profiling)
+            {
+                recordWrite(std::string_view(path).substr(outputDir.size() + 1), bytes);
+            }
+        }
+
+        /**
+         * @}
+         */
+
+        /**
+         * Write matrices in background threads.
+         * The matrices are pushed in a bounded queue, and written by the first available thread.
+         * Only the matrix files are written in the background, the lists file is always written by the caller,
+         * so the order of the lists file is the same as in synchronous mode.
+         */
+        class AsyncWriter
+        {
+        public:
+            /**
+             * Start the writer threads.
+             *
+             * @param threads The count of threads to start.
+             * @param capacity The maximum count of pending jobs before `push()` blocks.
+             */
+            void start(int threads, size_t capacity)
+            {
+                m_capacity = std::max<size_t>(capacity, 1);
+                m_stopping = false;
+
+                for(int i = 0; i < threads; i++)
+                {
+                    m_threads.emplace_back([this] { run(); });
+                }
+            }
+
+            /**
+             * Push a matrix to write.
+             * Blocks while the queue is full.
+             */
+            void push(WriteJob job)
+            {
+                std::unique_lock lock(m_mutex);
+                m_notFull.wait(lock, [this] { return m_jobs.size() < m_capacity; });
+                m_jobs.push_back(std::move(job));
+                lock.unlock();
+
+                m_notEmpty.notify_one();
+            }
+
+            /**
+             * Write all the pending matrices then stop the threads.
+             * Noop if the threads are not started.
+             */
+            void stop()
+            {
+                {
+                    std::lock_guard lock(m_mutex);
+                    m_stopping = true;
+                }
+
+                m_notEmpty.notify_all();
+
+                for(std::thread& thread: m_threads)
+                {
+                    thread.join();
+                }
+
+                m_threads.clear();
+            }
+
+            /**
+             * @{
+             * Lock around `fork()`, so a child does not inherit the queue in the middle of a push, see `beforeFork()`.
+             */
+            void lock()
+            {
+                m_mutex.lock();
+            }
+
+            void unlock()
+            {
+                m_mutex.unlock();
+            }
+            /**
+             * @}
+             */
+
+            /**
+             * Forget the threads and the pending matrices of the parent in a child process after `fork()`.
+             * Only the thread calling `fork()` exists in the child, the pending matrices are written by the parent.
+             */
+            void forget()
+            {
+                // The threads of the parent cannot be joined, nor destroyed while joinable, so they are leaked
+                static_cast<void>(new std::vector<std::thread>(std::move(m_threads)));
+                m_threads.clear();
+                m_jobs.clear();
+                m_stopping = false;
+
+                // The condition variables still count the threads of the parent waiting on them, which would never wake up,
+                // so they are created again over the ones inherited, which cannot be destroyed
+                new (&m_notEmpty) std::condition_variable;
+                new (&m_notFull) std::condition_variable;
+            }
+
+        private:
+            /**
+             * Main loop of each writer thread.
+             * Exit only when stopping and there is no more pending job.
+             */
+            void run()
+            {
+                while(true)
+                {
+                    std::unique_lock lock(m_mutex);
+                    m_notEmpty.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+
+                    if(m_jobs.empty())
+                    {
+                        return;
+                    }
+
+                    WriteJob job = std::move(m_jobs.front());
+                    m_jobs.pop_front();
+                    lock.unlock();
+
+                    m_notFull.notify_one();
+
+                    // There is nobody to catch the exception in the background, so just log it
+                    try
+                    {
+                        writeMatFile(job.path, job.mat, job.reference);
+                    }
+                    catch(const std::exception& error)
+                    {
+                        logError("SAVE MATRIX", error);
+                    }
+                }
+            }
+
+            std::mutex m_mutex;
+            std::condition_variable m_notEmpty;
+            std::condition_variable m_notFull;
+            std::deque<WriteJob> m_jobs;
+            std::vector<std::thread> m_threads;
+            size_t m_capacity = 1;
+            bool m_stopping = false;
+        };
+
+        /**
+         * Append an unsigned LEB128 varint to a binary record, see `ListsHeader`.
+         */
+        void appendVarint(std::string& record, std::uint64_t value)
+        {
+            while(value >= 0x80)
+            {
+                record += static_cast<char>((value & 0x7F) | 0x80);
+                value >>= 7;
+            }
+
+            record += static_cast<char>(value);
+        }
+
+        /**
+         * Buffered writer for the lists file.
+         * The file is opened once, and the lines are accumulated in a fixed buffer,
+         * written when the buffer is full, every `flushEvery` lines, or when `flush()` is called.
+         * In binary mode, the records are accumulated instead of the lines, see `ListsHeader`.
+         *
+         * The buffer has a fixed address and size so `flushFromSignal()` can write it from a signal handler.
+         */
+        class ListsWriter
+        {
+        public:
+            /**
+             * Create or clear the lists file and open it.
+             *
+             * @param flushEvery Write the buffer every this count of lines. If zero, only when full or when asked.
+             * @param binary If the records are appended in the binary format instead of the lines, the header is written now.
+             * @throw std::runtime_error If the file could not be opened.
+             */
+            void open(const std::string& path, int flushEvery, bool binary = false)
+            {
+                m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                if(m_fd < 0)
+                {
+                    throw std::runtime_error("Cannot open file for write: " + path);
+                }
+
+                m_path = path;
+                m_flushEvery = flushEvery;
+
+                if(binary)
+                {
+                    ListsHeader header;
+                    std::memcpy(header.magic, REGRR_LISTS_MAGIC, sizeof(header.magic));
+                    header.version = REGRR_LISTS_VERSION;
+                    std::memcpy(m_buffer, &header, sizeof(header));
+                    m_size = sizeof(header);
+                }
+            }
+
+            /**
+             * Append a line to the lists file.
+             * A newline character '\n' is automatically added at the end of the line.
+             *
+             * @throw std::runtime_error If the buffer had to be written and the write failed.
+             */
+            void append(std::string_view line)
+            {
+                StepTimer timer(Step::Lists);
+                std::lock_guard lock(m_mutex);
+                appendLocked(line, true);
+            }
+
+            /**
+             * Append a record to the binary lists file, see `ListsHeader`.
+             * The names it refers to are defined before if not already, and the thread is switched if it is not the last one.
+             *
+             * @param thread The ID of the name of the thread of the record, `NO_NAME` for a record of no thread like the extension.
+             * @param names The IDs of the names in the record, `NO_NAME` for the names not in the record.
+             * @throw std::runtime_error If the buffer had to be written and the write failed.
+             */
+            void appendRecord(std::uint32_t thread, std::string_view record, std::initializer_list<std::uint32_t> names)
+            {
+                StepTimer timer(Step::Lists);
+                std::lock_guard lock(m_mutex);
+
+                m_record.clear();
+                if(thread != NO_NAME && thread != m_thread)
+                {
+                    defineLocked(thread);
+                    appendVarint(m_record, REGRR_LISTS_THREAD);
+                    appendVarint(m_record, thread);
+                    m_thread = thread;
+                }
+
+                for(const std::uint32_t id: names)
+                {
+                    defineLocked(id);
+                }
+
+                m_record += record;
+                appendLocked(m_record, false);
+            }
+
+            /**
+             * Write the buffered lines to the file.
+             *
+             * @throw std::runtime_error If the file could not be written.
+             */
+            void flush()
+            {
+                StepTimer timer(Step::Lists);
+                std::lock_guard lock(m_mutex);
+                flushLocked();
+            }
+
+            /**
+             * Flush and close the file.
+             * Noop if not opened.
+             */
+            void close()
+            {
+                std::lock_guard lock(m_mutex);
+
+                if(m_fd >= 0)
+                {
+                    flushLocked();
+                    ::close(m_fd);
+                    m_fd = -1;
+                }
+            }
+
+            /**
+             * Write the buffered lines and synchronize the file to the disk.
+             * Only uses async-signal-safe functions, and never throws.
+             */
+            void flushFromSignal()
+            {
+                if(m_fd >= 0)
+                {
+                    size_t written = 0;
+                    while(written < m_size)
+                    {
+                        const ssize_t count = ::write(m_fd, m_buffer + written, m_size - written);
+                        if(count <= 0)
+                        {
+                            break;
+                        }
+
+                        written += static_cast<size_t>(count);
+                    }
+
+                    m_size = 0;
+                    ::fsync(m_fd);
+                }
+            }
+
+            /**
+             * @{
+             * Lock around `fork()`, so a child does not inherit the file in the middle of a write, see `beforeFork()`.
+             */
+            void lock()
+            {
+                m_mutex.lock();
+            }
+
+            void unlock()
+            {
+                m_mutex.unlock();
+            }
+            /**
+             * @}
+             */
+
+            /**
+             * Forget the file of the parent in a child process after `fork()`, with the lines buffered that the parent writes itself.
+             */
+            void forget()
+            {
+                if(m_fd >= 0)
+                {
+                    ::close(m_fd);
+                }
+
+                m_fd = -1;
+                m_size = 0;
+                m_lines = 0;
+                m_defined.clear();
+                m_thread = NO_NAME;
+            }
+
+        private:
+            /**
+             * Same as `append()`, but the mutex should be already locked.
+             *
+             * @param newline If a newline character '\n' is added at the end of the data.
+             */
+            void appendLocked(std::string_view data, bool newline)
+            {
+                const size_t size = data.size() + newline;
+                if(m_size + size > sizeof(m_buffer))
+                {
+                    flushLocked();
+
+                    // Too long to ever fit in the buffer, write it directly
+                    if(size > sizeof(m_buffer))
+                    {
+                        writeRaw(data.data(), data.size());
+                        if(newline)
+                        {
+                            writeRaw("\n", 1);
+                        }
+
+                        return;
+                    }
+                }
+
+                std::memcpy(m_buffer + m_size, data.data(), data.size());
+                if(newline)
+                {
+                    m_buffer[m_size + data.size()] = '\n';
+                }
+
+                m_size += size;
+
+                m_lines++;
+                if(m_flushEvery > 0 && m_lines % m_flushEvery == 0)
+                {
+                    flushLocked();
+                }
+            }
+
+            /**
+             * Append the `REGRR_LISTS_NAME` record of a name to `m_record`, unless already defined in the file or `NO_NAME`.
+             * The mutex should be already locked.
+             */
+            void defineLocked(std::uint32_t id)
+            {
+                if(id == NO_NAME)
+                {
+                    return;
+                }
+
+                if(id >= m_defined.size())
+                {
+                    m_defined.resize(id + 1, false);
+                }
+
+                if(!m_defined[id])
+                {
+                    const std::string_view name = nameTable.name(id);
+                    appendVarint(m_record, REGRR_LISTS_NAME);
+                    appendVarint(m_record, id);
+                    appendVarint(m_record, name.size());
+                    m_record += name;
+                    m_defined[id] = true;
+                }
+            }
+
+            /**
+             * Same as `flush()`, but the mutex should be already locked.
+             */
+            void flushLocked()
+            {
+                const size_t size = m_size;
+                m_size = 0;
+                writeRaw(m_buffer, size);
+
+                // The records of the archive staged in the meantime are recovered with the lines after a crash
+                archiveWriter.flush();
+            }
+
+            /**
+             * Write a buffer to the file, retrying on partial writes.
+             *
+             * @throw std::runtime_error If the file could not be written.
+             */
+            void writeRaw(const char *data, size_t size)
+            {
+                while(size > 0)
+                {
+                    const ssize_t count = ::write(m_fd, data, size);
+                    if(count < 0)
+                    {
+                        if(errno == EINTR)
+                        {
+                            continue;
+                        }
+
+                        throw std::runtime_error("Cannot write file: " + m_path + ": " + std::strerror(errno));
+                    }
+
+                    data += count;
+                    size -= static_cast<size_t>(count);
+                }
+            }
+
+            std::mutex m_mutex;
+            int m_fd = -1;
+            std::string m_path;
+            int m_flushEvery = 0;
+            long long m_lines = 0;
+            char m_buffer[64 * 1024];
+            size_t m_size = 0;
+
+            /**
+             * In binary mode: the record appended with its definitions, the names defined by ID, and the thread of the last record.
+             */
+            std::string m_record;
+            std::vector<bool> m_defined;
+            std::uint32_t m_thread = NO_NAME;
+        };
+
+        /**
+         * The asynchronous writer, only started if `asyncThreads > 0`.
+         */
+        AsyncWriter asyncWriter;
+
+        /**
+         * @{
+         * Budget implementation.
+         */
+
+        /**
+         * Parse the budget of the captures, settings `key=value` separated by `,`:
+         * `bytes` with an optional `K`, `M` or `G` suffix, `rate` in saves per second, and `every`.
+         *
+         * @throw std::runtime_error If a setting is unknown or its value invalid.
+         */
+        void parseBudget(std::string_view budget)
+        {
+            while(!budget.empty())
+            {
+                const size_t comma = std::min(budget.find(','), budget.size());
+                const std::string_view setting = budget.substr(0, comma);
+                budget.remove_prefix(std::min(comma + 1, budget.size()));
+
+                if(setting.empty())
+                {
+                    continue;
+                }
+
+                const size_t equal = setting.find('=');
+                const std::string_view key = setting.substr(0, equal);
+                const std::string_view value = equal == std::string_view::npos ? std::string_view() : setting.substr(equal + 1);
+                const char *end = value.data() + value.size();
+
+                bool valid = false;
+                if(key == "bytes")
+                {
+                    auto [ptr, error] = std::from_chars(value.data(), end, budgetBytes);
+                    if(error == std::errc() && ptr + 1 == end)
+                    {
+                        const char suffix = static_cast<char>(std::toupper(static_cast<unsigned char>(*ptr)));
+                        const int shift = suffix == 'K' ? 10 : suffix == 'M' ? 20 : suffix == 'G' ? 30 : 0;
+                        // Invalid if too large once multiplied, the suffix is then not consumed
+                        if(budgetBytes <= UINT64_MAX >> shift)
+                        {
+                            budgetBytes <<= shift;
+                            ptr += shift > 0;
+                        }
+                    }
+
+                    valid = error == std::errc() && ptr == end;
+                }
+                else if(key == "rate")
+                {
+                    const std::string text(value);
+                    char *ptr = nullptr;
+                    budgetRate = std::strtod(text.c_str(), &ptr);
+                    valid = !text.empty() && *ptr == '\0' && budgetRate >= 0;
+                }
+                else if(key == "every")
+                {
+                    auto [ptr, error] = std::from_chars(value.data(), end, budgetEvery);
+                    valid = error == std::errc() && ptr == end && budgetEvery >= 1;
+                }
+
+                if(!valid)
+                {
+                    throw std::runtime_error("Invalid budget setting: " + std::string(setting));
+                }
+            }
+
+            // The bucket starts full
+            budgetTokens = std::max(budgetRate, 1.0);
+            budgetRefill = std::chrono::steady_clock::now();
+        }
+
+        /**
+         * @{
+         * Size of the pixels of a matrix of the host or of a device.
+         */
+        std::uint64_t matBytes(const cv::Mat& mat)
+        {
+            return mat.total() * mat.elemSize();
+        }
+
+        std::uint64_t matBytes(const cv::UMat& mat)
+        {
+            return mat.total() * mat.elemSize();
+        }
+
+#if REGRR_HAVE_CUDA
+        std::uint64_t matBytes(const cv::cuda::GpuMat& mat)
+        {
+            return static_cast<std::uint64_t>(mat.rows) * mat.cols * mat.elemSize();
+        }
+#endif
+        /**
+         * @}
+         */
+
+        /**
+         * Check if a matrix fits in the budget, and account for it if so.
+         *
+         * @param call The call count of the matrix, already incremented.
+         * @param size The size of the pixels of the matrix, see `matBytes()`.
+         * @return The reason why the matrix is not saved (`every`, `rate` or `bytes`), or nullptr to save it.
+         */
+        const char* budgetSkip(int call, std::uint64_t size)
+        {
+            if(budgetEvery > 1 && (call - 1) % budgetEvery != 0)
+            {
+                return "every";
+            }
+
+            if(budgetRate > 0)
+            {
+                std::lock_guard lock(budgetMutex);
+                const auto now = std::chrono::steady_clock::now();
+                const double elapsed = std::chrono::duration<double>(now - budgetRefill).count();
+                budgetTokens = std::min(budgetTokens + elapsed * budgetRate, std::max(budgetRate, 1.0));
+                budgetRefill = now;
+
+                if(budgetTokens < 1)
+                {
+                    return "rate";
+                }
+
+                budgetTokens -= 1;
+            }
+
+            if(budgetBytes > 0)
+            {
+                if(budgetUsed.fetch_add(size, std::memory_order_relaxed) + size > budgetBytes)
+                {
+                    budgetExhausted.store(true, std::memory_order_relaxed);
+                    return "bytes";
+                }
+            }
+
+            return nullptr;
+        }
+
+        /**
+         * @}
+         */
+
+        /**
+         * @{
+         * Capture filter implementation.
+         * Each glob is matched as a non-deterministic automaton: the state is the set of positions reachable in the glob,
+         * which permits to match incrementally and to know early if a match is still possible.
+         */
+
+        /**
+         * Parse the capture filter, patterns separated by `;`.
+         */
+        void parseFilter(const std::string& filter)
+        {
+            size_t begin = 0;
+            while(begin <= filter.size())
+            {
+                size_t end = filter.find(';', begin);
+                if(end == std::string::npos)
+                {
+                    end = filter.size();
+                }
+
+                std::string glob = filter.substr(begin, end - begin);
+                begin = end + 1;
+
+                if(glob.empty())
+                {
+                    continue;
+                }
+
+                FilterPattern pattern{};
+                pattern.exclude = (glob[0] == '!');
+                pattern.glob = pattern.exclude ? glob.substr(1) : glob;
+
+                pattern.starTail = pattern.glob.size();
+                while(pattern.starTail > 0 && pattern.glob[pattern.starTail - 1] == '*')
+                {
+                    pattern.starTail--;
+                }
+
+                filterPatterns.push_back(std::move(pattern));
+            }
+        }
+
+        /**
+         * Add the positions reachable without consuming a character, that is skipping `*`.
+         */
+        void closePositions(const FilterPattern& pattern, std::vector<size_t>& positions)
+        {
+            for(size_t i = 0; i < positions.size(); i++)
+            {
+                const size_t position = positions[i];
+                if(position < pattern.glob.size() && pattern.glob[position] == '*'
+                   && std::find(positions.begin(), positions.end(), position + 1) == positions.end())
+                {
+                    positions.push_back(position + 1);
+                }
+            }
+        }
+
+        /**
+         * Advance the positions of a glob by matching a string.
+         * Stops early if no position is reachable anymore.
+         */
+        void advancePositions(const FilterPattern& pattern, std::vector<size_t>& positions, std::string_view text)
+        {
+            std::vector<size_t> next;
+
+            for(const char c: text)
+            {
+                if(positions.empty())
+                {
+                    return;
+                }
+
+                next.clear();
+                for(const size_t position: positions)
+                {
+                    if(position >= pattern.glob.size())
+                    {
+                        continue;
+                    }
+
+                    const char g = pattern.glob[position];
+                    size_t target;
+                    if(g == '*')
+                    {
+                        // The star consumes the character and stays
+                        target = position;
+                    }
+                    else if(g == '?' || g == c)
+                    {
+                        target = position + 1;
+                    }
+                    else
+                    {
+                        continue;
+                    }
+
+                    if(std::find(next.begin(), next.end(), target) == next.end())
+                    {
+                        next.push_back(target);
+                    }
+                }
+
+                closePositions(pattern, next);
+                std::swap(positions, next);
+            }
+        }
+
+        /**
+         * Check if a glob matches any name from these positions: it is at or after the final stars.
+         */
+        bool matchesAnyName(const FilterPattern& pattern, const std::vector<size_t>& positions)
+        {
+            return std::any_of(positions.begin(), positions.end(), [&pattern] (size_t position) {
+                return position >= pattern.starTail && position < pattern.glob.size();
+            });
+        }
+
+        /**
+         * Compute the verdict for all the matrices of a scope.
+         */
+        FilterVerdict computeVerdict(const FilterState& state)
+        {
+            bool hasInclude = false;
+            bool includeAll = false;
+            bool includeNone = true;
+            bool excludeAll = false;
+            bool excludeNone = true;
+
+            for(size_t i = 0; i < filterPatterns.size(); i++)
+            {
+                const FilterPattern& pattern = filterPatterns[i];
+                const std::vector<size_t>& positions = state.positions[i];
+
+                if(pattern.exclude)
+                {
+                    excludeAll = excludeAll || matchesAnyName(pattern, positions);
+                    excludeNone = excludeNone && positions.empty();
+                }
+                else
+                {
+                    hasInclude = true;
+                    includeAll = includeAll || matchesAnyName(pattern, positions);
+                    includeNone = includeNone && positions.empty();
+                }
+            }
+
+            if((hasInclude && includeNone) || excludeAll)
+            {
+                return FilterVerdict::Excluded;
+            }
+
+            if((!hasInclude || includeAll) && excludeNone)
+            {
+                return FilterVerdict::Included;
+            }
+
+            return FilterVerdict::ByName;
+        }
+
+        /**
+         * The state of the filter outside any scope.
+         */
+        FilterState rootFilterState()
+        {
+            FilterState state;
+            for(const FilterPattern& pattern: filterPatterns)
+            {
+                std::vector<size_t> positions{0};
+                closePositions(pattern, positions);
+                state.positions.push_back(std::move(positions));
+            }
+
+            state.verdict = computeVerdict(state);
+            return state;
+        }
+
+        /**
+         * The state of the filter inside a scope from the state of its parent.
+         */
+        FilterState childFilterState(const FilterState& parent, std::string_view scopeName)
+        {
+            FilterState state = parent;
+            for(size_t i = 0; i < filterPatterns.size(); i++)
+            {
+                advancePositions(filterPatterns[i], state.positions[i], scopeName);
+                advancePositions(filterPatterns[i], state.positions[i], "/");
+            }
+
+            state.verdict = computeVerdict(state);
+            return state;
+        }
+
+        /**
+         * The state of the filter for arbitrary scopes, not cached.
+         */
+        FilterState scopesFilterState(const std::vector<std::string>& scopes)
+        {
+            FilterState state = rootFilterState();
+            for(const std::string& scope: scopes)
+            {
+                state = childFilterState(state, scope);
+            }
+
+            return state;
+        }
+
+        /**
+         * Check if a matrix is captured when the verdict of its scope depends on its name.
+         */
+        bool filterName(const FilterState& state, std::string_view matName)
+        {
+            bool hasInclude = false;
+            bool included = false;
+
+            for(size_t i = 0; i < filterPatterns.size(); i++)
+            {
+                const FilterPattern& pattern = filterPatterns[i];
+                std::vector<size_t> positions = state.positions[i];
+                advancePositions(pattern, positions, matName);
+
+                const bool match = std::find(positions.begin(), positions.end(), pattern.glob.size()) != positions.end();
+                if(pattern.exclude)
+                {
+                    if(match)
+                    {
+                        return false;
+                    }
+                }
+                else
+                {
+                    hasInclude = true;
+                    included = included || match;
+                }
+            }
+
+            return !hasInclude || included;
+        }
+
+        /**
+         * Get the filter state of the current scope of a thread, or of custom scopes.
+         *
+         * @param custom Storage for the state if `scopesPtr` is not null, as it is not cached.
+         * @return nullptr if the filter is disabled.
+         */
+        const FilterState* scopeFilter(ThreadState& thread, const std::vector<std::string>* scopesPtr, FilterState& custom)
+        {
+            if(filterPatterns.empty())
+            {
+                return nullptr;
+            }
+
+            if(scopesPtr)
+            {
+                custom = scopesFilterState(*scopesPtr);
+                return &custom;
+            }
+
+            if(thread.filters.empty())
+            {
+                thread.filters.push_back(rootFilterState());
+            }
+
+            return &thread.filters.back();
+        }
+
+        /**
+         * Check if a matrix is captured.
+         *
+         * @param filter The state of the scope of the matrix, nullptr if the filter is disabled.
+         */
+        bool captured(const FilterState* filter, std::string_view matName)
+        {
+            if(!filter || filter->verdict == FilterVerdict::Included)
+            {
+                return true;
+            }
+
+            return filter->verdict == FilterVerdict::ByName && filterName(*filter, matName);
+        }
+
+        /**
+         * @}
+         */
+
+        /**
+         * The lists file, opened in `initialize()`.
+         */
+        ListsWriter listsWriter;
+
+        /**
+         * Append the extension of the matrix files to the lists file, its first line or its first record in binary.
+         */
+        void appendExtension()
+        {
+            if(binaryLists)
+            {
+                std::string record;
+                appendVarint(record, REGRR_LISTS_EXTENSION);
+                appendVarint(record, outputExtension.size());
+                record += outputExtension;
+                listsWriter.appendRecord(NO_NAME, record, {});
+            }
+            else
+            {
+                listsWriter.append(outputExtension);
+            }
+        }
+
+        /**
+         * Append an event of a thread to the lists file.
+         * In thread-aware mode, the lines of the threads other than the main thread are tagged with `@name\t`,
+         * so the flow of each thread can be extracted from the lists file.
+         */
+        void appendEvent(const ThreadState& thread, std::string_view line)
+        {
+            if(thread.name.empty())
+            {
+                listsWriter.append(line);
+            }
+            else
+            {
+                thread_local std::string tagged;
+                tagged.clear();
+                concatTo(tagged, '@', thread.name, '\t', line);
+                listsWriter.append(tagged);
+            }
+        }
+
+        /**
+         * A thread-local string to build a line of the lists file.
+         * Cleared on each call, its capacity is kept so there is no allocation in the steady state.
+         */
+        std::string& lineBuffer()
+        {
+            thread_local std::string line;
+            line.clear();
+            return line;
+        }
+
+        /**
+         * Get the ID of a name, interned the first time this thread sees it.
+         * The cache of the thread is looked up without lock, the shared table only the first time.
+         * The single hash of the name of a save, `get_mat()` or `release_mat()`, the state of the matrix is then found by its ID.
+         */
+        std::uint32_t nameId(ThreadState& thread, std::string_view name)
+        {
+            auto it = thread.nameIds.find(name);
+            if(it == thread.nameIds.end())
+            {
+                it = thread.nameIds.emplace(std::string(name), nameTable.intern(name)).first;
+            }
+
+            return it->second;
+        }
+
+        /**
+         * Get the ID of the name of a thread, interned again when the thread is renamed.
+         */
+        std::uint32_t threadNameId(ThreadState& thread)
+        {
+            if(thread.nameId == NO_NAME)
+            {
+                thread.nameId = nameId(thread, thread.name);
+            }
+
+            return thread.nameId;
+        }
+
+        /**
+         * Append to the lists file that a thread enters a scope.
+         */
+        void appendEnter(ThreadState& thread, std::string_view scopeName)
+        {
+            if(binaryLists)
+            {
+                const std::uint32_t id = nameId(thread, scopeName);
+                std::string& record = lineBuffer();
+                appendVarint(record, REGRR_LISTS_ENTER);
+                appendVarint(record, id);
+                listsWriter.appendRecord(threadNameId(thread), record, {id});
+                return;
+            }
+
+            std::string& line = lineBuffer();
+            concatTo(line, "+ ", scopeName);
+            appendEvent(thread, line);
+        }
+
+        /**
+         * Append to the lists file that a thread exits its current scope.
+         */
+        void appendExit(ThreadState& thread)
+        {
+            if(binaryLists)
+            {
+                std::string& record = lineBuffer();
+                appendVarint(record, REGRR_LISTS_EXIT);
+                listsWriter.appendRecord(threadNameId(thread), record, {});
+                return;
+            }
+
+            appendEvent(thread, "-");
+        }
+
+        /**
+         * Append a matrix to the lists file, saved or skipped by the budget.
+         *
+         * @param matId The ID of the name of the matrix, or `NO_NAME` to intern it if needed.
+         * @param region The annotation of the region saved, see `regionView()`, empty for the whole matrix.
+         * @param skipped The reason why the matrix was skipped by the budget, nullptr if saved.
+         * @param hash The hash of the matrix, nullptr if not recorded.
+         */
+        void appendMat(ThreadState& thread, std::string_view matName, std::uint32_t matId, int call, std::string_view region,
+                       const char *skipped, const std::uint64_t *hash)
+        {
+            if(binaryLists)
+            {
+                matId = matId == NO_NAME ? nameId(thread, matName) : matId;
+                const std::uint32_t regionId = region.empty() ? NO_NAME : nameId(thread, region);
+                const std::uint32_t skippedId = skipped ? nameId(thread, skipped) : NO_NAME;
+
+                std::string& record = lineBuffer();
+                appendVarint(record, REGRR_LISTS_SAVE);
+                appendVarint(record, matId);
+                appendVarint(record, (static_cast<std::uint32_t>(call) << 1) ^ static_cast<std::uint32_t>(call >> 31));
+                appendVarint(record, (regionId != NO_NAME ? REGRR_LISTS_HAS_REGION : 0) | (skipped ? REGRR_LISTS_HAS_SKIPPED : 0)
+                                     | (hash ? REGRR_LISTS_HAS_HASH : 0));
+
+                if(regionId != NO_NAME)
+                {
+                    appendVarint(record, regionId);
+                }
+
+                if(skipped)
+                {
+                    appendVarint(record, skippedId);
+                }
+
+                // The machines supported are all little-endian, same as the binary format of the matrices
+                if(hash)
+                {
+                    record.append(reinterpret_cast<const char*>(hash), sizeof(*hash));
+                }
+
+                listsWriter.appendRecord(threadNameId(thread), record, {matId, regionId, skippedId});
+                return;
+            }
+
+            std::string& line = lineBuffer();
+            concatTo(line, matName, '.', call);
+            if(!region.empty())
+            {
+                concatTo(line, "\t~", region);
+            }
+
+            if(skipped)
+            {
+                concatTo(line, "\t!", skipped);
+            }
+
+            if(hash)
+            {
+                char hex[17];
+                std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(*hash));
+                concatTo(line, "\t#", std::string_view(hex, 16));
+            }
+
+            appendEvent(thread, line);
+        }
+
+        /**
+         * @{
+         * Live comparison against a baseline, only if `REGRR_BASELINE` is set, see `save()`.
+         */
+
+        /**
+         * The output directory of the baseline, with the extension and the hashes of its lists file.
+         * The hashes are by path relative to the output directory, without the extension, like `scope/name.3`.
+         */
+        std::unique_ptr<OutputReader> baseline;
+        std::string baselineExtension;
+        StringMap<std::uint64_t> baselineHashes;
+
+        /**
+         * Tolerances of the comparisons, from `REGRR_BASELINE_TOLERANCE`.
+         * If null, the matrices are compared like the diff tools.
+         */
+        std::unique_ptr<ToleranceRules> baselineTolerances;
+
+        /**
+         * If the matrices diverging from the baseline are saved, and if the first divergence throws.
+         */
+        bool baselineSave = false;
+        bool baselineFail = false;
+
+        /**
+         * Count of matrices compared and diverging, for the summary at exit.
+         */
+        std::atomic<size_t> baselineCompared = 0;
+        std::atomic<size_t> baselineDivergent = 0;
+
+        /**
+         * The results of the comparisons, one line per matrix in the order of the saves.
+         */
+        ListsWriter baselineWriter;
+
+        /**
+         * Open the baseline and read the hashes of its lists file.
+         *
+         * @throw std::runtime_error If the lists file of the baseline could not be read.
+         */
+        void openBaseline(const std::string& directory)
+        {
+            const Lists lists = read_lists(lists_path(directory));
+            baselineExtension = lists.extension;
+
+            for(const auto& [thread, flow]: lists.flows)
+            {
+                std::string prefix = thread.empty() ? std::string() : thread + '/';
+                std::vector<size_t> sizes;
+
+                for(const ListsEvent& event: flow)
+                {
+                    if(event.type == ListsEvent::EnterScope)
+                    {
+                        sizes.push_back(prefix.size());
+                        concatTo(prefix, event.name, '/');
+                    }
+                    else if(event.type == ListsEvent::ExitScope)
+                    {
+                        if(!sizes.empty())
+                        {
+                            prefix.resize(sizes.back());
+                            sizes.pop_back();
+                        }
+                    }
+                    else if(std::uint64_t hash; std::from_chars(event.hash.data(), event.hash.data() + event.hash.size(), hash, 16).ec == std::errc())
+                    {
+                        baselineHashes[prefix + event.name] = hash;
+                    }
+                }
+            }
+
+            baseline = std::make_unique<OutputReader>(directory);
+        }
+
+        /**
+         * Compare a matrix to the same one of the baseline, and append the result to the results file.
+         * A matrix missing from the baseline, or which cannot be compared to it, is divergent.
+         *
+         * @param name The path of the matrix relative to the output directory, without the extension.
+         * @param hash The hash of the matrix, compared to the one of the baseline, or nullptr if not hashed.
+         * @return The result if the matrix diverges from the baseline, valid until the next call in the same thread,
+         * or nullptr if the matrix is the same.
+         */
+        const std::string* compareBaseline(std::string_view name, const cv::Mat& mat, const std::uint64_t *hash)
+        {
+            thread_local std::string result;
+            thread_local std::string path;
+            result.clear();
+            path.clear();
+            concatTo(result, name, ": ");
+            concatTo(path, name, baselineExtension);
+
+            bool divergent = true;
+            try
+            {
+                const auto baselineHash = baselineHashes.find(name);
+                if(!baseline->exists(path))
+                {
+                    concatTo(result, "missing in the baseline");
+                }
+                else if(hash && baselineHash != baselineHashes.end() && *hash == baselineHash->second)
+                {
+                    // Identical hashes, the matrices are the same without reading the baseline
+                    concatTo(result, "d=0");
+                    divergent = false;
+                }
+                else if(const Tolerance *tolerance = baselineTolerances ? baselineTolerances->find(name.substr(0, name.rfind('.'))) : nullptr; tolerance)
+                {
+                    const ToleranceResult check = check_tolerance(mat, baseline->load(path).mat, *tolerance);
+                    divergent = !check.within;
+                    if(divergent)
+                    {
+                        concatTo(result, "out of tolerance at element ", check.index, ", ", check.a, " and ", check.b);
+                    }
+                    else
+                    {
+                        concatTo(result, "within tolerance");
+                    }
+                }
+                else
+                {
+                    // Same threshold as the diff tools
+                    const DiffStats stats = diff_stats(mat, baseline->load(path).mat);
+                    divergent = stats.l1 >= 0.001;
+                    concatTo(result, "d=", stats.l1);
+                    if(divergent)
+                    {
+                        concatTo(result, ", min=", stats.min, ", max=", stats.max, ", avg=", stats.avg,
+                                 ", median=", stats.median, ", std=", stats.std);
+                    }
+                }
+            }
+            catch(const std::exception& error)
+            {
+                concatTo(result, "error: ", error.what());
+            }
+
+            baselineWriter.append(result);
+            baselineCompared.fetch_add(1, std::memory_order_relaxed);
+            if(divergent)
+            {
+                baselineDivergent.fetch_add(1, std::memory_order_relaxed);
+                return &result;
+            }
+
+            return nullptr;
+        }
+
+        /**
+         * Throw on a divergence from the baseline, if `REGRR_BASELINE_FAIL` is set.
+         * The files are written up to the divergence first, as the exception may terminate the process.
+         *
+         * @throw std::runtime_error If asked to fail.
+         */
+        void checkDivergence(const std::string& result)
+        {
+            if(baselineFail)
+            {
+                listsWriter.flush();
+                baselineWriter.flush();
+                logger.flush();
+                throw std::runtime_error("Divergence from the baseline: " + result);
+            }
+        }
+
+        /**
+         * @}
+         */
+
+        /**
+         * Signals on which the lists file is synchronized to the disk before the process dies,
+         * if enabled with `REGRR_FSYNC_ON_SIGNAL`.
+         */
+        constexpr int fatalSignals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGTERM, SIGINT};
+
+        /**
+         * The handlers installed before ours for each of `fatalSignals`, restored before re-raising the signal.
+         */
+        struct sigaction previousHandlers[std::size(fatalSignals)];
+
+        /**
+         * Signal handler to save the lists file before the process dies.
+         * Restore the previous handler then raise again the signal, so the default behaviour (core dump, ...) is kept.
+         */
+        void onFatalSignal(int signal)
+        {
+            // The buffers of a forked process are the ones of its parent until it is initialized
+            if(initState.load(std::memory_order_relaxed) != Forked)
+            {
+                listsWriter.flushFromSignal();
+                baselineWriter.flushFromSignal();
+                archiveWriter.syncFromSignal();
+                logger.flushFromSignal();
+            }
+
+            for(size_t i = 0; i < std::size(fatalSignals); i++)
+            {
+                if(fatalSignals[i] == signal)
+                {
+                    ::sigaction(signal, &previousHandlers[i], nullptr);
+                }
+            }
+
+            ::raise(signal);
+        }
+
+        /**
+         * Install `onFatalSignal()` for all the `fatalSignals`.
+         */
+        void installSignalHandlers()
+        {
+            struct sigaction action{};
+            action.sa_handler = onFatalSignal;
+            sigemptyset(&action.sa_mask);
+
+            for(size_t i = 0; i < std::size(fatalSignals); i++)
+            {
+                ::sigaction(fatalSignals[i], &action, &previousHandlers[i]);
+            }
+        }
+
+        /**
+         * Write the pending matrices, the index of the archive and the lists files, then close them.
+         * Noop for the ones not opened.
+         */
+        void closeOutputs()
+        {
+#if REGRR_HAVE_CUDA
+            // The downloads in flight are handed to the asynchronous writer, so they are written before it stops
+            deviceDownloader.stop();
+#endif
+            asyncWriter.stop();
+
+            try
+            {
+                archiveWriter.close();
+            }
+            catch(const std::exception& error)
+            {
+                logError("WRITE ARCHIVE FILE", error);
+            }
+
+#if REGRR_HAVE_URING
+            // The matrix files still in flight
+            uringWriter.stop();
+#endif
+
+            try
+            {
+                listsWriter.close();
+            }
+            catch(const std::exception& error)
+            {
+                logError("WRITE LISTS FILE", error);
+            }
+
+            try
+            {
+                baselineWriter.close();
+            }
+            catch(const std::exception& error)
+            {
+                logError("WRITE BASELINE RESULTS", error);
+            }
+        }
+
+        /**
+         * Called at exit to flush the pending matrices, the index of the archive and the lists file.
+         * Registered with `std::atexit()`, so it runs before the destruction of the global variables.
+         */
+        void shutdown()
+        {
+            // A forked process which never called the library only has the files and the threads of its parent,
+            // the threads are forgotten so they are not destroyed while joinable
+            if(initState.load(std::memory_order_acquire) == Forked)
+            {
+                asyncWriter.forget();
+                return;
+            }
+
+            // The releases of the scopes never exited, if the process exits from inside a scope
+            try
+            {
+                saveReleases(mainState, 0);
+            }
+            catch(const std::exception& error)
+            {
+                logError("SAVE MATRIX", error);
+            }
+
+            closeOutputs();
+
+            if(baseline)
+            {
+                logger.write(LogLevel::Info, concat("***** REGRR baseline: ", baselineCompared.load(), " matrices compared, ",
+                                                    baselineDivergent.load(), " divergent"));
+            }
+
+            // Once all the matrices are written
+            if(profiling)
+            {
+                printStats(stats());
+            }
+
+            logger.flush();
+        }
+
+        // Implementation of initialization functions
+
+        bool ensure_initialized()
+        {
+            // A single load once initialized, acquire so the variables set by the initialization are seen
+            if(initState.load(std::memory_order_acquire) != Initialized)
+            {
+                std::lock_guard lock(initMutex);
+
+                const int current = initState.load(std::memory_order_relaxed);
+                if(current == NotInitialized)
+                {
+                    initialize();
+                }
+                else if(current == Forked)
+                {
+                    initializeChild();
+                }
+
+                initState.store(Initialized, std::memory_order_release);
+            }
+
+            return runtimeEnabled;
+        }
+
+        /**
+         * @{
+         * Handlers of `fork()`, see `initializeChild()`.
+         * Every mutex is locked before forking so the child does not inherit one locked by a thread which does not exist in it,
+         * in the order they are nested.
+         */
+        void beforeFork()
+        {
+            // Registered in the parent, otherwise a thread which never called the library would be the main thread of the child
+            state();
+
+            initMutex.lock();
+            listsWriter.lock();
+            baselineWriter.lock();
+            archiveWriter.lock();
+            asyncWriter.lock();
+#if REGRR_HAVE_URING
+            uringWriter.lock();
+#endif
+            nameTable.lock();
+            bufferPool.lock();
+            budgetMutex.lock();
+            scopeStatsMutex.lock();
+            logger.lock();
+
+            forkCount++;
+        }
+
+        void unlockAfterFork()
+        {
+            logger.unlock();
+            scopeStatsMutex.unlock();
+            budgetMutex.unlock();
+            bufferPool.unlock();
+            nameTable.unlock();
+#if REGRR_HAVE_URING
+            uringWriter.unlock();
+#endif
+            asyncWriter.unlock();
+            archiveWriter.unlock();
+            baselineWriter.unlock();
+            listsWriter.unlock();
+            initMutex.unlock();
+        }
+
+        void afterForkInParent()
+        {
+            unlockAfterFork();
+        }
+
+        /**
+         * Only marks the child as forked, it is initialized at its first call of the library.
+         * So a child which calls `exec()` or never captures anything does not create any file.
+         */
+        void afterForkInChild()
+        {
+            unlockAfterFork();
+
+            forkIndex = forkCount;
+            forkCount = 0;
+
+            if(initState.load(std::memory_order_relaxed) == Initialized)
+            {
+                initState.store(Forked, std::memory_order_relaxed);
+            }
+        }
+        /**
+         * @}
+         */
+
+        /**
+         * The handlers of `fork()`, registered when the library is loaded,
+         * so the processes forked before the library is initialized get their own sub-directory too.
+         */
+        [[maybe_unused]] const int forkHandlers = ::pthread_atfork(beforeFork, afterForkInParent, afterForkInChild);
+
+        void initializeChild()
+        {
+            // The background threads, the files and the buffers of the parent are forgotten even if the library is disabled,
+            // the parent writes them
+            const bool archive = archiveWriter.opened();
+            asyncWriter.forget();
+            archiveWriter.forget();
+            listsWriter.forget();
+            baselineWriter.forget();
+            logger.forget();
+#if REGRR_HAVE_URING
+            const unsigned uringDepth = uringWriter.started() ? uringWriter.depth() : 0;
+            const bool uringDirect = uringWriter.direct();
+            uringWriter.forget();
+#endif
+
+            if(!runtimeEnabled)
+            {
+                return;
+            }
+
+            try
+            {
+                outputDir = joinPaths(outputDir, concat("fork-", forkIndex));
+                fs::create_directories(outputDir);
+
+                listsPath = joinPaths(outputDir, binaryLists ? REGRR_LISTS_BINARY_FILE : REGRR_LISTS_FILE);
+                listsWriter.open(listsPath, listsFlush, binaryLists);
+                appendExtension();
+
+#if REGRR_HAVE_URING
+                if(uringDepth > 0)
+                {
+                    try
+                    {
+                        uringWriter.start(uringDepth, uringDirect);
+                    }
+                    catch(const std::exception& error)
+                    {
+                        logger.write(LogLevel::Info, concat("***** REGRR ", error.what(), ", the files are written with write()"));
+                    }
+                }
+#endif
+
+                if(archive)
+                {
+                    archiveWriter.open(joinPaths(outputDir, REGRR_ARCHIVE_FILE));
+                }
+
+                if(baseline)
+                {
+                    baselineWriter.open(joinPaths(outputDir, REGRR_BASELINE_RESULTS), listsFlush);
+                }
+
+                if(asyncThreads > 0)
+                {
+                    asyncWriter.start(asyncThreads, asyncQueueSize);
+                }
+
+                // Only the thread which forked exists in the child
+                // Its managed matrices and releases are of the parent, which saves them, and its scopes are entered again
+                // in the lists file of the child, so its flow is complete
+                ThreadState& thread = state();
+                for(auto& [id, managed]: thread.managedMats)
+                {
+                    managed.filtered = true;
+                }
+
+                thread.batchedReleases.clear();
+                mainState.batchedReleases.clear();
+                thread.createdDirectories.clear();
+                thread.deltas.clear();
+                thread.deltaBytes = 0;
+
+                for(const std::string& scope: thread.scopes)
+                {
+                    appendEnter(thread, scope);
+                }
+
+                // The directory of the scopes is rebuilt in the output directory of the child, with the sizes to exit them
+                thread.directory.clear();
+                currentDirectory(thread);
+
+                logger.write(LogLevel::Info, concat("***** REGRR forked: output directory \"", outputDir, '"'));
+            }
+            catch(const std::runtime_error& error)
+            {
+                logError("INITIALIZE FORKED PROCESS", error);
+                runtimeEnabled = false;
+            }
+        }
+
+        ThreadState& state()
+        {
+            if(!threadAware)
+            {
+                return mainState;
+            }
+
+            // Register the thread on first call, the main thread of the process whichever thread initialized the library
+            // In a child, the thread which forked keeps the state it had in the parent, registered by `beforeFork()`
+            thread_local ThreadState& current = [] () -> ThreadState& {
+                if(::syscall(SYS_gettid) == ::getpid())
+                {
+                    return mainState;
+                }
+
+                thread_local ThreadState local;
+                return local;
+            }();
+
+            return current;
+        }
+
+        bool capturedThread(ThreadState& thread)
+        {
+            if(!threadAware || !thread.name.empty() || &thread == &mainState)
+            {
+                return true;
+            }
+
+            if(!thread.unnamedReported)
+            {
+                thread.unnamedReported = true;
+                logError("CAPTURE UNNAMED THREAD", std::runtime_error("The threads other than the main one should be named with set_thread_name()"));
+            }
+
+            return false;
+        }
+
+        void initialize()
+        {
+            // Configure the messages first, even if the library is disabled, as the banner is one of them
+            // An invalid setting is only logged, the library can work without its messages
+            try
+            {
+                if(const char *level = std::getenv(REGRR_LOG); level)
+                {
+                    logger.setLevel(parseLogLevel(level));
+                }
+
+                if(const char *logFile = std::getenv(REGRR_LOG_FILE); logFile)
+                {
+                    logger.open(logFile);
+                }
+            }
+            catch(const std::runtime_error& error)
+            {
+                logError("CONFIGURE THE LOGS", error);
+            }
+
+            // Check if the user set an output directory.
+            // This will define if the library is enabled or not.
+            if(const char *dir = std::getenv(REGRR_DIR); dir)
+            {
+                outputDir = dir;
+
+                // A process forked before its parent initialized the library has its own sub-directory too
+                if(forkIndex > 0)
+                {
+                    outputDir = joinPaths(outputDir, concat("fork-", forkIndex));
+                }
+
+                try
+                {
+                    // All the settings are parsed before any file is opened, so an invalid one leaves nothing behind
+
+                    // Check if each thread should have its own state
+                    if(const char *threads = std::getenv(REGRR_THREADS); threads && std::atoi(threads))
+                    {
+                        threadAware = true;
+                    }
+
+                    // Check if only some matrices should be captured
+                    if(const char *filter = std::getenv(REGRR_FILTER); filter)
+                    {
+                        parseFilter(filter);
+                    }
+
+                    // Check which categories are enabled
+                    if(const char *categories = std::getenv(REGRR_CATEGORIES); categories)
+                    {
+                        runtimeCategories = parseInteger<Category>(REGRR_CATEGORIES, categories);
+                    }
+
+                    // Check if the lists file is written in the binary format
+                    if(const char *binary = std::getenv(REGRR_LISTS_BINARY); binary)
+                    {
+                        binaryLists = std::atoi(binary) != 0;
+                    }
+
+                    // Check how often the lists file should be written
+                    if(const char *flush = std::getenv(REGRR_LISTS_FLUSH); flush)
+                    {
+                        listsFlush = std::max(std::atoi(flush), 0);
+                    }
+
+                    if(const char *fsync = std::getenv(REGRR_FSYNC_ON_SIGNAL); fsync && std::atoi(fsync))
+                    {
+                        fsyncOnSignal = true;
+                    }
+
+                    // Check if custom file extension
+                    if(const char *ext = std::getenv(REGRR_EXT); ext)
+                    {
+                        outputExtension = ext;
+                    }
+
+#if REGRR_HAVE_URING
+                    // Check if the binary files and the archive should be written through io_uring
+                    unsigned uringDepth = 0;
+                    bool uringDirect = false;
+                    if(const char *uring = std::getenv(REGRR_URING); uring)
+                    {
+                        uringDepth = parseInteger<unsigned>(REGRR_URING, uring);
+                        if(const char *direct = std::getenv(REGRR_DIRECT); uringDepth > 0 && direct)
+                        {
+                            uringDirect = parseInteger<int>(REGRR_DIRECT, direct) != 0;
+                        }
+                    }
+#endif
+
+                    // Check if the matrices should be appended to a single archive file
+                    // The archive only contains the native binary format
+                    bool archive = false;
+                    if(const char *archiveSetting = std::getenv(REGRR_ARCHIVE); archiveSetting && std::atoi(archiveSetting))
+                    {
+                        archive = true;
+                        outputExtension = REGRR_BINARY_EXT;
+                    }
+
+                    // Check if the pixels should be compressed, only in the native binary format
+                    if(const char *compress = std::getenv(REGRR_COMPRESS); compress)
+                    {
+                        outputCodec = codec_from_name(compress);
+                        if(outputCodec != REGRR_CODEC_NONE)
+                        {
+                            outputExtension = REGRR_BINARY_EXT;
+                        }
+                    }
+
+                    if(const char *level = std::getenv(REGRR_COMPRESS_LEVEL); level)
+                    {
+                        codecLevel = parseInteger<int>(REGRR_COMPRESS_LEVEL, level);
+                    }
+
+                    // Check if the successive calls of a matrix should be saved as deltas, only in the native binary format
+                    if(const char *delta = std::getenv(REGRR_DELTA); delta)
+                    {
+                        deltaInterval = std::max(parseInteger<int>(REGRR_DELTA, delta), 0);
+                        if(deltaInterval > 0)
+                        {
+                            outputExtension = REGRR_BINARY_EXT;
+                        }
+                    }
+
+                    if(const char *deltaBytes = std::getenv(REGRR_DELTA_MEMORY); deltaBytes)
+                    {
+                        deltaMemory = parseInteger<size_t>(REGRR_DELTA_MEMORY, deltaBytes);
+                    }
+
+                    // Check if the hashes of the matrices should be recorded
+                    if(const char *hash = std::getenv(REGRR_HASH); hash)
+                    {
+                        hashMats = std::atoi(hash) != 0;
+                    }
+
+                    // Check if the matrices should be compared to a baseline instead of saved
+                    // The deltas are disabled, as the previous calls are not saved
+                    const char *baselineDir = std::getenv(REGRR_BASELINE);
+                    if(baselineDir)
+                    {
+                        deltaInterval = 0;
+
+                        if(const char *tolerance = std::getenv(REGRR_BASELINE_TOLERANCE); tolerance)
+                        {
+                            baselineTolerances = std::make_unique<ToleranceRules>(tolerance);
+                        }
+
+                        if(const char *save = std::getenv(REGRR_BASELINE_SAVE); save)
+                        {
+                            baselineSave = std::atoi(save) != 0;
+                        }
+
+                        if(const char *fail = std::getenv(REGRR_BASELINE_FAIL); fail)
+                        {
+                            baselineFail = std::atoi(fail) != 0;
+                        }
+                    }
+
+                    // Check how many bytes the pool of matrices can keep
+                    if(const char *pool = std::getenv(REGRR_POOL); pool)
+                    {
+                        poolCapacity = parseInteger<size_t>(REGRR_POOL, pool);
+                    }
+
+                    // Check if the captures are limited
+                    if(const char *budget = std::getenv(REGRR_BUDGET); budget)
+                    {
+                        parseBudget(budget);
+                    }
+
+                    // Check if the library should measure itself
+                    if(const char *profile = std::getenv(REGRR_PROFILE); profile)
+                    {
+                        profiling = std::atoi(profile) != 0;
+                    }
+
+                    // Check if the matrices should be written in background threads
+                    if(const char *async = std::getenv(REGRR_ASYNC); async)
+                    {
+                        asyncThreads = std::max(parseInteger<int>(REGRR_ASYNC, async), 0);
+                    }
+
+                    if(const char *queueSize = std::getenv(REGRR_ASYNC_QUEUE); queueSize)
+                    {
+                        asyncQueueSize = std::max(parseInteger<int>(REGRR_ASYNC_QUEUE, queueSize), 1);
+                    }
+
+                    if(const char *batch = std::getenv(REGRR_BATCH_RELEASES); batch)
+                    {
+                        batchReleases = parseInteger<int>(REGRR_BATCH_RELEASES, batch) != 0;
+                    }
+
+                    // Read the baseline before writing anything, it may be the output directory of a previous run
+                    if(baselineDir)
+                    {
+                        openBaseline(baselineDir);
+                    }
+
+                    // If the output directory does not exist, try to create it (noop if it already exists)
+                    fs::create_directories(outputDir);
+
+                    // Get the path of the lists file
+                    // The lists file of the other format is removed, so the tools do not read the one of a previous run
+                    listsPath = joinPaths(outputDir, binaryLists ? REGRR_LISTS_BINARY_FILE : REGRR_LISTS_FILE);
+                    std::error_code removeError;
+                    fs::remove(joinPaths(outputDir, binaryLists ? REGRR_LISTS_FILE : REGRR_LISTS_BINARY_FILE), removeError);
+
+                    // Clear or create the lists file, kept open until the exit
+                    listsWriter.open(listsPath, listsFlush, binaryLists);
+
+#if REGRR_HAVE_URING
+                    // Before the archive is opened
+                    if(uringDepth > 0)
+                    {
+                        try
+                        {
+                            uringWriter.start(uringDepth, uringDirect);
+                        }
+                        catch(const std::exception& error)
+                        {
+                            logger.write(LogLevel::Info, concat("***** REGRR ", error.what(), ", the files are written with write()"));
+                        }
+                    }
+#endif
+
+                    if(archive)
+                    {
+                        archiveWriter.open(joinPaths(outputDir, REGRR_ARCHIVE_FILE));
+                    }
+
+                    // First line is the file extension
+                    appendExtension();
+
+                    if(baselineDir)
+                    {
+                        baselineWriter.open(joinPaths(outputDir, REGRR_BASELINE_RESULTS), listsFlush);
+                    }
+
+                    if(asyncThreads > 0)
+                    {
+                        asyncWriter.start(asyncThreads, asyncQueueSize);
+                    }
+
+#if REGRR_HAVE_CUDA
+                    // The matrices downloaded from the device are written like the others, as many in flight as queued
+                    deviceDownloader.configure(asyncQueueSize, [] (cv::Mat mat, std::string path) {
+                        if(asyncThreads > 0)
+                        {
+                            asyncWriter.push(WriteJob{
+                                .mat = std::move(mat),
+                                .path = std::move(path),
+                                .reference = 0,
+                            });
+                        }
+                        else
+                        {
+                            writeMatFile(path, mat, 0);
+                        }
+                    });
+#endif
+
+                    // Once the files to synchronize are opened
+                    if(fsyncOnSignal)
+                    {
+                        installSignalHandlers();
+                    }
+
+                    std::atexit(shutdown);
+
+                    // If no error, enable the library
+                    runtimeEnabled = true;
+                }
+                catch(const std::runtime_error& error)
+                {
+                    logError("INITIALIZE REGRESSION TESTS", error);
+
+                    // The files opened before a failure to write them
+                    closeOutputs();
+                    baseline.reset();
+                }
+            }
+
+            // A single message, so the banner is not interleaved with the messages of other threads
+            std::ostringstream banner;
+            banner << "***** REGRR library initialized:" << '\n';
+            banner << "    enabled: " << runtimeEnabled << '\n';
+            banner << "    file extension: \"" << outputExtension << "\"" << '\n';
+            banner << "    output directory: \"" << outputDir << "\"" << '\n';
+            banner << "    lists path: \"" << listsPath << "\"" << '\n';
+            banner << "    lists binary: " << binaryLists << '\n';
+            banner << "    archive: " << archiveWriter.opened() << '\n';
+            banner << "    codec: " << codec_name(outputCodec) << " (level " << codecLevel << ")" << '\n';
+            banner << "    delta interval: " << deltaInterval << '\n';
+            banner << "    async writers: " << asyncThreads << '\n';
+            banner << "    batch releases: " << batchReleases << '\n';
+#if REGRR_HAVE_URING
+            banner << "    io_uring: " << uringWriter.started() << " (registered " << uringWriter.registered() << ", direct " << uringWriter.direct() << ")" << '\n';
+#endif
+            banner << "    lists flush: " << listsFlush << '\n';
+            banner << "    pool capacity: " << poolCapacity << '\n';
+            banner << "    hashes: " << hashMats << '\n';
+            banner << "    baseline: \"" << (baseline ? baseline->directory() : std::string()) << "\" (save " << baselineSave << ", fail " << baselineFail << ")" << '\n';
+            banner << "    budget: " << budgetBytes << " bytes, " << budgetRate << " saves/s, every " << budgetEvery << " calls" << '\n';
+            banner << "    profiling: " << profiling << '\n';
+            banner << "    thread-aware: " << threadAware << '\n';
+            banner << "    categories: 0x" << std::hex << runtimeCategories << std::dec << '\n';
+            banner << "    filter patterns: " << filterPatterns.size() << '\n';
+
+            logger.write(LogLevel::Info, std::move(banner).str());
+            logger.flush();
+        }
+
+        const std::string& currentDirectory(ThreadState& thread)
+        {
+            if(thread.directory.empty())
+            {
+                concatTo(thread.directory, outputDir, '/');
+
+                if(!thread.name.empty())
+                {
+                    concatTo(thread.directory, thread.name, '/');
+                }
+
+                // The sizes are rebuilt with the directory, the output directory may have changed, see `initializeChild()`
+                thread.directorySizes.clear();
+                for(const std::string& scope: thread.scopes)
+                {
+                    thread.directorySizes.push_back(thread.directory.size());
+                    concatTo(thread.directory, scope, '/');
+                }
+            }
+
+            return thread.directory;
+        }
+
+        /**
+         * Build the directory of custom scopes, not cached.
+         */
+        std::string scopesDirectory(const ThreadState& thread, const std::vector<std::string>& scopes)
+        {
+            std::string directory;
+            concatTo(directory, outputDir, '/');
+
+            if(!thread.name.empty())
+            {
+                concatTo(directory, thread.name, '/');
+            }
+
+            for(const std::string& scope: scopes)
+            {
+                concatTo(directory, scope, '/');
+            }
+
+            return directory;
+        }
+
+        /**
+         * Create a directory and its parents, unless already done by this thread.
+         */
+        void ensureDirectory(ThreadState& thread, std::string_view directory)
+        {
+            if(thread.createdDirectories.find(directory) == thread.createdDirectories.end())
+            {
+                StepTimer timer(Step::Directories);
+                fs::create_directories(directory);
+                thread.createdDirectories.emplace(directory);
+            }
+        }
+
+        /**
+         * Increment the call count of a matrix and get it.
+         * Only allocates the first time a name is seen.
+         *
+         * @param matId The ID of the name of the matrix, see `nameId()`.
+         */
+        int nextCall(ThreadState& thread, std::uint32_t matId)
+        {
+            if(matId >= thread.callCounts.size())
+            {
+                thread.callCounts.resize(matId + 1, 0);
+            }
+
+            return ++thread.callCounts[matId];
+        }
+
+        /**
+         * Get the previous call of a matrix with the same name in the same directory, see `REGRR_DELTA`.
+         * Created empty the first time, valid until the next call of `keepDeltaReference()`.
+         */
+        DeltaReference& deltaReference(ThreadState& thread, std::string_view directory, std::string_view matName)
+        {
+            thread_local std::string key;
+            key.clear();
+            concatTo(key, directory, matName);
+
+            auto it = thread.deltas.find(key);
+            if(it == thread.deltas.end())
+            {
+                it = thread.deltas.emplace(key, DeltaReference{}).first;
+            }
+
+            it->second.lastUse = ++thread.deltaUses;
+            return it->second;
+        }
+
+        /**
+         * Prepare the delta of a matrix against its previous call, if it has the same shape and the chain is not too long.
+         *
+         * @param delta Output of the XOR of the matrix with the previous call, only set if it returns a previous call.
+         * @return The call count of the previous call, or 0 if the matrix should be saved in full.
+         */
+        int deltaEncode(const DeltaReference& previous, const cv::Mat& mat, cv::Mat& delta)
+        {
+            const bool same = !previous.mat.empty() && previous.mat.rows == mat.rows && previous.mat.cols == mat.cols && previous.mat.type() == mat.type();
+            if(!same || previous.chain + 1 >= deltaInterval)
+            {
+                return 0;
+            }
+
+            delta.allocator = allocator();
+            delta.create(mat.rows, mat.cols, mat.type());
+
+            const size_t rowSize = mat.cols * mat.elemSize();
+            for(int row = 0; row < mat.rows; row++)
+            {
+                xor_bytes(mat.ptr(row), previous.mat.ptr(row), delta.ptr(row), rowSize);
+            }
+
+            return previous.call;
+        }
+
+        /**
+         * Keep a copy of a matrix written as the reference of the next call, the least recently used are evicted beyond `deltaMemory`.
+         * Only once the matrix is written, so the next delta never refers to a call missing from the disk.
+         * In asynchronous mode the matrix is handed to the writers, the errors of the write are only logged.
+         *
+         * @param reference The call count of the reference of the delta written, 0 if the matrix was written in full.
+         */
+        void keepDeltaReference(ThreadState& thread, DeltaReference& previous, int call, int reference, const cv::Mat& mat)
+        {
+            previous.chain = reference > 0 ? previous.chain + 1 : 0;
+
+            // In the same buffer if the shape did not change
+            const bool same = !previous.mat.empty() && previous.mat.rows == mat.rows && previous.mat.cols == mat.cols && previous.mat.type() == mat.type();
+            if(!same)
+            {
+                thread.deltaBytes -= previous.mat.total() * previous.mat.elemSize();
+                previous.mat = cv::Mat();
+                previous.mat.allocator = allocator();
+                thread.deltaBytes += mat.total() * mat.elemSize();
+            }
+
+            mat.copyTo(previous.mat);
+            previous.call = call;
+
+            // Evict the least recently used, for example the matrices of a scope which is not entered anymore
+            while(thread.deltaBytes > deltaMemory && thread.deltas.size() > 1)
+            {
+                auto oldest = thread.deltas.end();
+                for(auto candidate = thread.deltas.begin(); candidate != thread.deltas.end(); ++candidate)
+                {
+                    if(oldest == thread.deltas.end() || candidate->second.lastUse < oldest->second.lastUse)
+                    {
+                        oldest = candidate;
+                    }
+                }
+
+                thread.deltaBytes -= oldest->second.mat.total() * oldest->second.mat.elemSize();
+                thread.deltas.erase(oldest);
+            }
+        }
+
+        /**
+         * Append a matrix saved to the lists file, with its region and its hash.
+         *
+         * @param matId The ID of the name of the matrix, or `NO_NAME` to intern it if needed.
+         * @param region The annotation of the region saved, see `regionView()`, empty for the whole matrix.
+         * @param hash The hash of the matrix, recorded if the hashes are enabled, or nullptr if not hashed.
+         */
+        void appendSave(ThreadState& thread, std::string_view matName, std::uint32_t matId, int call, std::string_view region,
+                        const std::uint64_t *hash)
+        {
+            // Append the name of the matrix to the lists file
+            // Permit to iterate in the same order at the execution
+            // We couldn't have use reliably the timestamp because it is OS-dependant whether the file will be created at some exact time in order
+            // Also save the call count in the name
+            appendMat(thread, matName, matId, call, region, nullptr, hashMats ? hash : nullptr);
+        }
+
+        /**
+         * Get the path of a matrix to save, and create its directory.
+         *
+         * @return The path, in a buffer of the calling thread valid until its next call.
+         */
+        const std::string& matPath(ThreadState& thread, std::string_view directory, std::string_view matName, int call)
+        {
+            // Save the file with full path:
+            // `scope1/scope2/.../matName.callCount.ext`
+            // In thread-aware mode, the threads other than the main thread are saved in a sub-directory with their name:
+            // `threadName/scope1/scope2/.../matName.callCount.ext`
+
+            thread_local std::string path;
+            path.clear();
+            concatTo(path, directory, matName, '.', call, outputExtension);
+
+            if(logger.enabled(LogLevel::Debug))
+            {
+                logger.write(LogLevel::Debug, concat("Saving test \"", path, '"'));
+            }
+
+            // Create intermediate directories if needed, there are none in archive mode
+            // Done by the caller even in asynchronous mode, so the writer threads never race on the same directory
+            if(!archiveWriter.opened())
+            {
+                ensureDirectory(thread, directory);
+            }
+
+            return path;
+        }
+
+        /**
+         * Implementation of `save()` once the name of the matrix is formatted.
+         *
+         * @param copy In asynchronous mode, if the data of the matrix should be copied before returning.
+         * Otherwise only a reference is kept, and the user should not modify the matrix until it is written.
+         * @param region The annotation of the region saved in the lists file, see `regionView()`, empty for the whole matrix.
+         */
+        void saveMat(const cv::Mat& mat, bool append, bool copy, const int *callPtr, std::string_view directory, std::string_view matName,
+                     std::string_view region)
+        {
+            StepTimer timer(Step::Save);
+            ThreadState& thread = state();
+
+            // Get the call count, from the argument or from the internal counter
+            int call;
+            std::uint32_t matId = NO_NAME;
+            if(callPtr)
+            {
+                call = *callPtr;
+            }
+            else
+            {
+                // Increment the call count for this matrix
+                matId = nameId(thread, matName);
+                call = nextCall(thread, matId);
+            }
+
+            // The budget is checked once the call count is incremented, so the calls saved have the same names as without budget
+            // The decision is recorded in the lists file instead of the matrix, only the saves appended to it are budgeted
+            if(const char *skipped = append ? budgetSkip(call, matBytes(mat)) : nullptr; skipped)
+            {
+                appendMat(thread, matName, matId, call, region, skipped, nullptr);
+                return;
+            }
+
+            // The hash is computed by the caller even in asynchronous mode, as the line is written now
+            // Computed once for both the lists file and the comparison with the baseline
+            std::uint64_t hash = 0;
+            const bool hashed = mat.dims <= 2 && ((append && hashMats) || (baseline && !baselineHashes.empty()));
+            if(hashed)
+            {
+                StepTimer hashTimer(Step::Hash);
+                hash = hash_mat(mat);
+            }
+
+            // In baseline mode, the matrix is compared instead of saved, only the divergent matrices are saved if asked
+            // The divergent matrix is written synchronously if it throws, as the process may terminate
+            const std::string *divergence = nullptr;
+            if(baseline)
+            {
+                thread_local std::string name;
+                name.clear();
+                concatTo(name, directory.substr(outputDir.size() + 1), matName, '.', call);
+
+                divergence = compareBaseline(name, mat, hashed ? &hash : nullptr);
+                if(!divergence || !baselineSave)
+                {
+                    if(append)
+                    {
+                        appendSave(thread, matName, matId, call, region, hashed ? &hash : nullptr);
+                    }
+
+                    if(divergence)
+                    {
+                        checkDivergence(*divergence);
+                    }
+
+                    return;
+                }
+            }
+
+            const std::string& path = matPath(thread, directory, matName, call);
+
+            // The delta is computed by the caller even in asynchronous mode, as the matrices of each name are in order
+            cv::Mat delta;
+            int reference = 0;
+            DeltaReference *previous = nullptr;
+            if(deltaInterval > 0 && mat.dims <= 2)
+            {
+                StepTimer deltaTimer(Step::Delta);
+                previous = &deltaReference(thread, directory, matName);
+                reference = deltaEncode(*previous, mat, delta);
+            }
+
+            if(asyncThreads > 0 && !(divergence && baselineFail))
+            {
+                // The snapshot shares the data of the caller (reference counted), unless asked otherwise.
+                // A matrix without reference counter (`u == nullptr`) wraps user memory that may not outlive the call,
+                // so it is always copied, in a buffer of the pool given back once written.
+                // A delta is already a copy.
+                WriteJob job{
+                    .mat = cv::Mat(),
+                    .path = path,
+                    .reference = reference,
+                };
+
+                if(reference > 0)
+                {
+                    job.mat = std::move(delta);
+                }
+                else if(copy || !mat.u)
+                {
+                    job.mat.allocator = allocator();
+                    mat.copyTo(job.mat);
+                }
+                else
+                {
+                    job.mat = mat;
+                }
+
+                asyncWriter.push(std::move(job));
+            }
+            else
+            {
+                writeMatFile(path, reference > 0 ? delta : mat, reference);
+            }
+
+            if(previous)
+            {
+                StepTimer deltaTimer(Step::Delta);
+                keepDeltaReference(thread, *previous, call, reference, mat);
+            }
+
+            if(append)
+            {
+                appendSave(thread, matName, matId, call, region, hashed ? &hash : nullptr);
+            }
+
+            if(divergence)
+            {
+                checkDivergence(*divergence);
+            }
+        }
+
+        /**
+         * Implementation of `save()` for a `cv::UMat`, once the name of the matrix is formatted.
+         * OpenCV has no asynchronous download of a `cv::UMat`, so it is downloaded now to a matrix of the pool,
+         * which is then saved as usual, referenced by the asynchronous writer without another copy.
+         * No copy if the `cv::UMat` is on the host.
+         */
+        void saveMat(const cv::UMat& mat, bool append, bool, const int *callPtr, std::string_view directory, std::string_view matName,
+                     std::string_view region)
+        {
+            cv::Mat host;
+            host.allocator = poolCapacity > 0 ? &bufferPool : nullptr;
+            mat.copyTo(host);
+
+            saveMat(host, append, false, callPtr, directory, matName, region);
+        }
+
+#if REGRR_HAVE_CUDA
+        /**
+         * Implementation of `save()` for a `cv::cuda::GpuMat`, once the name of the matrix is formatted.
+         * The matrix is downloaded in the background by `deviceDownloader`, the line of the lists file is written now without hash.
+         * It is downloaded now and saved as usual where the pixels are needed in order: in baseline mode and with the deltas.
+         */
+        void saveMat(const cv::cuda::GpuMat& mat, bool append, bool, const int *callPtr, std::string_view directory, std::string_view matName,
+                     std::string_view)
+        {
+            if(baseline || deltaInterval > 0)
+            {
+                cv::Mat host;
+                host.allocator = poolCapacity > 0 ? &bufferPool : nullptr;
+                mat.download(host);
+
+                saveMat(host, append, false, callPtr, directory, matName, {});
+                return;
+            }
+
+            StepTimer timer(Step::Save);
+            ThreadState& thread = state();
+
+            // Same as for a matrix of the host, see above
+            const std::uint32_t matId = callPtr ? NO_NAME : nameId(thread, matName);
+            const int call = callPtr ? *callPtr : nextCall(thread, matId);
+            const char *skipped = append ? budgetSkip(call, matBytes(mat)) : nullptr;
+
+            if(!skipped)
+            {
+                deviceDownloader.push(mat, matPath(thread, directory, matName, call));
+            }
+
+            if(append)
+            {
+                appendMat(thread, matName, matId, call, {}, skipped, nullptr);
+            }
+        }
+#endif
+
+        /**
+         * Get the region of a matrix to save, see `save_region()`.
+         * The region of interest and the strided rows are views of the matrix, the strided columns are gathered in a matrix of the pool.
+         *
+         * @param region Output, the annotation of the region in the lists file, like `roi=x,y,width,height stride=2,2`.
+         * @throw std::runtime_error If the region is not inside the matrix, a stride is not positive, or the matrix has more than 2 dimensions.
+         */
+        cv::Mat regionView(const cv::Mat& mat, const cv::Rect& roi, int rowStride, int colStride, std::string& region)
+        {
+            if(mat.dims > 2)
+            {
+                throw std::runtime_error("Cannot save a region of a matrix with more than 2 dimensions");
+            }
+
+            if(rowStride < 1 || colStride < 1)
+            {
+                throw std::runtime_error(concat("Invalid stride of a region: ", rowStride, ',', colStride));
+            }
+
+            cv::Mat view = mat;
+            if(roi != cv::Rect())
+            {
+                if(roi.x < 0 || roi.y < 0 || roi.width <= 0 || roi.height <= 0 || roi.x + roi.width > mat.cols || roi.y + roi.height > mat.rows)
+                {
+                    throw std::runtime_error(concat("Region of interest not inside the matrix: ", roi.x, ',', roi.y, ',', roi.width, ',', roi.height,
+                                                    " of ", mat.cols, 'x', mat.rows));
+                }
+
+                view = mat(roi);
+                concatTo(region, "roi=", roi.x, ',', roi.y, ',', roi.width, ',', roi.height);
+            }
+
+            if(rowStride == 1 && colStride == 1)
+            {
+                return view;
+            }
+
+            if(!region.empty())
+            {
+                region += ' ';
+            }
+
+            concatTo(region, "stride=", rowStride, ',', colStride);
+
+            // The rows are strided by the step, the header has no reference counter so the asynchronous mode copies it
+            const int rows = (view.rows + rowStride - 1) / rowStride;
+            const int cols = (view.cols + colStride - 1) / colStride;
+            if(colStride == 1)
+            {
+                return cv::Mat(rows, cols, view.type(), view.data, view.step[0] * rowStride);
+            }
+
+            // The columns kept are not contiguous, only them are copied
+            cv::Mat strided;
+            strided.allocator = allocator();
+            strided.create(rows, cols, view.type());
+
+            const size_t elemSize = view.elemSize();
+            for(int row = 0; row < rows; row++)
+            {
+                const uchar *source = view.ptr(row * rowStride);
+                uchar *destination = strided.ptr(row);
+                for(int col = 0; col < cols; col++)
+                {
+                    std::memcpy(destination + col * elemSize, source + col * colStride * elemSize, elemSize);
+                }
+            }
+
+            return strided;
+        }
+
+        /**
+         * Check if the saves are enabled, the first check of `save()`, `save_copy()` and `save_region()`.
+         * Once the budget is exhausted, they return before anything else.
          */
-        std::string outputDir;
+        bool savesEnabled()
+        {
+            return ensure_initialized() && !budgetExhausted.load(std::memory_order_relaxed);
+        }
 
         /**
-         * The path to the lists file.
+         * Implementation of `save()`, `save_copy()` and `save_region()` once the varargs are started, see `REGRR_VARARGS_SAVE`,
+         * for the matrices of the host and of the devices.
+         * Check the capture filter before formatting the name.
          */
-        std::string listsPath;
+        template<typename M>
+        void vsave(const M& mat, bool append, bool copy, const int *callPtr, const std::vector<std::string>* scopesPtr, std::string_view region,
+                   const char *fmt, va_list args)
+        {
+            ThreadState& thread = state();
+            if(!capturedThread(thread))
+            {
+                return;
+            }
 
-        /**
-         * Ensure all the variables of the library are initialized.
-         * Must be called in every function of the library.
-         *
-         * @return The value of runtimeEnabled.
-         */
-        bool ensure_initialized();
+            // Return before formatting if the whole scope is excluded
+            FilterState custom;
+            const FilterState *filter = scopeFilter(thread, scopesPtr, custom);
+            if(filter && filter->verdict == FilterVerdict::Excluded)
+            {
+                return;
+            }
 
-        /**
-         * Called by `ensure_initialized()` on first call.
-         */
-        void initialize();
+            const std::string_view matName = formatName(fmt, args);
+
+            if(!captured(filter, matName))
+            {
+                return;
+            }
+
+            if(scopesPtr)
+            {
+                saveMat(mat, append, copy, callPtr, scopesDirectory(thread, *scopesPtr), matName, region);
+            }
+            else
+            {
+                saveMat(mat, append, copy, callPtr, currentDirectory(thread), matName, region);
+            }
+        }
 
         /**
-         * @}
+         * Implementation of `enter_scope()` once the name of the scope is formatted.
          */
+        void enterScope(std::string_view scopeName)
+        {
+            // The scopes of a thread not captured are ignored, like its exits
+            ThreadState& thread = state();
+            if(!capturedThread(thread))
+            {
+                return;
+            }
+
+            // Evaluate the capture filter once for the whole scope
+            if(!filterPatterns.empty())
+            {
+                FilterState unused;
+                const FilterState& parent = *scopeFilter(thread, nullptr, unused);
+                thread.filters.push_back(childFilterState(parent, scopeName));
+            }
+
+            // Append the scope in memory
+            currentDirectory(thread);
+            thread.directorySizes.push_back(thread.directory.size());
+            concatTo(thread.directory, scopeName, '/');
+            thread.scopes.emplace_back(scopeName);
+
+            // Register we enter a scope in the lists file
+            appendEnter(thread, scopeName);
+        }
 
         /**
          * @{
-         * Utility functions.
+         * Set the matrix of a managed matrix, of the host or of a device.
          */
+        void setManaged(Managed& managed, cv::Mat&& mat)
+        {
+            managed.mat = std::move(mat);
+        }
 
-        /**
-         * Concat arguments into a string.
-         * Utility function.
-         */
-        template<typename... Args>
-        std::string concat(Args&& ... args)
+        void setManaged(Managed& managed, cv::UMat&& mat)
         {
-            return (std::ostringstream{} << ... << args).str();
+            managed.umat = std::move(mat);
+            managed.device = true;
         }
 
+#if REGRR_HAVE_CUDA
+        void setManaged(Managed& managed, cv::cuda::GpuMat&& mat)
+        {
+            managed.gpuMat = std::move(mat);
+            managed.device = true;
+        }
+#endif
         /**
-         * Concat arguments into a file path exactly like `os.path.join()` in Python.
-         * Utility function.
+         * @}
          */
-        template<typename First, typename... Args>
-        std::string joinPaths(First&& first, Args&& ... args)
+
+        /**
+         * Implementation of `store_mat()` once the name of the matrix is formatted, for the matrices of the host and of the devices.
+         */
+        template<typename M>
+        void storeMat(M mat, std::string_view matName)
         {
-            std::ostringstream os;
-            os << std::forward<First>(first);
-            ((os << "/" << std::forward<Args>(args)), ...);
+            ThreadState& thread = state();
+            const std::uint32_t matId = nameId(thread, matName);
+
+            if(thread.managedMats.find(matId) != thread.managedMats.end())
+            {
+                throw std::runtime_error("Managed matrix with the same name already exist: " + std::string(matName));
+            }
+
+            // A matrix excluded by the filter, of a thread not captured or once the budget is exhausted is still stored,
+            // because the user may access it, but it is as if it never existed
+            FilterState unused;
+            if(budgetExhausted.load(std::memory_order_relaxed) || !capturedThread(thread) || !captured(scopeFilter(thread, nullptr, unused), matName))
+            {
+                Managed& managed = thread.managedMats[matId];
+                managed.call = 0;
+                managed.filtered = true;
+                setManaged(managed, std::move(mat));
+                return;
+            }
+
+            // Increase the call count
+            const int call = nextCall(thread, matId);
+
+            // The budget is decided now, as the matrix is appended to the lists file before it is saved
+            const char *skipped = budgetSkip(call, matBytes(mat));
+
+            // Store the managed matrix in memory
+            Managed& managed = thread.managedMats[matId];
+            managed.directory = currentDirectory(thread);
+            managed.call = call;
+            managed.filtered = skipped != nullptr;
+            setManaged(managed, std::move(mat));
 
-            return os.str();
+            // Append immediately to the lists file, with the call count
+            appendMat(thread, matName, matId, call, {}, skipped, nullptr);
         }
 
         /**
-         * Stringify a container with a separator between the entries.
-         *
-         * @return The joined string.
-         *
-         * @tparam T The container.
+         * Implementation of `get_mat()` once the name of the matrix is formatted.
          */
-        template<typename T>
-        std::string join(const T& container, const std::string& separator)
+        cv::Mat& getMat(std::string_view matName)
         {
-            std::ostringstream ss;
-            bool first = true;
+            ThreadState& thread = state();
 
-            for(const auto& entry: container)
+            auto it = thread.managedMats.find(nameId(thread, matName));
+            if(it == thread.managedMats.end())
             {
-                if(!first)
-                {
-                    ss << separator;
-                }
-                else
-                {
-                    first = false;
-                }
+                throw std::runtime_error("Managed matrix with this name does not exist: " + std::string(matName));
+            }
 
-                ss << entry;
+            if(it->second.device)
+            {
+                throw std::runtime_error("Managed matrix on a device, it cannot be accessed by name: " + std::string(matName));
             }
 
-            return ss.str();
+            return it->second.mat;
         }
 
         /**
-         * Create an empty file from a path.
-         * If the file already exists, the previous content is erased.
+         * Save a managed matrix released, of the host or of a device, not appending to the lists.
+         * No need to copy, the library is the only owner of the matrix.
          */
-        void createEmptyFile(const std::string& filePath)
+        void saveManaged(const Managed& managed, std::string_view matName)
         {
-            std::ofstream out(filePath, std::ios_base::out | std::ios_base::trunc);
+#if REGRR_HAVE_CUDA
+            if(!managed.gpuMat.empty())
+            {
+                saveMat(managed.gpuMat, false, false, &managed.call, managed.directory, matName, {});
+                return;
+            }
+#endif
+
+            if(managed.device)
+            {
+                saveMat(managed.umat, false, false, &managed.call, managed.directory, matName, {});
+            }
+            else
+            {
+                saveMat(managed.mat, false, false, &managed.call, managed.directory, matName, {});
+            }
         }
 
         /**
-         * Append a line to a file.
-         *
-         * @param line The line to add.
-         * A newline character '\n' is automatically added at the end of the line.
+         * Save the managed matrices released in the scopes of this depth or deeper, see `batchReleases`.
+         * In synchronous archive mode, they are appended to the archive with a single write.
+         * All the matrices are saved even if one fails.
          *
-         * @throw std::runtime_error If the file could not be written.
+         * @throw std::runtime_error The first error, same as `save()`.
          */
-        void appendLineToFile(const std::string& fileName, const std::string& line)
+        void saveReleases(ThreadState& thread, size_t depth)
         {
-            std::ofstream out(fileName, std::ios_base::app);
-            if(!out)
+            std::vector<BatchedRelease>& batched = thread.batchedReleases;
+            auto first = batched.end();
+            while(first != batched.begin() && std::prev(first)->depth >= depth)
             {
-                throw std::runtime_error("Cannot open file for write: " + fileName);
+                --first;
             }
 
-            out << line << std::endl;
-        }
+            if(first == batched.end())
+            {
+                return;
+            }
 
-        /**
-         * @}
-         */
+            std::vector<BatchedRelease> releases(std::make_move_iterator(first), std::make_move_iterator(batched.end()));
+            batched.erase(first, batched.end());
 
-        // Implementation of initialization functions
+            // The writes of the calling thread to the archive are collected instead of written one by one
+            std::vector<WriteJob> batch;
+            archiveBatch = &batch;
 
-        bool ensure_initialized()
-        {
-            static bool initialized = false;
-            if(!initialized)
+            std::exception_ptr error;
+            for(const BatchedRelease& release: releases)
             {
-                initialized = true;
-                initialize();
+                try
+                {
+                    saveManaged(release.managed, release.name);
+                }
+                catch(...)
+                {
+                    error = error ? error : std::current_exception();
+                }
+            }
+
+            archiveBatch = nullptr;
+
+            if(!batch.empty())
+            {
+                try
+                {
+                    StepTimer timer(Step::Serialize);
+                    const std::vector<std::uint64_t> sizes = archiveWriter.write(batch, outputDir);
+
+                    if(profiling)
+                    {
+                        for(size_t i = 0; i < batch.size(); i++)
+                        {
+                            recordWrite(std::string_view(batch[i].path).substr(outputDir.size() + 1), sizes[i]);
+                        }
+                    }
+                }
+                catch(...)
+                {
+                    error = error ? error : std::current_exception();
+                }
             }
 
-            return initialized;
+            if(error)
+            {
+                std::rethrow_exception(error);
+            }
         }
 
-        void initialize()
+        ThreadState::~ThreadState()
         {
-            // Check if the user set an output directory.
-            // This will define if the library is enabled or not.
-            if(const char *dir = std::getenv(REGRR_DIR); dir)
+            if(this == &mainState || batchedReleases.empty())
             {
-                outputDir = dir;
+                return;
+            }
 
-                try
-                {
-                    // If the output directory does not exist, try to create it (noop if it already exists)
-                    fs::create_directories(outputDir);
+            // There is nobody to catch the exception at the exit of a thread, so just log it
+            try
+            {
+                saveReleases(*this, 0);
+            }
+            catch(const std::exception& error)
+            {
+                logError("SAVE MATRIX", error);
+            }
+        }
 
-                    // Get the path of the lists file
-                    listsPath = joinPaths(outputDir, REGRR_LISTS);
+        /**
+         * Implementation of `release_mat()` once the name of the matrix is formatted.
+         */
+        void releaseMat(std::string_view matName)
+        {
+            ThreadState& thread = state();
 
-                    // Clear or create the lists file
-                    createEmptyFile(listsPath);
+            auto it = thread.managedMats.find(nameId(thread, matName));
+            if(it == thread.managedMats.end())
+            {
+                throw std::runtime_error("Managed matrix with this name does not exist: " + std::string(matName));
+            }
 
-                    // Check if custom file extension
-                    if(const char *ext = std::getenv(REGRR_EXT); ext)
+            if(!it->second.filtered)
+            {
+                Managed& managed = it->second;
+                if(batchReleases && !thread.scopes.empty())
+                {
+                    // Saved when exiting the scope, so a matrix wrapping the memory of the user is copied as it may not live until then
+                    if(!managed.device && !managed.mat.u)
                     {
-                        outputExtension = ext;
+                        cv::Mat copy;
+                        copy.allocator = allocator();
+                        managed.mat.copyTo(copy);
+                        managed.mat = std::move(copy);
                     }
 
-                    // First line is the file extension
-                    appendLineToFile(listsPath, outputExtension);
-
-                    // If no error, enable the library
-                    runtimeEnabled = true;
+                    thread.batchedReleases.push_back(BatchedRelease{
+                        .name = std::string(matName),
+                        .managed = std::move(managed),
+                        .depth = thread.scopes.size(),
+                    });
                 }
-                catch(const fs::filesystem_error& error)
+                else
                 {
-                    std::cerr << "CANNOT INITIALIZE REGRESSION TESTS. ERROR IS:" << std::endl;
-                    std::cerr << error.what() << std::endl;
+                    saveManaged(managed, matName);
                 }
             }
 
-            std::cout << "***** REGRR library initialized:" << std::endl;
-            std::cout << "    enabled: " << runtimeEnabled << std::endl;
-            std::cout << "    file extension: \"" << outputExtension << "\"" << std::endl;
-            std::cout << "    output directory: \"" << outputDir << "\"" << std::endl;
-            std::cout << "    lists path: \"" << listsPath << "\"" << std::endl;
+            // Release memory
+            // If the user has reference (which he shouldn't), then the matrix continue to live, but the library consider it not managed anymore
+            thread.managedMats.erase(it);
         }
     }
 
@@ -263,6 +4131,11 @@ namespace regrr
         return runtimeEnabled;
     }
 
+    bool category_enabled(Category category)
+    {
+        return ensure_initialized() && (category & runtimeCategories) != 0;
+    }
+
     void enter_scope(const char *fmt, ...)
     {
         if(!ensure_initialized())
@@ -270,14 +4143,10 @@ namespace regrr
             return;
         }
 
-        std::string scopeName;
+        std::string_view scopeName;
         REGRR_VARARGS_TO_STRING(scopeName, fmt);
 
-        // Append the scope in memory
-        scopes.push_back(scopeName);
-
-        // Register we enter a scope in the lists file
-        appendLineToFile(listsPath, concat("+ ", scopeName));
+        enterScope(scopeName);
     }
 
     void exit_scope()
@@ -287,16 +4156,54 @@ namespace regrr
             return;
         }
 
-        if(scopes.empty())
+        ThreadState& thread = state();
+        if(!capturedThread(thread))
+        {
+            return;
+        }
+
+        if(thread.scopes.empty())
         {
             throw std::runtime_error("Outside any scope");
         }
 
         // Pop the scope in memory
-        scopes.pop_back();
+        thread.scopes.pop_back();
+        thread.directory.resize(thread.directorySizes.back());
+        thread.directorySizes.pop_back();
+
+        if(!filterPatterns.empty())
+        {
+            thread.filters.pop_back();
+        }
 
         // Register we exit a scope in the lists file
-        appendLineToFile(listsPath, "-");
+        appendExit(thread);
+
+        // The managed matrices released in the scope are saved together
+        if(!thread.batchedReleases.empty())
+        {
+            saveReleases(thread, thread.scopes.size() + 1);
+        }
+
+        // Outside any scope, a whole part of the execution is finished, a good time to write the lists file
+        if(thread.scopes.empty())
+        {
+            listsWriter.flush();
+        }
+    }
+
+    cv::MatAllocator* allocator()
+    {
+        return ensure_initialized() && poolCapacity > 0 ? &bufferPool : nullptr;
+    }
+
+    cv::Mat create_mat(int rows, int cols, int type)
+    {
+        cv::Mat mat;
+        mat.allocator = allocator();
+        mat.create(rows, cols, type);
+        return mat;
     }
 
     void store_mat(cv::Mat mat, const char *fmt, ...)
@@ -306,26 +4213,10 @@ namespace regrr
             return;
         }
 
-        std::string matName;
+        std::string_view matName;
         REGRR_VARARGS_TO_STRING(matName, fmt);
 
-        if(managedMats.count(matName))
-        {
-            throw std::runtime_error("Managed matrix with the same name already exist: " + matName);
-        }
-
-        // Increase the call count
-        const int call = (++callCounts[matName]);
-
-        // Store the managed matrix in memory
-        managedMats[matName] = Managed{
-            .mat = std::move(mat),
-            .scopes = scopes,
-            .call = call,
-        };
-
-        // Append immediately to the lists file, with the call count
-        appendLineToFile(listsPath, concat(matName, ".", call));
+        storeMat(std::move(mat), matName);
     }
 
     cv::Mat& get_mat(const char *fmt, ...)
@@ -335,16 +4226,10 @@ namespace regrr
             throw std::runtime_error("The library should be enabled to use this function");
         }
 
-        std::string matName;
+        std::string_view matName;
         REGRR_VARARGS_TO_STRING(matName, fmt);
 
-        auto it = managedMats.find(matName);
-        if(it == managedMats.end())
-        {
-            throw std::runtime_error("Managed matrix with this name does not exist: " + matName);
-        }
-
-        return it->second.mat;
+        return getMat(matName);
     }
 
     void release_mat(const char *fmt, ...)
@@ -354,122 +4239,207 @@ namespace regrr
             return;
         }
 
-        std::string matName;
+        std::string_view matName;
         REGRR_VARARGS_TO_STRING(matName, fmt);
 
-        auto it = managedMats.find(matName);
-        if(it == managedMats.end())
+        releaseMat(matName);
+    }
+
+    void save(const cv::Mat& mat, bool append, const int *callPtr, const std::vector<std::string>* scopesPtr, const char *fmt, ...)
+    {
+        if(!savesEnabled())
         {
-            throw std::runtime_error("Managed matrix with this name does not exist: " + matName);
+            return;
         }
 
-        // Save the matrix to a file, not appending to the lists
-        // Protect if the string contains a '%'
-        save(it->second.mat, false, &it->second.call, &it->second.scopes, "%s", matName.c_str());
+        REGRR_VARARGS_SAVE(fmt, mat, append, false, callPtr, scopesPtr, {});
+    }
+
+    void save_copy(const cv::Mat& mat, const char *fmt, ...)
+    {
+        if(!savesEnabled())
+        {
+            return;
+        }
 
-        // Release memory
-        // If the user has reference (which he shouldn't), then the matrix continue to live, but the library consider it not managed anymore
-        managedMats.erase(it);
+        REGRR_VARARGS_SAVE(fmt, mat, true, true, nullptr, nullptr, {});
     }
 
-    void save(const cv::Mat& mat, bool append, const int *callPtr, const std::vector<std::string>* scopesPtr, const char *fmt, ...)
+    void store_mat(cv::UMat mat, const char *fmt, ...)
     {
         if(!ensure_initialized())
         {
             return;
         }
 
-        std::string matName;
+        std::string_view matName;
         REGRR_VARARGS_TO_STRING(matName, fmt);
 
-        // Get the call count, from the argument or from the internal counter
-        int call;
-        if(callPtr)
+        storeMat(std::move(mat), matName);
+    }
+
+    void save(const cv::UMat& mat, bool append, const int *callPtr, const std::vector<std::string>* scopesPtr, const char *fmt, ...)
+    {
+        if(!savesEnabled())
+        {
+            return;
+        }
+
+        REGRR_VARARGS_SAVE(fmt, mat, append, false, callPtr, scopesPtr, {});
+    }
+
+    void save_copy(const cv::UMat& mat, const char *fmt, ...)
+    {
+        if(!savesEnabled())
         {
-            call = *callPtr;
+            return;
         }
-        else
+
+        REGRR_VARARGS_SAVE(fmt, mat, true, true, nullptr, nullptr, {});
+    }
+
+#if REGRR_HAVE_CUDA
+    void store_mat(cv::cuda::GpuMat mat, const char *fmt, ...)
+    {
+        if(!ensure_initialized())
         {
-            // Increment the call count for this matrix
-            call = (++callCounts[matName]);
+            return;
         }
 
-        // Get the scopes, from the argument or from the internal counter
-        const std::vector<std::string> *scopes;
-        if(scopesPtr)
+        std::string_view matName;
+        REGRR_VARARGS_TO_STRING(matName, fmt);
+
+        storeMat(std::move(mat), matName);
+    }
+
+    void save(const cv::cuda::GpuMat& mat, bool append, const int *callPtr, const std::vector<std::string>* scopesPtr, const char *fmt, ...)
+    {
+        if(!savesEnabled())
         {
-            scopes = scopesPtr;
+            return;
         }
-        else
+
+        REGRR_VARARGS_SAVE(fmt, mat, append, false, callPtr, scopesPtr, {});
+    }
+
+    void save_copy(const cv::cuda::GpuMat& mat, const char *fmt, ...)
+    {
+        if(!savesEnabled())
         {
-            scopes = &regrr::scopes;
+            return;
         }
 
-        // Save the file with full path:
-        // `scope1/scope2/.../matName.callCount.ext`
+        REGRR_VARARGS_SAVE(fmt, mat, true, true, nullptr, nullptr, {});
+    }
+
+#endif
 
+    void save_region(const cv::Mat& mat, const cv::Rect& roi, int rowStride, int colStride, const char *fmt, ...)
+    {
+        if(!savesEnabled())
+        {
+            return;
+        }
 
-        cv::FileStorage writer;
-        const std::string fileName = concat(matName, ".", call, outputExtension);
+        thread_local std::string region;
+        region.clear();
+        const cv::Mat view = regionView(mat, roi, rowStride, colStride, region);
 
-        const fs::path path = joinPaths(outputDir, join(*scopes, "/"), fileName);
-        std::cout << "Saving test " << path << std::endl;
+        REGRR_VARARGS_SAVE(fmt, view, true, false, nullptr, nullptr, region);
+    }
 
-        // Create intermediate directories if needed
-        fs::create_directories(path.parent_path());
+    void set_thread_name(const char *fmt, ...)
+    {
+        if(!ensure_initialized())
+        {
+            return;
+        }
 
-        // Open the file to write
-        if(!writer.open(path, cv::FileStorage::WRITE))
+        // Without the thread-aware mode all the threads share the state of the main thread, its scopes are not of the caller
+        if(!threadAware)
         {
-            throw std::runtime_error("Can't open file to write: " + path.string());
+            return;
         }
 
-        // Note:
-        // cv::FileStorage doesn't support matrices with more than 4 elements
-        // So we just flatten the channels in this case with reshape(1)
-        // See https://stackoverflow.com/a/53676859/5110937
+        std::string_view threadName;
+        REGRR_VARARGS_TO_STRING(threadName, fmt);
 
-        // Write the file to disk
-        // We don't care of the name of the node, but OpenCV requires one
-        // We use a default name, and not the matrix name, in case of special characters that may not be handled by OpenCV
-        writer << "root" << mat.reshape(1);
-        writer.release();
+        ThreadState& thread = state();
 
-        if(append)
+        if(!thread.scopes.empty())
         {
-            // Append the name of the matrix to the lists file
-            // Permit to iterate in the same order at the execution
-            // We couldn't have use reliably the timestamp because it is OS-dependant whether the file will be created at some exact time in order
-            // Also save the call count in the name
-            appendLineToFile(listsPath, concat(matName, ".", call));
+            throw std::runtime_error("Cannot rename a thread inside a scope: " + std::string(threadName));
         }
+
+        thread.name = threadName;
+        thread.nameId = NO_NAME;
+
+        // The directory depends on the name
+        thread.directory.clear();
     }
 
     // Implementation of RAII classes
+    // The name is formatted only once, then given to the implementation directly
 
     Scope::Scope(const char *fmt, ...)
     {
-        std::string scopeName;
-        REGRR_VARARGS_TO_STRING(scopeName, fmt);
-        // Protect if the string contains a '%'
-        enter_scope("%s", scopeName.c_str());
+        if(ensure_initialized())
+        {
+            std::string_view scopeName;
+            REGRR_VARARGS_TO_STRING(scopeName, fmt);
+            enterScope(scopeName);
+        }
+    }
+
+    Scope::Scope(Category category, const char *fmt, ...)
+        : m_active(category_enabled(category))
+    {
+        if(m_active)
+        {
+            std::string_view scopeName;
+            REGRR_VARARGS_TO_STRING(scopeName, fmt);
+            enterScope(scopeName);
+        }
     }
 
     Scope::~Scope()
     {
-        exit_scope();
+        if(m_active)
+        {
+            exit_scope();
+        }
     }
 
     ManagedMatrix::ManagedMatrix(cv::Mat mat, const char *fmt, ...)
+        : m_mat(mat)
+    {
+        if(ensure_initialized())
+        {
+            std::string_view matName;
+            REGRR_VARARGS_TO_STRING(matName, fmt);
+            m_name = matName;
+            storeMat(std::move(mat), m_name);
+        }
+    }
+
+    ManagedMatrix::ManagedMatrix(Category category, cv::Mat mat, const char *fmt, ...)
+        : m_mat(mat),
+          m_active(category_enabled(category))
     {
-        REGRR_VARARGS_TO_STRING(m_name, fmt);
-        // Protect if the string contains a '%'
-        store_mat(std::move(mat), "%s", m_name.c_str());
+        if(m_active)
+        {
+            std::string_view matName;
+            REGRR_VARARGS_TO_STRING(matName, fmt);
+            m_name = matName;
+            storeMat(std::move(mat), m_name);
+        }
     }
 
     ManagedMatrix::~ManagedMatrix()
     {
-        // Protect if the string contains a '%'
-        release_mat("%s", m_name.c_str());
+        if(m_active && ensure_initialized())
+        {
+            releaseMat(m_name);
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,739 @@
+#include "regrr_reader.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define REGRR_STATS_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define REGRR_STATS_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace regrr
+{
+    namespace
+    {
+        /**
+         * Sums and extrema of the absolute differences, computed in a single pass.
+         */
+        struct Moments
+        {
+            double sum = 0;
+            double sumSquares = 0;
+            double min = std::numeric_limits<double>::infinity();
+            double max = -std::numeric_limits<double>::infinity();
+        };
+
+        /**
+         * Absolute difference of two elements, in double so it is exact for all the types except `double`.
+         */
+        template<typename T>
+        double absDiff(T a, T b)
+        {
+            return std::abs(static_cast<double>(b) - static_cast<double>(a));
+        }
+
+        /**
+         * Add the absolute differences of two arrays to the moments, one element at a time.
+         * Used for the types without vectorized kernel, and for the tail of the arrays.
+         */
+        template<typename T>
+        void momentsScalar(const T *a, const T *b, size_t count, Moments& moments)
+        {
+            for(size_t i = 0; i < count; i++)
+            {
+                const double value = absDiff(a[i], b[i]);
+                moments.sum += value;
+                moments.sumSquares += value * value;
+                moments.min = std::min(moments.min, value);
+                moments.max = std::max(moments.max, value);
+            }
+        }
+
+        /**
+         * Absolute difference of two arrays of unsigned integers, one element at a time.
+         */
+        template<typename T>
+        void absDiffScalar(const T *a, const T *b, size_t count, T *diff)
+        {
+            for(size_t i = 0; i < count; i++)
+            {
+                diff[i] = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+            }
+        }
+
+#if REGRR_STATS_AVX2
+        /**
+         * @{
+         * AVX2 kernels, only called if the processor supports it.
+         * The floating differences are computed in double, 4 lanes at a time.
+         */
+
+        bool hasAvx2()
+        {
+            static const bool supported = __builtin_cpu_supports("avx2");
+            return supported;
+        }
+
+        __attribute__((target("avx2")))
+        void reduceAvx2(__m256d sum, __m256d sumSquares, __m256d min, __m256d max, Moments& moments)
+        {
+            alignas(32) double lanes[4][4];
+            _mm256_store_pd(lanes[0], sum);
+            _mm256_store_pd(lanes[1], sumSquares);
+            _mm256_store_pd(lanes[2], min);
+            _mm256_store_pd(lanes[3], max);
+
+            for(int i = 0; i < 4; i++)
+            {
+                moments.sum += lanes[0][i];
+                moments.sumSquares += lanes[1][i];
+                moments.min = std::min(moments.min, lanes[2][i]);
+                moments.max = std::max(moments.max, lanes[3][i]);
+            }
+        }
+
+        __attribute__((target("avx2")))
+        size_t momentsAvx2(const float *a, const float *b, size_t count, Moments& moments)
+        {
+            const __m256d sign = _mm256_set1_pd(-0.0);
+            __m256d sum = _mm256_setzero_pd();
+            __m256d sumSquares = _mm256_setzero_pd();
+            __m256d min = _mm256_set1_pd(moments.min);
+            __m256d max = _mm256_set1_pd(moments.max);
+
+            size_t i = 0;
+            for(; i + 8 <= count; i += 8)
+            {
+                const __m256 va = _mm256_loadu_ps(a + i);
+                const __m256 vb = _mm256_loadu_ps(b + i);
+
+                const __m256d low = _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(vb)), _mm256_cvtps_pd(_mm256_castps256_ps128(va))));
+                const __m256d high = _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(vb, 1)), _mm256_cvtps_pd(_mm256_extractf128_ps(va, 1))));
+
+                sum = _mm256_add_pd(sum, _mm256_add_pd(low, high));
+                sumSquares = _mm256_add_pd(sumSquares, _mm256_add_pd(_mm256_mul_pd(low, low), _mm256_mul_pd(high, high)));
+                min = _mm256_min_pd(min, _mm256_min_pd(low, high));
+                max = _mm256_max_pd(max, _mm256_max_pd(low, high));
+            }
+
+            reduceAvx2(sum, sumSquares, min, max, moments);
+            return i;
+        }
+
+        __attribute__((target("avx2")))
+        size_t momentsAvx2(const double *a, const double *b, size_t count, Moments& moments)
+        {
+            const __m256d sign = _mm256_set1_pd(-0.0);
+            __m256d sum = _mm256_setzero_pd();
+            __m256d sumSquares = _mm256_setzero_pd();
+            __m256d min = _mm256_set1_pd(moments.min);
+            __m256d max = _mm256_set1_pd(moments.max);
+
+            size_t i = 0;
+            for(; i + 4 <= count; i += 4)
+            {
+                const __m256d value = _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_loadu_pd(b + i), _mm256_loadu_pd(a + i)));
+
+                sum = _mm256_add_pd(sum, value);
+                sumSquares = _mm256_add_pd(sumSquares, _mm256_mul_pd(value, value));
+                min = _mm256_min_pd(min, value);
+                max = _mm256_max_pd(max, value);
+            }
+
+            reduceAvx2(sum, sumSquares, min, max, moments);
+            return i;
+        }
+
+        __attribute__((target("avx2")))
+        size_t absDiffAvx2(const uchar *a, const uchar *b, size_t count, uchar *diff)
+        {
+            size_t i = 0;
+            for(; i + 32 <= count; i += 32)
+            {
+                const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+                const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(diff + i), _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va)));
+            }
+
+            return i;
+        }
+
+        __attribute__((target("avx2")))
+        size_t absDiffAvx2(const ushort *a, const ushort *b, size_t count, ushort *diff)
+        {
+            size_t i = 0;
+            for(; i + 16 <= count; i += 16)
+            {
+                const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+                const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(diff + i), _mm256_or_si256(_mm256_subs_epu16(va, vb), _mm256_subs_epu16(vb, va)));
+            }
+
+            return i;
+        }
+
+        /**
+         * @}
+         */
+#endif
+
+#if REGRR_STATS_NEON
+        /**
+         * @{
+         * NEON kernels, always available on AArch64.
+         * The floating differences are computed in double, 2 lanes at a time.
+         */
+
+        void reduceNeon(float64x2_t sum, float64x2_t sumSquares, float64x2_t min, float64x2_t max, Moments& moments)
+        {
+            moments.sum += vaddvq_f64(sum);
+            moments.sumSquares += vaddvq_f64(sumSquares);
+            moments.min = std::min(moments.min, vminvq_f64(min));
+            moments.max = std::max(moments.max, vmaxvq_f64(max));
+        }
+
+        size_t momentsNeon(const float *a, const float *b, size_t count, Moments& moments)
+        {
+            float64x2_t sum = vdupq_n_f64(0);
+            float64x2_t sumSquares = vdupq_n_f64(0);
+            float64x2_t min = vdupq_n_f64(moments.min);
+            float64x2_t max = vdupq_n_f64(moments.max);
+
+            size_t i = 0;
+            for(; i + 4 <= count; i += 4)
+            {
+                const float32x4_t va = vld1q_f32(a + i);
+                const float32x4_t vb = vld1q_f32(b + i);
+
+                const float64x2_t low = vabdq_f64(vcvt_f64_f32(vget_low_f32(vb)), vcvt_f64_f32(vget_low_f32(va)));
+                const float64x2_t high = vabdq_f64(vcvt_high_f64_f32(vb), vcvt_high_f64_f32(va));
+
+                sum = vaddq_f64(sum, vaddq_f64(low, high));
+                sumSquares = vfmaq_f64(vfmaq_f64(sumSquares, low, low), high, high);
+                min = vminq_f64(min, vminq_f64(low, high));
+                max = vmaxq_f64(max, vmaxq_f64(low, high));
+            }
+
+            reduceNeon(sum, sumSquares, min, max, moments);
+            return i;
+        }
+
+        size_t momentsNeon(const double *a, const double *b, size_t count, Moments& moments)
+        {
+            float64x2_t sum = vdupq_n_f64(0);
+            float64x2_t sumSquares = vdupq_n_f64(0);
+            float64x2_t min = vdupq_n_f64(moments.min);
+            float64x2_t max = vdupq_n_f64(moments.max);
+
+            size_t i = 0;
+            for(; i + 2 <= count; i += 2)
+            {
+                const float64x2_t value = vabdq_f64(vld1q_f64(b + i), vld1q_f64(a + i));
+
+                sum = vaddq_f64(sum, value);
+                sumSquares = vfmaq_f64(sumSquares, value, value);
+                min = vminq_f64(min, value);
+                max = vmaxq_f64(max, value);
+            }
+
+            reduceNeon(sum, sumSquares, min, max, moments);
+            return i;
+        }
+
+        size_t absDiffNeon(const uchar *a, const uchar *b, size_t count, uchar *diff)
+        {
+            size_t i = 0;
+            for(; i + 16 <= count; i += 16)
+            {
+                vst1q_u8(diff + i, vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+            }
+
+            return i;
+        }
+
+        size_t absDiffNeon(const ushort *a, const ushort *b, size_t count, ushort *diff)
+        {
+            size_t i = 0;
+            for(; i + 8 <= count; i += 8)
+            {
+                vst1q_u16(diff + i, vabdq_u16(vld1q_u16(a + i), vld1q_u16(b + i)));
+            }
+
+            return i;
+        }
+
+        /**
+         * @}
+         */
+#endif
+
+        /**
+         * Compute the sums and extrema of the absolute differences, with the fastest kernel available.
+         */
+        template<typename T>
+        Moments moments(const T *a, const T *b, size_t count)
+        {
+            Moments moments;
+            size_t done = 0;
+
+            if constexpr(std::is_same_v<T, float> || std::is_same_v<T, double>)
+            {
+#if REGRR_STATS_AVX2
+                if(hasAvx2())
+                {
+                    done = momentsAvx2(a, b, count, moments);
+                }
+#elif REGRR_STATS_NEON
+                done = momentsNeon(a, b, count, moments);
+#endif
+            }
+
+            momentsScalar(a + done, b + done, count - done, moments);
+            return moments;
+        }
+
+        /**
+         * Compute the absolute differences of two arrays of unsigned integers, with the fastest kernel available.
+         */
+        template<typename T>
+        void absDiffUnsigned(const T *a, const T *b, size_t count, T *diff)
+        {
+            size_t done = 0;
+
+#if REGRR_STATS_AVX2
+            if(hasAvx2())
+            {
+                done = absDiffAvx2(a, b, count, diff);
+            }
+#elif REGRR_STATS_NEON
+            done = absDiffNeon(a, b, count, diff);
+#endif
+
+            absDiffScalar(a + done, b + done, count - done, diff + done);
+        }
+
+        /**
+         * Find the median of the absolute differences without sorting them all.
+         * The differences are counted in a histogram between the extrema,
+         * then only the values in the bins of the middle ranks are selected exactly.
+         * Same as numpy: the average of the two middle values when the count is even.
+         */
+        template<typename T>
+        double selectMedian(const T *a, const T *b, size_t count, double min, double max)
+        {
+            if(min == max)
+            {
+                return min;
+            }
+
+            constexpr size_t bins = 4096;
+            const double scale = bins / (max - min);
+            const auto binOf = [&] (double value) {
+                return std::min(static_cast<size_t>((value - min) * scale), bins - 1);
+            };
+
+            std::vector<size_t> histogram(bins);
+            for(size_t i = 0; i < count; i++)
+            {
+                histogram[binOf(absDiff(a[i], b[i]))]++;
+            }
+
+            // Find the bins of both middle ranks, and the count of values before the first one
+            const size_t lowRank = (count - 1) / 2;
+            const size_t highRank = count / 2;
+            size_t lowBin = 0;
+            size_t before = 0;
+            while(before + histogram[lowBin] <= lowRank)
+            {
+                before += histogram[lowBin];
+                lowBin++;
+            }
+
+            size_t highBin = lowBin;
+            size_t beforeHigh = before;
+            while(beforeHigh + histogram[highBin] <= highRank)
+            {
+                beforeHigh += histogram[highBin];
+                highBin++;
+            }
+
+            // Select exactly among the few values of these bins
+            std::vector<double> values;
+            values.reserve(beforeHigh - before + histogram[highBin]);
+            for(size_t i = 0; i < count; i++)
+            {
+                const double value = absDiff(a[i], b[i]);
+                const size_t bin = binOf(value);
+                if(bin >= lowBin && bin <= highBin)
+                {
+                    values.push_back(value);
+                }
+            }
+
+            const auto low = values.begin() + (lowRank - before);
+            std::nth_element(values.begin(), low, values.end());
+            if(highRank == lowRank)
+            {
+                return *low;
+            }
+
+            return (*low + *std::min_element(low + 1, values.end())) / 2;
+        }
+
+        /**
+         * Compute the statistics of two floating or signed arrays.
+         * A single pass for the sums and extrema, then the median is selected with a histogram.
+         */
+        template<typename T>
+        DiffStats diffStats(const T *a, const T *b, size_t count)
+        {
+            const Moments moments = regrr::moments(a, b, count);
+
+            DiffStats stats;
+            stats.count = count;
+            stats.l1 = moments.sum;
+            stats.min = moments.min;
+            stats.max = moments.max;
+            stats.avg = moments.sum / count;
+            stats.std = std::sqrt(std::max(moments.sumSquares / count - stats.avg * stats.avg, 0.0));
+
+            if(std::isnan(moments.sum))
+            {
+                // Same as numpy, the NaN propagate to all the statistics
+                stats.min = stats.max = stats.avg = stats.median = stats.std = moments.sum;
+            }
+            else if(std::isinf(moments.max))
+            {
+                // No histogram between infinite bounds, only a few values are infinite in practice
+                std::vector<double> values(count);
+                for(size_t i = 0; i < count; i++)
+                {
+                    values[i] = absDiff(a[i], b[i]);
+                }
+
+                const auto middle = values.begin() + (count - 1) / 2;
+                std::nth_element(values.begin(), middle, values.end());
+                stats.median = count % 2 ? *middle : (*middle + *std::min_element(middle + 1, values.end())) / 2;
+            }
+            else
+            {
+                stats.median = selectMedian(a, b, count, moments.min, moments.max);
+            }
+
+            return stats;
+        }
+
+        /**
+         * Compute the statistics of two arrays of 8 or 16 bits unsigned integers.
+         * The absolute differences are counted in a histogram with a bin per value, all the statistics are exact from it.
+         * The differences are computed by blocks, so they stay in the cache.
+         */
+        template<typename T>
+        DiffStats histogramStats(const T *a, const T *b, size_t count)
+        {
+            constexpr size_t values = size_t(std::numeric_limits<T>::max()) + 1;
+
+            // Several histograms for 8 bits, so the successive increments of the same bin do not wait for each other
+            constexpr size_t histograms = sizeof(T) == 1 ? 4 : 1;
+            std::vector<std::uint64_t> histogram(values * histograms);
+
+            constexpr size_t blockSize = 4096;
+            std::array<T, blockSize> block;
+            for(size_t first = 0; first < count; first += blockSize)
+            {
+                const size_t size = std::min(blockSize, count - first);
+                absDiffUnsigned(a + first, b + first, size, block.data());
+
+                for(size_t i = 0; i < size; i++)
+                {
+                    histogram[(i % histograms) * values + block[i]]++;
+                }
+            }
+
+            for(size_t h = 1; h < histograms; h++)
+            {
+                for(size_t value = 0; value < values; value++)
+                {
+                    histogram[value] += histogram[h * values + value];
+                }
+            }
+
+            DiffStats stats;
+            stats.count = count;
+
+            std::uint64_t sum = 0;
+            size_t min = values;
+            size_t max = 0;
+            for(size_t value = 0; value < values; value++)
+            {
+                if(histogram[value])
+                {
+                    sum += value * histogram[value];
+                    min = std::min(min, value);
+                    max = value;
+                }
+            }
+
+            stats.l1 = static_cast<double>(sum);
+            stats.min = static_cast<double>(min);
+            stats.max = static_cast<double>(max);
+            stats.avg = stats.l1 / count;
+
+            // Both middle ranks, and the variance around the exact average
+            const size_t lowRank = (count - 1) / 2;
+            const size_t highRank = count / 2;
+            double low = 0;
+            double high = 0;
+            double variance = 0;
+            size_t before = 0;
+            for(size_t value = min; value <= max; value++)
+            {
+                if(before <= lowRank && lowRank < before + histogram[value])
+                {
+                    low = static_cast<double>(value);
+                }
+
+                if(before <= highRank && highRank < before + histogram[value])
+                {
+                    high = static_cast<double>(value);
+                }
+
+                before += histogram[value];
+                variance += histogram[value] * (value - stats.avg) * (value - stats.avg);
+            }
+
+            stats.median = (low + high) / 2;
+            stats.std = std::sqrt(variance / count);
+            return stats;
+        }
+
+        /**
+         * Fill the absolute differences, saturated to the type of the matrices.
+         */
+        template<typename T>
+        void absDiffSaturated(const T *a, const T *b, size_t count, T *diff)
+        {
+            if constexpr(std::is_same_v<T, uchar> || std::is_same_v<T, ushort>)
+            {
+                absDiffUnsigned(a, b, count, diff);
+            }
+            else
+            {
+                for(size_t i = 0; i < count; i++)
+                {
+                    const double value = absDiff(a[i], b[i]);
+                    if constexpr(std::is_floating_point_v<T>)
+                    {
+                        diff[i] = static_cast<T>(value);
+                    }
+                    else
+                    {
+                        diff[i] = value >= static_cast<double>(std::numeric_limits<T>::max()) ? std::numeric_limits<T>::max() : static_cast<T>(value);
+                    }
+                }
+            }
+        }
+
+        /**
+         * Count of representable values between two floating values.
+         * The bits are mapped to integers ordered as the values, so the distance is their difference.
+         */
+        template<typename T>
+        std::uint64_t ulpDistance(T a, T b)
+        {
+            using Bits = std::conditional_t<sizeof(T) == 4, std::int32_t, std::int64_t>;
+
+            const auto ordered = [] (T value) {
+                Bits bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+                return bits < 0 ? static_cast<std::int64_t>(std::numeric_limits<Bits>::min()) - bits : static_cast<std::int64_t>(bits);
+            };
+
+            const std::int64_t x = ordered(a);
+            const std::int64_t y = ordered(b);
+            return x > y ? static_cast<std::uint64_t>(x) - static_cast<std::uint64_t>(y) : static_cast<std::uint64_t>(y) - static_cast<std::uint64_t>(x);
+        }
+
+        /**
+         * Check if two elements are within a tolerance.
+         */
+        template<typename T>
+        bool withinTolerance(T a, T b, const Tolerance& tolerance)
+        {
+            if(a == b)
+            {
+                return true;
+            }
+
+            const double difference = absDiff(a, b);
+
+            if constexpr(std::is_floating_point_v<T>)
+            {
+                if(std::isnan(a) || std::isnan(b))
+                {
+                    return std::isnan(a) && std::isnan(b);
+                }
+
+                if(tolerance.ulp >= 0 && ulpDistance(a, b) <= static_cast<std::uint64_t>(tolerance.ulp))
+                {
+                    return true;
+                }
+            }
+            else
+            {
+                if(tolerance.ulp >= 0 && difference <= static_cast<double>(tolerance.ulp))
+                {
+                    return true;
+                }
+            }
+
+            if(tolerance.absolute >= 0 && difference <= tolerance.absolute)
+            {
+                return true;
+            }
+
+            const double largest = std::max(std::abs(static_cast<double>(a)), std::abs(static_cast<double>(b)));
+            return tolerance.relative >= 0 && difference <= tolerance.relative * largest;
+        }
+
+        /**
+         * Find the first element out of the tolerance.
+         * The bitwise identical blocks are skipped with `memcmp()`, which is faster than checking each element.
+         */
+        template<typename T>
+        ToleranceResult checkTolerance(const T *a, const T *b, size_t count, const Tolerance& tolerance)
+        {
+            constexpr size_t blockSize = 4096 / sizeof(T);
+
+            for(size_t first = 0; first < count; first += blockSize)
+            {
+                const size_t size = std::min(blockSize, count - first);
+                if(std::memcmp(a + first, b + first, size * sizeof(T)) == 0)
+                {
+                    continue;
+                }
+
+                for(size_t i = first; i < first + size; i++)
+                {
+                    if(!withinTolerance(a[i], b[i], tolerance))
+                    {
+                        return ToleranceResult{false, i, static_cast<double>(a[i]), static_cast<double>(b[i])};
+                    }
+                }
+            }
+
+            return ToleranceResult{};
+        }
+
+        /**
+         * Check that two matrices can be compared, and get them as continuous arrays.
+         * The matrices are copied only if they have padding.
+         */
+        size_t flatten(const cv::Mat& a, const cv::Mat& b, cv::Mat& aContinuous, cv::Mat& bContinuous)
+        {
+            if(a.depth() != b.depth())
+            {
+                throw std::runtime_error("Different types: " + std::to_string(a.type()) + " and " + std::to_string(b.type()));
+            }
+
+            const size_t count = a.total() * a.channels();
+            if(count != b.total() * b.channels())
+            {
+                throw std::runtime_error("Different sizes: " + std::to_string(count) + " and " + std::to_string(b.total() * b.channels()) + " elements");
+            }
+
+            if(count == 0)
+            {
+                throw std::runtime_error("Empty matrices");
+            }
+
+            aContinuous = a.isContinuous() ? a : a.clone();
+            bContinuous = b.isContinuous() ? b : b.clone();
+            return count;
+        }
+
+        /**
+         * Call a function with the arrays of the matrices, typed by their depth.
+         */
+        template<typename Function>
+        auto dispatch(int depth, const cv::Mat& a, const cv::Mat& b, Function&& function)
+        {
+            switch(depth)
+            {
+            case CV_8U:
+                return function(a.ptr<uchar>(), b.ptr<uchar>());
+            case CV_8S:
+                return function(a.ptr<schar>(), b.ptr<schar>());
+            case CV_16U:
+                return function(a.ptr<ushort>(), b.ptr<ushort>());
+            case CV_16S:
+                return function(a.ptr<short>(), b.ptr<short>());
+            case CV_32S:
+                return function(a.ptr<int>(), b.ptr<int>());
+            case CV_32F:
+                return function(a.ptr<float>(), b.ptr<float>());
+            case CV_64F:
+                return function(a.ptr<double>(), b.ptr<double>());
+            default:
+                throw std::runtime_error("Unsupported type: " + std::to_string(depth));
+            }
+        }
+    }
+
+    DiffStats diff_stats(const cv::Mat& a, const cv::Mat& b)
+    {
+        cv::Mat aContinuous;
+        cv::Mat bContinuous;
+        const size_t count = flatten(a, b, aContinuous, bContinuous);
+
+        return dispatch(a.depth(), aContinuous, bContinuous, [count] (const auto *aData, const auto *bData) {
+            using T = std::remove_const_t<std::remove_pointer_t<decltype(aData)>>;
+            if constexpr(std::is_same_v<T, uchar> || std::is_same_v<T, ushort>)
+            {
+                return histogramStats(aData, bData, count);
+            }
+            else
+            {
+                return diffStats(aData, bData, count);
+            }
+        });
+    }
+
+    cv::Mat abs_diff(const cv::Mat& a, const cv::Mat& b)
+    {
+        cv::Mat aContinuous;
+        cv::Mat bContinuous;
+        const size_t count = flatten(a, b, aContinuous, bContinuous);
+
+        cv::Mat diff(1, static_cast<int>(count), CV_MAKETYPE(a.depth(), 1));
+        dispatch(a.depth(), aContinuous, bContinuous, [&diff, count] (const auto *aData, const auto *bData) {
+            using T = std::remove_const_t<std::remove_pointer_t<decltype(aData)>>;
+            absDiffSaturated(aData, bData, count, diff.ptr<T>());
+        });
+
+        return diff;
+    }
+
+    ToleranceResult check_tolerance(const cv::Mat& a, const cv::Mat& b, const Tolerance& tolerance)
+    {
+        cv::Mat aContinuous;
+        cv::Mat bContinuous;
+        const size_t count = flatten(a, b, aContinuous, bContinuous);
+
+        return dispatch(a.depth(), aContinuous, bContinuous, [&tolerance, count] (const auto *aData, const auto *bData) {
+            return checkTolerance(aData, bData, count, tolerance);
+        });
+    }
+}
\ No newline at end of file
@@ -0,0 +1,451 @@
+#include "uring.h"
+#if REGRR_HAVE_URING
+#include "logger.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace regrr
+{
+    UringWriter& uringWriter = *new UringWriter;
+
+    void UringWriter::start(unsigned depth, bool direct)
+    {
+        io_uring_params params{};
+        m_ring = static_cast<int>(::syscall(__NR_io_uring_setup, depth, &params));
+        if(m_ring < 0)
+        {
+            throw std::runtime_error(std::string("io_uring is not available: ") + std::strerror(errno));
+        }
+
+        // Both rings in a single mapping if supported, since Linux 5.4
+        const size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        const size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        m_sqMapSize = single ? std::max(sqSize, cqSize) : sqSize;
+        m_cqMapSize = single ? 0 : cqSize;
+        m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+        m_sqMap = ::mmap(nullptr, m_sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQ_RING);
+        m_cqMap = single ? m_sqMap : ::mmap(nullptr, m_cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_CQ_RING);
+        void *sqes = ::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES);
+        m_sqes = sqes == MAP_FAILED ? nullptr : static_cast<io_uring_sqe*>(sqes);
+        if(m_sqMap == MAP_FAILED || m_cqMap == MAP_FAILED || !m_sqes)
+        {
+            const int error = errno;
+            stop();
+            throw std::runtime_error(std::string("io_uring is not available: ") + std::strerror(error));
+        }
+
+        char *sq = static_cast<char*>(m_sqMap);
+        char *cq = static_cast<char*>(m_cqMap);
+        m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        m_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        m_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        // Never more writes in flight than entries in the rings
+        depth = std::min(depth, params.sq_entries);
+        m_buffers.resize(depth);
+        m_inFlight.resize(depth);
+        std::vector<iovec> registered(depth);
+        for(unsigned i = 0; i < depth; i++)
+        {
+            m_buffers[i] = static_cast<unsigned char*>(std::aligned_alloc(URING_ALIGNMENT, URING_CHUNK));
+            if(!m_buffers[i])
+            {
+                stop();
+                throw std::bad_alloc();
+            }
+
+            registered[i] = iovec{m_buffers[i], URING_CHUNK};
+            m_free.push_back(i);
+        }
+
+        // The registered buffers are not mapped again at every write, but count in the locked memory of the process
+        m_registered = ::syscall(__NR_io_uring_register, m_ring, IORING_REGISTER_BUFFERS, registered.data(), depth) == 0;
+        m_direct = direct;
+
+        // The writes are only submitted if the kernel has their operation, it fails them all otherwise
+        if(!supports(IORING_OP_WRITE) || (m_registered && !supports(IORING_OP_WRITE_FIXED)))
+        {
+            stop();
+            throw std::runtime_error("io_uring is not available: the kernel does not support its write operations");
+        }
+    }
+
+    void UringWriter::stop()
+    {
+        std::unique_lock lock(m_mutex);
+
+        while(m_ring >= 0 && m_writes > 0)
+        {
+            waitCompletion(lock);
+        }
+
+        for(unsigned char *buffer: m_buffers)
+        {
+            std::free(buffer);
+        }
+
+        m_buffers.clear();
+        m_free.clear();
+
+        if(m_sqes)
+        {
+            ::munmap(static_cast<void*>(m_sqes), m_sqesSize);
+            m_sqes = nullptr;
+        }
+
+        if(m_cqMap && m_cqMap != MAP_FAILED && m_cqMap != m_sqMap)
+        {
+            ::munmap(m_cqMap, m_cqMapSize);
+        }
+
+        if(m_sqMap && m_sqMap != MAP_FAILED)
+        {
+            ::munmap(m_sqMap, m_sqMapSize);
+        }
+
+        m_sqMap = m_cqMap = nullptr;
+
+        if(m_ring >= 0)
+        {
+            ::close(m_ring);
+            m_ring = -1;
+        }
+    }
+
+    UringWriter::File* UringWriter::open(const std::string& path)
+    {
+        int fd = -1;
+        if(m_direct)
+        {
+            // Not supported by every file system, like tmpfs
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+        }
+
+        const bool direct = fd >= 0;
+        if(!direct)
+        {
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        }
+
+        if(fd < 0)
+        {
+            throw std::runtime_error("Can't open file to write: " + path);
+        }
+
+        File *file = new File;
+        file->fd = fd;
+        file->path = path;
+        file->truncate = direct;
+        return file;
+    }
+
+    void UringWriter::append(File& file, const std::vector<iovec>& buffers)
+    {
+        for(const iovec& buffer: buffers)
+        {
+            const unsigned char *data = static_cast<const unsigned char*>(buffer.iov_base);
+            size_t size = buffer.iov_len;
+            while(size > 0)
+            {
+                if(file.buffer < 0)
+                {
+                    file.buffer = acquire();
+                    file.filled = 0;
+                }
+
+                const size_t count = std::min(size, URING_CHUNK - file.filled);
+                std::memcpy(m_buffers[file.buffer] + file.filled, data, count);
+                file.filled += count;
+                file.size += count;
+                data += count;
+                size -= count;
+
+                if(file.filled == URING_CHUNK)
+                {
+                    submit(file);
+                }
+            }
+        }
+    }
+
+    void UringWriter::flush(File& file)
+    {
+        if(file.buffer < 0 || file.filled == 0)
+        {
+            return;
+        }
+
+        const size_t kept = file.truncate ? file.filled % URING_ALIGNMENT : 0;
+        if(kept == 0)
+        {
+            submit(file);
+            return;
+        }
+
+        // Not copied to another staging buffer, as the file may hold the only one
+        unsigned char last[URING_ALIGNMENT];
+        std::memcpy(last, m_buffers[file.buffer] + file.filled - kept, kept);
+        submit(file);
+
+        {
+            std::unique_lock lock(m_mutex);
+            while(file.pending > 0)
+            {
+                waitCompletion(lock);
+            }
+        }
+
+        file.offset -= URING_ALIGNMENT;
+        file.buffer = acquire();
+        file.filled = kept;
+        std::memcpy(m_buffers[file.buffer], last, kept);
+    }
+
+    void UringWriter::close(File *file, bool wait)
+    {
+        if(file->buffer >= 0)
+        {
+            submit(*file);
+        }
+
+        std::unique_lock lock(m_mutex);
+        if(wait)
+        {
+            while(file->pending > 0)
+            {
+                waitCompletion(lock);
+            }
+
+            finish(file);
+            return;
+        }
+
+        // Closed by its last write otherwise
+        file->closing = true;
+        if(file->pending == 0)
+        {
+            finish(file);
+        }
+    }
+
+    void UringWriter::forget()
+    {
+        m_writes = 0;
+        m_unsubmitted = 0;
+        m_reaping = false;
+        m_inFlight.clear();
+        new (&m_changed) std::condition_variable;
+        stop();
+    }
+
+    bool UringWriter::supports(unsigned operation) const
+    {
+        constexpr unsigned count = 256;
+        std::vector<unsigned char> buffer(sizeof(io_uring_probe) + count * sizeof(io_uring_probe_op));
+        io_uring_probe *probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+
+        // Older than the probe, since Linux 5.6, the kernel has none of the write operations
+        if(::syscall(__NR_io_uring_register, m_ring, IORING_REGISTER_PROBE, probe, count) != 0)
+        {
+            return false;
+        }
+
+        return operation <= probe->last_op && (probe->ops[operation].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    int UringWriter::acquire()
+    {
+        std::unique_lock lock(m_mutex);
+        while(m_free.empty())
+        {
+            waitCompletion(lock);
+        }
+
+        const int buffer = m_free.back();
+        m_free.pop_back();
+        return buffer;
+    }
+
+    void UringWriter::submit(File& file)
+    {
+        size_t size = file.filled;
+        if(file.truncate && size % URING_ALIGNMENT != 0)
+        {
+            const size_t padded = (size + URING_ALIGNMENT - 1) / URING_ALIGNMENT * URING_ALIGNMENT;
+            std::memset(m_buffers[file.buffer] + size, 0, padded - size);
+            size = padded;
+        }
+
+        std::lock_guard lock(m_mutex);
+
+        const unsigned tail = *m_sqTail;
+        const unsigned index = tail & m_sqMask;
+        io_uring_sqe& sqe = m_sqes[index];
+        sqe = io_uring_sqe{};
+        sqe.opcode = m_registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe.fd = file.fd;
+        sqe.off = file.offset;
+        sqe.addr = reinterpret_cast<std::uint64_t>(m_buffers[file.buffer]);
+        sqe.len = static_cast<unsigned>(size);
+        sqe.buf_index = static_cast<std::uint16_t>(file.buffer);
+        sqe.user_data = static_cast<std::uint64_t>(file.buffer);
+        m_sqArray[index] = index;
+        std::atomic_ref(*m_sqTail).store(tail + 1, std::memory_order_release);
+
+        m_inFlight[file.buffer] = Write{&file, file.offset, size};
+        m_writes++;
+        m_unsubmitted++;
+        file.pending++;
+        file.offset += size;
+        file.buffer = -1;
+        file.filled = 0;
+
+        submitPending();
+
+        // A thread waiting while no write was in flight can now wait for this one
+        m_changed.notify_all();
+    }
+
+    void UringWriter::submitPending()
+    {
+        while(m_unsubmitted > 0)
+        {
+            const long submitted = ::syscall(__NR_io_uring_enter, m_ring, m_unsubmitted, 0, 0, nullptr, 0);
+            if(submitted > 0)
+            {
+                m_unsubmitted -= static_cast<unsigned>(std::min<long>(submitted, m_unsubmitted));
+            }
+            else if(submitted < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else
+            {
+                // Without `IORING_SETUP_SQPOLL`, the kernel only reads the ring in `io_uring_enter()` with entries to submit
+                const unsigned tail = *m_sqTail - m_unsubmitted;
+                std::vector<int> buffers;
+                for(unsigned i = tail; i != *m_sqTail; i++)
+                {
+                    buffers.push_back(static_cast<int>(m_sqes[m_sqArray[i & m_sqMask]].user_data));
+                }
+
+                std::atomic_ref(*m_sqTail).store(tail, std::memory_order_release);
+                m_unsubmitted = 0;
+
+                for(const int buffer: buffers)
+                {
+                    complete(buffer, 0);
+                }
+            }
+        }
+    }
+
+    void UringWriter::waitCompletion(std::unique_lock<std::mutex>& lock)
+    {
+        if(m_writes == 0 || m_reaping)
+        {
+            m_changed.wait(lock);
+            return;
+        }
+
+        unsigned head = *m_cqHead;
+        if(head == std::atomic_ref(*m_cqTail).load(std::memory_order_acquire))
+        {
+            m_reaping = true;
+            lock.unlock();
+            while(::syscall(__NR_io_uring_enter, m_ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno == EINTR)
+            {
+            }
+
+            lock.lock();
+            m_reaping = false;
+            head = *m_cqHead;
+        }
+
+        const unsigned tail = std::atomic_ref(*m_cqTail).load(std::memory_order_acquire);
+        for(; head != tail; head++)
+        {
+            const io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+            complete(static_cast<int>(cqe.user_data), cqe.res);
+        }
+
+        std::atomic_ref(*m_cqHead).store(head, std::memory_order_release);
+        m_changed.notify_all();
+    }
+
+    void UringWriter::complete(int buffer, int result)
+    {
+        Write& write = m_inFlight[buffer];
+        File *file = write.file;
+
+        // Refused by the kernel, for example by a security policy, the write is done again with `pwrite()`
+        const bool refused = result < 0;
+        size_t written = refused ? 0 : static_cast<size_t>(result);
+        result = 0;
+
+        // The rest of a partial write is not aligned for `O_DIRECT`, and a write refused may not be aligned for the file system,
+        // so the file is now written through the page cache
+        if((refused || (written > 0 && written < write.size)) && file->truncate)
+        {
+            const int flags = ::fcntl(file->fd, F_GETFL);
+            if(flags >= 0 && (flags & O_DIRECT))
+            {
+                ::fcntl(file->fd, F_SETFL, flags & ~O_DIRECT);
+            }
+        }
+
+        while(result >= 0 && written < write.size)
+        {
+            const ssize_t count = ::pwrite(file->fd, m_buffers[buffer] + written, write.size - written,
+                                           static_cast<off_t>(write.offset + written));
+            if(count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            result = count < 0 ? -errno : count == 0 ? -EIO : result;
+            written += count > 0 ? static_cast<size_t>(count) : 0;
+        }
+
+        if(result < 0)
+        {
+            logError("WRITE MATRIX FILE", std::runtime_error("Can't write file: " + file->path + ": " + std::strerror(-result)));
+        }
+
+        m_free.push_back(buffer);
+        write.file = nullptr;
+        m_writes--;
+
+        if(--file->pending == 0 && file->closing)
+        {
+            finish(file);
+        }
+    }
+
+    void UringWriter::finish(File *file)
+    {
+        if(file->truncate && file->size != file->offset && ::ftruncate(file->fd, static_cast<off_t>(file->size)) != 0)
+        {
+            logError("WRITE MATRIX FILE", std::runtime_error("Can't truncate file: " + file->path + ": " + std::strerror(errno)));
+        }
+
+        ::close(file->fd);
+        delete file;
+    }
+}
+#endif
\ No newline at end of file
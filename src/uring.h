@@ -0,0 +1,276 @@
+#pragma once
+
+
+#if REGRR_HAVE_URING
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+/**
+ * Writing of the files through io_uring, with `REGRR_URING`.
+ * Internal to the library.
+ */
+
+namespace regrr
+{
+    /**
+     * Write the files of the native binary format and the archive through io_uring, several writes in flight.
+     *
+     * The data is copied to staging buffers aligned for `O_DIRECT` and registered in the kernel once, of `URING_CHUNK` bytes each.
+     * A buffer full is written while the caller continues, so a file is only waited for when all the buffers are in flight.
+     * The last buffer of a file is written when it is closed, padded to the alignment with `O_DIRECT` and truncated after.
+     * The file descriptor is closed once all its writes are completed.
+     * With `O_DIRECT`, the pages of the files are never cached, so the working set of the process is not evicted.
+     *
+     * The errors of the writes in flight are only logged, as in asynchronous mode.
+     * Started once at initialization, if io_uring is not available the files are written with `write()` as usual.
+     */
+    class UringWriter
+    {
+    public:
+        /**
+         * An output file, written sequentially.
+         */
+        struct File
+        {
+            int fd = -1;
+            std::string path;
+
+            /**
+             * Count of bytes appended, the final size of the file.
+             */
+            std::uint64_t size = 0;
+
+            /**
+             * Offset of the next buffer submitted.
+             */
+            std::uint64_t offset = 0;
+
+            /**
+             * Staging buffer being filled, and its count of bytes, -1 if none.
+             */
+            int buffer = -1;
+            size_t filled = 0;
+
+            /**
+             * Count of writes in flight, and if the file is closed by the last one.
+             */
+            int pending = 0;
+            bool closing = false;
+            bool truncate = false;
+        };
+
+        /**
+         * Create the ring and its staging buffers.
+         *
+         * @param depth Count of staging buffers, as many writes in flight.
+         * @param direct If the files are opened with `O_DIRECT`, falling back to the page cache where not supported.
+         * @throw std::runtime_error If io_uring or its write operations are not available.
+         */
+        void start(unsigned depth, bool direct);
+
+        /**
+         * Wait for all the writes in flight, then destroy the ring.
+         * Noop if not started.
+         */
+        void stop();
+
+        /**
+         * If the writer is started, so the files should be written through it.
+         */
+        bool started() const
+        {
+            return m_ring >= 0;
+        }
+
+        /**
+         * If the files are opened with `O_DIRECT`.
+         */
+        bool direct() const
+        {
+            return m_direct;
+        }
+
+        /**
+         * If the staging buffers are registered in the kernel.
+         */
+        bool registered() const
+        {
+            return m_registered;
+        }
+
+        /**
+         * Create or clear a file to write.
+         *
+         * @return The file, owned by the writer until closed with `close()`.
+         * @throw std::runtime_error If the file could not be opened.
+         */
+        File* open(const std::string& path);
+
+        /**
+         * Append buffers to a file.
+         * The data is copied, so the buffers can be reused once returned. Blocks while all the staging buffers are in flight.
+         * A file should be appended by a single thread at a time.
+         */
+        void append(File& file, const std::vector<iovec>& buffers);
+
+        /**
+         * Submit the staging buffer of a file being filled, so its data is written without waiting for the buffer to be full.
+         * With `O_DIRECT`, the buffer is padded to the alignment and its last block is kept aside, copied to a staging buffer
+         * once the write is completed to be written again with the data appended after, so a single staging buffer is enough.
+         */
+        void flush(File& file);
+
+        /**
+         * Write the end of a file, then close it once all its writes are completed.
+         *
+         * @param wait If the writes of the file should be completed before returning, otherwise it is closed in the background.
+         */
+        void close(File *file, bool wait);
+
+        /**
+         * @{
+         * Lock around `fork()`, so a child does not inherit the ring in the middle of a write, see `beforeFork()`.
+         */
+        void lock()
+        {
+            m_mutex.lock();
+        }
+
+        void unlock()
+        {
+            m_mutex.unlock();
+        }
+        /**
+         * @}
+         */
+
+        /**
+         * Count of staging buffers, as many writes in flight.
+         */
+        unsigned depth() const
+        {
+            return static_cast<unsigned>(m_buffers.size());
+        }
+
+        /**
+         * Forget the ring of the parent in a child process after `fork()`, shared with the parent so never used by the child.
+         * The writes in flight and the files being written are left to the parent.
+         */
+        void forget();
+
+    private:
+        /**
+         * Size of each staging buffer, a multiple of the alignment.
+         */
+        static constexpr size_t URING_CHUNK = 1 << 20;
+
+        /**
+         * Alignment of the offsets, sizes and addresses of the writes with `O_DIRECT`, the largest logical block size.
+         */
+        static constexpr size_t URING_ALIGNMENT = 4096;
+
+        /**
+         * A write in flight, by staging buffer.
+         */
+        struct Write
+        {
+            File *file = nullptr;
+            std::uint64_t offset = 0;
+            size_t size = 0;
+        };
+
+        /**
+         * Check if the kernel supports an operation of the ring, `IORING_OP_*`.
+         */
+        bool supports(unsigned operation) const;
+
+        /**
+         * Get a free staging buffer, waiting for one to be released if all are in flight or being filled.
+         */
+        int acquire();
+
+        /**
+         * Submit the staging buffer of a file, padded to the alignment if it is the last one with `O_DIRECT`.
+         */
+        void submit(File& file);
+
+        /**
+         * Submit all the entries of the submission ring not consumed by the kernel yet, including the ones it refused before.
+         * If the kernel refuses them, busy or out of resources, they are taken back from the ring and written with `pwrite()`,
+         * so every write counted in flight completes. Called with the mutex locked, the only place entries are submitted.
+         */
+        void submitPending();
+
+        /**
+         * Wait for a change of the writes in flight, and process all the writes completed.
+         * Called with the mutex locked, the caller checks again what it waits for.
+         *
+         * A single thread waits in the kernel, with the mutex unlocked so the others can still submit their buffers:
+         * when no write is in flight, the missing buffers are being filled by other threads which need the mutex to submit them.
+         * The other threads wait to be notified of a write submitted or completed.
+         */
+        void waitCompletion(std::unique_lock<std::mutex>& lock);
+
+        /**
+         * Process a write completed, the rest is written with `pwrite()` if partial, all of it if the kernel refused the write.
+         */
+        void complete(int buffer, int result);
+
+        /**
+         * Truncate the padding of the last write and close a file whose writes are all completed.
+         */
+        void finish(File *file);
+
+        std::mutex m_mutex;
+
+        /**
+         * Notified when a write is submitted or completed, see `waitCompletion()`.
+         */
+        std::condition_variable m_changed;
+
+        /**
+         * If a thread waits for the completions in the kernel, with the mutex unlocked.
+         */
+        bool m_reaping = false;
+
+        int m_ring = -1;
+        bool m_direct = false;
+        bool m_registered = false;
+
+        void *m_sqMap = nullptr;
+        void *m_cqMap = nullptr;
+        size_t m_sqMapSize = 0;
+        size_t m_cqMapSize = 0;
+        size_t m_sqesSize = 0;
+        unsigned *m_sqTail = nullptr;
+        unsigned *m_sqArray = nullptr;
+        unsigned m_sqMask = 0;
+        io_uring_sqe *m_sqes = nullptr;
+        unsigned *m_cqHead = nullptr;
+        unsigned *m_cqTail = nullptr;
+        unsigned m_cqMask = 0;
+        io_uring_cqe *m_cqes = nullptr;
+
+        std::vector<unsigned char*> m_buffers;
+        std::vector<int> m_free;
+        std::vector<Write> m_inFlight;
+        size_t m_writes = 0;
+
+        /**
+         * Count of entries of the submission ring not consumed by the kernel yet, the last ones of the ring.
+         */
+        unsigned m_unsubmitted = 0;
+    };
+
+    /**
+     * The writer through io_uring, only started if `REGRR_URING` is set.
+     * Never destroyed, as the files may be written until the very end of the process.
+     */
+    extern UringWriter& uringWriter;
+}
+#endif
\ No newline at end of file
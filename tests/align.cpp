@@ -0,0 +1,148 @@
+#include "check.h"
+#include "regrr_reader.h"
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+/**
+ * Check `regrr::align_sequences()` against the longest common subsequence computed by dynamic programming.
+ */
+
+namespace
+{
+    using Sequence = std::vector<std::uint32_t>;
+
+    /**
+     * Length of the longest common subsequence, in O(N M).
+     */
+    size_t lcsLength(const Sequence& a, const Sequence& b)
+    {
+        std::vector<size_t> previous(b.size() + 1);
+        std::vector<size_t> current(b.size() + 1);
+        for(size_t i = 0; i < a.size(); i++)
+        {
+            for(size_t j = 0; j < b.size(); j++)
+            {
+                current[j + 1] = a[i] == b[j] ? previous[j] + 1 : std::max(previous[j + 1], current[j]);
+            }
+
+            std::swap(previous, current);
+        }
+
+        return previous[b.size()];
+    }
+
+    /**
+     * Check that the alignment is a common subsequence, and a longest one.
+     */
+    void checkAlignment(const Sequence& a, const Sequence& b)
+    {
+        std::vector<size_t> matches;
+        regrr::align_sequences(a, b, matches);
+        if(!REGRR_CHECK(matches.size() == a.size()))
+        {
+            return;
+        }
+
+        size_t count = 0;
+        size_t next = 0;
+        for(size_t i = 0; i < a.size(); i++)
+        {
+            if(matches[i] == SIZE_MAX)
+            {
+                continue;
+            }
+
+            // Matched in order, with equal elements
+            REGRR_CHECK(matches[i] >= next && matches[i] < b.size());
+            REGRR_CHECK(matches[i] < b.size() && a[i] == b[matches[i]]);
+            next = matches[i] + 1;
+            count++;
+        }
+
+        if(!REGRR_CHECK(count == lcsLength(a, b)))
+        {
+            std::cerr << "  " << a.size() << " and " << b.size() << " elements: " << count << " matches instead of " << lcsLength(a, b) << std::endl;
+        }
+    }
+
+    /**
+     * A flow of `size` events among `alphabet` distinct ones.
+     */
+    Sequence randomSequence(std::mt19937& random, size_t size, std::uint32_t alphabet)
+    {
+        Sequence sequence(size);
+        for(std::uint32_t& element: sequence)
+        {
+            element = random() % alphabet;
+        }
+
+        return sequence;
+    }
+
+    /**
+     * A copy of a flow with a few events removed, inserted or replaced, like a flow diverging from its baseline.
+     */
+    Sequence diverge(std::mt19937& random, Sequence sequence, size_t edits, std::uint32_t alphabet)
+    {
+        for(size_t edit = 0; edit < edits; edit++)
+        {
+            const size_t position = sequence.empty() ? 0 : random() % sequence.size();
+            switch(random() % 3)
+            {
+            case 0:
+                if(!sequence.empty())
+                {
+                    sequence.erase(sequence.begin() + static_cast<std::ptrdiff_t>(position));
+                }
+                break;
+            case 1:
+                sequence.insert(sequence.begin() + static_cast<std::ptrdiff_t>(position), random() % alphabet);
+                break;
+            default:
+                if(!sequence.empty())
+                {
+                    sequence[position] = random() % alphabet;
+                }
+                break;
+            }
+        }
+
+        return sequence;
+    }
+}
+
+int main()
+{
+    checkAlignment({}, {});
+    checkAlignment({1, 2, 3}, {});
+    checkAlignment({}, {1, 2, 3});
+    checkAlignment({1, 2, 3}, {1, 2, 3});
+    checkAlignment({1, 2, 3}, {4, 5, 6});
+    checkAlignment({1, 2, 3, 4}, {1, 9, 9, 9, 4});
+    checkAlignment({1, 2, 3, 4, 5}, {2, 3, 4, 5, 1});
+    checkAlignment({1, 1, 1, 2}, {2, 1, 1, 1});
+
+    // Every pair of small lengths, with odd and even differences
+    std::mt19937 random(12345);
+    for(size_t n = 0; n < 24; n++)
+    {
+        for(size_t m = 0; m < 24; m++)
+        {
+            for(const std::uint32_t alphabet : {2u, 3u, 8u})
+            {
+                checkAlignment(randomSequence(random, n, alphabet), randomSequence(random, m, alphabet));
+            }
+        }
+    }
+
+    // Long flows diverging in a few places, the case the alignment is optimized for
+    for(int i = 0; i < 50; i++)
+    {
+        const Sequence flow = randomSequence(random, 200 + random() % 800, 20);
+        checkAlignment(flow, diverge(random, flow, 1 + random() % 30, 20));
+    }
+
+    return regrr_test::failures() != 0;
+}
\ No newline at end of file
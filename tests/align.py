@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+
+import os
+import random
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'bin'))
+import diff
+
+
+# Check match_sequences() of bin/diff.py against the longest common subsequence computed by dynamic programming,
+# same cases as tests/align.cpp
+
+
+def lcs_length(a, b):
+    """
+    Length of the longest common subsequence, in O(N M).
+    """
+    previous = [0] * (len(b) + 1)
+    for x in a:
+        current = [0] * (len(b) + 1)
+        for j, y in enumerate(b):
+            current[j + 1] = previous[j] + 1 if x == y else max(previous[j + 1], current[j])
+        previous = current
+    return previous[len(b)]
+
+
+def check_alignment(a, b):
+    """
+    Check that the alignment is a common subsequence, and a longest one.
+    Return the count of failures.
+    """
+    matches = diff.match_sequences(a, b)
+    pairs = [(i, j) for i, j in enumerate(matches) if j is not None]
+    in_order = all(j1 < j2 for (_, j1), (_, j2) in zip(pairs, pairs[1:]))
+    equal = all(0 <= j < len(b) and a[i] == b[j] for i, j in pairs)
+    longest = len(pairs) == lcs_length(a, b)
+    if len(matches) == len(a) and in_order and equal and longest:
+        return 0
+    print(f'alignment failed: {a} and {b}, matches {matches}', file=sys.stderr)
+    return 1
+
+
+def diverge(rng, sequence, edits, alphabet):
+    """
+    A copy of a flow with a few events removed, inserted or replaced, like a flow diverging from its baseline.
+    """
+    sequence = list(sequence)
+    for _ in range(edits):
+        position = rng.randrange(len(sequence)) if sequence else 0
+        edit = rng.randrange(3)
+        if edit == 0 and sequence:
+            del sequence[position]
+        elif edit == 1:
+            sequence.insert(position, rng.randrange(alphabet))
+        elif sequence:
+            sequence[position] = rng.randrange(alphabet)
+    return sequence
+
+
+if __name__ == '__main__':
+    failures = 0
+    for a, b in [([], []), ([1, 2, 3], []), ([], [1, 2, 3]), ([1, 2, 3], [1, 2, 3]), ([1, 2, 3], [4, 5, 6]),
+                 ([1, 2, 3, 4], [1, 9, 9, 9, 4]), ([1, 2, 3, 4, 5], [2, 3, 4, 5, 1]), ([1, 1, 1, 2], [2, 1, 1, 1])]:
+        failures += check_alignment(a, b)
+
+    # Every pair of small lengths, with odd and even differences
+    rng = random.Random(12345)
+    for n in range(24):
+        for m in range(24):
+            for alphabet in (2, 3, 8):
+                failures += check_alignment([rng.randrange(alphabet) for _ in range(n)], [rng.randrange(alphabet) for _ in range(m)])
+
+    # Long flows diverging in a few places, the case the alignment is optimized for
+    for _ in range(20):
+        flow = [rng.randrange(20) for _ in range(rng.randrange(200, 600))]
+        failures += check_alignment(flow, diverge(rng, flow, rng.randrange(1, 30), 20))
+
+    sys.exit(1 if failures else 0)
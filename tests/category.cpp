@@ -0,0 +1,49 @@
+#include "check.h"
+#include "regrr.h"
+#include <type_traits>
+
+/**
+ * Check that the macros of a category not compiled do not evaluate their arguments, and that the others evaluate them once.
+ * The category 0 is never compiled, whatever `REGRR_COMPILE_MASK`. The library is not enabled, only the macros are checked.
+ */
+
+namespace
+{
+    int evaluations = 0;
+
+    /**
+     * An argument of the macros, counting its evaluations.
+     */
+    int counted(int value)
+    {
+        evaluations++;
+        return value;
+    }
+
+    constexpr regrr::Category NOT_COMPILED = 0;
+    constexpr regrr::Category COMPILED = REGRR_COMPILE_MASK;
+}
+
+int main()
+{
+    cv::Mat mat(2, 2, CV_8UC1);
+
+    {
+        REGRR_SCOPED_CAT(NOT_COMPILED, "scope-%d", counted(1));
+        REGRR_SAVE_CAT(NOT_COMPILED, mat, "mat-%d", counted(2));
+        REGRR_CREATE_MAT_CAT(NOT_COMPILED, uchar, counted(3), counted(4), "managed-%d", counted(5));
+        REGRR_SET_PX_CAT(NOT_COMPILED, counted(0), counted(0), uchar(1), "managed-%d", counted(5));
+    }
+    REGRR_CHECK(evaluations == 0);
+
+    {
+        REGRR_SCOPED_CAT(COMPILED, "scope-%d", counted(1));
+        REGRR_CREATE_MAT_CAT(COMPILED, uchar, counted(3), counted(4), "managed-%d", counted(5));
+    }
+    REGRR_CHECK(evaluations == 4);
+
+    // Nothing is left of the objects of the categories not compiled
+    static_assert(std::is_empty_v<decltype(regrr::make_if_compiled<false>([] { return 0; }))>);
+
+    return regrr_test::failures() != 0;
+}
\ No newline at end of file
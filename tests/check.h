@@ -0,0 +1,36 @@
+#pragma once
+
+
+#include <iostream>
+
+/**
+ * Checks of the tests, without test framework.
+ * A failed check is printed and the test goes on, `failures()` is its exit code.
+ */
+
+namespace regrr_test
+{
+    inline int& failures()
+    {
+        static int count = 0;
+        return count;
+    }
+
+    inline bool check(bool condition, const char *expression, const char *file, int line)
+    {
+        if(!condition)
+        {
+            std::cerr << file << ':' << line << ": check failed: " << expression << std::endl;
+            failures()++;
+        }
+
+        return condition;
+    }
+}
+
+/**
+ * Check a condition, the following statements run even if it fails.
+ *
+ * @return The condition, to print more context if it failed.
+ */
+#define REGRR_CHECK(condition) regrr_test::check(static_cast<bool>(condition), #condition, __FILE__, __LINE__)
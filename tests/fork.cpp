@@ -0,0 +1,232 @@
+#include "check.h"
+#include "regrr.h"
+#include "regrr_reader.h"
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * Fork inside nested scopes of an initialized process, then check that the child saves in its own sub-directory `fork-N`,
+ * before and after exiting the scopes entered by the parent, and that the children which call `exec()` or never call the library
+ * create nothing. The forking process runs as a child of the test for each configuration.
+ * In thread-aware mode, also fork from a named and an unnamed thread, which keep their identity in the child.
+ */
+
+namespace
+{
+    /**
+     * Wait for a child process, and check that it succeeded.
+     */
+    bool waitChild(pid_t pid)
+    {
+        int status = 0;
+        return ::waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    /**
+     * The flow of the process forking, and of its children.
+     */
+    int scenario()
+    {
+        cv::Mat mat(4, 4, CV_8UC1);
+        for(int i = 0; i < 16; i++)
+        {
+            mat.data[i] = static_cast<uchar>(i);
+        }
+
+        regrr::enter_scope("outer");
+        regrr::enter_scope("inner");
+        REGRR_SAVE(mat, "parent");
+
+        const pid_t capturing = ::fork();
+        if(capturing == 0)
+        {
+            REGRR_SAVE(mat, "child_inner");
+            regrr::exit_scope();
+            REGRR_SAVE(mat, "child_outer");
+            regrr::exit_scope();
+            REGRR_SAVE(mat, "child_top");
+            std::exit(0);
+        }
+
+        const pid_t executing = ::fork();
+        if(executing == 0)
+        {
+            ::execl("/bin/true", "true", nullptr);
+            ::_exit(1);
+        }
+
+        const pid_t idle = ::fork();
+        if(idle == 0)
+        {
+            std::exit(0);
+        }
+
+        const bool children = waitChild(capturing) & waitChild(executing) & waitChild(idle);
+
+        regrr::exit_scope();
+        REGRR_SAVE(mat, "parent_outer");
+        regrr::exit_scope();
+        REGRR_SAVE(mat, "parent_top");
+
+        return children ? 0 : 1;
+    }
+
+    /**
+     * Fork from the calling thread, and save a matrix in the child.
+     */
+    bool forkSaving(const cv::Mat& mat, const char *name)
+    {
+        const pid_t child = ::fork();
+        if(child == 0)
+        {
+            REGRR_SAVE(mat, "%s", name);
+            std::exit(0);
+        }
+
+        return waitChild(child);
+    }
+
+    /**
+     * Fork from a named thread then from an unnamed one, neither calling the library before forking but the naming.
+     */
+    int threadsScenario()
+    {
+        cv::Mat mat(4, 4, CV_8UC1);
+        for(int i = 0; i < 16; i++)
+        {
+            mat.data[i] = static_cast<uchar>(i);
+        }
+
+        bool children = true;
+
+        std::thread named([&] {
+            regrr::set_thread_name("worker");
+            children &= forkSaving(mat, "named");
+        });
+        named.join();
+
+        std::thread unnamed([&] {
+            children &= forkSaving(mat, "unnamed");
+        });
+        unnamed.join();
+
+        return children ? 0 : 1;
+    }
+
+    /**
+     * Names of the events of a lists file, `+scope`, `-` and `name.call`.
+     */
+    std::vector<std::string> events(const std::string& path)
+    {
+        std::vector<std::string> result;
+        regrr::stream_lists(path, [&result] (std::string_view, regrr::ListsEvent&& event) {
+            result.push_back(event.type == regrr::ListsEvent::EnterScope ? "+" + event.name : event.type == regrr::ListsEvent::ExitScope ? "-" : event.name);
+        });
+
+        return result;
+    }
+
+    /**
+     * Run the scenario in a child process with the configuration of a run, then check the outputs of the process and its children.
+     */
+    void checkScenario(const char *program, const std::string& directory, std::string_view settings)
+    {
+        const std::string command = "REGRR_DIR=" + directory + " REGRR_EXT=.rgb REGRR_LOG=error " + std::string(settings) + " " + program + " scenario";
+        if(!REGRR_CHECK(std::system(command.c_str()) == 0))
+        {
+            std::cerr << "  " << settings << std::endl;
+            return;
+        }
+
+        try
+        {
+            const regrr::OutputReader parent(directory);
+            const regrr::OutputReader child(directory + "/fork-1");
+            const bool valid = REGRR_CHECK(parent.exists("outer/inner/parent.1.rgb"))
+                             & REGRR_CHECK(parent.exists("outer/parent_outer.1.rgb"))
+                             & REGRR_CHECK(parent.exists("parent_top.1.rgb"))
+                             & REGRR_CHECK(child.exists("outer/inner/child_inner.1.rgb"))
+                             & REGRR_CHECK(child.exists("outer/child_outer.1.rgb"))
+                             & REGRR_CHECK(child.exists("child_top.1.rgb"))
+                             & REGRR_CHECK(child.load("child_top.1.rgb").mat.at<uchar>(3, 3) == 15);
+
+            // Nothing of the child in the output of the parent, even from the scopes it exited
+            const bool separate = REGRR_CHECK(!parent.exists("child_top.1.rgb"))
+                                & REGRR_CHECK(!parent.exists("outer/child_outer.1.rgb"))
+                                & REGRR_CHECK(!parent.exists("fork-1child_outer.1.rgb"))
+                                & REGRR_CHECK(!parent.exists("fork-1outer/child_outer.1.rgb"));
+
+            // The scopes of the parent are entered again in the lists file of the child
+            const std::vector<std::string> expected{"+outer", "+inner", "child_inner.1", "-", "child_outer.1", "-", "child_top.1"};
+            const bool listed = REGRR_CHECK(events(regrr::lists_path(directory + "/fork-1")) == expected);
+
+            // The children calling `exec()` or never calling the library create nothing
+            const bool nothing = REGRR_CHECK(!fs::exists(directory + "/fork-2")) & REGRR_CHECK(!fs::exists(directory + "/fork-3"));
+
+            if(!(valid && separate && listed && nothing))
+            {
+                std::cerr << "  " << settings << std::endl;
+            }
+        }
+        catch(const std::exception& error)
+        {
+            REGRR_CHECK(!error.what());
+            std::cerr << "  " << settings << ": " << error.what() << std::endl;
+        }
+
+        std::error_code error;
+        fs::remove_all(directory, error);
+    }
+
+    /**
+     * Run the scenario of the threads in a child process, then check the outputs of its children.
+     */
+    void checkThreadsScenario(const char *program, const std::string& directory)
+    {
+        const std::string command = "REGRR_DIR=" + directory + " REGRR_EXT=.rgb REGRR_LOG=error REGRR_THREADS=1 " + program + " threads 2> /dev/null";
+        if(REGRR_CHECK(std::system(command.c_str()) == 0))
+        {
+            REGRR_CHECK(fs::exists(directory + "/fork-1/worker/named.1.rgb"));
+            REGRR_CHECK(!fs::exists(directory + "/fork-2/unnamed.1.rgb"));
+        }
+
+        std::error_code error;
+        fs::remove_all(directory, error);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if(argc == 2 && std::string_view(argv[1]) == "scenario")
+    {
+        return scenario();
+    }
+
+    if(argc == 2 && std::string_view(argv[1]) == "threads")
+    {
+        return threadsScenario();
+    }
+
+    const std::string root = (fs::temp_directory_path() / ("regrr-test-fork-" + std::to_string(::getpid()))).string();
+    int run = 0;
+
+    for(const char *settings: {"", "REGRR_ASYNC=2", "REGRR_THREADS=1", "REGRR_ARCHIVE=1", "REGRR_ASYNC=2 REGRR_LISTS_BINARY=1", "REGRR_URING=2 REGRR_ASYNC=2"})
+    {
+        checkScenario(argv[0], root + "/" + std::to_string(run++), settings);
+    }
+
+    checkThreadsScenario(argv[0], root + "/" + std::to_string(run++));
+
+    std::error_code error;
+    fs::remove_all(root, error);
+
+    return regrr_test::failures() != 0;
+}
\ No newline at end of file
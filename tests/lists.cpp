@@ -0,0 +1,142 @@
+#include "check.h"
+#include "regrr.h"
+#include "regrr_format.h"
+#include "regrr_reader.h"
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/**
+ * Capture the same flow with the text and the binary lists file, then check that `regrr-lists` converts the binary file
+ * to exactly the text file, and that both are read as the same events.
+ * The captures run in child processes, as the library is configured once per process.
+ */
+
+namespace
+{
+    /**
+     * The flow captured, with nested scopes, a named thread, regions and calls skipped by the budget.
+     * A thread not named is not captured, and a thread exiting inside a scope saves the matrices it released there.
+     */
+    void capture()
+    {
+        cv::Mat mat(6, 8, CV_8UC1);
+        for(int i = 0; i < 48; i++)
+        {
+            mat.data[i] = static_cast<uchar>(i * 5);
+        }
+
+        REGRR_SCOPED("outer");
+        for(int frame = 0; frame < 5; frame++)
+        {
+            REGRR_SCOPED("frame-%d", frame);
+            REGRR_SAVE(mat, "image");
+            REGRR_SAVE_ROI(mat, cv::Rect(1, 2, 3, 2), "roi");
+            REGRR_SAVE_STRIDED(mat, 2, 3, "half");
+
+            mat.data[frame]++;
+        }
+
+        std::thread worker([&mat] {
+            REGRR_THREAD_NAME("worker");
+            REGRR_SCOPED("work");
+            REGRR_SAVE(mat, "result");
+        });
+        worker.join();
+
+        std::thread batcher([&mat] {
+            REGRR_THREAD_NAME("batcher");
+            regrr::enter_scope("open");
+            regrr::store_mat(mat.clone(), "managed");
+            regrr::release_mat("managed");
+        });
+        batcher.join();
+
+        std::thread unnamed([&mat] {
+            REGRR_SCOPED("ignored");
+            REGRR_SAVE(mat, "ignored");
+        });
+        unnamed.join();
+
+        REGRR_SAVE(mat, "last");
+    }
+
+    std::string readFile(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::ostringstream content;
+        content << file.rdbuf();
+        return content.str();
+    }
+
+    /**
+     * Run the capture in a child process, with the configuration of a run.
+     */
+    bool runCapture(const char *program, const std::string& directory, std::string_view settings)
+    {
+        const std::string command = "REGRR_DIR=" + directory + " REGRR_THREADS=1 REGRR_BUDGET=every=2 REGRR_BATCH_RELEASES=1 REGRR_LOG=error " + std::string(settings)
+                                  + " " + program + " capture 2> /dev/null";
+        return REGRR_CHECK(std::system(command.c_str()) == 0);
+    }
+
+    std::vector<std::string> events(const std::string& path)
+    {
+        std::vector<std::string> result;
+        result.push_back(regrr::stream_lists(path, [&result] (std::string_view thread, regrr::ListsEvent&& event) {
+            result.push_back(std::string(thread) + '|' + std::to_string(event.type) + '|' + event.name + '|' + event.hash + '|' + event.skipped + '|' + event.region);
+        }));
+
+        return result;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if(argc == 2 && std::string_view(argv[1]) == "capture")
+    {
+        capture();
+        return 0;
+    }
+
+    const std::string root = (fs::temp_directory_path() / ("regrr-test-lists-" + std::to_string(::getpid()))).string();
+    const std::string text = root + "/text";
+    const std::string binary = root + "/binary";
+    const std::string converted = root + "/converted.txt";
+
+    if(runCapture(argv[0], text, "") && runCapture(argv[0], binary, "REGRR_LISTS_BINARY=1"))
+    {
+        REGRR_CHECK(fs::exists(text + "/" REGRR_LISTS_FILE));
+        REGRR_CHECK(fs::exists(binary + "/" REGRR_LISTS_BINARY_FILE));
+        REGRR_CHECK(!fs::exists(binary + "/" REGRR_LISTS_FILE));
+        REGRR_CHECK(regrr::lists_path(binary) == binary + "/" REGRR_LISTS_BINARY_FILE);
+
+        // Both formats are read as the same events
+        const std::vector<std::string> textEvents = events(text + "/" REGRR_LISTS_FILE);
+        REGRR_CHECK(textEvents.size() > 30);
+        REGRR_CHECK(events(regrr::lists_path(binary)) == textEvents);
+        REGRR_CHECK(std::none_of(textEvents.begin(), textEvents.end(), [] (const std::string& event) { return event.find("ignored") != std::string::npos; }));
+        REGRR_CHECK(!fs::exists(text + "/ignored"));
+        REGRR_CHECK(fs::exists(text + "/batcher/open/managed.1.xml"));
+
+        // The conversion of the binary file is the text file, byte for byte
+        const std::string command = std::string(REGRR_LISTS_PATH) + " -o " + converted + " " + binary;
+        if(REGRR_CHECK(std::system(command.c_str()) == 0))
+        {
+            REGRR_CHECK(readFile(converted) == readFile(text + "/" REGRR_LISTS_FILE));
+        }
+    }
+
+    std::error_code error;
+    fs::remove_all(root, error);
+
+    return regrr_test::failures() != 0;
+}
\ No newline at end of file
@@ -0,0 +1,215 @@
+#include "check.h"
+#include "regrr_reader.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Check the vectorized statistics of `regrr::diff_stats()` and `regrr::abs_diff()` against a plain scalar computation,
+ * for every depth and for lengths around the widths of the kernels, so the tails are covered.
+ */
+
+namespace
+{
+    /**
+     * Lengths around the multiples of the width of the AVX2 and NEON kernels, in elements of any depth.
+     */
+    const size_t LENGTHS[] = {1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 4095, 4096, 4097, 10007};
+
+    /**
+     * Statistics of the absolute differences, computed in double one element at a time with a full sort for the median.
+     */
+    regrr::DiffStats reference(const std::vector<double>& values)
+    {
+        regrr::DiffStats stats;
+        stats.count = values.size();
+        stats.min = *std::min_element(values.begin(), values.end());
+        stats.max = *std::max_element(values.begin(), values.end());
+
+        for(const double value: values)
+        {
+            stats.l1 += value;
+        }
+
+        stats.avg = stats.l1 / values.size();
+
+        double variance = 0;
+        for(const double value: values)
+        {
+            variance += (value - stats.avg) * (value - stats.avg);
+        }
+
+        stats.std = std::sqrt(variance / values.size());
+
+        std::vector<double> sorted = values;
+        std::sort(sorted.begin(), sorted.end());
+        stats.median = (sorted[(sorted.size() - 1) / 2] + sorted[sorted.size() / 2]) / 2;
+        return stats;
+    }
+
+    /**
+     * Compare floating results, the sums of the kernels are not added in the same order.
+     */
+    bool near(double actual, double expected)
+    {
+        if(std::isinf(expected))
+        {
+            return actual == expected;
+        }
+
+        return std::abs(actual - expected) <= 1e-9 * std::max(1.0, std::abs(expected));
+    }
+
+    /**
+     * Random elements of a depth, over its whole range for the integers.
+     * The first matrix is partly copied to the second, so some differences are zero.
+     */
+    template<typename T>
+    void fill(std::mt19937_64& random, cv::Mat& a, cv::Mat& b)
+    {
+        T *aData = a.ptr<T>();
+        T *bData = b.ptr<T>();
+        const size_t count = a.total() * a.channels();
+
+        for(size_t i = 0; i < count; i++)
+        {
+            if constexpr(std::is_floating_point_v<T>)
+            {
+                std::uniform_real_distribution<T> distribution(-1000, 1000);
+                aData[i] = distribution(random);
+                bData[i] = random() % 4 == 0 ? aData[i] : distribution(random);
+            }
+            else
+            {
+                std::uniform_int_distribution<std::int64_t> distribution(std::numeric_limits<T>::min(), std::numeric_limits<T>::max());
+                aData[i] = static_cast<T>(distribution(random));
+                bData[i] = random() % 4 == 0 ? aData[i] : static_cast<T>(distribution(random));
+            }
+        }
+    }
+
+    /**
+     * Absolute differences of continuous matrices, in double.
+     */
+    template<typename T>
+    std::vector<double> differences(const cv::Mat& a, const cv::Mat& b)
+    {
+        std::vector<double> values(a.total() * a.channels());
+        for(size_t i = 0; i < values.size(); i++)
+        {
+            values[i] = std::abs(static_cast<double>(b.ptr<T>()[i]) - static_cast<double>(a.ptr<T>()[i]));
+        }
+
+        return values;
+    }
+
+    void checkStats(const regrr::DiffStats& actual, const regrr::DiffStats& expected, int depth, size_t length)
+    {
+        const bool same = REGRR_CHECK(actual.count == expected.count)
+                        & REGRR_CHECK(actual.min == expected.min)
+                        & REGRR_CHECK(actual.max == expected.max)
+                        & REGRR_CHECK(actual.median == expected.median)
+                        & REGRR_CHECK(near(actual.l1, expected.l1))
+                        & REGRR_CHECK(near(actual.avg, expected.avg))
+                        & REGRR_CHECK(near(actual.std, expected.std));
+        if(!same)
+        {
+            std::cerr << "  depth " << depth << ", " << length << " elements" << std::endl;
+        }
+    }
+
+    /**
+     * Check the statistics and the absolute differences of a depth, for every length.
+     */
+    template<typename T>
+    void checkDepth(int depth)
+    {
+        std::mt19937_64 random(static_cast<std::uint64_t>(depth) + 1);
+
+        for(const size_t length: LENGTHS)
+        {
+            cv::Mat a(1, static_cast<int>(length), CV_MAKETYPE(depth, 1));
+            cv::Mat b(1, static_cast<int>(length), CV_MAKETYPE(depth, 1));
+            fill<T>(random, a, b);
+
+            const std::vector<double> values = differences<T>(a, b);
+            checkStats(regrr::diff_stats(a, b), reference(values), depth, length);
+
+            // Saturated to the depth, like `cv::absdiff()`
+            const cv::Mat diff = regrr::abs_diff(a, b);
+            for(size_t i = 0; i < length; i++)
+            {
+                const double expected = std::min(values[i], static_cast<double>(std::numeric_limits<T>::max()));
+                if(!REGRR_CHECK(diff.ptr<T>()[i] == static_cast<T>(expected)))
+                {
+                    std::cerr << "  depth " << depth << ", element " << i << " of " << length << std::endl;
+                    break;
+                }
+            }
+        }
+
+        // A matrix with padding is compared as its continuous copy
+        cv::Mat a(9, 37, CV_MAKETYPE(depth, 3));
+        cv::Mat b(9, 37, CV_MAKETYPE(depth, 3));
+        fill<T>(random, a, b);
+        const cv::Rect roi(3, 2, 29, 6);
+        checkStats(regrr::diff_stats(a(roi), b(roi)), reference(differences<T>(a(roi).clone(), b(roi).clone())), depth, roi.area() * 3);
+    }
+
+    /**
+     * Check that a NaN propagates to all the statistics, in the body of the kernels and in their tail,
+     * and that an infinite difference keeps an exact median.
+     */
+    template<typename T>
+    void checkSpecialValues(int depth)
+    {
+        std::mt19937_64 random(99);
+
+        for(const size_t length: {9, 33, 4097})
+        {
+            for(const size_t position: {size_t(0), length / 2, length - 1})
+            {
+                cv::Mat a(1, static_cast<int>(length), CV_MAKETYPE(depth, 1));
+                cv::Mat b(1, static_cast<int>(length), CV_MAKETYPE(depth, 1));
+                fill<T>(random, a, b);
+
+                b.ptr<T>()[position] = std::numeric_limits<T>::quiet_NaN();
+                const regrr::DiffStats nan = regrr::diff_stats(a, b);
+                if(!(REGRR_CHECK(nan.count == length) & REGRR_CHECK(std::isnan(nan.l1)) & REGRR_CHECK(std::isnan(nan.min)) & REGRR_CHECK(std::isnan(nan.max))
+                   & REGRR_CHECK(std::isnan(nan.avg)) & REGRR_CHECK(std::isnan(nan.median)) & REGRR_CHECK(std::isnan(nan.std))))
+                {
+                    std::cerr << "  depth " << depth << ", NaN at " << position << " of " << length << std::endl;
+                }
+
+                b.ptr<T>()[position] = std::numeric_limits<T>::infinity();
+                const regrr::DiffStats infinite = regrr::diff_stats(a, b);
+                const regrr::DiffStats expected = reference(differences<T>(a, b));
+                if(!(REGRR_CHECK(infinite.max == expected.max) & REGRR_CHECK(infinite.l1 == expected.l1) & REGRR_CHECK(infinite.median == expected.median)
+                   & REGRR_CHECK(infinite.min == expected.min)))
+                {
+                    std::cerr << "  depth " << depth << ", infinity at " << position << " of " << length << std::endl;
+                }
+            }
+        }
+    }
+}
+
+int main()
+{
+    checkDepth<uchar>(CV_8U);
+    checkDepth<schar>(CV_8S);
+    checkDepth<ushort>(CV_16U);
+    checkDepth<short>(CV_16S);
+    checkDepth<int>(CV_32S);
+    checkDepth<float>(CV_32F);
+    checkDepth<double>(CV_64F);
+
+    checkSpecialValues<float>(CV_32F);
+    checkSpecialValues<double>(CV_64F);
+
+    return regrr_test::failures() != 0;
+}
\ No newline at end of file
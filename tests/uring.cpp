@@ -0,0 +1,185 @@
+#include "check.h"
+#include "regrr.h"
+#include "regrr_reader.h"
+#include <csignal>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * Save through io_uring with more writer threads than staging buffers, then check every matrix written,
+ * and check the archive recovered after a crash.
+ * The captures run in child processes, as the library is configured once per process. A hang fails with the timeout of ctest.
+ * Without io_uring the files are written with `write()`, which is checked the same.
+ * The temporary directory is often a tmpfs refusing `O_DIRECT`, so the direct writes are also checked in the working directory of the test.
+ */
+
+namespace
+{
+    constexpr int SAVES = 200;
+
+    /**
+     * Count of matrices saved before the process is killed, in the crash tests.
+     */
+    constexpr int CRASH_SAVES = 20;
+
+    /**
+     * Several staging buffers per matrix, and a partial one at the end.
+     */
+    constexpr int SIZE = 512;
+
+    /**
+     * Many matrices per staging buffer in the crash tests, so they are all lost if the buffer is not submitted.
+     */
+    constexpr int CRASH_SIZE = 64;
+
+    /**
+     * A new matrix at every call, as the asynchronous mode only keeps a reference, with the call in every row.
+     */
+    void capture(int saves, int size)
+    {
+        for(int call = 1; call <= saves; call++)
+        {
+            cv::Mat mat(size, size, CV_32FC1);
+            for(int row = 0; row < size; row++)
+            {
+                for(int col = 0; col < size; col++)
+                {
+                    mat.at<float>(row, col) = static_cast<float>(call + col);
+                }
+            }
+
+            REGRR_SAVE(mat, "frame");
+        }
+    }
+
+    /**
+     * Run the capture in a child process, then check the matrices.
+     *
+     * @param mode `capture` for all the matrices, or `crash` to kill the process without exiting after `CRASH_SAVES` matrices.
+     * @param expected The count of matrices which should be complete, the first ones.
+     */
+    void checkCapture(const char *program, const std::string& directory, std::string_view settings, std::string_view mode, int expected)
+    {
+        const int size = mode == "crash" ? CRASH_SIZE : SIZE;
+        const std::string command = "REGRR_DIR=" + directory + " REGRR_EXT=.rgb REGRR_LOG=error " + std::string(settings) + " "
+                                  + program + " " + std::string(mode) + (mode == "crash" ? " 2> /dev/null" : "");
+        const int status = std::system(command.c_str());
+        if(!REGRR_CHECK((status == 0) == (mode == "capture")))
+        {
+            std::cerr << "  " << settings << std::endl;
+            return;
+        }
+
+        int saved = 0;
+        try
+        {
+            const regrr::OutputReader output(directory);
+            for(int call = 1; call <= expected; call++)
+            {
+                // The matrix is mapped from the file kept by the result
+                const regrr::LoadedMat loaded = output.load("frame." + std::to_string(call) + ".rgb");
+                const cv::Mat& mat = loaded.mat;
+                const bool valid = mat.rows == size && mat.cols == size && mat.type() == CV_32FC1
+                                && mat.at<float>(0, 0) == call && mat.at<float>(size - 1, size - 1) == call + size - 1;
+                saved += valid;
+            }
+        }
+        catch(const std::exception& error)
+        {
+            std::cerr << error.what() << std::endl;
+        }
+
+        if(!REGRR_CHECK(saved == expected))
+        {
+            std::cerr << "  " << settings << ": " << saved << " of " << expected << " matrices" << std::endl;
+        }
+
+        std::error_code error;
+        fs::remove_all(directory, error);
+    }
+
+    /**
+     * Check if the files of a directory can be opened with `O_DIRECT`.
+     */
+    bool supportsDirect(const std::string& directory)
+    {
+        std::error_code error;
+        fs::create_directories(directory, error);
+
+        const std::string path = directory + "/direct";
+        const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+        if(fd >= 0)
+        {
+            ::close(fd);
+        }
+
+        fs::remove_all(directory, error);
+        return fd >= 0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if(argc == 2 && std::string_view(argv[1]) == "capture")
+    {
+        capture(SAVES, SIZE);
+        return 0;
+    }
+
+    if(argc == 2 && std::string_view(argv[1]) == "crash")
+    {
+        capture(CRASH_SAVES, CRASH_SIZE);
+        std::raise(SIGKILL);
+    }
+
+    const std::string root = (fs::temp_directory_path() / ("regrr-test-uring-" + std::to_string(::getpid()))).string();
+    int run = 0;
+
+    // More writer threads than staging buffers, so the threads wait for the buffers copied by the others
+    for(const char *settings: {"REGRR_URING=1 REGRR_ASYNC=4", "REGRR_URING=1 REGRR_ASYNC=8", "REGRR_URING=2 REGRR_ASYNC=16",
+                               "REGRR_URING=2 REGRR_ASYNC=16 REGRR_DIRECT=1", "REGRR_URING=1 REGRR_ASYNC=8 REGRR_ARCHIVE=1",
+                               "REGRR_URING=2 REGRR_ASYNC=8 REGRR_ARCHIVE=1 REGRR_DIRECT=1"})
+    {
+        checkCapture(argv[0], root + "/" + std::to_string(run++), settings, "capture", SAVES);
+    }
+
+    // The archive without index is recovered by scanning its records, the records staged are submitted with the lines of the lists file,
+    // the last one may not be complete yet as its line is written before its record
+    for(const char *settings: {"REGRR_URING=2 REGRR_ARCHIVE=1 REGRR_LISTS_FLUSH=1", "REGRR_URING=2 REGRR_ARCHIVE=1 REGRR_LISTS_FLUSH=1 REGRR_DIRECT=1"})
+    {
+        checkCapture(argv[0], root + "/" + std::to_string(run++), settings, "crash", CRASH_SAVES - 1);
+    }
+
+    // Not staged at all when synchronized from the signals
+    checkCapture(argv[0], root + "/" + std::to_string(run++), "REGRR_URING=2 REGRR_ARCHIVE=1 REGRR_FSYNC_ON_SIGNAL=1", "crash", CRASH_SAVES);
+
+    // Unaligned records flushed with a single staging buffer, so the last block of the buffer submitted is written again
+    const std::string disk = (fs::current_path() / ("regrr-test-uring-" + std::to_string(::getpid()))).string();
+    if(supportsDirect(disk))
+    {
+        for(const char *settings: {"REGRR_URING=1 REGRR_ASYNC=4 REGRR_DIRECT=1", "REGRR_URING=1 REGRR_ARCHIVE=1 REGRR_DIRECT=1",
+                                   "REGRR_URING=1 REGRR_ARCHIVE=1 REGRR_LISTS_FLUSH=1 REGRR_DIRECT=1",
+                                   "REGRR_URING=2 REGRR_ASYNC=4 REGRR_ARCHIVE=1 REGRR_LISTS_FLUSH=1 REGRR_DIRECT=1"})
+        {
+            checkCapture(argv[0], disk + "/" + std::to_string(run++), settings, "capture", SAVES);
+        }
+
+        checkCapture(argv[0], disk + "/" + std::to_string(run++), "REGRR_URING=1 REGRR_ARCHIVE=1 REGRR_LISTS_FLUSH=1 REGRR_DIRECT=1", "crash", CRASH_SAVES - 1);
+    }
+    else
+    {
+        std::cerr << "O_DIRECT not supported in " << fs::current_path().string() << ", the direct writes are not checked" << std::endl;
+    }
+
+    std::error_code error;
+    fs::remove_all(root, error);
+    fs::remove_all(disk, error);
+
+    return regrr_test::failures() != 0;
+}
\ No newline at end of file
@@ -0,0 +1,1076 @@
+#include "regrr_format.h"
+#include "regrr_reader.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/**
+ * Compare two outputs of the regression tests.
+ * Same output as `bin/diff.py`, the matrices are memory-mapped when in the native binary format or in an archive.
+ */
+
+namespace
+{
+    /**
+     * @{
+     * Colors of the terminal, same as `bin/colors.py`.
+     */
+    std::string colored(std::string_view code, std::string_view text)
+    {
+        std::string result = "\x1b[";
+        result += code;
+        result += 'm';
+        result += text;
+        result += "\x1b[0m";
+        return result;
+    }
+
+    std::string red(std::string_view text) { return colored("31", text); }
+    std::string green(std::string_view text) { return colored("32", text); }
+    std::string yellow(std::string_view text) { return colored("33", text); }
+    std::string white(std::string_view text) { return colored("37", text); }
+
+    /**
+     * Color a text from the name of the color, the text is unchanged if the name is unknown or empty.
+     */
+    std::string paint(std::string_view color, std::string_view text)
+    {
+        return color == "red" ? red(text) : color == "green" ? green(text) : color == "yellow" ? yellow(text) : std::string(text);
+    }
+
+    /**
+     * @}
+     */
+
+    /**
+     * Format a number as Python prints a float, so the output is the same as `bin/diff.py`.
+     * The shortest representation which reads back the same value,
+     * in scientific notation only if the exponent is less than -4 or at least 16.
+     */
+    std::string formatFloat(double value)
+    {
+        if(std::isnan(value))
+        {
+            return "nan";
+        }
+
+        if(std::isinf(value))
+        {
+            return value < 0 ? "-inf" : "inf";
+        }
+
+        char buffer[64];
+        const auto scientific = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::scientific);
+        const std::string_view text(buffer, scientific.ptr - buffer);
+
+        int exponent = 0;
+        const size_t e = text.find('e');
+        const char *begin = text.data() + e + 1;
+        std::from_chars(*begin == '+' ? begin + 1 : begin, text.data() + text.size(), exponent);
+
+        if(exponent < -4 || exponent >= 16)
+        {
+            return std::string(text);
+        }
+
+        const auto fixed = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed);
+        std::string result(buffer, fixed.ptr - buffer);
+        if(result.find('.') == std::string::npos)
+        {
+            result += ".0";
+        }
+
+        return result;
+    }
+
+    /**
+     * A matrix to compare, resolved from the flows.
+     */
+    struct Job
+    {
+        /**
+         * Path relative to the first output directory, it is also the key in an archive.
+         */
+        std::string path;
+
+        /**
+         * Path of the same matrix relative to the second output directory, where the flows are aligned.
+         */
+        std::string path2;
+
+        /**
+         * Directory of the matrix relative to the first output directory, with a trailing `/` if not empty.
+         */
+        std::string directory;
+
+        /**
+         * Name of the matrix, `name.call`.
+         */
+        std::string name;
+
+        /**
+         * Name of the same matrix in the second output directory, the call count differs where the flows diverged.
+         */
+        std::string name2;
+
+        /**
+         * Hash recorded in the lists of the first directory, and in the lists of the second directory.
+         * Empty if not recorded.
+         */
+        std::string hash1;
+        std::string hash2;
+
+        /**
+         * Reason why the matrix was not saved by the budget of the first directory, and of the second directory.
+         * Empty if saved.
+         */
+        std::string skipped1;
+        std::string skipped2;
+
+        /**
+         * Region saved in the first directory, and in the second directory, see `regrr::ListsEvent::region`.
+         * Empty for the whole matrix.
+         */
+        std::string region1;
+        std::string region2;
+
+        /**
+         * If the matrix is not in the flow of the second directory, once aligned.
+         */
+        bool unmatched = false;
+
+        size_t indent;
+    };
+
+    /**
+     * Name of a matrix in the output, with its call count in the second directory if different.
+     */
+    std::string label(const Job& job)
+    {
+        return job.name == job.name2 ? job.name : job.name + " (" + job.name2 + ")";
+    }
+
+    /**
+     * A line of the output, in the flow order.
+     * Either a text known in advance (a scope), or the result of a job.
+     */
+    struct Line
+    {
+        std::string text;
+        size_t job = SIZE_MAX;
+    };
+
+    /**
+     * Check if the scopes of a thread are in the subtree of a scope.
+     *
+     * @param fromScope The path of the scope relative to the output directory, prefixed by the thread for the threads other than the main thread.
+     */
+    bool inScope(std::string_view thread, const std::vector<std::string>& scopes, const std::vector<std::string>& fromScope)
+    {
+        const size_t offset = thread.empty() ? 0 : 1;
+        if(scopes.size() + offset < fromScope.size())
+        {
+            return false;
+        }
+
+        for(size_t i = 0; i < fromScope.size(); i++)
+        {
+            if((i < offset ? thread : std::string_view(scopes[i - offset])) != fromScope[i])
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * An event of the flow of a thread, with where it happened.
+     */
+    struct FlowEvent
+    {
+        regrr::ListsEvent event;
+
+        /**
+         * Directory of the matrix saved relative to the output directory, with a trailing `/` if not empty.
+         * Empty for the scopes.
+         */
+        std::string directory;
+
+        /**
+         * Count of scopes the event is in, a scope entered is not in itself.
+         */
+        size_t depth;
+    };
+
+    /**
+     * The flows of a lists file by thread, ordered like `regrr::Lists::threads()`, the main thread (empty name) first.
+     */
+    struct Flows
+    {
+        std::string extension;
+        std::map<std::string, std::vector<FlowEvent>, std::less<>> threads;
+    };
+
+    /**
+     * Read the flows of a lists file.
+     * The file is streamed, only the events of the subtree `fromScope` are kept.
+     *
+     * @param fromScope The path of a scope relative to the output directory, see `inScope()`, empty for all.
+     */
+    Flows readFlows(const std::string& path, const std::vector<std::string>& fromScope)
+    {
+        struct Stack
+        {
+            std::vector<std::string> scopes;
+
+            /**
+             * The directory of the current scope, and its size before each scope entered.
+             */
+            std::string directory;
+            std::vector<size_t> sizes;
+        };
+
+        Flows flows;
+        std::map<std::string, Stack, std::less<>> stacks;
+
+        flows.extension = regrr::stream_lists(path, [&] (std::string_view thread, regrr::ListsEvent&& event) {
+            auto it = stacks.find(thread);
+            if(it == stacks.end())
+            {
+                it = stacks.emplace(std::string(thread), Stack{{}, thread.empty() ? std::string() : std::string(thread) + '/', {}}).first;
+            }
+
+            Stack& stack = it->second;
+            bool kept = true;
+            size_t depth = stack.scopes.size();
+
+            if(event.type == regrr::ListsEvent::EnterScope)
+            {
+                stack.sizes.push_back(stack.directory.size());
+                stack.directory += event.name;
+                stack.directory += '/';
+                stack.scopes.push_back(event.name);
+                kept = inScope(thread, stack.scopes, fromScope);
+            }
+            else if(event.type == regrr::ListsEvent::ExitScope)
+            {
+                // Ignore the unbalanced exits, like a truncated file
+                if(stack.scopes.empty())
+                {
+                    return;
+                }
+
+                kept = inScope(thread, stack.scopes, fromScope);
+                depth--;
+                stack.scopes.pop_back();
+                stack.directory.resize(stack.sizes.back());
+                stack.sizes.pop_back();
+            }
+            else
+            {
+                kept = inScope(thread, stack.scopes, fromScope);
+            }
+
+            if(kept)
+            {
+                const bool save = event.type == regrr::ListsEvent::SaveMat;
+                flows.threads[it->first].push_back(FlowEvent{std::move(event), save ? stack.directory : std::string(), depth});
+            }
+        });
+
+        return flows;
+    }
+
+    /**
+     * Align the flows of a thread of both directories, on their scopes entered and exited and on the names of their matrices.
+     * The call counts are ignored, they are shifted after the flows diverge.
+     *
+     * @param matches Output, for each event of `flow1`, the index of the event of `flow2` it is matched with, or SIZE_MAX.
+     */
+    void alignFlows(const std::vector<FlowEvent>& flow1, const std::vector<FlowEvent>& flow2, std::vector<size_t>& matches)
+    {
+        // Compare integers instead of strings, each distinct event is interned
+        std::unordered_map<std::string, std::uint32_t> ids;
+        std::string key;
+        const auto tokens = [&] (const std::vector<FlowEvent>& flow) {
+            std::vector<std::uint32_t> result;
+            result.reserve(flow.size());
+            for(const FlowEvent& event: flow)
+            {
+                key.assign(1, event.event.type == regrr::ListsEvent::EnterScope ? '+' : event.event.type == regrr::ListsEvent::ExitScope ? '-' : '=');
+                key += event.event.type == regrr::ListsEvent::SaveMat ? std::string_view(event.event.name).substr(0, event.event.name.rfind('.'))
+                                                                      : std::string_view(event.event.name);
+                result.push_back(ids.emplace(key, static_cast<std::uint32_t>(ids.size())).first->second);
+            }
+
+            return result;
+        };
+
+        const std::vector<std::uint32_t> tokens1 = tokens(flow1);
+        const std::vector<std::uint32_t> tokens2 = tokens(flow2);
+        regrr::align_sequences(tokens1, tokens2, matches);
+    }
+
+    /**
+     * Resolve the flows of all the threads into the lines to print and the jobs to run.
+     * Each flow of the first directory is aligned with the same thread of the second directory, if its lists are given,
+     * so the matrices are paired even when the flows diverge. The matrices only in the second directory are printed where they are.
+     *
+     * @param flows2 The flows of the second directory, nullptr to pair the matrices by path instead.
+     */
+    void resolveFlows(const Flows& flows1, const Flows *flows2, const regrr::OutputReader& output1, const regrr::OutputReader& output2,
+                      std::vector<Line>& lines, std::vector<Job>& jobs)
+    {
+        static const std::vector<FlowEvent> empty;
+
+        // The threads of both directories
+        std::vector<std::string> threads;
+        for(const auto& [thread, flow]: flows1.threads)
+        {
+            threads.push_back(thread);
+        }
+
+        if(flows2)
+        {
+            for(const auto& [thread, flow]: flows2->threads)
+            {
+                if(!flows1.threads.count(thread))
+                {
+                    threads.push_back(thread);
+                }
+            }
+
+            std::sort(threads.begin(), threads.end());
+        }
+
+        // Once the bytes of its budget are exhausted, the matrices of a run are not in its lists, they are not only in the other run
+        const auto exhausted = [] (const Flows *flows) {
+            return flows && std::any_of(flows->threads.begin(), flows->threads.end(), [] (const auto& thread) {
+                return std::any_of(thread.second.begin(), thread.second.end(), [] (const FlowEvent& event) { return event.event.skipped == "bytes"; });
+            });
+        };
+
+        const bool exhausted1 = exhausted(&flows1);
+        const bool exhausted2 = exhausted(flows2);
+
+        std::vector<size_t> matches;
+        for(const std::string& thread: threads)
+        {
+            const auto it1 = flows1.threads.find(thread);
+            const std::vector<FlowEvent>& flow1 = it1 != flows1.threads.end() ? it1->second : empty;
+            const auto it2 = flows2 ? flows2->threads.find(thread) : flows1.threads.end();
+            const std::vector<FlowEvent>& flow2 = flows2 && it2 != flows2->threads.end() ? it2->second : empty;
+
+            // The threads other than the main thread are printed under the name of the thread, like a top-level scope
+            const size_t indent = thread.empty() ? 0 : 1;
+            if(!thread.empty())
+            {
+                lines.push_back(Line{white(thread + "/")});
+            }
+
+            if(flows2)
+            {
+                alignFlows(flow1, flow2, matches);
+            }
+
+            // Print the scopes and the matrices only in the second directory before the next matched event
+            size_t next2 = 0;
+            const auto printUnmatched = [&] (size_t end) {
+                for(; next2 < end; next2++)
+                {
+                    if(const FlowEvent& event = flow2[next2]; event.event.type == regrr::ListsEvent::EnterScope)
+                    {
+                        lines.push_back(Line{white(std::string(4 * (indent + event.depth), ' ') + event.event.name + "/")});
+                    }
+                    else if(event.event.type == regrr::ListsEvent::SaveMat)
+                    {
+                        const std::string indentation(4 * (indent + event.depth), ' ');
+                        lines.push_back(Line{yellow(exhausted1 ? indentation + event.event.name + ": not saved by the budget (bytes) of \"" + output1.directory() + "\""
+                                                               : indentation + event.event.name + ": only in \"" + output2.directory() + "\"")});
+                    }
+                }
+            };
+
+            for(size_t i = 0; i < flow1.size(); i++)
+            {
+                const FlowEvent& event = flow1[i];
+                const FlowEvent *event2 = nullptr;
+                if(flows2 && matches[i] != SIZE_MAX)
+                {
+                    printUnmatched(matches[i]);
+                    event2 = &flow2[next2++];
+                }
+
+                if(event.event.type == regrr::ListsEvent::EnterScope)
+                {
+                    lines.push_back(Line{white(std::string(4 * (indent + event.depth), ' ') + event.event.name + "/")});
+                }
+                else if(event.event.type == regrr::ListsEvent::SaveMat)
+                {
+                    Job job{
+                        .path = event.directory + event.event.name + flows1.extension,
+                        .path2 = event.directory + event.event.name + flows1.extension,
+                        .directory = event.directory,
+                        .name = event.event.name,
+                        .name2 = event.event.name,
+                        .hash1 = event.event.hash,
+                        .hash2 = {},
+                        .skipped1 = event.event.skipped,
+                        .skipped2 = {},
+                        .region1 = event.event.region,
+                        .region2 = event.event.region,
+                        .unmatched = false,
+                        .indent = indent + event.depth,
+                    };
+
+                    if(event2)
+                    {
+                        job.path2 = event2->directory + event2->event.name + flows2->extension;
+                        job.name2 = event2->event.name;
+                        job.hash2 = event2->event.hash;
+                        job.skipped2 = event2->event.skipped;
+                        job.region2 = event2->event.region;
+                    }
+                    else if(flows2)
+                    {
+                        job.unmatched = true;
+                        if(exhausted2)
+                        {
+                            job.skipped2 = "bytes";
+                        }
+                    }
+
+                    lines.push_back(Line{{}, jobs.size()});
+                    jobs.push_back(std::move(job));
+                }
+            }
+
+            printUnmatched(flow2.size());
+        }
+    }
+
+    /**
+     * Result of the comparison of a matrix, without the indentation.
+     */
+    struct Result
+    {
+        /**
+         * Name of the color, as in `bin/colors.py`, empty for an error.
+         */
+        std::string color;
+
+        std::string text;
+    };
+
+    /**
+     * Identify the content of a file without reading it, from its size and its modification time.
+     * Same as `bin/diff.py`, so both share the cache.
+     *
+     * @return An empty string if the file does not exist.
+     */
+    std::string fileStamp(const std::string& path)
+    {
+        struct stat status{};
+        if(::stat(path.c_str(), &status) != 0)
+        {
+            return {};
+        }
+
+        return std::to_string(status.st_size) + ':' + std::to_string(static_cast<long long>(status.st_mtim.tv_sec) * 1000000000LL + status.st_mtim.tv_nsec);
+    }
+
+    /**
+     * Results of the previous comparisons, so an unchanged pair of matrices is not compared again.
+     * Same file as `bin/diff.py`: each line is the key of a pair then the color and the text of its result, separated by tabulations.
+     * The key is the path of both matrices and the content of each: its hash in the lists if recorded, otherwise the stamp of its file.
+     * Only the last result of each pair of paths is kept. Thread-safe.
+     */
+    class DiffCache
+    {
+    public:
+        struct Key
+        {
+            /**
+             * Absolute path of both matrices, separated by a tabulation.
+             */
+            std::string paths;
+
+            /**
+             * Content of both matrices, separated by a tabulation.
+             */
+            std::string contents;
+        };
+
+        /**
+         * Load the cache file if it exists and was written with the same settings.
+         */
+        DiffCache(std::string path, std::string_view settings)
+            : m_path(std::move(path)),
+              m_header("regrr-diff-cache 2\t" + std::string(settings))
+        {
+            std::ifstream file(m_path);
+            std::string line;
+            if(!file || !std::getline(file, line) || line != m_header)
+            {
+                return;
+            }
+
+            while(std::getline(file, line))
+            {
+                // Split the 6 fields, the text is the last one
+                size_t tabs[5];
+                size_t position = 0;
+                size_t count = 0;
+                for(; count < 5 && (position = line.find('\t', position)) != std::string::npos; count++, position++)
+                {
+                    tabs[count] = position;
+                }
+
+                if(count == 5)
+                {
+                    m_entries[line.substr(0, tabs[1])] = Entry{
+                        line.substr(tabs[1] + 1, tabs[3] - tabs[1] - 1),
+                        Result{line.substr(tabs[3] + 1, tabs[4] - tabs[3] - 1), line.substr(tabs[4] + 1)},
+                    };
+                }
+            }
+        }
+
+        /**
+         * Get the key of a matrix of two output directories.
+         */
+        static Key key(const regrr::OutputReader& output1, const regrr::OutputReader& output2, const Job& job)
+        {
+            const auto absolute = [] (const std::string& path) { return fs::absolute(path).lexically_normal().string(); };
+            const auto content = [] (const regrr::OutputReader& output, const std::string& path, const std::string& hash) {
+                if(!hash.empty())
+                {
+                    return 'h' + hash;
+                }
+
+                const std::string archive = output.directory() + "/" + REGRR_ARCHIVE_FILE;
+                return fileStamp(fs::exists(archive) ? archive : output.directory() + "/" + path);
+            };
+
+            return Key{
+                absolute(output1.path(job.path)) + '\t' + absolute(output2.path(job.path2)),
+                content(output1, job.path, job.hash1) + '\t' + content(output2, job.path2, job.hash2),
+            };
+        }
+
+        /**
+         * Get the result of a pair, if cached and none of the matrices changed.
+         */
+        bool get(const Key& key, Result& result) const
+        {
+            std::lock_guard lock(m_mutex);
+            const auto it = m_entries.find(key.paths);
+            if(it == m_entries.end() || it->second.contents != key.contents)
+            {
+                return false;
+            }
+
+            result = it->second.result;
+            return true;
+        }
+
+        void put(const Key& key, const Result& result)
+        {
+            std::lock_guard lock(m_mutex);
+            Entry& entry = m_entries[key.paths];
+            if(entry.contents != key.contents || entry.result.color != result.color || entry.result.text != result.text)
+            {
+                entry = Entry{key.contents, result};
+                m_changed = true;
+            }
+        }
+
+        /**
+         * Write the cache file if it changed, replacing it atomically so an interrupted run does not corrupt it.
+         *
+         * @throw std::runtime_error If the file could not be written.
+         */
+        void save() const
+        {
+            std::lock_guard lock(m_mutex);
+            if(!m_changed)
+            {
+                return;
+            }
+
+            if(const fs::path parent = fs::path(m_path).parent_path(); !parent.empty())
+            {
+                fs::create_directories(parent);
+            }
+
+            const std::string temporary = m_path + ".tmp";
+            {
+                std::ofstream file(temporary);
+                file << m_header << '\n';
+                for(const auto& [paths, entry]: m_entries)
+                {
+                    file << paths << '\t' << entry.contents << '\t' << entry.result.color << '\t' << entry.result.text << '\n';
+                }
+
+                if(!file.flush())
+                {
+                    throw std::runtime_error("Cannot write file: " + temporary);
+                }
+            }
+
+            fs::rename(temporary, m_path);
+        }
+
+    private:
+        struct Entry
+        {
+            std::string contents;
+            Result result;
+        };
+
+        std::string m_path;
+        std::string m_header;
+        mutable std::mutex m_mutex;
+        std::map<std::string, Entry> m_entries;
+        bool m_changed = false;
+    };
+
+    /**
+     * Load and compare a matrix of two output directories, and save the difference if any.
+     */
+    Result compareMats(const Job& job, const std::string& extension, const regrr::OutputReader& output1, const regrr::OutputReader& output2,
+                       const regrr::ToleranceRules *rules)
+    {
+        try
+        {
+            const regrr::LoadedMat m1 = output1.load(job.path);
+            const regrr::LoadedMat m2 = output2.load(job.path2);
+
+            // With a tolerance, stop at the first element out of it instead of computing the statistics
+            // The rules are matched without the call count of the name
+            if(const regrr::Tolerance *tolerance = rules ? rules->find(job.directory + job.name.substr(0, job.name.rfind('.'))) : nullptr; tolerance)
+            {
+                const regrr::ToleranceResult result = regrr::check_tolerance(m1.mat, m2.mat, *tolerance);
+                if(result.within)
+                {
+                    return Result{"green", label(job) + ": within tolerance"};
+                }
+
+                return Result{"red", label(job) + ": out of tolerance at element " + std::to_string(result.index)
+                                     + ", " + formatFloat(result.a) + " and " + formatFloat(result.b)};
+            }
+
+            const regrr::DiffStats stats = regrr::diff_stats(m1.mat, m2.mat);
+
+            std::string text = label(job) + ": d=" + formatFloat(stats.l1);
+
+            // Are the matrices almost the same?
+            if(stats.l1 < 0.001)
+            {
+                return Result{"green", std::move(text)};
+            }
+
+            text += ", min=" + formatFloat(stats.min) + ", max=" + formatFloat(stats.max)
+                  + ", avg=" + formatFloat(stats.avg) + ", median=" + formatFloat(stats.median)
+                  + ", std=" + formatFloat(stats.std);
+
+            // Save the difference, in the same file format as the one of the lists file
+            const fs::path diffDirectory = fs::path(output1.directory()) / "diff" / job.directory;
+            fs::create_directories(diffDirectory);
+            regrr::write_mat((diffDirectory / (job.name + extension)).string(), regrr::abs_diff(m1.mat, m2.mat));
+
+            return Result{stats.l1 < 10.0 ? "yellow" : "red", std::move(text)};
+        }
+        catch(const std::exception& error)
+        {
+            return Result{{}, "Error when comparing \"" + job.path + "\": \"" + error.what() + "\"."};
+        }
+    }
+
+    /**
+     * Compare a matrix of two output directories, unless its result is cached.
+     *
+     * @param cache The results of the previous runs, nullptr to compare all the matrices.
+     * @return The line to print.
+     */
+    std::string compare(const Job& job, const std::string& extension, const regrr::OutputReader& output1, const regrr::OutputReader& output2,
+                        const regrr::ToleranceRules *rules, DiffCache *cache)
+    {
+        const std::string indent(4 * job.indent, ' ');
+
+        // A matrix not saved by the budget of a run is not missing
+        if(!job.skipped1.empty() || !job.skipped2.empty())
+        {
+            const bool first = !job.skipped1.empty();
+            return yellow(indent + label(job) + ": not saved by the budget ("
+                          + (first ? job.skipped1 : job.skipped2) + ") of \"" + (first ? output1 : output2).directory() + "\"");
+        }
+
+        if(job.unmatched)
+        {
+            return yellow(indent + label(job) + ": only in \"" + output1.directory() + "\"");
+        }
+
+        // Two different regions of a matrix are not comparable
+        if(job.region1 != job.region2)
+        {
+            const auto region = [] (const std::string& text) { return text.empty() ? std::string("whole matrix") : text; };
+            return red(indent + label(job) + ": different regions \"" + region(job.region1) + "\" and \"" + region(job.region2) + "\"");
+        }
+
+        if(!output1.exists(job.path) || !output2.exists(job.path2))
+        {
+            return "Cannot find file matrices: \"" + output1.path(job.path) + "\" or \"" + output2.path(job.path2) + "\"";
+        }
+
+        // Identical hashes, the matrices are the same without reading them
+        if(!job.hash1.empty() && job.hash1 == job.hash2)
+        {
+            return green(indent + label(job) + ": d=0.0");
+        }
+
+        // Reuse the result of a previous run if both matrices did not change
+        Result result;
+        DiffCache::Key key;
+        if(cache)
+        {
+            key = DiffCache::key(output1, output2, job);
+            if(cache->get(key, result))
+            {
+                return paint(result.color, indent + result.text);
+            }
+        }
+
+        result = compareMats(job, extension, output1, output2, rules);
+
+        // The errors are not cached, nor indented
+        if(result.color.empty())
+        {
+            return result.text;
+        }
+
+        if(cache)
+        {
+            cache->put(key, result);
+        }
+
+        return paint(result.color, indent + result.text);
+    }
+
+    /**
+     * Thread pool where each worker has its own queue, and steals from the others when its queue is empty.
+     * The tasks are distributed in turn to the queues, a worker takes the oldest task of its queue
+     * but the newest task of the others, so the tasks stay close to the submission order.
+     */
+    class WorkStealingPool
+    {
+    public:
+        explicit WorkStealingPool(size_t threads)
+        {
+            for(size_t i = 0; i < threads; i++)
+            {
+                m_queues.push_back(std::make_unique<Queue>());
+            }
+
+            for(size_t i = 0; i < threads; i++)
+            {
+                m_threads.emplace_back([this, i] { run(i); });
+            }
+        }
+
+        /**
+         * Run the remaining tasks then stop the threads.
+         */
+        ~WorkStealingPool()
+        {
+            {
+                std::lock_guard lock(m_mutex);
+                m_stopping = true;
+            }
+
+            m_available.notify_all();
+
+            for(std::thread& thread: m_threads)
+            {
+                thread.join();
+            }
+        }
+
+        void submit(std::function<void()> task)
+        {
+            Queue& queue = *m_queues[m_next++ % m_queues.size()];
+            {
+                std::lock_guard lock(queue.mutex);
+                queue.tasks.push_back(std::move(task));
+            }
+
+            {
+                std::lock_guard lock(m_mutex);
+                m_pending++;
+            }
+
+            m_available.notify_one();
+        }
+
+    private:
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        /**
+         * Take a task, from the queue of the worker first.
+         */
+        bool take(size_t worker, std::function<void()>& task)
+        {
+            for(size_t i = 0; i < m_queues.size(); i++)
+            {
+                Queue& queue = *m_queues[(worker + i) % m_queues.size()];
+                std::lock_guard lock(queue.mutex);
+                if(!queue.tasks.empty())
+                {
+                    if(i == 0)
+                    {
+                        task = std::move(queue.tasks.front());
+                        queue.tasks.pop_front();
+                    }
+                    else
+                    {
+                        task = std::move(queue.tasks.back());
+                        queue.tasks.pop_back();
+                    }
+
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void run(size_t worker)
+        {
+            while(true)
+            {
+                {
+                    std::unique_lock lock(m_mutex);
+                    m_available.wait(lock, [this] { return m_stopping || m_pending > 0; });
+                    if(m_pending == 0)
+                    {
+                        return;
+                    }
+
+                    m_pending--;
+                }
+
+                // A task is reserved for this worker, it is in one of the queues
+                std::function<void()> task;
+                while(!take(worker, task))
+                {
+                    std::this_thread::yield();
+                }
+
+                task();
+            }
+        }
+
+        std::vector<std::unique_ptr<Queue>> m_queues;
+        std::vector<std::thread> m_threads;
+        size_t m_next = 0;
+        std::mutex m_mutex;
+        std::condition_variable m_available;
+        size_t m_pending = 0;
+        bool m_stopping = false;
+    };
+
+    /**
+     * Compare all the matrices of the flows on a thread pool, and print the results in the flow order.
+     * Only `window` jobs are submitted ahead of the line printed,
+     * which bounds the matrices loaded and the results waiting to be printed.
+     *
+     * @param lists2 The lists of the second directory, to align the flows. Empty if none, the matrices are paired by path.
+     */
+    void compareAll(const std::string& lists, const std::string& lists2, const std::vector<std::string>& fromScope,
+                    const regrr::OutputReader& output1, const regrr::OutputReader& output2, const regrr::ToleranceRules *rules,
+                    DiffCache *cache, size_t threads)
+    {
+        std::vector<Line> lines;
+        std::vector<Job> jobs;
+        std::string extension;
+        {
+            const Flows flows1 = readFlows(lists, fromScope);
+            const Flows flows2 = lists2.empty() ? Flows() : readFlows(lists2, fromScope);
+            resolveFlows(flows1, lists2.empty() ? nullptr : &flows2, output1, output2, lines, jobs);
+            extension = flows1.extension;
+        }
+
+        std::vector<std::string> results(jobs.size());
+        std::vector<char> done(jobs.size(), false);
+        std::mutex mutex;
+        std::condition_variable finished;
+
+        const size_t window = threads * 16;
+        size_t submitted = 0;
+
+        WorkStealingPool pool(threads);
+
+        for(const Line& line: lines)
+        {
+            if(line.job == SIZE_MAX)
+            {
+                std::cout << line.text << '\n';
+                continue;
+            }
+
+            // Keep the pool busy up to the window ahead of the printed job
+            while(submitted < jobs.size() && submitted < line.job + window)
+            {
+                pool.submit([&, job = submitted] {
+                    std::string result = compare(jobs[job], extension, output1, output2, rules, cache);
+
+                    {
+                        std::lock_guard lock(mutex);
+                        results[job] = std::move(result);
+                        done[job] = true;
+                    }
+
+                    finished.notify_all();
+                });
+
+                submitted++;
+            }
+
+            std::unique_lock lock(mutex);
+            finished.wait(lock, [&] { return done[line.job] != 0; });
+            std::cout << results[line.job] << '\n';
+            results[line.job] = {};
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    // Count of threads comparing the matrices, `-j N` to change it
+    size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    // Tolerances of the matrices, `-t file` to load them, see `regrr::ToleranceRules`
+    std::string tolerancesPath;
+
+    // Subtree to compare, `--from-scope scope1/scope2` or `--from-scope thread/scope1`, see `inScope()`
+    std::vector<std::string> fromScope;
+
+    // Cache of the results, `diff/cache.txt` in the first directory unless `--cache file` or `--no-cache`
+    std::string cachePath;
+    bool useCache = true;
+
+    std::vector<std::string> directories;
+
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view argument = argv[i];
+        if(argument == "-j" && i + 1 < argc)
+        {
+            threads = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if(argument == "-t" && i + 1 < argc)
+        {
+            tolerancesPath = argv[++i];
+        }
+        else if(argument == "--from-scope" && i + 1 < argc)
+        {
+            std::string_view scope = argv[++i];
+            while(!scope.empty())
+            {
+                const size_t slash = std::min(scope.find('/'), scope.size());
+                if(slash > 0)
+                {
+                    fromScope.emplace_back(scope.substr(0, slash));
+                }
+
+                scope.remove_prefix(std::min(slash + 1, scope.size()));
+            }
+        }
+        else if(argument == "--cache" && i + 1 < argc)
+        {
+            cachePath = argv[++i];
+        }
+        else if(argument == "--no-cache")
+        {
+            useCache = false;
+        }
+        else
+        {
+            directories.emplace_back(argument);
+        }
+    }
+
+    if(directories.size() != 2)
+    {
+        std::cerr << "usage: regrr-diff [-j threads] [-t tolerances] [--from-scope scope] [--cache file | --no-cache] tmp_dir1 tmp_dir2" << std::endl;
+        std::cerr << "Compare two output of the regressions tests." << std::endl;
+        return 2;
+    }
+
+    std::unique_ptr<DiffCache> cache;
+
+    try
+    {
+        const regrr::OutputReader output1(directories[0]);
+        const regrr::OutputReader output2(directories[1]);
+
+        std::unique_ptr<regrr::ToleranceRules> rules;
+        if(!tolerancesPath.empty())
+        {
+            rules = std::make_unique<regrr::ToleranceRules>(tolerancesPath);
+        }
+
+        // The results depend on the tolerances, so the cache is only valid with the same ones
+        if(useCache)
+        {
+            const std::string settings = tolerancesPath.empty() ? std::string()
+                                       : "tolerances " + fs::absolute(tolerancesPath).lexically_normal().string() + " " + fileStamp(tolerancesPath);
+            cache = std::make_unique<DiffCache>(cachePath.empty() ? output1.directory() + "/diff/cache.txt" : cachePath, settings);
+        }
+
+        // Use the lists of the first temporary directory
+        // It doesn't matter as the matrix should appears in both sides
+        // But it can change the visual output order if the algorithms flows differ
+        // The lists of the second directory are only used for the hashes and the budget decisions, it may not exist
+        const std::string lists2 = regrr::lists_path(output2.directory());
+        compareAll(regrr::lists_path(output1.directory()), fs::exists(lists2) ? lists2 : std::string(), fromScope,
+                   output1, output2, rules.get(), cache.get(), threads);
+
+        if(cache)
+        {
+            cache->save();
+        }
+    }
+    catch(const std::exception& error)
+    {
+        std::cout << std::flush;
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
\ No newline at end of file
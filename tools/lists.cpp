@@ -0,0 +1,133 @@
+#include "regrr_format.h"
+#include "regrr_reader.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+/**
+ * Convert a lists file to the text format, for example the binary `lists.rgl` written with `REGRR_LISTS_BINARY`,
+ * so `bin/diff.py` can read it. `regrr-diff` reads both formats.
+ */
+
+namespace
+{
+    /**
+     * Append an event as a line of the text format, tagged with its thread if not the main thread.
+     */
+    void appendLine(std::string& text, std::string_view thread, const regrr::ListsEvent& event)
+    {
+        if(!thread.empty())
+        {
+            text += '@';
+            text += thread;
+            text += '\t';
+        }
+
+        if(event.type == regrr::ListsEvent::EnterScope)
+        {
+            text += "+ ";
+            text += event.name;
+        }
+        else if(event.type == regrr::ListsEvent::ExitScope)
+        {
+            text += '-';
+        }
+        else
+        {
+            text += event.name;
+
+            // Same order of the annotations as the library
+            for(const auto& [symbol, annotation]: {std::pair{'~', &event.region}, std::pair{'!', &event.skipped}, std::pair{'#', &event.hash}})
+            {
+                if(!annotation->empty())
+                {
+                    text += '\t';
+                    text += symbol;
+                    text += *annotation;
+                }
+            }
+        }
+
+        text += '\n';
+    }
+}
+
+int main(int argc, char **argv)
+{
+    // Text lists file written, `lists.txt` next to the input unless `-o file`, `-o -` for the standard output
+    std::string outputPath;
+    std::string inputPath;
+
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view argument = argv[i];
+        if(argument == "-o" && i + 1 < argc)
+        {
+            outputPath = argv[++i];
+        }
+        else if(inputPath.empty())
+        {
+            inputPath = argument;
+        }
+        else
+        {
+            inputPath.clear();
+            break;
+        }
+    }
+
+    if(inputPath.empty())
+    {
+        std::cerr << "usage: regrr-lists [-o output] lists_file|tmp_dir" << std::endl;
+        std::cerr << "Convert a lists file to the text format, lists.txt next to it by default." << std::endl;
+        return 2;
+    }
+
+    try
+    {
+        // An output directory is converted in place
+        if(fs::is_directory(inputPath))
+        {
+            inputPath = regrr::lists_path(inputPath);
+        }
+
+        if(outputPath.empty())
+        {
+            outputPath = (fs::path(inputPath).parent_path() / REGRR_LISTS_FILE).string();
+        }
+
+        // The whole text is converted before writing, so the input can be the output
+        std::string text;
+        const std::string extension = regrr::stream_lists(inputPath, [&text] (std::string_view thread, regrr::ListsEvent&& event) {
+            appendLine(text, thread, event);
+        });
+
+        text.insert(0, extension + '\n');
+
+        if(outputPath == "-")
+        {
+            std::cout << text << std::flush;
+        }
+        else
+        {
+            std::ofstream output(outputPath, std::ios::binary | std::ios::trunc);
+            if(!output.write(text.data(), static_cast<std::streamsize>(text.size())))
+            {
+                throw std::runtime_error("Cannot write file: " + outputPath);
+            }
+        }
+    }
+    catch(const std::exception& error)
+    {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
\ No newline at end of file